@@ -260,6 +260,7 @@ struct nfs_attr {
         uint64_t size;
         uint64_t used;
         uint64_t fsid;
+        uint64_t fileid;
         struct nfs_specdata rdev;
         struct nfs_time atime;
         struct nfs_time mtime;
@@ -271,6 +272,189 @@ struct nfs_fh {
         char *val;
 };
 
+/*
+ * State we keep per filehandle. This is shared between all open
+ * handles for the same file and lives on after the file is closed for as
+ * long as the pagecache still holds data for it.
+ */
+#define NFS_INODE_HASHES 1024
+
+struct nfs_inode {
+       struct nfs_inode *next;
+       struct nfs_fh fh;
+       uint32_t hash;
+       int refcount;
+       uint32_t pagecache_pages;
+
+       /* attributes we last validated the cached data against */
+       int has_attr;
+       struct nfs_attr attr;
+       /* when the server last gave us attr, in seconds */
+       time_t attr_ts;
+
+       /* bumped every time the cached data is invalidated */
+       uint32_t gen;
+
+       /* our own WRITEs in flight and whether any of them overlapped */
+       int writes;
+       int write_overlap;
+
+       /* READs in flight, both readahead and application reads */
+       struct nfs_read_req *reads;
+
+       /* open files of the disk cache, if any */
+       struct nfs_dc_file *dc;
+       int dc_failed;
+};
+
+/*
+ * An application read that is waiting for a READ that is already in
+ * flight to bring the data it needs into the pagecache.
+ */
+struct nfs_read_waiter {
+       struct nfs_read_waiter *next;
+       struct nfsfh *nfsfh;
+       uint64_t offset;
+       size_t count;
+       nfs_cb cb;
+       void *private_data;
+       int update_pos;
+};
+
+struct nfs_read_req {
+       struct nfs_read_req *next;
+       struct nfs_context *nfs;
+       struct nfs_inode *inode;
+       uint64_t offset;
+       uint32_t count;
+       uint32_t gen;
+       struct nfs_read_waiter *waiters;
+};
+
+/*
+ * The pagecache is shared by all open files of a context.
+ * It is an NFS_PAGECACHE_WAYS-way set-associative cache with LRU
+ * replacement within each set. The total number of pages is the memory
+ * budget for the whole context and the page buffers are only allocated
+ * once they are used.
+ */
+#define NFS_PAGECACHE_WAYS 8
+
+struct nfs_inode;
+struct nfs_dc_file;
+struct nfs_diskcache;
+
+struct nfs_pagecache_entry {
+       char *buf;
+       struct nfs_inode *inode;
+       uint64_t offset;
+       uint64_t lru;
+       time_t ts;
+};
+
+struct nfs_pagecache {
+       struct nfs_pagecache_entry *entries;
+       uint32_t num_sets;
+       uint32_t num_ways;
+       uint32_t num_pages;
+       uint32_t num_users;
+       uint64_t lru_clock;
+       uint64_t hits;
+       uint64_t misses;
+       uint64_t evictions;
+};
+
+/*
+ * How far past the last file that was opened we look for the next one
+ * when deciding if files are opened in readdir order, and the max number
+ * of files we read ahead of the application.
+ */
+#define NFS_DIRSCAN_WINDOW 8
+#define NFS_DIRSCAN_MAX_FILES 32
+
+#define NFS_DENTRY_HASHES 1024
+#define NFS_DENTRY_MAX 16384
+
+/*
+ * Directory listings kept after nfs_closedir(). They are found by fh
+ * through a hash table and evicted in LRU order once the total number of
+ * entries or the memory they use goes over the limits.
+ */
+#define NFS_DIRCACHE_HASHES 256
+#define NFS_DIRCACHE_ENTRIES 65536
+#define NFS_DIRCACHE_SIZE (16 * 1024 * 1024)
+
+/* an entry in the name lookup cache */
+struct nfs_dentry {
+       struct nfs_dentry *next;
+       uint32_t hash;
+       struct nfs_fh dir;
+       char *name;
+       /* fh is empty and attr holds the attributes of dir at the time
+        * for names that do not exist */
+       int negative;
+       struct nfs_fh fh;
+       struct nfs_attr attr;
+       /* rpc_current_time() after which the entry is no longer used */
+       uint64_t expires;
+};
+
+#define NFS_ATTRCACHE_HASHES 1024
+#define NFS_ATTRCACHE_MAX 16384
+
+#define NFS_LINKCACHE_HASHES 256
+#define NFS_LINKCACHE_MAX 4096
+
+/* the target of a symlink, valid for as long as its mtime and ctime */
+struct nfs_linkentry {
+       struct nfs_linkentry *next;
+       uint32_t hash;
+       struct nfs_fh fh;
+       struct nfs_time mtime;
+       struct nfs_time ctime;
+       char *target;
+};
+
+#define NFS_ACCESS_MAX_CREDS 8
+
+/* an ACCESS result, valid for as long as the attributes it hangs off */
+struct nfs_access_entry {
+       struct nfs_access_entry *next;
+       /* the credential we asked with and its hash */
+       uint32_t cred;
+       uint32_t cred_flavor;
+       uint32_t cred_len;
+       char *cred_body;
+       /* ACCESS3_* bits we asked about and those that were granted */
+       uint32_t mask;
+       uint32_t access;
+};
+
+/* an entry in the attribute cache */
+struct nfs_acentry {
+       struct nfs_acentry *next;
+       uint32_t hash;
+       struct nfs_fh fh;
+       struct nfs_attr attr;
+       /* how long the attributes are trusted for, in ms, and until when */
+       uint32_t timeo;
+       uint64_t expires;
+       struct nfs_access_entry *access;
+};
+
+/* prefetching of the files of the directory the application is reading */
+struct nfs_dirscan {
+       /* the directory nfs_readdir() was last called for */
+       struct nfsdir *dir;
+       /* the last file that was opened and its index in dir */
+       struct nfsdirent *pos;
+       int pos_index;
+       /* index of the last file that has been prefetched */
+       int ahead_index;
+       /* number of files in a row opened in readdir order */
+       int hits;
+};
+
 struct nfs_context {
        struct rpc_context *rpc;
        char *server;
@@ -278,10 +462,62 @@ struct nfs_context {
        struct nfs_fh rootfh;
        uint64_t readmax;
        uint64_t writemax;
+       /* preferred READDIR size from FSINFO and our overrides of it */
+       uint32_t dtpref;
+       uint32_t readdir_dircount;
+       uint32_t readdir_maxcount;
+       /* read directories with READDIR and without their attributes */
+       int readdir_names_only;
+       /* max LOOKUPs in flight for entries READDIR gave no attributes for */
+       int readdir_lookups;
        char *cwd;
        int dircache_enabled;
        int auto_reconnect;
-       struct nfsdir *dircache;
+       struct nfsdir *dircache[NFS_DIRCACHE_HASHES];
+       /* most and least recently used cached directory */
+       struct nfsdir *dircache_mru;
+       struct nfsdir *dircache_lru;
+       uint32_t dircache_entries;
+       uint64_t dircache_bytes;
+       uint32_t dircache_max_entries;
+       uint64_t dircache_max_bytes;
+       struct nfs_pagecache pagecache;
+       struct nfs_inode *inodes[NFS_INODE_HASHES];
+       /* write-back cache size for new file handles */
+       uint32_t writeback;
+       /* files up to this size are read in full when they are opened */
+       uint32_t prefetch_small;
+       /* name lookup cache, timeouts in seconds for files and dirs */
+       uint32_t dentry_ttl;
+       uint32_t dentry_dir_ttl;
+       /* timeout in seconds for names that do not exist */
+       uint32_t negative_ttl;
+       /* attribute cache, min and max timeouts in seconds */
+       uint32_t acregmin;
+       uint32_t acregmax;
+       uint32_t acdirmin;
+       uint32_t acdirmax;
+       /* open without revalidating against the server */
+       int nocto;
+       struct nfs_acentry *acentries[NFS_ATTRCACHE_HASHES];
+       uint32_t num_acentries;
+       uint32_t ac_evict;
+       /* cache of symlink targets */
+       int linkcache_enabled;
+       struct nfs_linkentry *links[NFS_LINKCACHE_HASHES];
+       uint32_t num_links;
+       uint32_t link_evict;
+       struct nfs_dentry *dentries[NFS_DENTRY_HASHES];
+       uint32_t num_dentries;
+       uint32_t dentry_evict;
+       /* bytes to prefetch from the files of a directory being scanned */
+       uint32_t dirscan_prefetch;
+       struct nfs_dirscan dirscan;
+       /* file handles that have a write-back cache */
+       struct nfs_writeback *writebacks;
+       /* persistent cache below the pagecache, NULL if disabled */
+       struct nfs_diskcache *diskcache;
+       uint64_t diskcache_size;
        uint16_t	mask;
 
        int auto_traverse_mounts;
@@ -315,6 +551,13 @@ struct nfs_cb_data {
 
        struct nfs_fh fh;
 
+       /* directory and name of the LOOKUP in flight when the name lookup
+        * cache is enabled */
+       struct nfs_fh lookup_dir;
+       char *lookup_name;
+       /* the symlink we are reading while resolving a path */
+       struct nfs_fh link_fh;
+
        /* for multi-read/write calls. */
        int error;
        int cancel;
@@ -326,6 +569,7 @@ struct nfs_cb_data {
        int not_my_buffer;
        const char *usrbuf;
        int update_pos;
+       uint32_t inode_gen;
 };
 
 struct nested_mounts {
@@ -335,57 +579,316 @@ struct nested_mounts {
        struct nfs_attr attr;
 };
 
-#define MAX_DIR_CACHE 128
 #define MAX_LINK_COUNT 40
 
+/* smallest READDIR/READDIRPLUS reply we ask for unless told otherwise */
+#define NFS_READDIR_MIN_SIZE 8192
+
+/* default number of LOOKUPs in flight when READDIRPLUS is not available */
+#define NFS_READDIR_LOOKUPS 64
+
+/*
+ * The entries of a directory listing are kept in one array, in the order
+ * the server returned them, and their names in one string buffer. While
+ * the listing is being read the name and next fields of the entries are
+ * not set, nfs_dirbuf_finish() fills them in once all entries are in.
+ */
+struct nfs_dirbuf {
+       struct nfsdirent *dirents;
+       uint32_t count;
+       uint32_t max;
+       char *strings;
+       size_t len;
+       size_t size;
+};
+
+/* a directory that is read page by page, see nfs_opendir_stream_async() */
+struct nfs_dirstream {
+       struct nfs_context *nfs;
+       struct nfsdir *dir;
+       struct nfs_fh fh;
+       int names_only;
+       /* where the next page we ask for starts */
+       uint64_t cookie;
+       cookieverf3 cookieverf;
+       /* cookie before the current page and those of its entries */
+       uint64_t start_cookie;
+       uint64_t *cookies;
+       /* the page after the current one once it has arrived or failed */
+       int next_ready;
+       int next_status;
+       struct nfs_dirbuf next_buf;
+       uint64_t *next_cookies;
+       uint64_t next_start;
+       int in_flight;
+       int eof;
+       /* closed while a page was in flight, the reply frees the stream */
+       int closed;
+       /* opendir or nfs_readdir_next_page_async() waiting for a page */
+       int opening;
+       nfs_cb cb;
+       void *private_data;
+};
+
+/* an entry in the name index of a directory listing */
+struct nfsdir_name {
+       struct nfsdir_name *next;
+       uint32_t hash;
+       /* index of the entry in the listing */
+       uint32_t index;
+       /* empty if the server did not give us the handle */
+       struct nfs_fh fh;
+};
+
 struct nfsdir {
        struct nfs_fh fh;
        struct nfs_attr attr;
        struct nfsdir *next;
 
+       struct nfs_dirbuf buf;
+       /* buf.dirents once the listing is complete */
        struct nfsdirent *entries;
        struct nfsdirent *current;
+       /* read with READDIR, the entries only have names and inodes */
+       int names_only;
+       /* when we started to read the listing, in ms */
+       uint64_t read_time;
+       /* NULL unless the directory is read page by page */
+       struct nfs_dirstream *stream;
+
+       /* dircache hash chain is next, lru list and accounting */
+       uint32_t hash;
+       struct nfsdir *lru_prev;
+       struct nfsdir *lru_next;
+       uint32_t num_entries;
+       uint64_t size;
+       /* names are collected while the directory is read and hashed
+        * into names_index when it is added to the dircache */
+       struct nfsdir_name *names;
+       uint32_t num_names;
+       struct nfsdir_name **names_index;
+       uint32_t names_hashes;
 };
 
-struct nfs_readahead {
+/*
+ * Number of independent sequential or strided streams we track per
+ * file handle and the number of reads on the handle after which a
+ * stream that has not been used is forgotten.
+ */
+#define NFS_RA_STREAMS 4
+#define NFS_RA_STREAM_AGE 64
+
+struct nfs_ra_stream {
+       int in_use;
+       uint32_t last_use;
+       /* start and end of the last read in this stream */
+       uint64_t last_offset;
        uint64_t fh_offset;
+       /* distance between reads if this is a strided stream */
+       uint64_t stride;
        uint32_t cur_ra;
+       /* how far we have already issued readahead READs */
+       uint64_t ra_end;
 };
 
-struct nfs_pagecache_entry {
-       char buf[NFS_BLKSIZE];
+struct nfs_readahead {
+       uint32_t clock;
+       struct nfs_ra_stream streams[NFS_RA_STREAMS];
+};
+
+/*
+ * Write-back cache of a file handle.
+ * Small writes are collected in dirty ranges which are merged when they
+ * overlap or touch and are sent to the server in the background as
+ * UNSTABLE WRITEs once they reach wsize, the handle has too much dirty
+ * data or the data gets too old. Errors from these writes are reported
+ * by the next fsync or close.
+ */
+#define NFS_WB_MAX_AGE 1000 /* ms */
+
+/*
+ * Data written UNSTABLE is kept until a COMMIT returns the same write
+ * verifier as the WRITEs did. If the verifier changed the server has
+ * rebooted and may have lost the data, so it is written again.
+ * Once a handle holds this much uncommitted data we send a COMMIT in
+ * the background so that the copies can be dropped.
+ */
+#define NFS_WB_MAX_UNSTABLE (16 * 1024 * 1024)
+#define NFS_WB_COMMIT_RETRIES 3
+
+struct nfs_writeback;
+
+struct nfs_wb_range {
+       struct nfs_wb_range *next;
+       struct nfs_writeback *wb;
        uint64_t offset;
-       time_t ts;
+       size_t len;
+       size_t size;
+       char *buf;
 };
 
-struct nfs_pagecache {
-       struct nfs_pagecache_entry *entries;
-       uint32_t num_entries;
-       time_t ttl;
+struct nfs_wb_waiter {
+       struct nfs_wb_waiter *next;
+       nfs_cb cb;
+       void *private_data;
+};
+
+struct nfs_writeback {
+       struct nfs_writeback *next;
+       struct nfsfh *nfsfh;
+       /* sorted by offset, never overlapping or touching */
+       struct nfs_wb_range *dirty;
+       uint64_t dirty_bytes;
+       uint64_t dirty_since;
+       /* ranges that are being written to the server */
+       struct nfs_wb_range *inflight;
+       /* first error from a background WRITE, 0 if none */
+       int error;
+       /* waiting for everything to reach the server */
+       struct nfs_wb_waiter *waiters;
+       /* written UNSTABLE but not yet committed */
+       struct nfs_wb_range *unstable;
+       uint64_t unstable_bytes;
+       /* verifier of the last UNSTABLE WRITE */
+       int verf_valid;
+       int verf_changed;
+       char verf[NFS3_WRITEVERFSIZE];
+       /* ranges covered by the COMMIT that is in flight */
+       struct nfs_wb_range *committing;
+       int commit_replay;
+       char commit_verf[NFS3_WRITEVERFSIZE];
 };
 
 struct nfsfh {
        struct nfs_fh fh;
        int is_sync;
        int is_append;
+       struct nfs_inode *inode;
        uint64_t offset;
        struct nfs_readahead ra;
-       struct nfs_pagecache pagecache;
+       /* max dirty bytes in the write-back cache, 0 to write through */
+       uint32_t writeback;
+       struct nfs_writeback *wb;
+       /*
+        * End of file for O_APPEND writes, if known. It includes our
+        * own writes that are buffered or in flight so that appends can
+        * be sent back to back without a GETATTR for each of them.
+        */
+       int eof_valid;
+       uint64_t eof;
+};
+
+/*
+ * Batched I/O queue.
+ * Every queued operation holds one slot until its completion has been
+ * put in the ring, so the ring never holds more than depth entries.
+ * Reads that follow each other in the same file are merged into a single
+ * preadv() and their slots are chained through next.
+ */
+#define NFS_IOQ_MAX_MERGE 16
+
+struct nfs_ioq;
+
+struct nfs_ioq_slot {
+       struct nfs_ioq_slot *next;
+       struct nfs_ioq *q;
+       void *tag;
+       uint64_t count;
+};
+
+struct nfs_ioq {
+       struct nfs_context *nfs;
+       int depth;
+       /* submitted but not yet completed */
+       int inflight;
+       int destroyed;
+       struct nfs_ioq_slot *slots;
+       struct nfs_ioq_slot *free;
+       /* completions waiting to be reaped */
+       struct nfs_io_completion *ring;
+       int head;
+       int count;
 };
 
 const struct nfs_fh *nfs_get_rootfh(struct nfs_context *nfs);
 
 int nfs_normalize_path(struct nfs_context *nfs, char *path);
 void nfs_free_nfsdir(struct nfsdir *nfsdir);
-void nfs_free_nfsfh(struct nfsfh *nfsfh);
+struct nfsdirent *nfs_dirbuf_add(struct nfs_dirbuf *buf, const char *fname,
+                                 uint64_t inode);
+void nfs_dirbuf_finish(struct nfs_dirbuf *buf);
+void nfs_dirbuf_free(struct nfs_dirbuf *buf);
+void nfs_free_nfsfh(struct nfs_context *nfs, struct nfsfh *nfsfh);
 
 void nfs_dircache_add(struct nfs_context *nfs, struct nfsdir *nfsdir);
 struct nfsdir *nfs_dircache_find(struct nfs_context *nfs, struct nfs_fh *fh);
 void nfs_dircache_drop(struct nfs_context *nfs, struct nfs_fh *fh);
-
-char * nfs_pagecache_get(struct nfs_pagecache *pagecache, uint64_t offset);
-void nfs_pagecache_put(struct nfs_pagecache *pagecache, uint64_t offset,
-                       const char *buf, size_t len);
+void nfs_dircache_add_name(struct nfs_context *nfs, struct nfsdir *nfsdir,
+                           uint32_t index, struct nfs_fh *fh);
+int nfs_dircache_lookup(struct nfs_context *nfs, struct nfs_fh *dir,
+                        struct nfs_attr *dir_attr, const char *fname,
+                        struct nfs_fh *fh, struct nfs_attr *attr);
+void nfs_dircache_free_all(struct nfs_context *nfs);
+
+struct nfs_inode *nfs_inode_find(struct nfs_context *nfs, struct nfs_fh *fh);
+struct nfs_inode *nfs_inode_get(struct nfs_context *nfs, struct nfs_fh *fh);
+void nfs_inode_put(struct nfs_context *nfs, struct nfs_inode *inode);
+void nfs_inode_revalidate(struct nfs_context *nfs, struct nfs_inode *inode,
+                          struct nfs_attr *attr);
+void nfs_inode_update_wcc(struct nfs_context *nfs, struct nfs_inode *inode,
+                          struct nfs_attr *before, struct nfs_attr *after);
+
+struct nfs_dentry *nfs_dentry_find(struct nfs_context *nfs,
+                                   struct nfs_fh *dir, const char *fname);
+void nfs_dentry_add(struct nfs_context *nfs, struct nfs_fh *dir,
+                    const char *fname, struct nfs_fh *fh,
+                    struct nfs_attr *attr);
+void nfs_dentry_add_negative(struct nfs_context *nfs, struct nfs_fh *dir,
+                             const char *fname, struct nfs_attr *dir_attr);
+void nfs_dentry_drop(struct nfs_context *nfs, struct nfs_fh *dir,
+                     const char *fname);
+void nfs_dentry_free_all(struct nfs_context *nfs);
+
+struct nfs_attr *nfs_attrcache_find(struct nfs_context *nfs,
+                                    struct nfs_fh *fh);
+void nfs_attrcache_update(struct nfs_context *nfs, struct nfs_fh *fh,
+                          struct nfs_attr *attr);
+void nfs_attrcache_drop(struct nfs_context *nfs, struct nfs_fh *fh);
+int nfs_access_cache_find(struct nfs_context *nfs, struct nfs_fh *fh,
+                          uint32_t mask, uint32_t *access);
+void nfs_access_cache_add(struct nfs_context *nfs, struct nfs_fh *fh,
+                          uint32_t mask, uint32_t access);
+void nfs_attrcache_free_all(struct nfs_context *nfs);
+
+const char *nfs_linkcache_find(struct nfs_context *nfs, struct nfs_fh *fh,
+                               struct nfs_attr *attr);
+void nfs_linkcache_add(struct nfs_context *nfs, struct nfs_fh *fh,
+                       struct nfs_attr *attr, const char *target);
+void nfs_linkcache_free_all(struct nfs_context *nfs);
+
+#define NFS_DISKCACHE_DEFAULT_SIZE (1024ULL * 1024 * 1024)
+
+void nfs_diskcache_set_size(struct nfs_context *nfs, uint64_t max_bytes);
+void nfs_diskcache_free(struct nfs_context *nfs);
+void nfs_diskcache_attach(struct nfs_context *nfs, struct nfs_inode *inode);
+void nfs_diskcache_detach(struct nfs_context *nfs, struct nfs_inode *inode);
+void nfs_diskcache_invalidate(struct nfs_context *nfs,
+                              struct nfs_inode *inode);
+int nfs_diskcache_cached(struct nfs_inode *inode, uint64_t offset);
+int nfs_diskcache_get(struct nfs_context *nfs, struct nfs_inode *inode,
+                      uint64_t offset, char *buf);
+void nfs_diskcache_put(struct nfs_context *nfs, struct nfs_inode *inode,
+                       uint64_t offset, const char *buf, size_t len);
+
+void nfs_pagecache_init(struct nfs_context *nfs, struct nfsfh *nfsfh);
+void nfs_pagecache_release(struct nfs_context *nfs, struct nfsfh *nfsfh);
+void nfs_pagecache_free(struct nfs_context *nfs);
+char *nfs_pagecache_get(struct nfs_context *nfs, struct nfs_inode *inode,
+                        uint64_t offset);
+int nfs_pagecache_cached(struct nfs_context *nfs, struct nfs_inode *inode,
+                         uint64_t offset);
+void nfs_pagecache_put(struct nfs_context *nfs, struct nfs_inode *inode,
+                       uint64_t offset, const char *buf, size_t len);
 
 int nfs3_access_async(struct nfs_context *nfs, const char *path, int mode,
                       nfs_cb cb, void *private_data);
@@ -429,12 +932,24 @@ int nfs3_open_async(struct nfs_context *nfs, const char *path, int flags,
                     nfs_cb cb, void *private_data);
 int nfs3_opendir_async(struct nfs_context *nfs, const char *path, nfs_cb cb,
                        void *private_data);
+int nfs3_opendir_stream_async(struct nfs_context *nfs, const char *path,
+                              uint64_t cookie, nfs_cb cb, void *private_data);
+int nfs3_readdir_next_page_async(struct nfs_context *nfs,
+                                 struct nfsdir *nfsdir, nfs_cb cb,
+                                 void *private_data);
+void nfs3_dirstream_close(struct nfs_context *nfs, struct nfsdir *nfsdir);
 int nfs3_pread_async_internal(struct nfs_context *nfs, struct nfsfh *nfsfh,
                               uint64_t offset, size_t count, nfs_cb cb,
                               void *private_data, int update_pos);
 int nfs3_pwrite_async_internal(struct nfs_context *nfs, struct nfsfh *nfsfh,
                                uint64_t offset, size_t count, const char *buf,
                                nfs_cb cb, void *private_data, int update_pos);
+int nfs3_preadv_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                      const struct iovec *iov, int iovcnt, uint64_t offset,
+                      nfs_cb cb, void *private_data);
+int nfs3_pwritev_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                       const struct iovec *iov, int iovcnt, uint64_t offset,
+                       nfs_cb cb, void *private_data);
 int nfs3_readlink_async(struct nfs_context *nfs, const char *path, nfs_cb cb,
                         void *private_data);
 int nfs3_rename_async(struct nfs_context *nfs, const char *oldpath,
@@ -461,6 +976,23 @@ int nfs3_utimes_async_internal(struct nfs_context *nfs, const char *path,
 int nfs3_write_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
                      uint64_t count, const void *buf, nfs_cb cb,
                      void *private_data);
+struct nfs_writeback *nfs3_writeback_get(struct nfs_context *nfs,
+                                         struct nfsfh *nfsfh);
+int nfs3_writeback_busy(struct nfsfh *nfsfh);
+struct nfsfh *nfs3_writeback_busy_fh(struct nfs_context *nfs,
+                                     struct nfs_fh *fh);
+int nfs3_writeback_flush(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                         nfs_cb cb, void *private_data);
+int nfs3_writeback_defer(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                         continue_func fn, struct nfs_cb_data *data);
+void nfs3_writeback_scan(struct nfs_context *nfs);
+int nfs3_writeback_unstable(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                            uint64_t offset, const char *buf, size_t count,
+                            const char *verf);
+int nfs3_writeback_commit_done(struct nfs_context *nfs,
+                               struct nfs_writeback *wb, const char *verf);
+void nfs_wb_free_ranges(struct nfs_wb_range **list);
+void nfs_writeback_free(struct nfs_context *nfs, struct nfsfh *nfsfh);
    
 int nfs4_mount_async(struct nfs_context *nfs, const char *server,
 		     const char *export, nfs_cb cb, void *private_data);
@@ -24,6 +24,10 @@
 #define _LIBNFS_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
 #if defined(__ANDROID__) || defined(AROS) \
  || ( defined(__APPLE__) && defined(__MACH__) )
 #include <sys/time.h>
@@ -38,6 +42,8 @@ extern "C" {
 #define LIBNFS_FEATURE_READAHEAD
 #define LIBNFS_FEATURE_PAGECACHE
 #define LIBNFS_FEATURE_DEBUG
+#define LIBNFS_FEATURE_IOVEC
+#define LIBNFS_FEATURE_IOQ
 #define NFS_BLKSIZE 4096
 #define NFS_PAGECACHE_DEFAULT_TTL 5
 
@@ -57,6 +63,10 @@ struct nfs_url {
 #endif
 
 #ifdef WIN32
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
 #ifdef HAVE_FUSE_H
 #include <fuse.h>
 #else
@@ -191,10 +201,65 @@ EXTERN void nfs_destroy_context(struct nfs_context *nfs);
  *                     default is 65534 on Windows and getgid() on unixen.
  * readahead=<int>   : Enable readahead for files and set the maximum amount
  *                     of readahead to <int> bytes.
+ * pagecache=<int>   : Enable the pagecache and set the number of pages
+ *                     the context may use for caching file data.
+ * pagecache_ttl=<int>
+ *                   : Number of seconds cached data is used for before
+ *                     it is read again from the server. 0 means forever.
+ *                     Data is also dropped as soon as the server reports
+ *                     that the file was changed by someone else.
+ * prefetch_small=<int>
+ *                   : Read files of up to <int> bytes in full as soon
+ *                     as they are opened. Uses the pagecache.
+ * dirscan_prefetch=<int>
+ *                   : When files are opened in readdir order, read up to
+ *                     <int> bytes of the files that come next in the
+ *                     directory ahead of time. Uses the pagecache.
+ * writeback=<int>   : Enable write-back caching of small writes and set
+ *                     the max number of dirty bytes per open file.
  * auto-traverse-mounts=<0|1>
  *                   : Should libnfs try to traverse across nested mounts
  *                     automatically or not. Default is 1 == enabled.
  * dircache=<0|1>    : Disable/enable directory caching. Enabled by default.
+ * dircache_entries=<int>
+ *                   : Max number of directory entries in the dircache.
+ * dircache_size=<int>
+ *                   : Max memory used by the dircache in MiB.
+ * readdir_dircount=<int>
+ * readdir_maxcount=<int>
+ *                   : Size of the directory information and of the whole
+ *                     READDIRPLUS reply to ask for. Defaults to the size
+ *                     the server prefers.
+ * readdir_names_only=<0|1>
+ *                   : Read directories without the attributes of their
+ *                     entries. Default is 0.
+ * readdir_lookups=<int>
+ *                   : Max number of LOOKUPs in flight while fetching the
+ *                     attributes of entries on servers without
+ *                     READDIRPLUS. Default is 64.
+ * linkcache=<0|1>   : Disable/enable caching of symlink targets. Enabled
+ *                     by default.
+ * dentry_ttl=<int>  : Number of seconds the file handles of files found
+ *                     by LOOKUP are remembered. Default is 0, disabled.
+ * dentry_dir_ttl=<int>
+ *                   : Same as dentry_ttl but for directories.
+ * negative_ttl=<int>: Number of seconds a name LOOKUP did not find, or
+ *                     a cached directory listing does not have, is
+ *                     remembered. Default is 0, disabled.
+ * acregmin=<int>    : Minimum number of seconds the attributes of a file
+ *                     are cached for. Default is 0.
+ * acregmax=<int>    : Maximum number of seconds the attributes of a file
+ *                     are cached for. Default is 0, disabled.
+ * acdirmin=<int>    : Same as acregmin but for directories.
+ * acdirmax=<int>    : Same as acregmax but for directories.
+ * actimeo=<int>     : Set all four of the above to the same value.
+ * nocto=<0|1>       : Let opens be answered from the attribute cache,
+ *                     without close-to-open consistency. Default is 0.
+ * diskcache=<dir>   : Keep a persistent copy of the file data that goes
+ *                     through the pagecache in this local directory.
+ *                     Needs pagecache=<int>.
+ * diskcache_size=<int>
+ *                   : Size of the disk cache in MiB. Default is 1024.
  * autoreconnect=<-1|0|>=1>
  *                   : Control the auto-reconnect behaviour to the NFS session.
  *                    -1 : Try to reconnect forever on session failures.
@@ -257,8 +322,174 @@ EXTERN void nfs_set_gid(struct nfs_context *nfs, int gid);
 EXTERN void nfs_set_pagecache(struct nfs_context *nfs, uint32_t v);
 EXTERN void nfs_set_pagecache_ttl(struct nfs_context *nfs, uint32_t v);
 EXTERN void nfs_set_readahead(struct nfs_context *nfs, uint32_t v);
+/*
+ * Whole-file prefetch.
+ * When a regular file of at most v bytes is opened for reading the READs
+ * for all of it are sent together with the ACCESS call of the open and
+ * the data is kept in the pagecache, so that reading the file right after
+ * opening it does not have to wait for another round trip. This enables
+ * the pagecache if it is not already large enough. 0 disables it, which
+ * is the default.
+ */
+EXTERN void nfs_set_prefetch_small(struct nfs_context *nfs, uint32_t v);
+/*
+ * Directory scan prefetch.
+ * When the application opens the files of a directory in the order
+ * nfs_readdir() returns them, the beginning of the files that come next
+ * is read into the pagecache before they are opened, up to a total of
+ * v bytes ahead of the application. This also works when the directory
+ * is closed before the files are opened, for as long as its listing is
+ * kept in the dircache, see nfs_set_dircache(). This enables the
+ * pagecache if it is not already large enough. 0 disables it, which is
+ * the default.
+ */
+EXTERN void nfs_set_dirscan_prefetch(struct nfs_context *nfs, uint32_t v);
+/*
+ * Write-back caching.
+ * When enabled, writes are collected in memory and sent to the server
+ * in the background in larger chunks. The write callback is invoked as
+ * soon as the data has been buffered. Data is sent once a handle has
+ * v bytes or more buffered, when it has been buffered for a second,
+ * and on nfs_fsync(), nfs_close(), nfs_ftruncate() and nfs_fstat().
+ * Errors writing buffered data are returned by the next nfs_fsync() or
+ * nfs_close() on the handle.
+ * Handles opened with O_SYNC never use the write-back cache.
+ *
+ * nfs_set_writeback() sets the default for files opened from now on,
+ * nfs_set_fh_writeback() changes it for an open handle. 0 disables it.
+ * Disabling it with nfs_set_writeback() also disables it on all open
+ * handles and starts sending the data they have buffered.
+ */
+EXTERN void nfs_set_writeback(struct nfs_context *nfs, uint32_t v);
+EXTERN void nfs_set_fh_writeback(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                                 uint32_t v);
 EXTERN void nfs_set_debug(struct nfs_context *nfs, int level);
 EXTERN void nfs_set_dircache(struct nfs_context *nfs, int enabled);
+/*
+ * Limit the directory cache.
+ * Listings read by nfs_opendir() are kept after nfs_closedir() and the
+ * least recently used ones are dropped when the cache holds more than
+ * max_entries directory entries or uses more than max_bytes of memory.
+ * While a directory has not changed its cached listing also answers the
+ * lookups of names that exist in it when the attribute cache is enabled,
+ * see nfs_set_attr_cache(), and of names that do not exist in it for
+ * negative_ttl seconds after it was read when the negative lookup cache
+ * is enabled, see nfs_set_negative_cache().
+ * The defaults are 65536 entries and 16MiB.
+ */
+EXTERN void nfs_set_dircache_size(struct nfs_context *nfs,
+                                  uint32_t max_entries, uint64_t max_bytes);
+/*
+ * Symlink cache.
+ * Remember the targets of the symlinks that nfs_readlink() and path
+ * resolution read so that following the same symlink again does not need
+ * a READLINK. A target is used for as long as the symlink still has the
+ * mtime and ctime it had when it was read. Enabled by default.
+ */
+EXTERN void nfs_set_linkcache(struct nfs_context *nfs, int enabled);
+/*
+ * Directory reading.
+ * nfs_opendir() reads directories with READDIRPLUS calls that ask for
+ * replies of the size the server prefers, its FSINFO dtpref, or 8k if
+ * it prefers less. nfs_set_readdir() overrides the dircount and maxcount
+ * of the calls, the latter is also the count of READDIR calls. 0 means
+ * use the default.
+ *
+ * With nfs_set_readdir_names_only() enabled directories are read with
+ * READDIR instead, which is much cheaper for large directories. The
+ * entries then only have their name and inode set, type is 0.
+ *
+ * Servers that do not support READDIRPLUS are read with READDIR and a
+ * LOOKUP for every entry. nfs_set_readdir_lookups() sets how many of
+ * these LOOKUPs are kept in flight at a time, default is 64. Values less
+ * than 1 mean 1.
+ */
+EXTERN void nfs_set_readdir(struct nfs_context *nfs, uint32_t dircount,
+                            uint32_t maxcount);
+EXTERN void nfs_set_readdir_names_only(struct nfs_context *nfs, int enabled);
+EXTERN void nfs_set_readdir_lookups(struct nfs_context *nfs, int lookups);
+/*
+ * Name lookup cache.
+ * Remember the file handle and attributes the server returned for a name
+ * in a directory so that resolving a path does not need a LOOKUP for
+ * every component each time. Names of files are remembered for file_ttl
+ * seconds and names of directories for dir_ttl seconds. The cache is
+ * filled from LOOKUP, CREATE, MKDIR and READDIRPLUS replies and our own
+ * REMOVE, RMDIR and RENAME calls drop the names they change. Changes
+ * made by other clients are only noticed once the entries expire.
+ *
+ * The attributes passed on from the cache are as old as the entry, so
+ * for example nfs_opendir() may return a cached listing of a directory
+ * for up to dir_ttl seconds after it changed. 0 for both disables the
+ * cache, which is the default.
+ */
+EXTERN void nfs_set_dentry_cache(struct nfs_context *nfs, uint32_t file_ttl,
+                                 uint32_t dir_ttl);
+/*
+ * Negative name lookup cache.
+ * Remember for ttl seconds that a LOOKUP of a name failed with
+ * NFS3ERR_NOENT so that probing the same missing path again fails
+ * without talking to the server. An entry is only used for as long as
+ * the directory still has the mtime and ctime it had when the name was
+ * not found, whenever we have fresh attributes for the directory, and
+ * names we create, link or rename to ourselves are dropped right away.
+ * Names missing from a cached directory listing that is no older than
+ * ttl seconds also fail without a LOOKUP.
+ * 0 disables it, which is the default.
+ */
+EXTERN void nfs_set_negative_cache(struct nfs_context *nfs, uint32_t ttl);
+/*
+ * Attribute cache.
+ * Remember the attributes the server returns for a file handle in any
+ * reply, GETATTR, LOOKUP, READDIRPLUS, READ, or the wcc data of WRITE,
+ * SETATTR and COMMIT, so that nfs_stat64(), nfs_fstat64() and friends can
+ * be answered without a GETATTR.
+ *
+ * As with the kernel client, attributes are trusted for acregmin seconds
+ * (acdirmin for directories) after the file last changed, and for twice
+ * as long every time they come back unchanged, up to acregmax (acdirmax)
+ * seconds. Changes made by other clients are only noticed once the
+ * attributes expire. acregmax and acdirmax of 0 disable the cache, which
+ * is the default.
+ *
+ * The results of ACCESS calls, made by nfs_open(), nfs_access() and
+ * nfs_access2(), are cached per credential alongside the attributes and
+ * are dropped when the mode, owner or ctime of the file change.
+ *
+ * Unless nfs_set_nocto() is enabled nfs_open() still asks the server
+ * every time, so that a file opened after another client closed it has
+ * the data that client wrote (close-to-open consistency).
+ */
+EXTERN void nfs_set_attr_cache(struct nfs_context *nfs, uint32_t acregmin,
+                               uint32_t acregmax, uint32_t acdirmin,
+                               uint32_t acdirmax);
+/*
+ * No close-to-open consistency.
+ * When enabled, nfs_open() of a file whose attributes and access rights
+ * are still in the attribute cache does not talk to the server at all.
+ * Changes other clients made to the file are then only seen once its
+ * attributes expire, like with the nocto mount option of the kernel
+ * client. O_APPEND opens always ask the server. 0 disables it, which is
+ * the default.
+ */
+EXTERN void nfs_set_nocto(struct nfs_context *nfs, int enabled);
+/*
+ * Persistent disk cache.
+ * Keep a copy of the file data that goes through the pagecache in the
+ * local directory dir and use it for later reads of the same file, also
+ * from other contexts and processes and after a restart. The directory
+ * is created if it does not exist. The cached data for a file is used as
+ * long as the size, mtime and ctime the server reports for the file are
+ * the same as when the data was stored. When the cache grows larger than
+ * max_bytes the files that were least recently used are removed.
+ *
+ * The disk cache only works when the pagecache is enabled, see
+ * nfs_set_pagecache(). A NULL dir or a max_bytes of 0 disables it.
+ *
+ * Returns 0 on success and -1 on failure. Not available on Windows.
+ */
+EXTERN int nfs_set_diskcache(struct nfs_context *nfs, const char *dir,
+                             uint64_t max_bytes);
 EXTERN void nfs_set_autoreconnect(struct nfs_context *nfs, int num_retries);
 
 /*
@@ -274,6 +505,22 @@ EXTERN int nfs_set_version(struct nfs_context *nfs, int version);
 EXTERN void nfs_pagecache_invalidate(struct nfs_context *nfs,
                                      struct nfsfh *nfsfh);
 
+/*
+ * Pagecache statistics.
+ * The pagecache is shared by all files opened through the context and
+ * nfs_set_pagecache() sets its total size in pages of NFS_BLKSIZE bytes.
+ */
+struct nfs_pagecache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint32_t pages;          /* pages currently allocated */
+	uint32_t max_pages;      /* memory budget in pages */
+};
+
+EXTERN void nfs_get_pagecache_stats(struct nfs_context *nfs,
+                                    struct nfs_pagecache_stats *stats);
+
 /*
  * MOUNT THE EXPORT
  */
@@ -528,6 +775,13 @@ EXTERN uint16_t nfs_umask(struct nfs_context *nfs, uint16_t mask);
  * O_SYNC
  * O_TRUNC (Only valid with O_RDWR or O_WRONLY. Ignored otherwise.)
  *
+ * With O_APPEND the size of the file is remembered when it is opened and
+ * every write on the handle moves it forward, so appends do not need a
+ * GETATTR and can be sent without waiting for each other. Appends by
+ * other clients are noticed once a WRITE reply shows that the file did
+ * not end where we wrote, the next append then asks the server for the
+ * size again.
+ *
  * When the callback is invoked, status indicates the result:
  *      0 : Success.
  *          data is a struct *nfsfh;
@@ -675,6 +929,227 @@ EXTERN int nfs_pwrite(struct nfs_context *nfs, struct nfsfh *nfsfh,
                       uint64_t offset, uint64_t count, const void *buf);
 
 
+/*
+ * PREADV()
+ */
+/*
+ * Async preadv()
+ * Reads into the iovcnt buffers described by iov, starting at offset.
+ * The data is copied straight into the buffers as the READ replies
+ * arrive. The buffers must stay valid until the callback is invoked,
+ * the iov array itself does not need to.
+ *
+ * Function returns
+ *  0 : The command was queued successfully. The callback will be invoked once
+ *      the command completes.
+ * <0 : An error occured when trying to queue the command.
+ *      The callback will not be invoked.
+ *
+ * When the callback is invoked, status indicates the result:
+ *    >=0 : Success.
+ *          status is numer of bytes read.
+ *          data is NULL.
+ * -errno : An error occured.
+ *          data is the error string.
+ */
+EXTERN int nfs_preadv_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                            const struct iovec *iov, int iovcnt,
+                            uint64_t offset, nfs_cb cb, void *private_data);
+/*
+ * Sync preadv()
+ * Function returns
+ *    >=0 : numer of bytes read.
+ * -errno : An error occured.
+ */
+EXTERN int nfs_preadv(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                      const struct iovec *iov, int iovcnt, uint64_t offset);
+
+
+/*
+ * PWRITEV()
+ */
+/*
+ * Async pwritev()
+ * Writes the iovcnt buffers described by iov to the file, starting at
+ * offset. The buffers must stay valid until the callback is invoked,
+ * the iov array itself does not need to.
+ *
+ * Function returns
+ *  0 : The command was queued successfully. The callback will be invoked once
+ *      the command completes.
+ * <0 : An error occured when trying to queue the command.
+ *      The callback will not be invoked.
+ *
+ * When the callback is invoked, status indicates the result:
+ *    >=0 : Success.
+ *          status is numer of bytes written.
+ * -errno : An error occured.
+ *          data is the error string.
+ */
+EXTERN int nfs_pwritev_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                             const struct iovec *iov, int iovcnt,
+                             uint64_t offset, nfs_cb cb, void *private_data);
+/*
+ * Sync pwritev()
+ * Function returns
+ *    >=0 : numer of bytes written.
+ * -errno : An error occured.
+ */
+EXTERN int nfs_pwritev(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                       const struct iovec *iov, int iovcnt, uint64_t offset);
+
+
+/*
+ * BATCHED I/O
+ */
+/*
+ * A queue for submitting many reads and writes at once and collecting
+ * their results later, similar to io_uring or libaio.
+ * Operations are described by struct nfs_io. tag is not used by libnfs,
+ * it is returned unchanged in the completion for that operation.
+ * Completions are kept in a ring inside the queue instead of invoking a
+ * callback for each operation and are collected with nfs_ioq_reap() or
+ * nfs_ioq_wait().
+ * Reads that directly follow each other in the same file and are
+ * submitted together are merged and sent as one preadv().
+ *
+ * For NFS_IO_READ and NFS_IO_WRITE the completion status is the number
+ * of bytes read or written, for NFS_IO_FSYNC it is 0. A negative status
+ * is -errno.
+ * buf must stay valid until the completion for the operation has been
+ * reaped.
+ */
+#define NFS_IO_READ  0
+#define NFS_IO_WRITE 1
+#define NFS_IO_FSYNC 2
+
+struct nfs_io {
+	struct nfsfh *nfsfh;
+	int op;
+	uint64_t offset;
+	uint64_t count;
+	void *buf;
+	void *tag;
+};
+
+struct nfs_io_completion {
+	void *tag;
+	int status;
+};
+
+struct nfs_ioq;
+
+/*
+ * Create a queue that can hold up to depth operations that have been
+ * submitted but whose completion has not yet been reaped.
+ * Returns NULL on failure.
+ */
+EXTERN struct nfs_ioq *nfs_ioq_init(struct nfs_context *nfs, int depth);
+/*
+ * Destroy the queue. Completions that have not been reaped are lost.
+ * Operations that are still in flight are not cancelled, the queue is
+ * released once they finish or the context is destroyed.
+ * The queue must be destroyed before the context.
+ */
+EXTERN void nfs_ioq_destroy(struct nfs_ioq *q);
+/*
+ * Submit up to nr operations.
+ * Submission stops early once the queue is full.
+ * Operations that can not be sent are failed through the completion ring.
+ * The ios array itself does not need to stay valid after the call.
+ *
+ * Function returns the number of operations taken from ios.
+ */
+EXTERN int nfs_ioq_submit(struct nfs_ioq *q, struct nfs_io *ios, int nr);
+/*
+ * Copy up to max completions into comps without blocking.
+ *
+ * Function returns the number of completions copied.
+ */
+EXTERN int nfs_ioq_reap(struct nfs_ioq *q, struct nfs_io_completion *comps,
+                        int max);
+/*
+ * Number of operations that have been submitted but have not completed.
+ */
+EXTERN int nfs_ioq_inflight(struct nfs_ioq *q);
+/*
+ * Sync wait for completions.
+ * Services the context until at least min completions are available or
+ * nothing is in flight, then copies up to max of them into comps.
+ *
+ * Function returns
+ *    >=0 : number of completions copied.
+ * -errno : An error occured.
+ */
+EXTERN int nfs_ioq_wait(struct nfs_ioq *q, struct nfs_io_completion *comps,
+                        int min, int max);
+
+
+#ifndef WIN32
+/*
+ * MMAP()
+ */
+/*
+ * Map the first length bytes of an open file into memory without
+ * reading them first. Only supported on Linux, it needs userfaultfd.
+ *
+ * The data is read when a thread touches a part of the mapping that has
+ * not been read yet. That thread blocks until the data is there and the
+ * thread that drives the context has to serve the fault:
+ * nfs_mmap_get_fd() returns a descriptor that becomes readable when a
+ * fault is pending, nfs_mmap_service() must then be called to send the
+ * READs. The READs complete from nfs_service() like any other call, so
+ * a thread must not touch the mapping while it is the one that services
+ * the context.
+ * When the mapping is accessed in order, READs for the following parts
+ * are sent ahead of the faults.
+ * The mapping is read-only and private, it does not see later changes
+ * to the file. Data past the end of the file reads as zero.
+ *
+ * Returns NULL on failure.
+ */
+struct nfs_mmap;
+
+EXTERN struct nfs_mmap *nfs_mmap(struct nfs_context *nfs,
+                                 struct nfsfh *nfsfh, uint64_t length);
+/*
+ * Address of the mapping.
+ */
+EXTERN void *nfs_mmap_get_addr(struct nfs_mmap *map);
+/*
+ * Descriptor to poll for POLLIN, see nfs_mmap().
+ */
+EXTERN int nfs_mmap_get_fd(struct nfs_mmap *map);
+/*
+ * Serve the pending faults.
+ * If a part of the mapping could not be read after a few tries the
+ * thread that touched it gets SIGBUS, like for a kernel mapping of a
+ * file that can not be read. Kernels older than Linux 6.6 can not do
+ * that, the thread then stays blocked and every following call tries
+ * to read that part again, so call this function again, for example
+ * after a timeout, when it returned an error. Threads that are still
+ * blocked when the mapping is removed fault on the unmapped range.
+ *
+ * Function returns
+ *      0 : Success
+ * -errno : An error occured since the last call.
+ */
+EXTERN int nfs_mmap_service(struct nfs_mmap *map);
+/*
+ * Fill the parts of the mapping that could not be read with zeros
+ * instead, so that the thread that touched them just goes on. The
+ * data it sees is then not what is in the file. 0 by default.
+ */
+EXTERN void nfs_mmap_set_zero_fill(struct nfs_mmap *map, int enabled);
+/*
+ * Remove the mapping.
+ * READs that are still in flight complete in the background, the file
+ * handle must stay open until they have.
+ */
+EXTERN void nfs_munmap(struct nfs_mmap *map);
+#endif
+
+
 /*
  * WRITE()
  */
@@ -743,6 +1218,11 @@ EXTERN int nfs_lseek(struct nfs_context *nfs, struct nfsfh *nfsfh,
 /*
  * Async fsync()
  *
+ * With NFSv3 this commits the data that was written UNSTABLE through
+ * this handle. If the server rebooted and lost some of it, that data
+ * is written again before fsync completes. If nothing needs to be
+ * committed no COMMIT is sent.
+ *
  * Function returns
  *  0 : The command was queued successfully. The callback will be invoked once
  *      the command completes.
@@ -1068,6 +1548,94 @@ EXTERN int nfs_opendir_async(struct nfs_context *nfs, const char *path,
 EXTERN int nfs_opendir(struct nfs_context *nfs, const char *path,
                        struct nfsdir **nfsdir);
 
+/*
+ * OPENDIR_STREAM()
+ */
+/*
+ * nfs_opendir() reads the whole directory before it returns. For very
+ * large directories nfs_opendir_stream_async() instead returns as soon
+ * as the first page of the directory has arrived and hands out the rest
+ * a page at a time, as it comes in. The page after the one that is being
+ * read is always already being fetched, and only those two pages are
+ * kept in memory.
+ *
+ * nfs_readdir() returns the entries of the current page and NULL at the
+ * end of it. nfs_readdir_next_page_async() then moves on to the next
+ * page. nfs_telldir(), nfs_seekdir() and nfs_rewinddir() work within the
+ * current page. Streamed directories are not kept in the dircache.
+ *
+ * cookie is 0 to start at the beginning of the directory or a value
+ * returned by nfs_readdir_cookie() to carry on after that entry, also
+ * from another context. Not all servers can resume from a cookie without
+ * the verifier that came with it.
+ *
+ * Entries have their attributes unless nfs_set_readdir_names_only() is
+ * set or the server does not support READDIRPLUS, type is 0 then.
+ *
+ * Async opendir_stream()
+ *
+ * Function returns
+ *  0 : The command was queued successfully. The callback will be invoked once
+ *      the first page has arrived.
+ * <0 : An error occured when trying to queue the command.
+ *      The callback will not be invoked.
+ *
+ * When the callback is invoked, status indicates the result:
+ *      0 : Success.
+ *          data is struct nfsdir *, closed with nfs_closedir().
+ * -errno : An error occured.
+ *          data is the error string.
+ */
+EXTERN int nfs_opendir_stream_async(struct nfs_context *nfs,
+                                    const char *path, uint64_t cookie,
+                                    nfs_cb cb, void *private_data);
+/*
+ * Sync opendir_stream()
+ * Function returns
+ *      0 : Success
+ * -errno : An error occured.
+ */
+EXTERN int nfs_opendir_stream(struct nfs_context *nfs, const char *path,
+                              uint64_t cookie, struct nfsdir **nfsdir);
+
+/*
+ * Async readdir_next_page()
+ * Only for directories opened with nfs_opendir_stream_async(). The
+ * entries of the current page are freed.
+ *
+ * Function returns
+ *  0 : The command was queued successfully. The callback will be invoked once
+ *      the next page is available.
+ * <0 : An error occured when trying to queue the command.
+ *      The callback will not be invoked.
+ *
+ * When the callback is invoked, status indicates the result:
+ *     >0 : Number of entries in the new page.
+ *      0 : The end of the directory has been reached.
+ * -errno : An error occured.
+ *          data is the error string.
+ */
+EXTERN int nfs_readdir_next_page_async(struct nfs_context *nfs,
+                                       struct nfsdir *nfsdir,
+                                       nfs_cb cb, void *private_data);
+/*
+ * Sync readdir_next_page()
+ * Function returns
+ *     >0 : Number of entries in the new page.
+ *      0 : The end of the directory has been reached.
+ * -errno : An error occured.
+ */
+EXTERN int nfs_readdir_next_page(struct nfs_context *nfs,
+                                 struct nfsdir *nfsdir);
+
+/*
+ * Cookie of the last entry nfs_readdir() returned for a streamed
+ * directory, to pass to nfs_opendir_stream_async() to carry on after it.
+ * This function will never block so there is no need for an async version.
+ */
+EXTERN uint64_t nfs_readdir_cookie(struct nfs_context *nfs,
+                                   struct nfsdir *nfsdir);
+
 
 
 /*
@@ -0,0 +1,669 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Persistent cache of file data in a local directory.
+ *
+ * This sits below the pagecache. Pages that go into the pagecache are
+ * also written to disk and pages that are missing from the pagecache
+ * are looked for on disk before we send a READ.
+ *
+ * Every file has two cache files named after the fsid and the file
+ * handle. <name>.dat is a sparse file holding the pages at their offset
+ * in the file, <name>.idx holds a header and a bitmap of the pages that
+ * are present. The index is mapped into memory while the file is in
+ * use. The header records the size, mtime and ctime of the file the
+ * data belongs to and the cache is thrown away when the file no longer
+ * matches them.
+ *
+ * A cache file is only used by one process at a time, we take an
+ * exclusive lock on the index. If the process dies while it holds a
+ * cache file the clean flag is not set and the next user starts over.
+ *
+ * When the cache directory grows past its size budget we delete the
+ * cache files that were used least recently.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef AROS
+#include "aros_compat.h"
+#endif
+
+#ifdef WIN32
+#include "win32_compat.h"
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && !defined(WIN32)
+#define NFS_DISKCACHE 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "libnfs.h"
+#include "libnfs-raw.h"
+#include "libnfs-private.h"
+
+#ifdef NFS_DISKCACHE
+
+#define NFS_DC_MAGIC   0x6e667363
+#define NFS_DC_VERSION 1
+
+/* when we are over budget we delete files until we are below this */
+#define NFS_DC_LOW_WATER(max) ((max) / 10 * 9)
+
+/* times we try again when the index we locked was just evicted */
+#define NFS_DC_OPEN_RETRIES 3
+
+struct nfs_dc_header {
+       uint32_t magic;
+       uint32_t version;
+       uint32_t blksize;
+       uint32_t clean;
+       uint64_t size;
+       uint64_t mtime_sec;
+       uint64_t ctime_sec;
+       uint32_t mtime_nsec;
+       uint32_t ctime_nsec;
+       /* number of pages the bitmap can describe */
+       uint64_t nblocks;
+};
+
+struct nfs_dc_file {
+       int idx_fd;
+       int dat_fd;
+       size_t map_len;
+       struct nfs_dc_header *hdr;
+       unsigned char *bitmap;
+};
+
+struct nfs_diskcache {
+       char *dir;
+       /* bytes used by the data files, -1 until we have looked */
+       int64_t used;
+       /* do not try to evict again before used has grown past this */
+       int64_t next_scan;
+};
+
+static size_t
+nfs_dc_map_len(uint64_t nblocks)
+{
+	return sizeof(struct nfs_dc_header) + (size_t)((nblocks + 7) / 8);
+}
+
+static char *
+nfs_dc_path(struct nfs_diskcache *dc, struct nfs_inode *inode,
+            const char *ext)
+{
+	char *path, *p;
+	size_t len;
+	int i;
+
+	len = strlen(dc->dir) + 1 + 16 + 1 + 2 * inode->fh.len +
+		strlen(ext) + 1;
+	path = malloc(len);
+	if (path == NULL) {
+		return NULL;
+	}
+	p = path + sprintf(path, "%s/%016llx-", dc->dir,
+			   (unsigned long long)inode->attr.fsid);
+	for (i = 0; i < inode->fh.len; i++) {
+		p += sprintf(p, "%02x", (unsigned char)inode->fh.val[i]);
+	}
+	strcpy(p, ext);
+	return path;
+}
+
+static int
+nfs_dc_map(struct nfs_dc_file *f, uint64_t nblocks)
+{
+	size_t len = nfs_dc_map_len(nblocks);
+	void *m;
+
+	if (ftruncate(f->idx_fd, (off_t)len) != 0) {
+		return -1;
+	}
+	m = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, f->idx_fd, 0);
+	if (m == MAP_FAILED) {
+		return -1;
+	}
+	if (f->hdr) {
+		munmap(f->hdr, f->map_len);
+	}
+	f->hdr = m;
+	f->map_len = len;
+	f->bitmap = (unsigned char *)m + sizeof(struct nfs_dc_header);
+	f->hdr->nblocks = nblocks;
+	return 0;
+}
+
+static void
+nfs_dc_set_attr(struct nfs_dc_header *hdr, struct nfs_attr *attr)
+{
+	hdr->size       = attr->size;
+	hdr->mtime_sec  = attr->mtime.seconds;
+	hdr->mtime_nsec = attr->mtime.nseconds;
+	hdr->ctime_sec  = attr->ctime.seconds;
+	hdr->ctime_nsec = attr->ctime.nseconds;
+}
+
+static int
+nfs_dc_matches(struct nfs_dc_header *hdr, struct nfs_attr *attr)
+{
+	return hdr->magic == NFS_DC_MAGIC &&
+		hdr->version == NFS_DC_VERSION &&
+		hdr->blksize == NFS_BLKSIZE &&
+		hdr->clean &&
+		hdr->size == attr->size &&
+		hdr->mtime_sec == attr->mtime.seconds &&
+		hdr->mtime_nsec == attr->mtime.nseconds &&
+		hdr->ctime_sec == attr->ctime.seconds &&
+		hdr->ctime_nsec == attr->ctime.nseconds;
+}
+
+static uint64_t
+nfs_dc_file_bytes(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) != 0) {
+		return 0;
+	}
+	return (uint64_t)st.st_blocks * 512;
+}
+
+static void
+nfs_dc_reset(struct nfs_context *nfs, struct nfs_dc_file *f)
+{
+	struct nfs_diskcache *dc = nfs->diskcache;
+
+	if (dc && dc->used > 0) {
+		dc->used -= MIN((int64_t)nfs_dc_file_bytes(f->dat_fd),
+				dc->used);
+	}
+	/* the bitmap is cleared either way so stale data is never used */
+	if (ftruncate(f->dat_fd, 0) != 0) {
+		RPC_LOG(nfs->rpc, 1, "failed to truncate disk cache file");
+	}
+	memset(f->bitmap, 0, f->map_len - sizeof(struct nfs_dc_header));
+}
+
+struct nfs_dc_entry {
+       char *name;
+       time_t mtime;
+};
+
+static int
+nfs_dc_entry_cmp(const void *a, const void *b)
+{
+	const struct nfs_dc_entry *ea = a, *eb = b;
+
+	return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/*
+ * Walk the cache directory. Adds up the space used by the data files
+ * and, if evict is set, deletes the least recently used cache files
+ * that nobody holds until we are below the low water mark.
+ */
+static void
+nfs_dc_scan(struct nfs_diskcache *dc, uint64_t max_bytes, int evict)
+{
+	struct nfs_dc_entry *entries = NULL;
+	size_t num = 0, size = 0, i;
+	struct dirent *de;
+	struct stat st;
+	char path[PATH_MAX];
+	DIR *dir;
+
+	dir = opendir(dc->dir);
+	if (dir == NULL) {
+		return;
+	}
+	dc->used = 0;
+	while ((de = readdir(dir)) != NULL) {
+		size_t len = strlen(de->d_name);
+
+		if (len < 4 || strcmp(de->d_name + len - 4, ".idx")) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%.*s.dat", dc->dir,
+			 (int)(len - 4), de->d_name);
+		if (stat(path, &st) != 0) {
+			continue;
+		}
+		dc->used += (int64_t)st.st_blocks * 512;
+		if (!evict) {
+			continue;
+		}
+		if (num == size) {
+			struct nfs_dc_entry *tmp;
+
+			size = size ? size * 2 : 64;
+			tmp = realloc(entries, size * sizeof(*entries));
+			if (tmp == NULL) {
+				break;
+			}
+			entries = tmp;
+		}
+		entries[num].name = strdup(de->d_name);
+		if (entries[num].name == NULL) {
+			break;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dc->dir, de->d_name);
+		entries[num].mtime = stat(path, &st) == 0 ? st.st_mtime : 0;
+		num++;
+	}
+	closedir(dir);
+
+	qsort(entries, num, sizeof(*entries), nfs_dc_entry_cmp);
+	for (i = 0; i < num; i++) {
+		size_t len = strlen(entries[i].name);
+		int fd;
+
+		if (dc->used <= (int64_t)NFS_DC_LOW_WATER(max_bytes)) {
+			break;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dc->dir, entries[i].name);
+		fd = open(path, O_RDWR|O_CLOEXEC);
+		if (fd < 0) {
+			continue;
+		}
+		/* in use, by us or by someone else */
+		if (flock(fd, LOCK_EX|LOCK_NB) != 0) {
+			close(fd);
+			continue;
+		}
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/%.*s.dat", dc->dir,
+			 (int)(len - 4), entries[i].name);
+		if (stat(path, &st) == 0) {
+			dc->used -= (int64_t)st.st_blocks * 512;
+		}
+		unlink(path);
+		close(fd);
+	}
+	for (i = 0; i < num; i++) {
+		free(entries[i].name);
+	}
+	free(entries);
+
+	/* if the files are in use we may still be over budget, do not
+	 * walk the directory again for every page we add */
+	if (evict) {
+		dc->next_scan = dc->used +
+			(int64_t)(max_bytes - NFS_DC_LOW_WATER(max_bytes));
+	}
+}
+
+int
+nfs_set_diskcache(struct nfs_context *nfs, const char *dir,
+                  uint64_t max_bytes)
+{
+	struct nfs_diskcache *dc;
+
+	nfs_diskcache_free(nfs);
+	nfs->diskcache_size = max_bytes;
+	if (dir == NULL || max_bytes == 0) {
+		return 0;
+	}
+
+	if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+		nfs_set_error(nfs, "Failed to create disk cache directory "
+			      "%s: %s", dir, strerror(errno));
+		return -1;
+	}
+
+	dc = malloc(sizeof(struct nfs_diskcache));
+	if (dc == NULL) {
+		nfs_set_error(nfs, "Out of memory: failed to allocate "
+			      "nfs_diskcache structure");
+		return -1;
+	}
+	memset(dc, 0, sizeof(struct nfs_diskcache));
+	dc->dir = strdup(dir);
+	if (dc->dir == NULL) {
+		nfs_set_error(nfs, "Out of memory: failed to allocate "
+			      "nfs_diskcache structure");
+		free(dc);
+		return -1;
+	}
+	dc->used = -1;
+	nfs->diskcache = dc;
+	return 0;
+}
+
+void
+nfs_diskcache_set_size(struct nfs_context *nfs, uint64_t max_bytes)
+{
+	struct nfs_diskcache *dc = nfs->diskcache;
+
+	nfs->diskcache_size = max_bytes;
+	if (dc == NULL) {
+		return;
+	}
+	if (max_bytes == 0) {
+		nfs_diskcache_free(nfs);
+		return;
+	}
+	dc->next_scan = 0;
+	if (dc->used > (int64_t)max_bytes) {
+		nfs_dc_scan(dc, max_bytes, 1);
+	}
+}
+
+void
+nfs_diskcache_free(struct nfs_context *nfs)
+{
+	if (nfs->diskcache == NULL) {
+		return;
+	}
+	free(nfs->diskcache->dir);
+	free(nfs->diskcache);
+	nfs->diskcache = NULL;
+}
+
+/*
+ * Called whenever we have new attributes for the inode that the data we
+ * cache is valid for. Opens the cache files the first time.
+ */
+void
+nfs_diskcache_attach(struct nfs_context *nfs, struct nfs_inode *inode)
+{
+	struct nfs_diskcache *dc = nfs->diskcache;
+	struct nfs_dc_file *f;
+	char *path;
+	struct stat st;
+	uint64_t nblocks;
+	int tries;
+
+	if (inode->dc) {
+		nfs_dc_set_attr(inode->dc->hdr, &inode->attr);
+		return;
+	}
+	if (dc == NULL || inode->dc_failed || !inode->has_attr) {
+		return;
+	}
+	inode->dc_failed = 1;
+
+	if (dc->used < 0) {
+		nfs_dc_scan(dc, nfs->diskcache_size, 0);
+	}
+
+	f = malloc(sizeof(struct nfs_dc_file));
+	if (f == NULL) {
+		return;
+	}
+	memset(f, 0, sizeof(struct nfs_dc_file));
+	f->idx_fd = -1;
+	f->dat_fd = -1;
+
+	path = nfs_dc_path(dc, inode, ".idx");
+	if (path == NULL) {
+		goto err;
+	}
+	for (tries = 0; ; tries++) {
+		f->idx_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+		if (f->idx_fd < 0 ||
+		    flock(f->idx_fd, LOCK_EX|LOCK_NB) != 0 ||
+		    fstat(f->idx_fd, &st) != 0) {
+			free(path);
+			goto err;
+		}
+		/* an evicting scan may have removed the index between our
+		 * open() and flock(), its .dat is gone too then */
+		if (st.st_nlink > 0) {
+			break;
+		}
+		close(f->idx_fd);
+		f->idx_fd = -1;
+		if (tries == NFS_DC_OPEN_RETRIES) {
+			free(path);
+			goto err;
+		}
+	}
+	free(path);
+	path = nfs_dc_path(dc, inode, ".dat");
+	if (path == NULL) {
+		goto err;
+	}
+	f->dat_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	free(path);
+	if (f->dat_fd < 0 || fstat(f->idx_fd, &st) != 0) {
+		goto err;
+	}
+
+	nblocks = inode->attr.size / NFS_BLKSIZE + 1;
+	if ((size_t)st.st_size >= sizeof(struct nfs_dc_header)) {
+		struct nfs_dc_header hdr;
+
+		if (pread(f->idx_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+		    (size_t)st.st_size == nfs_dc_map_len(hdr.nblocks)) {
+			nblocks = MAX(nblocks, hdr.nblocks);
+		}
+	}
+	if (nfs_dc_map(f, nblocks) != 0) {
+		goto err;
+	}
+	if (!nfs_dc_matches(f->hdr, &inode->attr)) {
+		RPC_LOG(nfs->rpc, 2, "disk cache for file is stale");
+		nfs_dc_reset(nfs, f);
+		f->hdr->magic   = NFS_DC_MAGIC;
+		f->hdr->version = NFS_DC_VERSION;
+		f->hdr->blksize = NFS_BLKSIZE;
+		nfs_dc_set_attr(f->hdr, &inode->attr);
+	}
+	/* if we die while we have it open the next user starts over */
+	f->hdr->clean = 0;
+	msync(f->hdr, sizeof(struct nfs_dc_header), MS_SYNC);
+	/* the mtime of the index is what we evict by */
+	futimens(f->idx_fd, NULL);
+
+	inode->dc = f;
+	inode->dc_failed = 0;
+	return;
+
+ err:
+	if (f->idx_fd >= 0) {
+		close(f->idx_fd);
+	}
+	if (f->dat_fd >= 0) {
+		close(f->dat_fd);
+	}
+	free(f);
+}
+
+void
+nfs_diskcache_detach(struct nfs_context *nfs _U_, struct nfs_inode *inode)
+{
+	struct nfs_dc_file *f = inode->dc;
+
+	if (f == NULL) {
+		return;
+	}
+	inode->dc = NULL;
+	f->hdr->clean = 1;
+	munmap(f->hdr, f->map_len);
+	close(f->dat_fd);
+	/* closing the index drops the lock */
+	close(f->idx_fd);
+	free(f);
+}
+
+void
+nfs_diskcache_invalidate(struct nfs_context *nfs, struct nfs_inode *inode)
+{
+	if (inode->dc == NULL) {
+		return;
+	}
+	nfs_dc_reset(nfs, inode->dc);
+}
+
+int
+nfs_diskcache_cached(struct nfs_inode *inode, uint64_t offset)
+{
+	struct nfs_dc_file *f = inode->dc;
+	uint64_t blk = offset / NFS_BLKSIZE;
+
+	return f && blk < f->hdr->nblocks &&
+		(f->bitmap[blk / 8] & (1 << (blk % 8)));
+}
+
+int
+nfs_diskcache_get(struct nfs_context *nfs _U_, struct nfs_inode *inode,
+                  uint64_t offset, char *buf)
+{
+	struct nfs_dc_file *f = inode->dc;
+	uint64_t blk = offset / NFS_BLKSIZE;
+
+	if (!nfs_diskcache_cached(inode, offset)) {
+		return -1;
+	}
+	if (pread(f->dat_fd, buf, NFS_BLKSIZE, (off_t)(blk * NFS_BLKSIZE)) !=
+	    NFS_BLKSIZE) {
+		f->bitmap[blk / 8] &= ~(1 << (blk % 8));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Store the full pages of [offset, offset + len). Pages that are only
+ * partly covered are dropped since we can not tell if the rest of the
+ * page we have on disk is still good.
+ */
+void
+nfs_diskcache_put(struct nfs_context *nfs, struct nfs_inode *inode,
+                  uint64_t offset, const char *buf, size_t len)
+{
+	struct nfs_diskcache *dc = nfs->diskcache;
+	struct nfs_dc_file *f = inode->dc;
+
+	if (f == NULL || dc == NULL) {
+		return;
+	}
+	while (len > 0) {
+		uint64_t blk = offset / NFS_BLKSIZE;
+		size_t n = MIN(NFS_BLKSIZE - offset % NFS_BLKSIZE, len);
+
+		if (blk >= f->hdr->nblocks) {
+			if (nfs_dc_map(f, MAX(blk + 1,
+					      f->hdr->nblocks * 2)) != 0) {
+				return;
+			}
+		}
+		if (n < NFS_BLKSIZE) {
+			f->bitmap[blk / 8] &= ~(1 << (blk % 8));
+		} else if (pwrite(f->dat_fd, buf, NFS_BLKSIZE,
+				  (off_t)offset) == NFS_BLKSIZE) {
+			if (!(f->bitmap[blk / 8] & (1 << (blk % 8)))) {
+				f->bitmap[blk / 8] |= 1 << (blk % 8);
+				dc->used += NFS_BLKSIZE;
+			}
+		}
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+
+	if (dc->used > (int64_t)nfs->diskcache_size &&
+	    dc->used > dc->next_scan) {
+		nfs_dc_scan(dc, nfs->diskcache_size, 1);
+	}
+}
+
+#else /* NFS_DISKCACHE */
+
+int
+nfs_set_diskcache(struct nfs_context *nfs, const char *dir,
+                  uint64_t max_bytes _U_)
+{
+	if (dir == NULL) {
+		return 0;
+	}
+	nfs_set_error(nfs, "The disk cache is not supported on this "
+		      "platform");
+	return -1;
+}
+
+void
+nfs_diskcache_set_size(struct nfs_context *nfs, uint64_t max_bytes)
+{
+	nfs->diskcache_size = max_bytes;
+}
+
+void
+nfs_diskcache_free(struct nfs_context *nfs _U_)
+{
+}
+
+void
+nfs_diskcache_attach(struct nfs_context *nfs _U_,
+                     struct nfs_inode *inode _U_)
+{
+}
+
+void
+nfs_diskcache_detach(struct nfs_context *nfs _U_,
+                     struct nfs_inode *inode _U_)
+{
+}
+
+void
+nfs_diskcache_invalidate(struct nfs_context *nfs _U_,
+                         struct nfs_inode *inode _U_)
+{
+}
+
+int
+nfs_diskcache_cached(struct nfs_inode *inode _U_, uint64_t offset _U_)
+{
+	return 0;
+}
+
+int
+nfs_diskcache_get(struct nfs_context *nfs _U_, struct nfs_inode *inode _U_,
+                  uint64_t offset _U_, char *buf _U_)
+{
+	return -1;
+}
+
+void
+nfs_diskcache_put(struct nfs_context *nfs _U_, struct nfs_inode *inode _U_,
+                  uint64_t offset _U_, const char *buf _U_,
+                  size_t len _U_)
+{
+}
+
+#endif /* NFS_DISKCACHE */
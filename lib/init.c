@@ -159,10 +159,9 @@ void rpc_set_readahead(struct rpc_context *rpc, uint32_t v)
 	}
 	RPC_LOG(rpc, 2, "readahead set to %d byte", v);
 	rpc->readahead = v;
-	min_pagecache = (2 * v) / NFS_BLKSIZE;
+	min_pagecache = v / NFS_BLKSIZE;
 	if (rpc->pagecache < min_pagecache) {
-		/* current pagecache implementation needs a pagecache bigger
-		 * than the readahead size to avoid collisions */
+		/* we need room in the pagecache for the readahead data */
 		rpc_set_pagecache(rpc, min_pagecache);
 	}
 }
@@ -590,6 +590,90 @@ nfs_pwrite(struct nfs_context *nfs, struct nfsfh *nfsfh, uint64_t offset,
 	return cb_data.status;
 }
 
+/*
+ * preadv()
+ */
+int
+nfs_preadv(struct nfs_context *nfs, struct nfsfh *nfsfh,
+           const struct iovec *iov, int iovcnt, uint64_t offset)
+{
+	struct sync_cb_data cb_data;
+
+	cb_data.is_finished = 0;
+	cb_data.call = "preadv";
+
+	if (nfs_preadv_async(nfs, nfsfh, iov, iovcnt, offset, pwrite_cb,
+                             &cb_data) != 0) {
+		nfs_set_error(nfs, "nfs_preadv_async failed");
+		return -1;
+	}
+
+	wait_for_nfs_reply(nfs, &cb_data);
+
+	return cb_data.status;
+}
+
+/*
+ * pwritev()
+ */
+int
+nfs_pwritev(struct nfs_context *nfs, struct nfsfh *nfsfh,
+            const struct iovec *iov, int iovcnt, uint64_t offset)
+{
+	struct sync_cb_data cb_data;
+
+	cb_data.is_finished = 0;
+	cb_data.call = "pwritev";
+
+	if (nfs_pwritev_async(nfs, nfsfh, iov, iovcnt, offset, pwrite_cb,
+                              &cb_data) != 0) {
+		nfs_set_error(nfs, "nfs_pwritev_async failed");
+		return -1;
+	}
+
+	wait_for_nfs_reply(nfs, &cb_data);
+
+	return cb_data.status;
+}
+
+/*
+ * ioq_wait()
+ */
+int
+nfs_ioq_wait(struct nfs_ioq *q, struct nfs_io_completion *comps,
+             int min, int max)
+{
+	struct nfs_context *nfs = q->nfs;
+	struct pollfd pfd;
+	int revents;
+	int ret;
+
+	if (min > max) {
+		min = max;
+	}
+	while (q->count < min && q->inflight > 0) {
+		pfd.fd = nfs_get_fd(nfs);
+		pfd.events = nfs_which_events(nfs);
+		pfd.revents = 0;
+
+		ret = poll(&pfd, 1, 100);
+		if (ret < 0) {
+			nfs_set_error(nfs, "Poll failed");
+			revents = -1;
+		} else {
+			revents = pfd.revents;
+		}
+
+		if (nfs_service(nfs, revents) < 0) {
+			if (revents != -1)
+				nfs_set_error(nfs, "nfs_service failed");
+			return -EIO;
+		}
+	}
+
+	return nfs_ioq_reap(q, comps, max);
+}
+
 /*
  * write()
  */
@@ -977,6 +1061,64 @@ nfs_opendir(struct nfs_context *nfs, const char *path, struct nfsdir **nfsdir)
 	return cb_data.status;
 }
 
+int
+nfs_opendir_stream(struct nfs_context *nfs, const char *path,
+                   uint64_t cookie, struct nfsdir **nfsdir)
+{
+	struct sync_cb_data cb_data;
+
+	cb_data.is_finished = 0;
+	cb_data.return_data = nfsdir;
+
+	if (nfs_opendir_stream_async(nfs, path, cookie, opendir_cb,
+                                     &cb_data) != 0) {
+		nfs_set_error(nfs, "nfs_opendir_stream_async failed");
+		return -1;
+	}
+
+	wait_for_nfs_reply(nfs, &cb_data);
+
+	return cb_data.status;
+}
+
+
+/*
+ * readdir_next_page()
+ */
+static void
+readdir_next_page_cb(int status, struct nfs_context *nfs, void *data,
+                     void *private_data)
+{
+	struct sync_cb_data *cb_data = private_data;
+
+	cb_data->is_finished = 1;
+	cb_data->status = status;
+
+	if (status < 0) {
+		nfs_set_error(nfs, "readdir_next_page call failed with \"%s\"",
+                              (char *)data);
+		return;
+	}
+}
+
+int
+nfs_readdir_next_page(struct nfs_context *nfs, struct nfsdir *nfsdir)
+{
+	struct sync_cb_data cb_data;
+
+	cb_data.is_finished = 0;
+
+	if (nfs_readdir_next_page_async(nfs, nfsdir, readdir_next_page_cb,
+                                        &cb_data) != 0) {
+		nfs_set_error(nfs, "nfs_readdir_next_page_async failed");
+		return -1;
+	}
+
+	wait_for_nfs_reply(nfs, &cb_data);
+
+	return cb_data.status;
+}
+
 
 /*
  * lseek()
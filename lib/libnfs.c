@@ -77,128 +77,1551 @@
 #include "libnfs-raw-portmap.h"
 #include "libnfs-private.h"
 
+static uint32_t
+nfs_hash_fh(struct nfs_fh *fh)
+{
+	uint32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < fh->len; i++) {
+		h = (h ^ (unsigned char)fh->val[i]) * 16777619U;
+	}
+	return h;
+}
+
+static void
+nfs_free_nfsdir_names(struct nfsdir_name *dname)
+{
+	while (dname) {
+		struct nfsdir_name *next = dname->next;
+
+		free(dname->fh.val);
+		free(dname);
+		dname = next;
+	}
+}
+
 void
-nfs_free_nfsdir(struct nfsdir *nfsdir)
+nfs_dirbuf_free(struct nfs_dirbuf *buf)
+{
+	free(buf->dirents);
+	free(buf->strings);
+	memset(buf, 0, sizeof(struct nfs_dirbuf));
+}
+
+/*
+ * Add an entry to a listing that is being read. The entry is only valid
+ * until the next one is added.
+ */
+struct nfsdirent *
+nfs_dirbuf_add(struct nfs_dirbuf *buf, const char *fname, uint64_t inode)
+{
+	struct nfsdirent *dirent;
+	size_t len = strlen(fname) + 1;
+
+	if (buf->count == buf->max) {
+		uint32_t max = buf->max ? buf->max * 2 : 64;
+
+		dirent = realloc(buf->dirents, max * sizeof(struct nfsdirent));
+		if (dirent == NULL) {
+			return NULL;
+		}
+		buf->dirents = dirent;
+		buf->max = max;
+	}
+	if (buf->len + len > buf->size) {
+		size_t size = buf->size ? buf->size : 1024;
+		char *strings;
+
+		while (buf->len + len > size) {
+			size *= 2;
+		}
+		strings = realloc(buf->strings, size);
+		if (strings == NULL) {
+			return NULL;
+		}
+		buf->strings = strings;
+		buf->size = size;
+	}
+	memcpy(buf->strings + buf->len, fname, len);
+	buf->len += len;
+
+	dirent = &buf->dirents[buf->count++];
+	memset(dirent, 0, sizeof(struct nfsdirent));
+	dirent->inode = inode;
+	return dirent;
+}
+
+/*
+ * All entries are in, give back the unused space and point the entries at
+ * their names and at each other. The names are in the buffer in the same
+ * order as the entries.
+ */
+void
+nfs_dirbuf_finish(struct nfs_dirbuf *buf)
 {
-	while (nfsdir->entries) {
-		struct nfsdirent *dirent = nfsdir->entries->next;
-		if (nfsdir->entries->name != NULL) {
-			free(nfsdir->entries->name);
+	char *fname;
+	uint32_t i;
+
+	if (buf->count == 0) {
+		nfs_dirbuf_free(buf);
+		return;
+	}
+	if (buf->count < buf->max) {
+		struct nfsdirent *dirents;
+
+		dirents = realloc(buf->dirents,
+                                  buf->count * sizeof(struct nfsdirent));
+		if (dirents != NULL) {
+			buf->dirents = dirents;
+			buf->max = buf->count;
 		}
-		free(nfsdir->entries);
-		nfsdir->entries = dirent;
 	}
+	if (buf->len < buf->size) {
+		char *strings = realloc(buf->strings, buf->len);
+
+		if (strings != NULL) {
+			buf->strings = strings;
+			buf->size = buf->len;
+		}
+	}
+
+	fname = buf->strings;
+	for (i = 0; i < buf->count; i++) {
+		buf->dirents[i].name = fname;
+		buf->dirents[i].next = i + 1 < buf->count ?
+			&buf->dirents[i + 1] : NULL;
+		fname += strlen(fname) + 1;
+	}
+}
+
+void
+nfs_free_nfsdir(struct nfsdir *nfsdir)
+{
+	uint32_t i;
+
+	nfs_dirbuf_free(&nfsdir->buf);
+	nfs_free_nfsdir_names(nfsdir->names);
+	for (i = 0; i < nfsdir->names_hashes; i++) {
+		nfs_free_nfsdir_names(nfsdir->names_index[i]);
+	}
+	free(nfsdir->names_index);
 	free(nfsdir->fh.val);
 	free(nfsdir);
 }
 
+static uint32_t
+nfs_dircache_name_hash(const char *fname)
+{
+	uint32_t h = 2166136261U;
+
+	while (*fname) {
+		h = (h ^ (unsigned char)*fname++) * 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Remember the handle of an entry while a directory is read so that its
+ * listing can answer lookups once it is in the dircache. fh is NULL if
+ * the server did not return it.
+ */
 void
-nfs_dircache_add(struct nfs_context *nfs, struct nfsdir *nfsdir)
+nfs_dircache_add_name(struct nfs_context *nfs, struct nfsdir *nfsdir,
+                      uint32_t index, struct nfs_fh *fh)
 {
-	int i = 0;
-	LIBNFS_LIST_ADD(&nfs->dircache, nfsdir);
+	struct nfsdir_name *dname;
 
-	for (nfsdir = nfs->dircache; nfsdir; nfsdir = nfsdir->next, i++) {
-		if (i > MAX_DIR_CACHE) {
-			LIBNFS_LIST_REMOVE(&nfs->dircache, nfsdir);
-			nfs_free_nfsdir(nfsdir);
-			break;
+	if (!nfs->dircache_enabled) {
+		return;
+	}
+	dname = malloc(sizeof(struct nfsdir_name));
+	if (dname == NULL) {
+		return;
+	}
+	memset(dname, 0, sizeof(struct nfsdir_name));
+	if (fh) {
+		dname->fh.val = malloc(fh->len);
+		if (dname->fh.val == NULL) {
+			free(dname);
+			return;
 		}
+		dname->fh.len = fh->len;
+		memcpy(dname->fh.val, fh->val, fh->len);
 	}
+	dname->index = index;
+	LIBNFS_LIST_ADD(&nfsdir->names, dname);
+	nfsdir->num_names++;
 }
 
-struct nfsdir *
-nfs_dircache_find(struct nfs_context *nfs, struct nfs_fh *fh)
+/*
+ * Count the entries and memory of a listing and hash its names. Only a
+ * listing that has a name for every entry can say that a name does not
+ * exist, for the others the names are thrown away.
+ */
+static void
+nfs_dircache_index(struct nfsdir *nfsdir)
+{
+	struct nfsdir_name *dname;
+	uint32_t hashes = 16;
+
+	nfsdir->num_entries = nfsdir->buf.count;
+	nfsdir->size = sizeof(struct nfsdir) + nfsdir->fh.len +
+		nfsdir->buf.max * sizeof(struct nfsdirent) + nfsdir->buf.size;
+
+	if (nfsdir->names_index == NULL &&
+	    nfsdir->num_names == nfsdir->num_entries) {
+		while (hashes < nfsdir->num_names) {
+			hashes <<= 1;
+		}
+		nfsdir->names_index = calloc(hashes,
+                                             sizeof(struct nfsdir_name *));
+		if (nfsdir->names_index != NULL) {
+			nfsdir->names_hashes = hashes;
+		}
+	}
+	if (nfsdir->names_index == NULL) {
+		nfs_free_nfsdir_names(nfsdir->names);
+		nfsdir->names = NULL;
+		nfsdir->num_names = 0;
+		return;
+	}
+
+	while ((dname = nfsdir->names) != NULL) {
+		LIBNFS_LIST_REMOVE(&nfsdir->names, dname);
+		dname->hash = nfs_dircache_name_hash(
+			nfsdir->entries[dname->index].name);
+		LIBNFS_LIST_ADD(&nfsdir->names_index[dname->hash %
+                                                     nfsdir->names_hashes],
+                                dname);
+	}
+	nfsdir->size += nfsdir->names_hashes * sizeof(struct nfsdir_name *) +
+		nfsdir->num_names * sizeof(struct nfsdir_name);
+}
+
+/* the listing is about to go away, stop prefetching from it */
+static void
+nfs_dirscan_forget(struct nfs_context *nfs, struct nfsdir *nfsdir)
+{
+	if (nfs->dirscan.dir == nfsdir) {
+		memset(&nfs->dirscan, 0, sizeof(struct nfs_dirscan));
+	}
+}
+
+static void
+nfs_dircache_unlink(struct nfs_context *nfs, struct nfsdir *nfsdir)
+{
+	nfs_dirscan_forget(nfs, nfsdir);
+	LIBNFS_LIST_REMOVE(&nfs->dircache[nfsdir->hash % NFS_DIRCACHE_HASHES],
+                           nfsdir);
+	if (nfsdir->lru_prev) {
+		nfsdir->lru_prev->lru_next = nfsdir->lru_next;
+	} else {
+		nfs->dircache_mru = nfsdir->lru_next;
+	}
+	if (nfsdir->lru_next) {
+		nfsdir->lru_next->lru_prev = nfsdir->lru_prev;
+	} else {
+		nfs->dircache_lru = nfsdir->lru_prev;
+	}
+	nfsdir->lru_prev = NULL;
+	nfsdir->lru_next = NULL;
+	nfs->dircache_entries -= nfsdir->num_entries;
+	nfs->dircache_bytes -= nfsdir->size;
+}
+
+static void
+nfs_dircache_touch(struct nfs_context *nfs, struct nfsdir *nfsdir)
+{
+	if (nfs->dircache_mru == nfsdir) {
+		return;
+	}
+	/* unlink from the lru list and put it back at the head */
+	nfsdir->lru_prev->lru_next = nfsdir->lru_next;
+	if (nfsdir->lru_next) {
+		nfsdir->lru_next->lru_prev = nfsdir->lru_prev;
+	} else {
+		nfs->dircache_lru = nfsdir->lru_prev;
+	}
+	nfsdir->lru_prev = NULL;
+	nfsdir->lru_next = nfs->dircache_mru;
+	nfs->dircache_mru->lru_prev = nfsdir;
+	nfs->dircache_mru = nfsdir;
+}
+
+static struct nfsdir *
+nfs_dircache_get(struct nfs_context *nfs, struct nfs_fh *fh)
 {
 	struct nfsdir *nfsdir;
+	uint32_t hash;
 
-	for (nfsdir = nfs->dircache; nfsdir; nfsdir = nfsdir->next) {
-		if (nfsdir->fh.len == fh->len &&
+	if (nfs->dircache_mru == NULL) {
+		return NULL;
+	}
+	hash = nfs_hash_fh(fh);
+	for (nfsdir = nfs->dircache[hash % NFS_DIRCACHE_HASHES];
+	     nfsdir;
+	     nfsdir = nfsdir->next) {
+		if (nfsdir->hash == hash &&
+		    nfsdir->fh.len == fh->len &&
 		    !memcmp(nfsdir->fh.val, fh->val, fh->len)) {
-			LIBNFS_LIST_REMOVE(&nfs->dircache, nfsdir);
 			return nfsdir;
 		}
 	}
+	return NULL;
+}
+
+void
+nfs_dircache_add(struct nfs_context *nfs, struct nfsdir *nfsdir)
+{
+	struct nfsdir *old;
+
+	nfs_dircache_index(nfsdir);
+	if (nfsdir->num_entries > nfs->dircache_max_entries ||
+	    nfsdir->size > nfs->dircache_max_bytes) {
+		nfs_dirscan_forget(nfs, nfsdir);
+		nfs_free_nfsdir(nfsdir);
+		return;
+	}
+
+	/* the directory may have been read again while it was open */
+	old = nfs_dircache_get(nfs, &nfsdir->fh);
+	if (old) {
+		nfs_dircache_unlink(nfs, old);
+		nfs_free_nfsdir(old);
+	}
+
+	while (nfs->dircache_lru &&
+	       (nfs->dircache_entries + nfsdir->num_entries >
+                nfs->dircache_max_entries ||
+		nfs->dircache_bytes + nfsdir->size > nfs->dircache_max_bytes)) {
+		old = nfs->dircache_lru;
+		nfs_dircache_unlink(nfs, old);
+		nfs_free_nfsdir(old);
+	}
+
+	nfsdir->hash = nfs_hash_fh(&nfsdir->fh);
+	LIBNFS_LIST_ADD(&nfs->dircache[nfsdir->hash % NFS_DIRCACHE_HASHES],
+                        nfsdir);
+	nfsdir->lru_prev = NULL;
+	nfsdir->lru_next = nfs->dircache_mru;
+	if (nfs->dircache_mru) {
+		nfs->dircache_mru->lru_prev = nfsdir;
+	} else {
+		nfs->dircache_lru = nfsdir;
+	}
+	nfs->dircache_mru = nfsdir;
+	nfs->dircache_entries += nfsdir->num_entries;
+	nfs->dircache_bytes += nfsdir->size;
+}
+
+/* takes the directory out of the cache, the caller now owns it */
+struct nfsdir *
+nfs_dircache_find(struct nfs_context *nfs, struct nfs_fh *fh)
+{
+	struct nfsdir *nfsdir;
+
+	nfsdir = nfs_dircache_get(nfs, fh);
+	if (nfsdir) {
+		nfs_dircache_unlink(nfs, nfsdir);
+	}
+	return nfsdir;
+}
+
+/*
+ * Look up fname in the cached listing of dir. The listing is only used
+ * while the directory still has the mtime it had when it was read.
+ * dir_attr are the attributes of dir the caller has, if any, the
+ * attribute cache is used when it knows them. A name that exists is only
+ * answered if the attribute cache has its attributes, the ones we got
+ * with the listing can be much older than that. A name that is missing
+ * is only answered if the negative lookup cache is enabled and the
+ * listing is not older than negative_ttl, the mtime of the directory
+ * alone does not catch names created by other clients within the
+ * granularity of the server's timestamps.
+ * Returns 1 and sets fh and attr if the name exists, 0 if it does not
+ * exist and -1 if the cache can not tell. fh->val points into the cache
+ * and must be copied before the cache is used again.
+ */
+int
+nfs_dircache_lookup(struct nfs_context *nfs, struct nfs_fh *dir,
+                    struct nfs_attr *dir_attr, const char *fname,
+                    struct nfs_fh *fh, struct nfs_attr *attr)
+{
+	struct nfsdir *nfsdir;
+	struct nfsdir_name *dname;
+	struct nfs_attr *acattr;
+	uint32_t hash;
+
+	nfsdir = nfs_dircache_get(nfs, dir);
+	if (nfsdir == NULL || nfsdir->names_index == NULL) {
+		return -1;
+	}
+	acattr = nfs_attrcache_find(nfs, dir);
+	if (acattr) {
+		dir_attr = acattr;
+	}
+	if (dir_attr == NULL) {
+		return -1;
+	}
+	if (dir_attr->mtime.seconds != nfsdir->attr.mtime.seconds ||
+	    dir_attr->mtime.nseconds != nfsdir->attr.mtime.nseconds) {
+		/* cache must be stale */
+		nfs_dircache_unlink(nfs, nfsdir);
+		nfs_free_nfsdir(nfsdir);
+		return -1;
+	}
+	nfs_dircache_touch(nfs, nfsdir);
+
+	hash = nfs_dircache_name_hash(fname);
+	for (dname = nfsdir->names_index[hash % nfsdir->names_hashes];
+	     dname;
+	     dname = dname->next) {
+		if (dname->hash == hash &&
+		    !strcmp(nfsdir->entries[dname->index].name, fname)) {
+			break;
+		}
+	}
+	if (dname == NULL) {
+		if (nfs->negative_ttl == 0 ||
+		    nfsdir->read_time + (uint64_t)nfs->negative_ttl * 1000 <=
+		    rpc_current_time()) {
+			return -1;
+		}
+		return 0;
+	}
+	if (dname->fh.len == 0) {
+		return -1;
+	}
+	acattr = nfs_attrcache_find(nfs, &dname->fh);
+	if (acattr == NULL) {
+		return -1;
+	}
+	*fh = dname->fh;
+	*attr = *acattr;
+	return 1;
+}
+
+void
+nfs_dircache_drop(struct nfs_context *nfs, struct nfs_fh *fh)
+{
+	struct nfsdir *cached;
+
+	cached = nfs_dircache_find(nfs, fh);
+	if (cached) {
+		nfs_free_nfsdir(cached);
+	}
+	/* the directory has changed, so have its attributes */
+	nfs_attrcache_drop(nfs, fh);
+}
+
+void
+nfs_dircache_free_all(struct nfs_context *nfs)
+{
+	while (nfs->dircache_mru) {
+		struct nfsdir *nfsdir = nfs->dircache_mru;
+
+		nfs_dircache_unlink(nfs, nfsdir);
+		nfs_free_nfsdir(nfsdir);
+	}
+}
+
+static uint32_t
+nfs_dentry_hash(struct nfs_fh *dir, const char *fname)
+{
+	uint32_t h = nfs_hash_fh(dir);
+
+	while (*fname) {
+		h = (h ^ (unsigned char)*fname++) * 16777619U;
+	}
+	return h;
+}
 
+static void
+nfs_dentry_free(struct nfs_context *nfs, struct nfs_dentry *dentry)
+{
+	LIBNFS_LIST_REMOVE(&nfs->dentries[dentry->hash % NFS_DENTRY_HASHES],
+                           dentry);
+	nfs->num_dentries--;
+	free(dentry->dir.val);
+	free(dentry->name);
+	free(dentry->fh.val);
+	free(dentry);
+}
+
+static struct nfs_dentry *
+nfs_dentry_lookup(struct nfs_context *nfs, struct nfs_fh *dir,
+                  const char *fname, uint32_t hash)
+{
+	struct nfs_dentry *dentry;
+
+	for (dentry = nfs->dentries[hash % NFS_DENTRY_HASHES]; dentry;
+	     dentry = dentry->next) {
+		if (dentry->hash == hash && dentry->dir.len == dir->len &&
+		    !memcmp(dentry->dir.val, dir->val, dir->len) &&
+		    !strcmp(dentry->name, fname)) {
+			return dentry;
+		}
+	}
 	return NULL;
 }
 
+/*
+ * Look up fname in the directory dir in the fname lookup cache. Returns
+ * NULL if it is not cached or the entry has expired.
+ */
+struct nfs_dentry *
+nfs_dentry_find(struct nfs_context *nfs, struct nfs_fh *dir,
+                const char *fname)
+{
+	struct nfs_dentry *dentry;
+
+	if (nfs->num_dentries == 0) {
+		return NULL;
+	}
+	dentry = nfs_dentry_lookup(nfs, dir, fname,
+                                   nfs_dentry_hash(dir, fname));
+	if (dentry && dentry->expires <= rpc_current_time()) {
+		nfs_dentry_free(nfs, dentry);
+		return NULL;
+	}
+	return dentry;
+}
+
+void
+nfs_dentry_drop(struct nfs_context *nfs, struct nfs_fh *dir,
+                const char *fname)
+{
+	struct nfs_dentry *dentry;
+
+	if (nfs->num_dentries == 0) {
+		return;
+	}
+	dentry = nfs_dentry_lookup(nfs, dir, fname,
+                                   nfs_dentry_hash(dir, fname));
+	if (dentry) {
+		nfs_dentry_free(nfs, dentry);
+	}
+}
+
+static void
+nfs_dentry_insert(struct nfs_context *nfs, struct nfs_fh *dir,
+                  const char *fname, struct nfs_fh *fh,
+                  struct nfs_attr *attr, uint32_t ttl)
+{
+	uint32_t hash = nfs_dentry_hash(dir, fname);
+	struct nfs_dentry *dentry;
+
+	dentry = nfs_dentry_lookup(nfs, dir, fname, hash);
+	if (dentry) {
+		nfs_dentry_free(nfs, dentry);
+	}
+	if (ttl == 0) {
+		return;
+	}
+
+	/* make room by dropping a whole hash chain, starting with the one
+	 * after the chain we dropped last time */
+	while (nfs->num_dentries >= NFS_DENTRY_MAX) {
+		nfs->dentry_evict = (nfs->dentry_evict + 1) % NFS_DENTRY_HASHES;
+		while (nfs->dentries[nfs->dentry_evict]) {
+			nfs_dentry_free(nfs, nfs->dentries[nfs->dentry_evict]);
+		}
+	}
+
+	dentry = malloc(sizeof(struct nfs_dentry));
+	if (dentry == NULL) {
+		return;
+	}
+	memset(dentry, 0, sizeof(struct nfs_dentry));
+	dentry->dir.val = malloc(dir->len);
+	dentry->fh.val = fh ? malloc(fh->len) : NULL;
+	dentry->name = strdup(fname);
+	if (dentry->dir.val == NULL || (fh && dentry->fh.val == NULL) ||
+	    dentry->name == NULL) {
+		free(dentry->dir.val);
+		free(dentry->fh.val);
+		free(dentry->name);
+		free(dentry);
+		return;
+	}
+	dentry->dir.len = dir->len;
+	memcpy(dentry->dir.val, dir->val, dir->len);
+	if (fh) {
+		dentry->fh.len = fh->len;
+		memcpy(dentry->fh.val, fh->val, fh->len);
+	} else {
+		dentry->negative = 1;
+	}
+	dentry->attr = *attr;
+	dentry->hash = hash;
+	dentry->expires = rpc_current_time() + (uint64_t)ttl * 1000;
+	LIBNFS_LIST_ADD(&nfs->dentries[hash % NFS_DENTRY_HASHES], dentry);
+	nfs->num_dentries++;
+}
+
+/*
+ * Add what a LOOKUP, or an operation that creates a fname, told us about
+ * fname in dir to the cache.
+ */
+void
+nfs_dentry_add(struct nfs_context *nfs, struct nfs_fh *dir,
+               const char *fname, struct nfs_fh *fh, struct nfs_attr *attr)
+{
+	nfs_dentry_insert(nfs, dir, fname, fh, attr,
+                          attr->type == NF3DIR ? nfs->dentry_dir_ttl :
+                                                 nfs->dentry_ttl);
+}
+
+/*
+ * Remember that fname does not exist in dir. dir_attr are the attributes
+ * of dir at the time, the entry is only used for as long as dir still
+ * has the same mtime and ctime.
+ */
+void
+nfs_dentry_add_negative(struct nfs_context *nfs, struct nfs_fh *dir,
+                        const char *fname, struct nfs_attr *dir_attr)
+{
+	nfs_dentry_insert(nfs, dir, fname, NULL, dir_attr, nfs->negative_ttl);
+}
+
+void
+nfs_dentry_free_all(struct nfs_context *nfs)
+{
+	int i;
+
+	for (i = 0; i < NFS_DENTRY_HASHES; i++) {
+		while (nfs->dentries[i]) {
+			nfs_dentry_free(nfs, nfs->dentries[i]);
+		}
+	}
+}
+
+static void
+nfs_access_entry_free(struct nfs_access_entry *ae)
+{
+	free(ae->cred_body);
+	free(ae);
+}
+
+static void
+nfs_access_cache_free(struct nfs_acentry *ac)
+{
+	struct nfs_access_entry *ae;
+
+	while ((ae = ac->access) != NULL) {
+		ac->access = ae->next;
+		nfs_access_entry_free(ae);
+	}
+}
+
+static void
+nfs_attrcache_free(struct nfs_context *nfs, struct nfs_acentry *ac)
+{
+	LIBNFS_LIST_REMOVE(&nfs->acentries[ac->hash % NFS_ATTRCACHE_HASHES],
+                           ac);
+	nfs->num_acentries--;
+	nfs_access_cache_free(ac);
+	free(ac->fh.val);
+	free(ac);
+}
+
+static struct nfs_acentry *
+nfs_attrcache_lookup(struct nfs_context *nfs, struct nfs_fh *fh,
+                     uint32_t hash)
+{
+	struct nfs_acentry *ac;
+
+	for (ac = nfs->acentries[hash % NFS_ATTRCACHE_HASHES]; ac;
+	     ac = ac->next) {
+		if (ac->hash == hash && ac->fh.len == fh->len &&
+		    !memcmp(ac->fh.val, fh->val, fh->len)) {
+			return ac;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Returns the cached attributes of fh, or NULL if we have none that are
+ * recent enough to be used.
+ */
+struct nfs_attr *
+nfs_attrcache_find(struct nfs_context *nfs, struct nfs_fh *fh)
+{
+	struct nfs_acentry *ac;
+
+	if (nfs->num_acentries == 0) {
+		return NULL;
+	}
+	ac = nfs_attrcache_lookup(nfs, fh, nfs_hash_fh(fh));
+	if (ac == NULL || ac->expires <= rpc_current_time()) {
+		return NULL;
+	}
+	return &ac->attr;
+}
+
+/*
+ * Store attributes the server returned for fh. Like the kernel client we
+ * trust attributes that keep coming back unchanged for longer and longer,
+ * doubling the timeout each time up to acregmax/acdirmax, and go back to
+ * acregmin/acdirmin as soon as the file changes.
+ */
+void
+nfs_attrcache_update(struct nfs_context *nfs, struct nfs_fh *fh,
+                     struct nfs_attr *attr)
+{
+	uint32_t hash, acmin, acmax;
+	struct nfs_acentry *ac;
+
+	if (nfs->acregmax == 0 && nfs->acdirmax == 0) {
+		return;
+	}
+	if (attr->type == NF3DIR) {
+		acmin = nfs->acdirmin * 1000;
+		acmax = nfs->acdirmax * 1000;
+	} else {
+		acmin = nfs->acregmin * 1000;
+		acmax = nfs->acregmax * 1000;
+	}
+
+	hash = nfs_hash_fh(fh);
+	ac = nfs_attrcache_lookup(nfs, fh, hash);
+	if (ac == NULL) {
+		while (nfs->num_acentries >= NFS_ATTRCACHE_MAX) {
+			nfs->ac_evict = (nfs->ac_evict + 1) %
+                                NFS_ATTRCACHE_HASHES;
+			while (nfs->acentries[nfs->ac_evict]) {
+				nfs_attrcache_free(nfs,
+                                        nfs->acentries[nfs->ac_evict]);
+			}
+		}
+		ac = malloc(sizeof(struct nfs_acentry));
+		if (ac == NULL) {
+			return;
+		}
+		memset(ac, 0, sizeof(struct nfs_acentry));
+		ac->fh.val = malloc(fh->len);
+		if (ac->fh.val == NULL) {
+			free(ac);
+			return;
+		}
+		ac->fh.len = fh->len;
+		memcpy(ac->fh.val, fh->val, fh->len);
+		ac->hash = hash;
+		ac->timeo = acmin;
+		LIBNFS_LIST_ADD(&nfs->acentries[hash % NFS_ATTRCACHE_HASHES],
+                                ac);
+		nfs->num_acentries++;
+	} else if (ac->attr.size != attr->size ||
+		   ac->attr.mtime.seconds != attr->mtime.seconds ||
+		   ac->attr.mtime.nseconds != attr->mtime.nseconds ||
+		   ac->attr.ctime.seconds != attr->ctime.seconds ||
+		   ac->attr.ctime.nseconds != attr->ctime.nseconds) {
+		ac->timeo = acmin;
+	} else {
+		ac->timeo = ac->timeo ? ac->timeo * 2 : 1000;
+	}
+	/* what we may do with the file can only have changed if these did */
+	if (ac->attr.mode != attr->mode || ac->attr.uid != attr->uid ||
+	    ac->attr.gid != attr->gid ||
+	    ac->attr.ctime.seconds != attr->ctime.seconds ||
+	    ac->attr.ctime.nseconds != attr->ctime.nseconds) {
+		nfs_access_cache_free(ac);
+	}
+	if (ac->timeo < acmin) {
+		ac->timeo = acmin;
+	}
+	if (ac->timeo > acmax) {
+		ac->timeo = acmax;
+	}
+	ac->attr = *attr;
+	ac->expires = rpc_current_time() + ac->timeo;
+}
+
+void
+nfs_attrcache_drop(struct nfs_context *nfs, struct nfs_fh *fh)
+{
+	struct nfs_acentry *ac;
+
+	if (nfs->num_acentries == 0) {
+		return;
+	}
+	ac = nfs_attrcache_lookup(nfs, fh, nfs_hash_fh(fh));
+	if (ac) {
+		nfs_attrcache_free(nfs, ac);
+	}
+}
+
+/*
+ * The credential we send calls with. For AUTH_UNIX this covers the uid,
+ * gid and the list of auxiliary gids but not the timestamp, which
+ * changes every time the credential is recreated.
+ */
+struct nfs_access_cred {
+	uint32_t hash;
+	uint32_t flavor;
+	uint32_t len;
+	const char *body;
+};
+
+static void
+nfs_access_cred(struct nfs_context *nfs, struct nfs_access_cred *cred)
+{
+	struct AUTH *auth = nfs->rpc->auth;
+	uint32_t i, skip = 0;
+
+	memset(cred, 0, sizeof(struct nfs_access_cred));
+	cred->hash = 2166136261U;
+	if (auth == NULL) {
+		return;
+	}
+	if (auth->ah_cred.oa_flavor == AUTH_UNIX) {
+		skip = 4;
+	}
+	cred->flavor = auth->ah_cred.oa_flavor;
+	if (auth->ah_cred.oa_length > skip) {
+		cred->body = auth->ah_cred.oa_base + skip;
+		cred->len = auth->ah_cred.oa_length - skip;
+	}
+	cred->hash = (cred->hash ^ cred->flavor) * 16777619U;
+	for (i = 0; i < cred->len; i++) {
+		cred->hash = (cred->hash ^ (unsigned char)cred->body[i]) *
+			16777619U;
+	}
+}
+
+/* the hash only saves us the memcmp() for the other credentials */
+static int
+nfs_access_cred_match(struct nfs_access_entry *ae,
+                      struct nfs_access_cred *cred)
+{
+	return ae->cred == cred->hash && ae->cred_flavor == cred->flavor &&
+		ae->cred_len == cred->len &&
+		(cred->len == 0 ||
+		 !memcmp(ae->cred_body, cred->body, cred->len));
+}
+
+/*
+ * Look up the ACCESS3_* bits of mask in the ACCESS results cached for fh
+ * and the current credential. Returns 0 and the granted bits in access
+ * if all of mask is known.
+ */
+int
+nfs_access_cache_find(struct nfs_context *nfs, struct nfs_fh *fh,
+                      uint32_t mask, uint32_t *access)
+{
+	struct nfs_access_entry *ae;
+	struct nfs_access_cred cred;
+	struct nfs_acentry *ac;
+
+	if (nfs_attrcache_find(nfs, fh) == NULL) {
+		return -1;
+	}
+	ac = nfs_attrcache_lookup(nfs, fh, nfs_hash_fh(fh));
+	nfs_access_cred(nfs, &cred);
+	for (ae = ac->access; ae; ae = ae->next) {
+		if (nfs_access_cred_match(ae, &cred) &&
+		    (ae->mask & mask) == mask) {
+			*access = ae->access & mask;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Remember what an ACCESS call for mask returned. Only kept if we have
+ * current attributes for fh.
+ */
+void
+nfs_access_cache_add(struct nfs_context *nfs, struct nfs_fh *fh,
+                     uint32_t mask, uint32_t access)
+{
+	struct nfs_access_entry *ae, *last = NULL;
+	struct nfs_access_cred cred;
+	struct nfs_acentry *ac;
+	int count = 0;
+
+	if (nfs_attrcache_find(nfs, fh) == NULL) {
+		return;
+	}
+	ac = nfs_attrcache_lookup(nfs, fh, nfs_hash_fh(fh));
+	nfs_access_cred(nfs, &cred);
+	for (ae = ac->access; ae; ae = ae->next) {
+		if (nfs_access_cred_match(ae, &cred)) {
+			ae->access = (ae->access & ~mask) | (access & mask);
+			ae->mask |= mask;
+			return;
+		}
+		last = ae;
+		count++;
+	}
+	if (count >= NFS_ACCESS_MAX_CREDS) {
+		LIBNFS_LIST_REMOVE(&ac->access, last);
+		nfs_access_entry_free(last);
+	}
+
+	ae = malloc(sizeof(struct nfs_access_entry));
+	if (ae == NULL) {
+		return;
+	}
+	memset(ae, 0, sizeof(struct nfs_access_entry));
+	if (cred.len) {
+		ae->cred_body = malloc(cred.len);
+		if (ae->cred_body == NULL) {
+			free(ae);
+			return;
+		}
+		memcpy(ae->cred_body, cred.body, cred.len);
+	}
+	ae->cred = cred.hash;
+	ae->cred_flavor = cred.flavor;
+	ae->cred_len = cred.len;
+	ae->mask = mask;
+	ae->access = access & mask;
+	LIBNFS_LIST_ADD(&ac->access, ae);
+}
+
+void
+nfs_attrcache_free_all(struct nfs_context *nfs)
+{
+	int i;
+
+	for (i = 0; i < NFS_ATTRCACHE_HASHES; i++) {
+		while (nfs->acentries[i]) {
+			nfs_attrcache_free(nfs, nfs->acentries[i]);
+		}
+	}
+}
+
+static void
+nfs_linkcache_free(struct nfs_context *nfs, struct nfs_linkentry *link)
+{
+	LIBNFS_LIST_REMOVE(&nfs->links[link->hash % NFS_LINKCACHE_HASHES],
+                           link);
+	nfs->num_links--;
+	free(link->fh.val);
+	free(link->target);
+	free(link);
+}
+
+static struct nfs_linkentry *
+nfs_linkcache_lookup(struct nfs_context *nfs, struct nfs_fh *fh,
+                     uint32_t hash)
+{
+	struct nfs_linkentry *link;
+
+	for (link = nfs->links[hash % NFS_LINKCACHE_HASHES]; link;
+	     link = link->next) {
+		if (link->hash == hash && link->fh.len == fh->len &&
+		    !memcmp(link->fh.val, fh->val, fh->len)) {
+			return link;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Returns the cached target of the symlink fh, provided the symlink
+ * still has the mtime and ctime in attr, or NULL.
+ */
+const char *
+nfs_linkcache_find(struct nfs_context *nfs, struct nfs_fh *fh,
+                   struct nfs_attr *attr)
+{
+	struct nfs_linkentry *link;
+
+	if (nfs->num_links == 0 || attr == NULL) {
+		return NULL;
+	}
+	link = nfs_linkcache_lookup(nfs, fh, nfs_hash_fh(fh));
+	if (link == NULL) {
+		return NULL;
+	}
+	if (link->mtime.seconds != attr->mtime.seconds ||
+	    link->mtime.nseconds != attr->mtime.nseconds ||
+	    link->ctime.seconds != attr->ctime.seconds ||
+	    link->ctime.nseconds != attr->ctime.nseconds) {
+		nfs_linkcache_free(nfs, link);
+		return NULL;
+	}
+	return link->target;
+}
+
+void
+nfs_linkcache_add(struct nfs_context *nfs, struct nfs_fh *fh,
+                  struct nfs_attr *attr, const char *target)
+{
+	uint32_t hash = nfs_hash_fh(fh);
+	struct nfs_linkentry *link;
+
+	if (!nfs->linkcache_enabled) {
+		return;
+	}
+	link = nfs_linkcache_lookup(nfs, fh, hash);
+	if (link) {
+		nfs_linkcache_free(nfs, link);
+	}
+	while (nfs->num_links >= NFS_LINKCACHE_MAX) {
+		nfs->link_evict = (nfs->link_evict + 1) % NFS_LINKCACHE_HASHES;
+		while (nfs->links[nfs->link_evict]) {
+			nfs_linkcache_free(nfs, nfs->links[nfs->link_evict]);
+		}
+	}
+
+	link = malloc(sizeof(struct nfs_linkentry));
+	if (link == NULL) {
+		return;
+	}
+	memset(link, 0, sizeof(struct nfs_linkentry));
+	link->fh.val = malloc(fh->len);
+	link->target = strdup(target);
+	if (link->fh.val == NULL || link->target == NULL) {
+		free(link->fh.val);
+		free(link->target);
+		free(link);
+		return;
+	}
+	link->fh.len = fh->len;
+	memcpy(link->fh.val, fh->val, fh->len);
+	link->mtime = attr->mtime;
+	link->ctime = attr->ctime;
+	link->hash = hash;
+	LIBNFS_LIST_ADD(&nfs->links[hash % NFS_LINKCACHE_HASHES], link);
+	nfs->num_links++;
+}
+
+void
+nfs_linkcache_free_all(struct nfs_context *nfs)
+{
+	int i;
+
+	for (i = 0; i < NFS_LINKCACHE_HASHES; i++) {
+		while (nfs->links[i]) {
+			nfs_linkcache_free(nfs, nfs->links[i]);
+		}
+	}
+}
+
+struct nfs_inode *
+nfs_inode_find(struct nfs_context *nfs, struct nfs_fh *fh)
+{
+	struct nfs_inode *inode;
+	uint32_t hash = nfs_hash_fh(fh);
+
+	for (inode = nfs->inodes[hash % NFS_INODE_HASHES]; inode;
+	     inode = inode->next) {
+		if (inode->hash == hash && inode->fh.len == fh->len &&
+		    !memcmp(inode->fh.val, fh->val, fh->len)) {
+			return inode;
+		}
+	}
+	return NULL;
+}
+
+static void
+nfs_inode_free(struct nfs_context *nfs, struct nfs_inode *inode)
+{
+	LIBNFS_LIST_REMOVE(&nfs->inodes[inode->hash % NFS_INODE_HASHES], inode);
+	nfs_diskcache_detach(nfs, inode);
+	free(inode->fh.val);
+	free(inode);
+}
+
+/*
+ * Inodes stay around after the last close for as long as they still
+ * have pages in the pagecache.
+ */
+static void
+nfs_inode_maybe_free(struct nfs_context *nfs, struct nfs_inode *inode)
+{
+	if (inode->refcount == 0 && inode->pagecache_pages == 0) {
+		nfs_inode_free(nfs, inode);
+	}
+}
+
+struct nfs_inode *
+nfs_inode_get(struct nfs_context *nfs, struct nfs_fh *fh)
+{
+	struct nfs_inode *inode;
+
+	inode = nfs_inode_find(nfs, fh);
+	if (inode == NULL) {
+		inode = malloc(sizeof(struct nfs_inode));
+		if (inode == NULL) {
+			return NULL;
+		}
+		memset(inode, 0, sizeof(struct nfs_inode));
+		inode->fh.val = malloc(fh->len);
+		if (inode->fh.val == NULL) {
+			free(inode);
+			return NULL;
+		}
+		memcpy(inode->fh.val, fh->val, fh->len);
+		inode->fh.len = fh->len;
+		inode->hash = nfs_hash_fh(fh);
+		LIBNFS_LIST_ADD(&nfs->inodes[inode->hash % NFS_INODE_HASHES],
+                                inode);
+	}
+	if (inode->refcount++ == 0) {
+		nfs->pagecache.num_users++;
+	}
+	return inode;
+}
+
+void
+nfs_inode_put(struct nfs_context *nfs, struct nfs_inode *inode)
+{
+	if (--inode->refcount == 0) {
+		nfs->pagecache.num_users--;
+	}
+	nfs_inode_maybe_free(nfs, inode);
+}
+
+static void
+nfs_inode_invalidate(struct nfs_context *nfs, struct nfs_inode *inode);
+
+/* only size, mtime and ctime are compared */
+static int
+nfs_attr_changed(struct nfs_attr *a, struct nfs_attr *b)
+{
+	return a->size != b->size ||
+		a->mtime.seconds != b->mtime.seconds ||
+		a->mtime.nseconds != b->mtime.nseconds ||
+		a->ctime.seconds != b->ctime.seconds ||
+		a->ctime.nseconds != b->ctime.nseconds;
+}
+
+/*
+ * Check the change attributes from the server against what we saw the
+ * last time and drop all cached data for the file if it has changed.
+ */
+void
+nfs_inode_revalidate(struct nfs_context *nfs, struct nfs_inode *inode,
+                     struct nfs_attr *attr)
+{
+	if (attr == NULL) {
+		nfs_inode_invalidate(nfs, inode);
+		inode->has_attr = 0;
+	} else {
+		if (inode->has_attr && nfs_attr_changed(&inode->attr, attr)) {
+			RPC_LOG(nfs->rpc, 2, "file has changed on the server");
+			nfs_inode_invalidate(nfs, inode);
+		}
+		inode->attr = *attr;
+		inode->has_attr = 1;
+		inode->attr_ts = (time_t)(rpc_current_time() / 1000);
+		nfs_diskcache_attach(nfs, inode);
+	}
+	nfs_inode_maybe_free(nfs, inode);
+}
+
+/*
+ * Update the inode from the weak cache consistency data in the reply to
+ * one of our own modifying operations. If the file looked the way we
+ * expected it to just before the operation then the change was ours and
+ * the cached data is still good. Only size, mtime and ctime are set in
+ * before.
+ */
+void
+nfs_inode_update_wcc(struct nfs_context *nfs, struct nfs_inode *inode,
+                     struct nfs_attr *before, struct nfs_attr *after)
+{
+	if (before && after && inode->has_attr &&
+	    !nfs_attr_changed(&inode->attr, before)) {
+		inode->attr = *after;
+		inode->attr_ts = (time_t)(rpc_current_time() / 1000);
+		nfs_diskcache_attach(nfs, inode);
+		return;
+	}
+	/*
+	 * When we have several WRITEs in flight at once the replies can
+	 * arrive in a different order than the server executed them so
+	 * the pre-op attributes will not line up with what we have.
+	 * Assume the changes are ours and just keep the newest attributes.
+	 */
+	if (after && inode->has_attr && inode->write_overlap) {
+		if (after->ctime.seconds > inode->attr.ctime.seconds ||
+		    (after->ctime.seconds == inode->attr.ctime.seconds &&
+		     after->ctime.nseconds >= inode->attr.ctime.nseconds)) {
+			inode->attr = *after;
+			inode->attr_ts = (time_t)(rpc_current_time() / 1000);
+			nfs_diskcache_attach(nfs, inode);
+		}
+		return;
+	}
+	nfs_inode_revalidate(nfs, inode, after);
+}
+
+static uint32_t
+nfs_pagecache_hash(struct nfs_pagecache *pagecache, struct nfs_inode *inode,
+                   uint64_t offset)
+{
+	/* consecutive pages of a file go to consecutive sets */
+	return (inode->hash + (uint32_t)(offset / NFS_BLKSIZE)) &
+                (pagecache->num_sets - 1);
+}
+
+static int
+nfs_pagecache_valid(struct nfs_context *nfs, struct nfs_pagecache_entry *e,
+                    time_t now)
+{
+	if (!e->ts) {
+		return 0;
+	}
+	if (nfs->rpc->pagecache_ttl &&
+	    now - e->ts > (time_t)nfs->rpc->pagecache_ttl) {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Pages in the disk cache outlive the pagecache TTL, we only use them
+ * while the server has told us within the TTL that the file has not
+ * changed. Otherwise the READ we send instead brings fresh attributes.
+ */
+static int
+nfs_diskcache_usable(struct nfs_context *nfs, struct nfs_inode *inode,
+                     time_t now)
+{
+	if (inode->dc == NULL || !inode->has_attr) {
+		return 0;
+	}
+	if (nfs->rpc->pagecache_ttl &&
+	    now - inode->attr_ts > (time_t)nfs->rpc->pagecache_ttl) {
+		return 0;
+	}
+	return 1;
+}
+
+static void
+nfs_pagecache_drop(struct nfs_context *nfs, struct nfs_pagecache_entry *e)
+{
+	if (e->inode) {
+		e->inode->pagecache_pages--;
+		nfs_inode_maybe_free(nfs, e->inode);
+		e->inode = NULL;
+	}
+	if (e->buf) {
+		free(e->buf);
+		e->buf = NULL;
+		nfs->pagecache.num_pages--;
+	}
+	e->ts = 0;
+}
+
+void
+nfs_pagecache_free(struct nfs_context *nfs)
+{
+	struct nfs_pagecache *pagecache = &nfs->pagecache;
+	uint32_t i;
+
+	if (pagecache->entries == NULL) {
+		return;
+	}
+	for (i = 0; i < pagecache->num_sets * pagecache->num_ways; i++) {
+		nfs_pagecache_drop(nfs, &pagecache->entries[i]);
+	}
+	free(pagecache->entries);
+	pagecache->entries = NULL;
+	pagecache->num_sets = 0;
+	pagecache->num_ways = 0;
+}
+
+/*
+ * The set table is allocated on first use and reallocated if the size of
+ * the pagecache has been changed since.
+ */
+static int
+nfs_pagecache_setup(struct nfs_context *nfs)
+{
+	struct nfs_pagecache *pagecache = &nfs->pagecache;
+	uint32_t num_pages = nfs->rpc->pagecache;
+
+	if (pagecache->entries &&
+	    pagecache->num_sets * pagecache->num_ways == num_pages) {
+		return 0;
+	}
+
+	nfs_pagecache_free(nfs);
+	if (num_pages == 0) {
+		return -1;
+	}
+
+	pagecache->entries = malloc(sizeof(struct nfs_pagecache_entry) *
+                                    num_pages);
+	if (pagecache->entries == NULL) {
+		return -1;
+	}
+	memset(pagecache->entries, 0,
+               sizeof(struct nfs_pagecache_entry) * num_pages);
+	pagecache->num_ways = MIN(NFS_PAGECACHE_WAYS, num_pages);
+	pagecache->num_sets = num_pages / pagecache->num_ways;
+	RPC_LOG(nfs->rpc, 2, "init pagecache %d sets of %d pages of size %d",
+                pagecache->num_sets, pagecache->num_ways, NFS_BLKSIZE);
+
+	return 0;
+}
+
+static struct nfs_pagecache_entry *
+nfs_pagecache_set(struct nfs_pagecache *pagecache, struct nfs_inode *inode,
+                  uint64_t offset)
+{
+	return &pagecache->entries[nfs_pagecache_hash(pagecache, inode,
+                                                      offset) *
+                                   pagecache->num_ways];
+}
+
+static struct nfs_pagecache_entry *
+nfs_pagecache_find(struct nfs_pagecache *pagecache,
+                   struct nfs_pagecache_entry *set, struct nfs_inode *inode,
+                   uint64_t offset)
+{
+	uint32_t i;
+
+	for (i = 0; i < pagecache->num_ways; i++) {
+		if (set[i].inode == inode && set[i].offset == offset) {
+			return &set[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Pick a way in the set to store a new page in.
+ * Unused and expired ways are taken first. Otherwise we replace the least
+ * recently used page, but an open file that already holds its fair share
+ * of the cache may only replace its own pages or those of closed files.
+ */
+static struct nfs_pagecache_entry *
+nfs_pagecache_victim(struct nfs_context *nfs, struct nfs_pagecache_entry *set,
+                     struct nfs_inode *inode, time_t now)
+{
+	struct nfs_pagecache *pagecache = &nfs->pagecache;
+	struct nfs_pagecache_entry *victim = NULL;
+	uint32_t share, i;
+
+	share = (pagecache->num_sets * pagecache->num_ways) /
+                MAX(1, pagecache->num_users);
+
+	for (i = 0; i < pagecache->num_ways; i++) {
+		struct nfs_pagecache_entry *e = &set[i];
+
+		if (e->inode == NULL || !nfs_pagecache_valid(nfs, e, now)) {
+			victim = e;
+			break;
+		}
+		if (e->inode != inode && e->inode->refcount &&
+		    inode->pagecache_pages >= share) {
+			continue;
+		}
+		if (victim == NULL || e->lru < victim->lru) {
+			victim = e;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	if (victim->inode) {
+		if (nfs_pagecache_valid(nfs, victim, now)) {
+			pagecache->evictions++;
+		}
+		victim->inode->pagecache_pages--;
+		nfs_inode_maybe_free(nfs, victim->inode);
+		victim->inode = NULL;
+		victim->ts = 0;
+	}
+	if (victim->buf == NULL) {
+		victim->buf = malloc(NFS_BLKSIZE);
+		if (victim->buf == NULL) {
+			return NULL;
+		}
+		pagecache->num_pages++;
+	}
+	victim->inode = inode;
+	inode->pagecache_pages++;
+
+	return victim;
+}
+
+static void
+nfs_inode_invalidate(struct nfs_context *nfs, struct nfs_inode *inode)
+{
+	struct nfs_pagecache *pagecache = &nfs->pagecache;
+	uint32_t i;
+
+	inode->gen++;
+	nfs_diskcache_invalidate(nfs, inode);
+	if (pagecache->entries == NULL || inode->pagecache_pages == 0) {
+		return;
+	}
+	RPC_LOG(nfs->rpc, 2, "invalidating pagecache");
+
+	/* hold a reference so the inode is not freed under our feet.
+	 * The caller is responsible for freeing it if it is unused. */
+	inode->refcount++;
+	for (i = 0; i < pagecache->num_sets * pagecache->num_ways; i++) {
+		if (pagecache->entries[i].inode == inode) {
+			nfs_pagecache_drop(nfs, &pagecache->entries[i]);
+		}
+	}
+	inode->refcount--;
+}
+
 void
-nfs_dircache_drop(struct nfs_context *nfs, struct nfs_fh *fh)
+nfs_pagecache_init(struct nfs_context *nfs, struct nfsfh *nfsfh)
 {
-	struct nfsdir *cached;
-
-	cached = nfs_dircache_find(nfs, fh);
-	if (cached) {
-		nfs_free_nfsdir(cached);
+	if (!nfs->rpc->pagecache || nfsfh->inode) {
+		return;
 	}
+	nfsfh->inode = nfs_inode_get(nfs, &nfsfh->fh);
 }
 
-static uint32_t
-nfs_pagecache_hash(struct nfs_pagecache *pagecache, uint64_t offset) {
-	return (2654435761UL * (1 + ((uint32_t)(offset) / NFS_BLKSIZE))) &
-                (pagecache->num_entries - 1);
+void
+nfs_pagecache_release(struct nfs_context *nfs, struct nfsfh *nfsfh)
+{
+	if (nfsfh->inode == NULL) {
+		return;
+	}
+	nfs_inode_put(nfs, nfsfh->inode);
+	nfsfh->inode = NULL;
 }
 
 void
 nfs_pagecache_invalidate(struct nfs_context *nfs, struct nfsfh *nfsfh) {
-	if (nfsfh->pagecache.entries) {
-		RPC_LOG(nfs->rpc, 2, "invalidating pagecache");
-		memset(nfsfh->pagecache.entries, 0x00,
-                       sizeof(struct nfs_pagecache_entry) *
-                       nfsfh->pagecache.num_entries);
+	struct nfs_inode *inode = nfsfh->inode;
+
+	if (inode == NULL) {
+		inode = nfs_inode_find(nfs, &nfsfh->fh);
+	}
+	if (inode) {
+		nfs_inode_invalidate(nfs, inode);
+		nfs_inode_maybe_free(nfs, inode);
 	}
 }
 
-void
-nfs_pagecache_put(struct nfs_pagecache *pagecache, uint64_t offset,
-                  const char *buf, size_t len)
+static struct nfs_pagecache_entry *
+nfs_pagecache_fill(struct nfs_context *nfs, struct nfs_inode *inode,
+                   uint64_t offset, const char *buf, size_t len)
 {
-	time_t ts = pagecache->ttl ? (time_t)(rpc_current_time() / 1000) : 1;
-	if (!pagecache->num_entries) return;
+	struct nfs_pagecache *pagecache = &nfs->pagecache;
+	struct nfs_pagecache_entry *e = NULL;
+	time_t now = (time_t)(rpc_current_time() / 1000);
+
 	while (len > 0) {
 		uint64_t page_offset = offset & ~(NFS_BLKSIZE - 1);
-		uint32_t entry = nfs_pagecache_hash(pagecache, page_offset);
-		struct nfs_pagecache_entry *e = &pagecache->entries[entry];
+		struct nfs_pagecache_entry *set;
 		size_t n = MIN(NFS_BLKSIZE - offset % NFS_BLKSIZE, len);
 
+		set = nfs_pagecache_set(pagecache, inode, page_offset);
+		e = nfs_pagecache_find(pagecache, set, inode, page_offset);
+
 		/* we can only write to the cache if we add a full page or
 		 * partially update a page that is still valid */
-		if (n == NFS_BLKSIZE ||
-		    (e->ts && e->offset == page_offset &&
-		     (!pagecache->ttl || ts - e->ts <= pagecache->ttl))) {
-			e->ts = ts;
+		if (n < NFS_BLKSIZE &&
+		    (e == NULL || !nfs_pagecache_valid(nfs, e, now))) {
+			e = NULL;
+		} else if (e == NULL) {
+			e = nfs_pagecache_victim(nfs, set, inode, now);
+		}
+		if (e) {
+			e->ts = nfs->rpc->pagecache_ttl ? now : 1;
 			e->offset = page_offset;
+			e->lru = ++pagecache->lru_clock;
 			memcpy(e->buf + offset % NFS_BLKSIZE, buf, n);
 		}
 		buf += n;
 		offset += n;
 		len -= n;
 	}
+	return e;
 }
 
-char *
-nfs_pagecache_get(struct nfs_pagecache *pagecache, uint64_t offset)
+void
+nfs_pagecache_put(struct nfs_context *nfs, struct nfs_inode *inode,
+                  uint64_t offset, const char *buf, size_t len)
 {
-	uint32_t entry;
-	struct nfs_pagecache_entry *e;
+	if (inode == NULL || nfs_pagecache_setup(nfs) != 0) {
+		return;
+	}
+	nfs_pagecache_fill(nfs, inode, offset, buf, len);
+	nfs_diskcache_put(nfs, inode, offset, buf, len);
+}
 
-	entry = nfs_pagecache_hash(pagecache, offset);
-	e = &pagecache->entries[entry];
+/* like nfs_pagecache_get() but does not touch the LRU or the stats */
+int
+nfs_pagecache_cached(struct nfs_context *nfs, struct nfs_inode *inode,
+                     uint64_t offset)
+{
+	struct nfs_pagecache *pagecache = &nfs->pagecache;
+	struct nfs_pagecache_entry *set, *e;
 
-	if (offset != e->offset) {
-		return NULL;
+	if (inode == NULL) {
+		return 0;
 	}
-	if (!e->ts) {
-		return NULL;
+	if (nfs_diskcache_usable(nfs, inode,
+                                 (time_t)(rpc_current_time() / 1000)) &&
+	    nfs_diskcache_cached(inode, offset)) {
+		return 1;
+	}
+	if (pagecache->entries == NULL) {
+		return 0;
 	}
-	if (pagecache->ttl && (time_t)(rpc_current_time() / 1000) - e->ts > pagecache->ttl) {
+
+	set = nfs_pagecache_set(pagecache, inode, offset);
+	e = nfs_pagecache_find(pagecache, set, inode, offset);
+	return e != NULL &&
+		nfs_pagecache_valid(nfs, e, (time_t)(rpc_current_time() / 1000));
+}
+
+char *
+nfs_pagecache_get(struct nfs_context *nfs, struct nfs_inode *inode,
+                  uint64_t offset)
+{
+	struct nfs_pagecache *pagecache = &nfs->pagecache;
+	struct nfs_pagecache_entry *set, *e;
+
+	if (inode == NULL || nfs_pagecache_setup(nfs) != 0) {
 		return NULL;
 	}
 
+	set = nfs_pagecache_set(pagecache, inode, offset);
+	e = nfs_pagecache_find(pagecache, set, inode, offset);
+	if (e == NULL ||
+	    !nfs_pagecache_valid(nfs, e, (time_t)(rpc_current_time() / 1000))) {
+		char buf[NFS_BLKSIZE];
+
+		pagecache->misses++;
+		/* pull the page back in from the disk cache if it is there */
+		if (!nfs_diskcache_usable(nfs, inode,
+                                          (time_t)(rpc_current_time() / 1000)) ||
+		    nfs_diskcache_get(nfs, inode, offset, buf) != 0) {
+			return NULL;
+		}
+		e = nfs_pagecache_fill(nfs, inode, offset, buf, NFS_BLKSIZE);
+		return e ? e->buf : NULL;
+	}
+
+	pagecache->hits++;
+	e->lru = ++pagecache->lru_clock;
 	return e->buf;
 }
 
+void
+nfs_get_pagecache_stats(struct nfs_context *nfs,
+                        struct nfs_pagecache_stats *stats)
+{
+	memset(stats, 0, sizeof(struct nfs_pagecache_stats));
+	stats->hits      = nfs->pagecache.hits;
+	stats->misses    = nfs->pagecache.misses;
+	stats->evictions = nfs->pagecache.evictions;
+	stats->pages     = nfs->pagecache.num_pages;
+	stats->max_pages = nfs->rpc->pagecache;
+}
+
 void
 nfs_set_auth(struct nfs_context *nfs, struct AUTH *auth)
 {
@@ -226,7 +1649,13 @@ nfs_which_events(struct nfs_context *nfs)
 int
 nfs_service(struct nfs_context *nfs, int revents)
 {
-	return rpc_service(nfs->rpc, revents);
+	int ret;
+
+	ret = rpc_service(nfs->rpc, revents);
+	if (ret == 0 && nfs->writebacks) {
+		nfs3_writeback_scan(nfs);
+	}
+	return ret;
 }
 
 char *
@@ -256,12 +1685,64 @@ nfs_set_context_args(struct nfs_context *nfs, const char *arg, const char *val)
 		rpc_set_readahead(nfs_get_rpc_context(nfs), atoi(val));
 	} else if (!strcmp(arg, "pagecache")) {
 		rpc_set_pagecache(nfs_get_rpc_context(nfs), atoi(val));
+	} else if (!strcmp(arg, "prefetch_small")) {
+		nfs_set_prefetch_small(nfs, atoi(val));
+	} else if (!strcmp(arg, "dirscan_prefetch")) {
+		nfs_set_dirscan_prefetch(nfs, atoi(val));
+	} else if (!strcmp(arg, "writeback")) {
+		nfs_set_writeback(nfs, atoi(val));
+	} else if (!strcmp(arg, "pagecache_ttl")) {
+		rpc_set_pagecache_ttl(nfs_get_rpc_context(nfs), atoi(val));
 	} else if (!strcmp(arg, "debug")) {
 		rpc_set_debug(nfs_get_rpc_context(nfs), atoi(val));
 	} else if (!strcmp(arg, "auto-traverse-mounts")) {
 		nfs->auto_traverse_mounts = atoi(val);
 	} else if (!strcmp(arg, "dircache")) {
 		nfs_set_dircache(nfs, atoi(val));
+	} else if (!strcmp(arg, "dircache_entries")) {
+		nfs_set_dircache_size(nfs, atoi(val), nfs->dircache_max_bytes);
+	} else if (!strcmp(arg, "dircache_size")) {
+		nfs_set_dircache_size(nfs, nfs->dircache_max_entries,
+                                      (uint64_t)atoi(val) * 1024 * 1024);
+	} else if (!strcmp(arg, "readdir_dircount")) {
+		nfs_set_readdir(nfs, atoi(val), nfs->readdir_maxcount);
+	} else if (!strcmp(arg, "readdir_maxcount")) {
+		nfs_set_readdir(nfs, nfs->readdir_dircount, atoi(val));
+	} else if (!strcmp(arg, "readdir_names_only")) {
+		nfs_set_readdir_names_only(nfs, atoi(val));
+	} else if (!strcmp(arg, "readdir_lookups")) {
+		nfs_set_readdir_lookups(nfs, atoi(val));
+	} else if (!strcmp(arg, "linkcache")) {
+		nfs_set_linkcache(nfs, atoi(val));
+	} else if (!strcmp(arg, "dentry_ttl")) {
+		nfs_set_dentry_cache(nfs, atoi(val), nfs->dentry_dir_ttl);
+	} else if (!strcmp(arg, "dentry_dir_ttl")) {
+		nfs_set_dentry_cache(nfs, nfs->dentry_ttl, atoi(val));
+	} else if (!strcmp(arg, "negative_ttl")) {
+		nfs_set_negative_cache(nfs, atoi(val));
+	} else if (!strcmp(arg, "acregmin")) {
+		nfs_set_attr_cache(nfs, atoi(val), nfs->acregmax,
+                                   nfs->acdirmin, nfs->acdirmax);
+	} else if (!strcmp(arg, "acregmax")) {
+		nfs_set_attr_cache(nfs, nfs->acregmin, atoi(val),
+                                   nfs->acdirmin, nfs->acdirmax);
+	} else if (!strcmp(arg, "acdirmin")) {
+		nfs_set_attr_cache(nfs, nfs->acregmin, nfs->acregmax,
+                                   atoi(val), nfs->acdirmax);
+	} else if (!strcmp(arg, "acdirmax")) {
+		nfs_set_attr_cache(nfs, nfs->acregmin, nfs->acregmax,
+                                   nfs->acdirmin, atoi(val));
+	} else if (!strcmp(arg, "actimeo")) {
+		nfs_set_attr_cache(nfs, atoi(val), atoi(val),
+                                   atoi(val), atoi(val));
+	} else if (!strcmp(arg, "nocto")) {
+		nfs_set_nocto(nfs, atoi(val));
+	} else if (!strcmp(arg, "diskcache")) {
+		if (nfs_set_diskcache(nfs, val, nfs->diskcache_size) < 0) {
+			return -1;
+		}
+	} else if (!strcmp(arg, "diskcache_size")) {
+		nfs_diskcache_set_size(nfs, (uint64_t)atoi(val) * 1024 * 1024);
 	} else if (!strcmp(arg, "autoreconnect")) {
 		nfs_set_autoreconnect(nfs, atoi(val));
 #ifdef HAVE_SO_BINDTODEVICE
@@ -303,10 +1784,14 @@ nfs_parse_url(struct nfs_context *nfs, const char *url, int dir, int incomplete)
 		return NULL;
 	}
 
-	if (urls->server[0] == '/' || urls->server[0] == '\0' ||
-		urls->server[0] == '?') {
+	/* the arguments may contain '/', split them off first */
+	flagsp = strchr(urls->server, '?');
+	if (flagsp) {
+		*flagsp = 0;
+	}
+
+	if (urls->server[0] == '/' || urls->server[0] == '\0') {
 		if (incomplete) {
-			flagsp = strchr(urls->server, '?');
 			goto flags;
 		}
 		nfs_destroy_url(urls);
@@ -317,7 +1802,6 @@ nfs_parse_url(struct nfs_context *nfs, const char *url, int dir, int incomplete)
 	strp = strchr(urls->server, '/');
 	if (strp == NULL) {
 		if (incomplete) {
-			flagsp = strchr(urls->server, '?');
 			goto flags;
 		}
 		nfs_destroy_url(urls);
@@ -334,14 +1818,12 @@ nfs_parse_url(struct nfs_context *nfs, const char *url, int dir, int incomplete)
 	*strp = 0;
 
 	if (dir) {
-		flagsp = strchr(urls->path, '?');
 		goto flags;
 	}
 
 	strp = strrchr(urls->path, '/');
 	if (strp == NULL) {
 		if (incomplete) {
-			flagsp = strchr(urls->path, '?');
 			goto flags;
 		}
 		nfs_destroy_url(urls);
@@ -355,13 +1837,8 @@ nfs_parse_url(struct nfs_context *nfs, const char *url, int dir, int incomplete)
 		return NULL;
 	}
 	*strp = 0;
-	flagsp = strchr(urls->file, '?');
 
 flags:
-	if (flagsp) {
-		*flagsp = 0;
-	}
-
 	if (urls->file && !strlen(urls->file)) {
 		free(urls->file);
 		urls->file = NULL;
@@ -452,6 +1929,11 @@ nfs_init_context(void)
 	nfs->mask = 022;
 	nfs->auto_traverse_mounts = 1;
 	nfs->dircache_enabled = 1;
+	nfs->dircache_max_entries = NFS_DIRCACHE_ENTRIES;
+	nfs->dircache_max_bytes = NFS_DIRCACHE_SIZE;
+	nfs->readdir_lookups = NFS_READDIR_LOOKUPS;
+	nfs->linkcache_enabled = 1;
+	nfs->diskcache_size = NFS_DISKCACHE_DEFAULT_SIZE;
 	/* Default is never give up, never surrender */
 	nfs->auto_reconnect = -1;
 	nfs->version = NFS_V3;
@@ -484,9 +1966,46 @@ nfs4_set_verifier(struct nfs_context *nfs, const char *verifier)
         memcpy(nfs->verifier, verifier, NFS4_VERIFIER_SIZE);
 }
 
+void
+nfs_wb_free_ranges(struct nfs_wb_range **list)
+{
+	struct nfs_wb_range *r;
+
+	while ((r = *list) != NULL) {
+		*list = r->next;
+		free(r->buf);
+		free(r);
+	}
+}
+
+void
+nfs_writeback_free(struct nfs_context *nfs, struct nfsfh *nfsfh)
+{
+	struct nfs_writeback *wb = nfsfh->wb;
+	struct nfs_wb_waiter *w;
+
+	if (wb == NULL) {
+		return;
+	}
+	LIBNFS_LIST_REMOVE(&nfs->writebacks, wb);
+	nfs_wb_free_ranges(&wb->dirty);
+	nfs_wb_free_ranges(&wb->inflight);
+	nfs_wb_free_ranges(&wb->unstable);
+	nfs_wb_free_ranges(&wb->committing);
+	while ((w = wb->waiters) != NULL) {
+		wb->waiters = w->next;
+		free(w);
+	}
+	free(wb);
+	nfsfh->wb = NULL;
+}
+
 void
 nfs_destroy_context(struct nfs_context *nfs)
 {
+	struct nfs_writeback *wb;
+	int i;
+
 	while (nfs->nested_mounts) {
 		struct nested_mounts *mnt = nfs->nested_mounts;
 
@@ -496,6 +2015,13 @@ nfs_destroy_context(struct nfs_context *nfs)
                 free(mnt);
 	}
 
+	/* data still buffered for files that were never closed is lost,
+	 * make sure cancelling their WRITEs does not start new ones */
+	for (wb = nfs->writebacks; wb; wb = wb->next) {
+		nfs_wb_free_ranges(&wb->dirty);
+		wb->error = -EINTR;
+	}
+
 	rpc_destroy_context(nfs->rpc);
 	nfs->rpc = NULL;
 
@@ -515,11 +2041,19 @@ nfs_destroy_context(struct nfs_context *nfs)
         free(nfs->client_name);
         nfs->client_name = NULL;
 
-	while (nfs->dircache) {
-		struct nfsdir *nfsdir = nfs->dircache;
-		LIBNFS_LIST_REMOVE(&nfs->dircache, nfsdir);
-		nfs_free_nfsdir(nfsdir);
+	nfs_dircache_free_all(nfs);
+
+	nfs_pagecache_free(nfs);
+
+	for (i = 0; i < NFS_INODE_HASHES; i++) {
+		while (nfs->inodes[i]) {
+			nfs_inode_free(nfs, nfs->inodes[i]);
+		}
 	}
+	nfs_diskcache_free(nfs);
+	nfs_dentry_free_all(nfs);
+	nfs_attrcache_free_all(nfs);
+	nfs_linkcache_free_all(nfs);
 
 	free(nfs);
 }
@@ -762,6 +2296,9 @@ free_nfs_cb_data(struct nfs_cb_data *data)
 
 	free(data->saved_path);
 	free(data->fh.val);
+	free(data->lookup_dir.val);
+	free(data->lookup_name);
+	free(data->link_fh.val);
 	if (!data->not_my_buffer) {
 		free(data->buffer);
 	}
@@ -770,14 +2307,15 @@ free_nfs_cb_data(struct nfs_cb_data *data)
 }
 
 void
-nfs_free_nfsfh(struct nfsfh *nfsfh)
+nfs_free_nfsfh(struct nfs_context *nfs, struct nfsfh *nfsfh)
 {
+	nfs_writeback_free(nfs, nfsfh);
+	nfs_pagecache_release(nfs, nfsfh);
 	if (nfsfh->fh.val != NULL) {
 		free(nfsfh->fh.val);
 		nfsfh->fh.len = 0;
 		nfsfh->fh.val = NULL;
 	}
-	free(nfsfh->pagecache.entries);
 	free(nfsfh);
 }
 
@@ -1027,6 +2565,245 @@ nfs_pwrite_async(struct nfs_context *nfs, struct nfsfh *nfsfh, uint64_t offset,
         }
 }
 
+int
+nfs_preadv_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                 const struct iovec *iov, int iovcnt, uint64_t offset,
+                 nfs_cb cb, void *private_data)
+{
+	switch (nfs->version) {
+        case NFS_V3:
+                return nfs3_preadv_async(nfs, nfsfh, iov, iovcnt, offset,
+                                         cb, private_data);
+        default:
+                nfs_set_error(nfs, "%s does not support NFSv4",
+                              __FUNCTION__);
+                return -1;
+        }
+}
+
+int
+nfs_pwritev_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                  const struct iovec *iov, int iovcnt, uint64_t offset,
+                  nfs_cb cb, void *private_data)
+{
+	switch (nfs->version) {
+        case NFS_V3:
+                return nfs3_pwritev_async(nfs, nfsfh, iov, iovcnt, offset,
+                                          cb, private_data);
+        default:
+                nfs_set_error(nfs, "%s does not support NFSv4",
+                              __FUNCTION__);
+                return -1;
+        }
+}
+
+struct nfs_ioq *
+nfs_ioq_init(struct nfs_context *nfs, int depth)
+{
+	struct nfs_ioq *q;
+	int i;
+
+	if (depth <= 0) {
+		nfs_set_error(nfs, "Invalid queue depth %d", depth);
+		return NULL;
+	}
+
+	q = calloc(1, sizeof(struct nfs_ioq));
+	if (q == NULL) {
+		nfs_set_error(nfs, "Out of memory: failed to allocate "
+			      "nfs_ioq structure");
+		return NULL;
+	}
+	q->nfs = nfs;
+	q->depth = depth;
+	q->slots = calloc(depth, sizeof(struct nfs_ioq_slot));
+	q->ring = calloc(depth, sizeof(struct nfs_io_completion));
+	if (q->slots == NULL || q->ring == NULL) {
+		nfs_set_error(nfs, "Out of memory: failed to allocate "
+			      "queue of depth %d", depth);
+		free(q->slots);
+		free(q->ring);
+		free(q);
+		return NULL;
+	}
+	for (i = 0; i < depth; i++) {
+		q->slots[i].q = q;
+		q->slots[i].next = q->free;
+		q->free = &q->slots[i];
+	}
+
+	return q;
+}
+
+static void
+nfs_ioq_free(struct nfs_ioq *q)
+{
+	free(q->slots);
+	free(q->ring);
+	free(q);
+}
+
+void
+nfs_ioq_destroy(struct nfs_ioq *q)
+{
+	if (q == NULL) {
+		return;
+	}
+	/* Operations still in flight release the queue when they finish */
+	q->destroyed = 1;
+	q->count = 0;
+	if (q->inflight == 0) {
+		nfs_ioq_free(q);
+	}
+}
+
+static void
+nfs_ioq_cb(int status, struct nfs_context *nfs _U_, void *data _U_,
+           void *private_data)
+{
+	struct nfs_ioq_slot *slot = private_data;
+	struct nfs_ioq *q = slot->q;
+	struct nfs_ioq_slot *next;
+	int res;
+
+	/*
+	 * Merged reads share one call. Hand the bytes out in order, a short
+	 * read leaves the later operations with whatever is left.
+	 */
+	while (slot) {
+		next = slot->next;
+		res = status;
+		if (status > 0 && (uint64_t)status > slot->count) {
+			res = (int)slot->count;
+		}
+		if (status > 0) {
+			status -= res;
+		}
+
+		if (!q->destroyed) {
+			struct nfs_io_completion *c;
+
+			c = &q->ring[(q->head + q->count) % q->depth];
+			c->tag = slot->tag;
+			c->status = res;
+			q->count++;
+		}
+
+		slot->next = q->free;
+		q->free = slot;
+		q->inflight--;
+		slot = next;
+	}
+
+	if (q->destroyed && q->inflight == 0) {
+		nfs_ioq_free(q);
+	}
+}
+
+static struct nfs_ioq_slot *
+nfs_ioq_get_slot(struct nfs_ioq *q, struct nfs_io *io)
+{
+	struct nfs_ioq_slot *slot;
+
+	if (q->inflight + q->count >= q->depth) {
+		return NULL;
+	}
+	slot = q->free;
+	q->free = slot->next;
+	slot->next = NULL;
+	slot->tag = io->tag;
+	slot->count = io->count;
+	q->inflight++;
+
+	return slot;
+}
+
+int
+nfs_ioq_submit(struct nfs_ioq *q, struct nfs_io *ios, int nr)
+{
+	struct iovec iov[NFS_IOQ_MAX_MERGE];
+	struct nfs_ioq_slot *slot, *last;
+	struct nfs_io *io;
+	int i, n, ret;
+
+	for (i = 0; i < nr; i += n) {
+		io = &ios[i];
+		slot = nfs_ioq_get_slot(q, io);
+		if (slot == NULL) {
+			break;
+		}
+		n = 1;
+
+		switch (io->op) {
+		case NFS_IO_READ:
+			/*
+			 * Back to back reads of the same file are sent as
+			 * one preadv() so that they share the READs.
+			 */
+			iov[0].iov_base = io->buf;
+			iov[0].iov_len = io->count;
+			last = slot;
+			while (i + n < nr && n < NFS_IOQ_MAX_MERGE &&
+			       ios[i + n].op == NFS_IO_READ &&
+			       ios[i + n].nfsfh == io->nfsfh &&
+			       ios[i + n].offset ==
+			       ios[i + n - 1].offset + ios[i + n - 1].count) {
+				last->next = nfs_ioq_get_slot(q, &ios[i + n]);
+				if (last->next == NULL) {
+					break;
+				}
+				last = last->next;
+				iov[n].iov_base = ios[i + n].buf;
+				iov[n].iov_len = ios[i + n].count;
+				n++;
+			}
+			ret = nfs_preadv_async(q->nfs, io->nfsfh, iov, n,
+					       io->offset, nfs_ioq_cb, slot);
+			break;
+		case NFS_IO_WRITE:
+			ret = nfs_pwrite_async(q->nfs, io->nfsfh, io->offset,
+					       io->count, io->buf,
+					       nfs_ioq_cb, slot);
+			break;
+		case NFS_IO_FSYNC:
+			ret = nfs_fsync_async(q->nfs, io->nfsfh,
+					      nfs_ioq_cb, slot);
+			break;
+		default:
+			nfs_set_error(q->nfs, "Invalid I/O operation %d",
+				      io->op);
+			ret = -EINVAL;
+		}
+		if (ret < 0) {
+			/* Fail the operations through the completion ring */
+			nfs_ioq_cb(ret == -EINVAL ? -EINVAL : -EIO, q->nfs,
+				   NULL, slot);
+		}
+	}
+
+	return i;
+}
+
+int
+nfs_ioq_reap(struct nfs_ioq *q, struct nfs_io_completion *comps, int max)
+{
+	int i;
+
+	for (i = 0; i < max && q->count > 0; i++) {
+		comps[i] = q->ring[q->head];
+		q->head = (q->head + 1) % q->depth;
+		q->count--;
+	}
+
+	return i;
+}
+
+int
+nfs_ioq_inflight(struct nfs_ioq *q)
+{
+	return q->inflight;
+}
+
 int
 nfs_write_async(struct nfs_context *nfs, struct nfsfh *nfsfh, uint64_t count,
                 const void *buf, nfs_cb cb, void *private_data)
@@ -1226,11 +3003,63 @@ nfs_opendir_async(struct nfs_context *nfs, const char *path, nfs_cb cb,
         }
 }
 
+int
+nfs_opendir_stream_async(struct nfs_context *nfs, const char *path,
+                         uint64_t cookie, nfs_cb cb, void *private_data)
+{
+	switch (nfs->version) {
+        case NFS_V3:
+                return nfs3_opendir_stream_async(nfs, path, cookie,
+                                                 cb, private_data);
+        default:
+                nfs_set_error(nfs, "%s does not support NFSv4",
+                              __FUNCTION__);
+                return -1;
+        }
+}
+
+int
+nfs_readdir_next_page_async(struct nfs_context *nfs, struct nfsdir *nfsdir,
+                            nfs_cb cb, void *private_data)
+{
+	if (nfsdir->stream == NULL) {
+		nfs_set_error(nfs, "Directory was not opened with "
+                              "nfs_opendir_stream_async()");
+		return -1;
+	}
+	return nfs3_readdir_next_page_async(nfs, nfsdir, cb, private_data);
+}
+
+uint64_t
+nfs_readdir_cookie(struct nfs_context *nfs _U_, struct nfsdir *nfsdir)
+{
+	struct nfs_dirstream *stream = nfsdir->stream;
+	long i;
+
+	if (stream == NULL) {
+		return 0;
+	}
+	i = nfsdir->current ? nfsdir->current - nfsdir->entries :
+		(long)nfsdir->buf.count;
+	if (i == 0) {
+		return stream->start_cookie;
+	}
+	return stream->cookies[i - 1];
+}
+
 struct nfsdirent *
-nfs_readdir(struct nfs_context *nfs _U_, struct nfsdir *nfsdir)
+nfs_readdir(struct nfs_context *nfs, struct nfsdir *nfsdir)
 {
 	struct nfsdirent *nfsdirent = nfsdir->current;
 
+	/* remember the directory for the prefetching of its files, unless
+	 * we only ever have a page of it */
+	if (nfsdir->stream == NULL && nfs->dirscan.dir != nfsdir) {
+		memset(&nfs->dirscan, 0, sizeof(struct nfs_dirscan));
+		nfs->dirscan.dir = nfsdir;
+		nfs->dirscan.ahead_index = -1;
+	}
+
 	if (nfsdir->current != NULL) {
 		nfsdir->current = nfsdir->current->next;
 	}
@@ -1240,15 +3069,10 @@ nfs_readdir(struct nfs_context *nfs _U_, struct nfsdir *nfsdir)
 long
 nfs_telldir(struct nfs_context *nfs _U_, struct nfsdir *nfsdir)
 {
-        long i;
-        struct nfsdirent *tmp;
-
-        for (i = 0, tmp = nfsdir->entries; tmp; i++, tmp = tmp->next) {
-                if (tmp == nfsdir->current) {
-                        return i;
-                }
+        if (nfsdir->current == NULL) {
+                return -1;
         }
-        return -1;
+        return nfsdir->current - nfsdir->entries;
 }
 
 void
@@ -1257,10 +3081,11 @@ nfs_seekdir(struct nfs_context *nfs _U_, struct nfsdir *nfsdir, long loc)
         if (loc < 0) {
                 return;
         }
-        for (nfsdir->current = nfsdir->entries;
-             nfsdir && loc--;
-             nfsdir = nfsdir->next) {
+        if ((unsigned long)loc >= nfsdir->buf.count) {
+                nfsdir->current = NULL;
+                return;
         }
+        nfsdir->current = &nfsdir->entries[loc];
 }
 
 void
@@ -1272,9 +3097,17 @@ nfs_rewinddir(struct nfs_context *nfs _U_, struct nfsdir *nfsdir)
 void
 nfs_closedir(struct nfs_context *nfs, struct nfsdir *nfsdir)
 {
+	if (nfsdir->stream) {
+		nfs_dirscan_forget(nfs, nfsdir);
+		nfs3_dirstream_close(nfs, nfsdir);
+		return;
+	}
+	/* files opened after the directory was closed are still
+	 * prefetched for as long as its listing is in the dircache */
 	if (nfs->dircache_enabled) {
 		nfs_dircache_add(nfs, nfsdir);
 	} else {
+		nfs_dirscan_forget(nfs, nfsdir);
 		nfs_free_nfsdir(nfsdir);
 	}
 }
@@ -1584,6 +3417,83 @@ nfs_set_readahead(struct nfs_context *nfs, uint32_t v) {
 	rpc_set_readahead(nfs->rpc, v);
 }
 
+void
+nfs_set_prefetch_small(struct nfs_context *nfs, uint32_t v) {
+	uint32_t min_pagecache = 2 * (v / NFS_BLKSIZE + 1);
+
+	nfs->prefetch_small = v;
+	/* a read only waits for the prefetch if the pagecache could hold
+	 * twice as much as it asks for */
+	if (v && nfs->rpc->pagecache < min_pagecache) {
+		rpc_set_pagecache(nfs->rpc, min_pagecache);
+	}
+}
+
+void
+nfs_set_dirscan_prefetch(struct nfs_context *nfs, uint32_t v) {
+	uint32_t min_pagecache = 2 * (v / NFS_BLKSIZE + 1);
+
+	nfs->dirscan_prefetch = v;
+	if (v && nfs->rpc->pagecache < min_pagecache) {
+		rpc_set_pagecache(nfs->rpc, min_pagecache);
+	}
+}
+
+void
+nfs_set_dentry_cache(struct nfs_context *nfs, uint32_t file_ttl,
+                     uint32_t dir_ttl) {
+	nfs->dentry_ttl = file_ttl;
+	nfs->dentry_dir_ttl = dir_ttl;
+	/* entries added with the old timeouts must not outlive the new ones */
+	nfs_dentry_free_all(nfs);
+}
+
+void
+nfs_set_negative_cache(struct nfs_context *nfs, uint32_t ttl) {
+	nfs->negative_ttl = ttl;
+	nfs_dentry_free_all(nfs);
+}
+
+void
+nfs_set_attr_cache(struct nfs_context *nfs, uint32_t acregmin,
+                   uint32_t acregmax, uint32_t acdirmin, uint32_t acdirmax) {
+	nfs->acregmin = acregmin;
+	nfs->acregmax = acregmax;
+	nfs->acdirmin = acdirmin;
+	nfs->acdirmax = acdirmax;
+	nfs_attrcache_free_all(nfs);
+}
+
+void
+nfs_set_nocto(struct nfs_context *nfs, int enabled) {
+	nfs->nocto = enabled;
+}
+
+void
+nfs_set_writeback(struct nfs_context *nfs, uint32_t v) {
+	struct nfs_writeback *wb;
+
+	nfs->writeback = v;
+	if (v == 0) {
+		/* stop buffering on the open handles too and send what
+		 * they have buffered */
+		for (wb = nfs->writebacks; wb; wb = wb->next) {
+			wb->nfsfh->writeback = 0;
+		}
+		nfs3_writeback_scan(nfs);
+	}
+}
+
+void
+nfs_set_fh_writeback(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                     uint32_t v) {
+	nfsfh->writeback = v;
+	if (nfsfh->wb && nfsfh->wb->dirty && v == 0) {
+		/* send what we have buffered */
+		nfs3_writeback_scan(nfs);
+	}
+}
+
 void
 nfs_set_debug(struct nfs_context *nfs, int level) {
 	rpc_set_debug(nfs->rpc, level);
@@ -1594,6 +3504,49 @@ nfs_set_dircache(struct nfs_context *nfs, int enabled) {
 	nfs->dircache_enabled = enabled;
 }
 
+void
+nfs_set_dircache_size(struct nfs_context *nfs, uint32_t max_entries,
+                      uint64_t max_bytes) {
+	struct nfsdir *nfsdir;
+
+	nfs->dircache_max_entries = max_entries;
+	nfs->dircache_max_bytes = max_bytes;
+	while ((nfsdir = nfs->dircache_lru) != NULL &&
+	       (nfs->dircache_entries > max_entries ||
+		nfs->dircache_bytes > max_bytes)) {
+		nfs_dircache_unlink(nfs, nfsdir);
+		nfs_free_nfsdir(nfsdir);
+	}
+}
+
+void
+nfs_set_readdir(struct nfs_context *nfs, uint32_t dircount,
+                uint32_t maxcount) {
+	nfs->readdir_dircount = dircount;
+	nfs->readdir_maxcount = maxcount;
+}
+
+void
+nfs_set_readdir_names_only(struct nfs_context *nfs, int enabled) {
+	nfs->readdir_names_only = enabled;
+}
+
+void
+nfs_set_readdir_lookups(struct nfs_context *nfs, int lookups) {
+	if (lookups < 1) {
+		lookups = 1;
+	}
+	nfs->readdir_lookups = lookups;
+}
+
+void
+nfs_set_linkcache(struct nfs_context *nfs, int enabled) {
+	nfs->linkcache_enabled = enabled;
+	if (!enabled) {
+		nfs_linkcache_free_all(nfs);
+	}
+}
+
 void
 nfs_set_autoreconnect(struct nfs_context *nfs, int num_retries) {
 	nfs->auto_reconnect = num_retries;
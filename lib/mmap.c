@@ -0,0 +1,528 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Lazy memory mappings of remote files.
+ *
+ * The mapping is an anonymous region registered with userfaultfd. When
+ * a thread touches a part of it that has not been read yet the kernel
+ * blocks that thread and queues an event on the userfaultfd descriptor.
+ * nfs_mmap_service() picks these events up and sends READs for the
+ * chunk that was touched. Once the data arrives it is copied into the
+ * region with UFFDIO_COPY which also wakes up the thread.
+ * A chunk that can not be read is poisoned with UFFDIO_POISON so that
+ * the thread gets SIGBUS like for a kernel mapping. Where the kernel
+ * can not do that the chunk is read again from the next
+ * nfs_mmap_service() unless zero fill was asked for.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LINUX_USERFAULTFD_H
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#endif
+
+#include "libnfs.h"
+#include "libnfs-raw.h"
+#include "libnfs-private.h"
+
+#ifdef HAVE_LINUX_USERFAULTFD_H
+
+/*
+ * Largest chunk we fetch for a single fault, the chunk is also limited
+ * by readmax. When faults walk through the mapping in order we fetch
+ * this many chunks ahead of the one that was touched.
+ */
+#define NFS_MMAP_MAX_CHUNK (1024 * 1024)
+#define NFS_MMAP_PREFETCH 4
+#define NFS_MMAP_RETRIES 3
+
+#define NFS_MMAP_MISSING   0
+#define NFS_MMAP_REQUESTED 1
+#define NFS_MMAP_MAPPED    2
+/* could not be read, fetched again by nfs_mmap_service() */
+#define NFS_MMAP_FAILED    3
+
+struct nfs_mmap {
+       struct nfs_context *nfs;
+       struct nfsfh *nfsfh;
+       char *addr;
+       size_t length;
+       int uffd;
+       size_t chunk;
+       uint32_t num_chunks;
+       unsigned char *state;
+       /* page aligned buffer for UFFDIO_COPY */
+       char *bounce;
+       uint32_t last_fault;
+       int inflight;
+       int destroyed;
+       /* first error since the last nfs_mmap_service() */
+       int error;
+       /* the kernel supports UFFDIO_POISON */
+       int poison;
+       int zero_fill;
+       /* number of chunks in NFS_MMAP_FAILED */
+       uint32_t num_failed;
+};
+
+struct nfs_mmap_read {
+       struct nfs_mmap *map;
+       uint32_t idx;
+       int retries;
+};
+
+static void
+nfs_mmap_free(struct nfs_mmap *map)
+{
+	if (map->bounce) {
+		munmap(map->bounce, map->chunk);
+	}
+	free(map->state);
+	free(map);
+}
+
+static int nfs_mmap_send(struct nfs_mmap *map, struct nfs_mmap_read *rd);
+
+static void
+nfs_mmap_fill(struct nfs_mmap *map, uint32_t idx, const char *buf,
+              size_t count)
+{
+	struct uffdio_copy copy;
+
+	map->state[idx] = NFS_MMAP_MAPPED;
+
+	/* data past the end of the file reads as zero */
+	if (count) {
+		memcpy(map->bounce, buf, count);
+	}
+	memset(map->bounce + count, 0, map->chunk - count);
+
+	memset(&copy, 0, sizeof(copy));
+	copy.dst  = (uintptr_t)map->addr + (uint64_t)idx * map->chunk;
+	copy.src  = (uintptr_t)map->bounce;
+	copy.len  = map->chunk;
+	copy.mode = 0;
+	if (ioctl(map->uffd, UFFDIO_COPY, &copy) != 0 && errno != EEXIST) {
+		int err = errno;
+
+		nfs_set_error(map->nfs, "UFFDIO_COPY failed: %s",
+			      strerror(err));
+		if (map->error == 0) {
+			map->error = -err;
+		}
+	}
+}
+
+/* the chunk could not be read, resolve the fault without data */
+static void
+nfs_mmap_fail(struct nfs_mmap *map, uint32_t idx)
+{
+	if (map->zero_fill) {
+		nfs_mmap_fill(map, idx, NULL, 0);
+		return;
+	}
+#ifdef UFFDIO_POISON
+	if (map->poison) {
+		struct uffdio_poison poison;
+
+		map->state[idx] = NFS_MMAP_MAPPED;
+
+		memset(&poison, 0, sizeof(poison));
+		poison.range.start = (uintptr_t)map->addr +
+			(uint64_t)idx * map->chunk;
+		poison.range.len   = map->chunk;
+		poison.mode        = 0;
+		if (ioctl(map->uffd, UFFDIO_POISON, &poison) != 0 &&
+		    errno != EEXIST) {
+			int err = errno;
+
+			nfs_set_error(map->nfs, "UFFDIO_POISON failed: %s",
+				      strerror(err));
+			if (map->error == 0) {
+				map->error = -err;
+			}
+		}
+		return;
+	}
+#endif
+	/* the thread that touched the chunk stays blocked, like on a
+	 * hard mount, until a later nfs_mmap_service() reads it */
+	map->state[idx] = NFS_MMAP_FAILED;
+	map->num_failed++;
+}
+
+static void
+nfs_mmap_read_cb(int status, struct nfs_context *nfs _U_, void *data,
+                 void *private_data)
+{
+	struct nfs_mmap_read *rd = private_data;
+	struct nfs_mmap *map = rd->map;
+
+	map->inflight--;
+	if (map->destroyed) {
+		free(rd);
+		if (map->inflight == 0) {
+			nfs_mmap_free(map);
+		}
+		return;
+	}
+
+	if (status < 0) {
+		if (map->error == 0) {
+			map->error = status;
+		}
+		/* the thread that touched the chunk is still blocked, try
+		 * again before we give up on the chunk */
+		if (status != -EINTR && ++rd->retries < NFS_MMAP_RETRIES &&
+		    nfs_mmap_send(map, rd) == 0) {
+			return;
+		}
+		nfs_mmap_fail(map, rd->idx);
+		free(rd);
+		return;
+	}
+
+	nfs_mmap_fill(map, rd->idx, data, MIN((size_t)status, map->chunk));
+	free(rd);
+}
+
+static int
+nfs_mmap_send(struct nfs_mmap *map, struct nfs_mmap_read *rd)
+{
+	if (nfs_pread_async(map->nfs, map->nfsfh,
+			    (uint64_t)rd->idx * map->chunk, map->chunk,
+			    nfs_mmap_read_cb, rd) != 0) {
+		return -1;
+	}
+	map->inflight++;
+	return 0;
+}
+
+static int
+nfs_mmap_fetch(struct nfs_mmap *map, uint32_t idx)
+{
+	struct nfs_mmap_read *rd;
+
+	if (idx >= map->num_chunks ||
+	    map->state[idx] != NFS_MMAP_MISSING) {
+		return 0;
+	}
+
+	rd = malloc(sizeof(struct nfs_mmap_read));
+	if (rd == NULL) {
+		nfs_set_error(map->nfs, "Out of memory: failed to allocate "
+			      "nfs_mmap_read structure");
+		return -ENOMEM;
+	}
+	memset(rd, 0, sizeof(struct nfs_mmap_read));
+	rd->map = map;
+	rd->idx = idx;
+	if (nfs_mmap_send(map, rd) != 0) {
+		free(rd);
+		return -EIO;
+	}
+	map->state[idx] = NFS_MMAP_REQUESTED;
+	return 0;
+}
+
+/* creates map->uffd, returns -1 and closes it again on failure */
+static int
+nfs_mmap_open_uffd(struct nfs_mmap *map, uint64_t features)
+{
+	struct uffdio_api api;
+
+#ifdef UFFD_USER_MODE_ONLY
+	/* we only need to see faults from user space and this works
+	 * without privileges even when vm.unprivileged_userfaultfd is 0 */
+	map->uffd = (int)syscall(SYS_userfaultfd,
+				 O_CLOEXEC|O_NONBLOCK|UFFD_USER_MODE_ONLY);
+#endif
+	if (map->uffd < 0) {
+		map->uffd = (int)syscall(SYS_userfaultfd, O_CLOEXEC|O_NONBLOCK);
+	}
+	if (map->uffd < 0) {
+		nfs_set_error(map->nfs, "userfaultfd failed: %s",
+			      strerror(errno));
+		return -1;
+	}
+
+	memset(&api, 0, sizeof(api));
+	api.api = UFFD_API;
+	api.features = features;
+	if (ioctl(map->uffd, UFFDIO_API, &api) != 0) {
+		nfs_set_error(map->nfs, "UFFDIO_API failed: %s",
+			      strerror(errno));
+		close(map->uffd);
+		map->uffd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+struct nfs_mmap *
+nfs_mmap(struct nfs_context *nfs, struct nfsfh *nfsfh, uint64_t length)
+{
+	struct nfs_mmap *map;
+	struct uffdio_register reg;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t chunk;
+
+	if (length == 0 || length > SIZE_MAX / 2) {
+		nfs_set_error(nfs, "Invalid length for nfs_mmap");
+		return NULL;
+	}
+
+	chunk = (size_t)MIN(nfs_get_readmax(nfs), NFS_MMAP_MAX_CHUNK);
+	chunk &= ~(page - 1);
+	if (chunk == 0) {
+		chunk = page;
+	}
+	if ((length + chunk - 1) / chunk > UINT32_MAX) {
+		nfs_set_error(nfs, "Invalid length for nfs_mmap");
+		return NULL;
+	}
+
+	map = malloc(sizeof(struct nfs_mmap));
+	if (map == NULL) {
+		nfs_set_error(nfs, "Out of memory: failed to allocate "
+			      "nfs_mmap structure");
+		return NULL;
+	}
+	memset(map, 0, sizeof(struct nfs_mmap));
+	map->nfs = nfs;
+	map->nfsfh = nfsfh;
+	map->uffd = -1;
+	map->chunk = chunk;
+	map->num_chunks = (uint32_t)((length + chunk - 1) / chunk);
+	map->length = (size_t)map->num_chunks * chunk;
+	/* a first fault at the start of the file counts as sequential */
+	map->last_fault = UINT32_MAX;
+
+	map->state = calloc(map->num_chunks, 1);
+	map->bounce = mmap(NULL, chunk, PROT_READ|PROT_WRITE,
+			   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (map->bounce == MAP_FAILED) {
+		map->bounce = NULL;
+	}
+	if (map->state == NULL || map->bounce == NULL) {
+		nfs_set_error(nfs, "Out of memory: failed to allocate "
+			      "nfs_mmap state");
+		nfs_mmap_free(map);
+		return NULL;
+	}
+
+#ifdef UFFDIO_POISON
+	/* older kernels refuse the feature, try again without it */
+	if (nfs_mmap_open_uffd(map, UFFD_FEATURE_POISON) == 0) {
+		map->poison = 1;
+	} else
+#endif
+	if (nfs_mmap_open_uffd(map, 0) != 0) {
+		nfs_mmap_free(map);
+		return NULL;
+	}
+
+	map->addr = mmap(NULL, map->length, PROT_READ,
+			 MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (map->addr == MAP_FAILED) {
+		map->addr = NULL;
+		nfs_set_error(nfs, "mmap failed: %s", strerror(errno));
+		goto err;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.range.start = (uintptr_t)map->addr;
+	reg.range.len   = map->length;
+	reg.mode        = UFFDIO_REGISTER_MODE_MISSING;
+	if (ioctl(map->uffd, UFFDIO_REGISTER, &reg) != 0) {
+		nfs_set_error(nfs, "UFFDIO_REGISTER failed: %s",
+			      strerror(errno));
+		goto err;
+	}
+
+	return map;
+
+ err:
+	if (map->addr) {
+		munmap(map->addr, map->length);
+	}
+	close(map->uffd);
+	nfs_mmap_free(map);
+	return NULL;
+}
+
+void *
+nfs_mmap_get_addr(struct nfs_mmap *map)
+{
+	return map->addr;
+}
+
+int
+nfs_mmap_get_fd(struct nfs_mmap *map)
+{
+	return map->uffd;
+}
+
+void
+nfs_mmap_set_zero_fill(struct nfs_mmap *map, int enabled)
+{
+	map->zero_fill = enabled;
+}
+
+int
+nfs_mmap_service(struct nfs_mmap *map)
+{
+	struct uffd_msg msg[16];
+	ssize_t n;
+	uint32_t idx;
+	int i, j, err;
+
+	while ((n = read(map->uffd, msg, sizeof(msg))) > 0) {
+		for (i = 0; i < (int)(n / sizeof(struct uffd_msg)); i++) {
+			uint64_t addr;
+
+			if (msg[i].event != UFFD_EVENT_PAGEFAULT) {
+				continue;
+			}
+			addr = msg[i].arg.pagefault.address;
+			idx = (uint32_t)((addr - (uintptr_t)map->addr) /
+					 map->chunk);
+
+			err = nfs_mmap_fetch(map, idx);
+			if (err) {
+				/* like for a READ that failed, and go on
+				 * with the other faults */
+				if (map->error == 0) {
+					map->error = err;
+				}
+				nfs_mmap_fail(map, idx);
+				continue;
+			}
+			/* faults walking through the mapping in order */
+			if (idx == map->last_fault + 1) {
+				for (j = 1; j <= NFS_MMAP_PREFETCH; j++) {
+					if (nfs_mmap_fetch(map, idx + j)) {
+						break;
+					}
+				}
+			}
+			map->last_fault = idx;
+		}
+	}
+	if (n < 0 && errno != EAGAIN) {
+		err = errno;
+		nfs_set_error(map->nfs, "Failed to read from userfaultfd: "
+			      "%s", strerror(err));
+		return -err;
+	}
+
+	/* try the chunks that could not be read again */
+	for (idx = 0; map->num_failed && idx < map->num_chunks; idx++) {
+		if (map->state[idx] != NFS_MMAP_FAILED) {
+			continue;
+		}
+		map->state[idx] = NFS_MMAP_MISSING;
+		map->num_failed--;
+		err = nfs_mmap_fetch(map, idx);
+		if (err) {
+			if (map->error == 0) {
+				map->error = err;
+			}
+			map->state[idx] = NFS_MMAP_FAILED;
+			map->num_failed++;
+			break;
+		}
+	}
+
+	err = map->error;
+	map->error = 0;
+	return err;
+}
+
+void
+nfs_munmap(struct nfs_mmap *map)
+{
+	if (map == NULL) {
+		return;
+	}
+	/* threads that are still blocked in a fault are woken up when
+	 * the descriptor is closed and retry it against the unmapped
+	 * range, unmap first so they do not find an empty page there */
+	munmap(map->addr, map->length);
+	close(map->uffd);
+	map->destroyed = 1;
+	if (map->inflight == 0) {
+		nfs_mmap_free(map);
+	}
+}
+
+#else /* HAVE_LINUX_USERFAULTFD_H */
+
+struct nfs_mmap *
+nfs_mmap(struct nfs_context *nfs, struct nfsfh *nfsfh _U_,
+         uint64_t length _U_)
+{
+	nfs_set_error(nfs, "nfs_mmap is not supported on this platform");
+	return NULL;
+}
+
+void *
+nfs_mmap_get_addr(struct nfs_mmap *map _U_)
+{
+	return NULL;
+}
+
+int
+nfs_mmap_get_fd(struct nfs_mmap *map _U_)
+{
+	return -1;
+}
+
+void
+nfs_mmap_set_zero_fill(struct nfs_mmap *map _U_, int enabled _U_)
+{
+}
+
+int
+nfs_mmap_service(struct nfs_mmap *map _U_)
+{
+	return -ENOSYS;
+}
+
+void
+nfs_munmap(struct nfs_mmap *map _U_)
+{
+}
+
+#endif /* HAVE_LINUX_USERFAULTFD_H */
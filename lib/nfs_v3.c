@@ -117,6 +117,8 @@ struct nfs_mcb_data {
        struct nfs_cb_data *data;
        uint64_t offset;
        size_t count;
+       /* other reads can wait for this one to fill the pagecache */
+       struct nfs_read_req *req;
 };
 
 static int
@@ -151,41 +153,19 @@ static int nfs3_lookup_path_async_internal(struct nfs_context *nfs,
  * call a specific function once the filehandle for the final component is
  * found.
  */
+
+/* continue resolving the path through a symlink that points to path */
 static void
-nfs3_lookup_path_2_cb(struct rpc_context *rpc, int status, void *command_data,
-                      void *private_data)
+nfs3_lookup_path_follow(struct nfs_context *nfs, struct nfs_cb_data *data,
+                        const char *path)
 {
-	struct nfs_cb_data *data = private_data;
-	struct nfs_context *nfs = data->nfs;
-	READLINK3res *res;
-	char *path, *newpath;
-
-	assert(rpc->magic == RPC_CONTEXT_MAGIC);
-
-	if (check_nfs3_error(nfs, status, data, command_data)) {
-		free_nfs_cb_data(data);
-		return;
-	}
-
-	res = command_data;
-	if (res->status != NFS3_OK) {
-		nfs_set_error(nfs, "NFS: READLINK of %s failed with "
-                              "%s(%d)", data->saved_path,
-                              nfsstat3_to_str(res->status),
-                              nfsstat3_to_errno(res->status));
-		data->cb(nfsstat3_to_errno(res->status), nfs,
-                         nfs_get_error(nfs), data->private_data);
-		free_nfs_cb_data(data);
-		return;
-	}
-
-	path = res->READLINK3res_u.resok.data;
+	char *newpath;
 
 	/* Handle absolute paths, ensuring that the path lies within the
 	 * export. */
 	if (path[0] == '/') {
 		if (strstr(path, nfs->export) == path) {
-			char *ptr = path + strlen(nfs->export);
+			const char *ptr = path + strlen(nfs->export);
 			if (*ptr == '/') {
 				newpath = strdup(ptr);
 			} else if (*ptr == '\0') {
@@ -260,6 +240,7 @@ fattr3_to_nfs_attr(struct nfs_attr *attr, fattr3 *fa3)
         attr->size  = fa3->size;
         attr->used  = fa3->used;
         attr->fsid  = fa3->fsid;
+        attr->fileid = fa3->fileid;
         attr->rdev.specdata1 = fa3->rdev.specdata1;
         attr->rdev.specdata2 = fa3->rdev.specdata2;
         attr->atime.seconds  = fa3->atime.seconds;
@@ -270,6 +251,208 @@ fattr3_to_nfs_attr(struct nfs_attr *attr, fattr3 *fa3)
         attr->ctime.nseconds = fa3->ctime.nseconds;
 }
 
+static void
+nfs3_lookup_path_2_cb(struct rpc_context *rpc, int status, void *command_data,
+                      void *private_data)
+{
+	struct nfs_cb_data *data = private_data;
+	struct nfs_context *nfs = data->nfs;
+	READLINK3res *res;
+	struct nfs_attr attr;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	if (check_nfs3_error(nfs, status, data, command_data)) {
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	res = command_data;
+	if (res->status != NFS3_OK) {
+		nfs_set_error(nfs, "NFS: READLINK of %s failed with "
+                              "%s(%d)", data->saved_path,
+                              nfsstat3_to_str(res->status),
+                              nfsstat3_to_errno(res->status));
+		data->cb(nfsstat3_to_errno(res->status), nfs,
+                         nfs_get_error(nfs), data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	if (res->READLINK3res_u.resok.symlink_attributes.attributes_follow) {
+		fattr3_to_nfs_attr(&attr, &res->READLINK3res_u.resok.symlink_attributes.post_op_attr_u.attributes);
+		nfs_linkcache_add(nfs, &data->link_fh, &attr,
+                                  res->READLINK3res_u.resok.data);
+	}
+	nfs3_lookup_path_follow(nfs, data, res->READLINK3res_u.resok.data);
+}
+
+/*
+ * Check any data we have cached for the file against attributes returned
+ * by the server.
+ */
+static struct nfs_inode *
+nfs3_cb_data_inode(struct nfs_context *nfs, struct nfs_cb_data *data)
+{
+	if (data->nfsfh) {
+		return data->nfsfh->inode;
+	}
+	if (data->fh.val) {
+		return nfs_inode_find(nfs, &data->fh);
+	}
+	return NULL;
+}
+
+/* the file handle the attributes in a reply for data belong to */
+static struct nfs_fh *
+nfs3_cb_data_fh(struct nfs_cb_data *data)
+{
+	if (data->nfsfh) {
+		return &data->nfsfh->fh;
+	}
+	if (data->fh.val) {
+		return &data->fh;
+	}
+	return NULL;
+}
+
+static void
+nfs3_revalidate_inode(struct nfs_context *nfs, struct nfs_cb_data *data,
+                      fattr3 *fa3)
+{
+	struct nfs_inode *inode;
+	struct nfs_attr attr;
+	struct nfs_fh *fh;
+
+	fattr3_to_nfs_attr(&attr, fa3);
+	fh = nfs3_cb_data_fh(data);
+	if (fh) {
+		nfs_attrcache_update(nfs, fh, &attr);
+	}
+	inode = nfs3_cb_data_inode(nfs, data);
+	if (inode == NULL) {
+		return;
+	}
+	nfs_inode_revalidate(nfs, inode, &attr);
+}
+
+static void
+nfs3_revalidate_inode_post_op(struct nfs_context *nfs,
+                              struct nfs_cb_data *data, post_op_attr *poa)
+{
+	if (poa->attributes_follow) {
+		nfs3_revalidate_inode(nfs, data,
+                                      &poa->post_op_attr_u.attributes);
+	}
+}
+
+static void
+nfs3_inode_write_start(struct nfsfh *nfsfh)
+{
+	struct nfs_inode *inode = nfsfh->inode;
+
+	if (inode == NULL) {
+		return;
+	}
+	if (inode->writes++) {
+		inode->write_overlap = 1;
+	}
+}
+
+static void
+nfs3_inode_write_done(struct nfsfh *nfsfh)
+{
+	struct nfs_inode *inode = nfsfh->inode;
+
+	if (inode == NULL) {
+		return;
+	}
+	if (--inode->writes == 0) {
+		inode->write_overlap = 0;
+	}
+}
+
+/*
+ * Update the inode from the wcc data returned by one of our own
+ * modifying operations so that our own changes do not invalidate the
+ * data we have cached.
+ */
+static void
+nfs3_update_inode_wcc(struct nfs_context *nfs, struct nfs_cb_data *data,
+                      wcc_data *wcc)
+{
+	struct nfs_inode *inode;
+	struct nfs_attr before, after;
+	struct nfs_fh *fh;
+	wcc_attr *wa;
+
+	if (wcc->after.attributes_follow) {
+		fattr3_to_nfs_attr(&after,
+                                   &wcc->after.post_op_attr_u.attributes);
+	}
+	fh = nfs3_cb_data_fh(data);
+	if (fh && wcc->after.attributes_follow) {
+		nfs_attrcache_update(nfs, fh, &after);
+	} else if (fh) {
+		nfs_attrcache_drop(nfs, fh);
+	}
+
+	inode = nfs3_cb_data_inode(nfs, data);
+	if (inode == NULL) {
+		return;
+	}
+	if (wcc->before.attributes_follow) {
+		wa = &wcc->before.pre_op_attr_u.attributes;
+		memset(&before, 0, sizeof(before));
+		before.size = wa->size;
+		before.mtime.seconds = wa->mtime.seconds;
+		before.mtime.nseconds = wa->mtime.nseconds;
+		before.ctime.seconds = wa->ctime.seconds;
+		before.ctime.nseconds = wa->ctime.nseconds;
+	}
+	nfs_inode_update_wcc(nfs, inode,
+                             wcc->before.attributes_follow ? &before : NULL,
+                             wcc->after.attributes_follow ? &after : NULL);
+}
+
+/*
+ * Where an O_APPEND handle writes next. We only learn about the end of
+ * the file when we open it and from the attributes returned by our own
+ * WRITEs, so the only way we can notice appends from other clients is
+ * from the size the file had just before one of our WRITEs.
+ */
+static void
+nfs3_set_eof(struct nfsfh *nfsfh, post_op_attr *attr)
+{
+	if (nfsfh->is_append && attr->attributes_follow) {
+		nfsfh->eof = attr->post_op_attr_u.attributes.size;
+		nfsfh->eof_valid = 1;
+	}
+}
+
+static void
+nfs3_update_eof(struct nfsfh *nfsfh, uint64_t offset, wcc_data *wcc)
+{
+	if (!nfsfh->eof_valid) {
+		return;
+	}
+	/*
+	 * An append that did not start at the end of the file means that
+	 * someone else has appended to or truncated the file, and our
+	 * write may have landed on top of their data. Ask the server
+	 * where the file ends before the next append.
+	 */
+	if (nfsfh->is_append && wcc->before.attributes_follow &&
+	    wcc->before.pre_op_attr_u.attributes.size != offset) {
+		nfsfh->eof_valid = 0;
+		return;
+	}
+	if (wcc->after.attributes_follow &&
+	    wcc->after.post_op_attr_u.attributes.size > nfsfh->eof) {
+		nfsfh->eof = wcc->after.post_op_attr_u.attributes.size;
+	}
+}
+
 static void
 nfs3_lookup_path_1_cb(struct rpc_context *rpc, int status, void *command_data,
                       void *private_data)
@@ -288,6 +471,12 @@ nfs3_lookup_path_1_cb(struct rpc_context *rpc, int status, void *command_data,
 	}
 
 	res = command_data;
+	if (res->status == NFS3ERR_NOENT && data->lookup_name &&
+	    res->LOOKUP3res_u.resfail.dir_attributes.attributes_follow) {
+		fattr3_to_nfs_attr(&attr, &res->LOOKUP3res_u.resfail.dir_attributes.post_op_attr_u.attributes);
+		nfs_dentry_add_negative(nfs, &data->lookup_dir,
+                                        data->lookup_name, &attr);
+	}
 	if (res->status != NFS3_OK) {
 		nfs_set_error(nfs, "NFS: Lookup of %s failed with "
                               "%s(%d)", data->saved_path,
@@ -309,9 +498,63 @@ nfs3_lookup_path_1_cb(struct rpc_context *rpc, int status, void *command_data,
 	 */
         fh.val = res->LOOKUP3res_u.resok.object.data.data_val;
         fh.len = res->LOOKUP3res_u.resok.object.data.data_len;
+	if (res->LOOKUP3res_u.resok.obj_attributes.attributes_follow) {
+		nfs_attrcache_update(nfs, &fh, &attr);
+	}
+	if (data->lookup_name &&
+	    res->LOOKUP3res_u.resok.obj_attributes.attributes_follow) {
+		nfs_dentry_add(nfs, &data->lookup_dir, data->lookup_name,
+                               &fh, &attr);
+	}
 	nfs3_lookup_path_async_internal(nfs, &attr, data, &fh);
 }
 
+/* add a name we just created to the name lookup and attribute caches */
+static void
+nfs3_dentry_add_created(struct nfs_context *nfs, struct nfs_fh *dir,
+                        const char *fname, post_op_fh3 *obj,
+                        post_op_attr *obj_attributes)
+{
+	struct nfs_attr attr;
+	struct nfs_fh fh;
+
+	/* also forgets that the name did not exist */
+	nfs_dentry_drop(nfs, dir, fname);
+	if (!obj->handle_follows || !obj_attributes->attributes_follow) {
+		return;
+	}
+	fattr3_to_nfs_attr(&attr, &obj_attributes->post_op_attr_u.attributes);
+	fh.len = obj->post_op_fh3_u.handle.data.data_len;
+	fh.val = obj->post_op_fh3_u.handle.data.data_val;
+	nfs_attrcache_update(nfs, &fh, &attr);
+	if (nfs->dentry_ttl || nfs->dentry_dir_ttl) {
+		nfs_dentry_add(nfs, dir, fname, &fh, &attr);
+	}
+}
+
+/*
+ * Remember which name we are looking up in which directory so that the
+ * reply can go into the name lookup cache.
+ */
+static void
+nfs3_lookup_remember(struct nfs_cb_data *data, struct nfs_fh *dir,
+                     const char *fname)
+{
+	free(data->lookup_dir.val);
+	free(data->lookup_name);
+	data->lookup_dir.len = dir->len;
+	data->lookup_dir.val = malloc(dir->len);
+	data->lookup_name = strdup(fname);
+	if (data->lookup_dir.val == NULL || data->lookup_name == NULL) {
+		free(data->lookup_dir.val);
+		free(data->lookup_name);
+		data->lookup_dir.val = NULL;
+		data->lookup_name = NULL;
+		return;
+	}
+	memcpy(data->lookup_dir.val, dir->val, dir->len);
+}
+
 static int
 nfs3_lookup_path_async_internal(struct nfs_context *nfs, struct nfs_attr *attr,
                                 struct nfs_cb_data *data, struct nfs_fh *fh)
@@ -335,6 +578,7 @@ nfs3_lookup_path_async_internal(struct nfs_context *nfs, struct nfs_attr *attr,
 		}
 		if (!data->no_follow || *path != '\0') {
 			READLINK3args rl_args;
+			const char *target;
 
 			if (data->link_count++ >= MAX_LINK_COUNT) {
 				data->cb(-ELOOP, nfs, "Too many levels of "
@@ -343,6 +587,25 @@ nfs3_lookup_path_async_internal(struct nfs_context *nfs, struct nfs_attr *attr,
 				return -1;
                         }
 
+			target = nfs_linkcache_find(nfs, fh, attr);
+			if (target) {
+				nfs3_lookup_path_follow(nfs, data, target);
+				return 0;
+			}
+
+			free(data->link_fh.val);
+			data->link_fh.len = fh->len;
+			data->link_fh.val = malloc(fh->len);
+			if (data->link_fh.val == NULL) {
+				nfs_set_error(nfs, "Out of memory: Failed to "
+                                              "allocate fh for %s", data->path);
+				data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                                         data->private_data);
+				free_nfs_cb_data(data);
+				return -1;
+			}
+			memcpy(data->link_fh.val, fh->val, fh->len);
+
 			rl_args.symlink.data.data_len = fh->len;
 			rl_args.symlink.data.data_val = fh->val;
 
@@ -381,6 +644,17 @@ nfs3_lookup_path_async_internal(struct nfs_context *nfs, struct nfs_attr *attr,
 	}
 
 	if (*path == 0) {
+		struct nfs_attr *acattr, cattr;
+
+		/* we got here without the attributes, e.g. for the root of
+		 * a mount, the attribute cache may have them */
+		if (attr == NULL) {
+			acattr = nfs_attrcache_find(nfs, fh);
+			if (acattr) {
+				cattr = *acattr;
+				attr = &cattr;
+			}
+		}
 		data->fh.len = fh->len;
 		data->fh.val = malloc(data->fh.len);
 		if (data->fh.val == NULL) {
@@ -399,6 +673,89 @@ nfs3_lookup_path_async_internal(struct nfs_context *nfs, struct nfs_attr *attr,
 		return 0;
 	}
 
+	if (nfs->dentry_ttl || nfs->dentry_dir_ttl || nfs->negative_ttl) {
+		struct nfs_dentry *dentry = nfs_dentry_find(nfs, fh, path);
+
+		/* a name that did not exist is only trusted for as long as
+		 * the directory has not changed, as far as we can tell */
+		if (dentry && dentry->negative) {
+			if (attr == NULL ||
+			    (attr->mtime.seconds == dentry->attr.mtime.seconds &&
+			     attr->mtime.nseconds == dentry->attr.mtime.nseconds &&
+			     attr->ctime.seconds == dentry->attr.ctime.seconds &&
+			     attr->ctime.nseconds == dentry->attr.ctime.nseconds)) {
+				if (slash != NULL) {
+					*slash = '/';
+				}
+				nfs_set_error(nfs, "NFS: Lookup of %s failed "
+                                              "with NFS3ERR_NOENT(%d)",
+                                              data->saved_path, -ENOENT);
+				data->cb(-ENOENT, nfs, nfs_get_error(nfs),
+                                         data->private_data);
+				free_nfs_cb_data(data);
+				return -1;
+			}
+			nfs_dentry_drop(nfs, fh, path);
+			dentry = NULL;
+		}
+		if (dentry && dentry->fh.len <= NFS3_FHSIZE) {
+			char val[NFS3_FHSIZE];
+			struct nfs_attr cattr = dentry->attr;
+			struct nfs_attr *acattr;
+			struct nfs_fh cfh;
+
+			/* the attribute cache may know better */
+			acattr = nfs_attrcache_find(nfs, &dentry->fh);
+			if (acattr) {
+				cattr = *acattr;
+			}
+
+			/* use copies, the cache may change under our feet
+			 * before we are done with them */
+			memcpy(val, dentry->fh.val, dentry->fh.len);
+			cfh.len = dentry->fh.len;
+			cfh.val = val;
+			if (slash != NULL) {
+				*slash = '/';
+			}
+			return nfs3_lookup_path_async_internal(nfs, &cattr,
+                                                               data, &cfh);
+		}
+		nfs3_lookup_remember(data, fh, path);
+	}
+
+	/* a directory we have listed knows which names it has */
+	if (nfs->dircache_enabled) {
+		char val[NFS3_FHSIZE];
+		struct nfs_attr cattr;
+		struct nfs_fh cfh;
+
+		switch (nfs_dircache_lookup(nfs, fh, attr, path, &cfh, &cattr)) {
+		case 0:
+			if (slash != NULL) {
+				*slash = '/';
+			}
+			nfs_set_error(nfs, "NFS: Lookup of %s failed with "
+                                      "NFS3ERR_NOENT(%d)", data->saved_path,
+                                      -ENOENT);
+			data->cb(-ENOENT, nfs, nfs_get_error(nfs),
+                                 data->private_data);
+			free_nfs_cb_data(data);
+			return -1;
+		case 1:
+			if (cfh.len > NFS3_FHSIZE) {
+				break;
+			}
+			memcpy(val, cfh.val, cfh.len);
+			cfh.val = val;
+			if (slash != NULL) {
+				*slash = '/';
+			}
+			return nfs3_lookup_path_async_internal(nfs, &cattr,
+                                                               data, &cfh);
+		}
+	}
+
 	memset(&args, 0, sizeof(LOOKUP3args));
 	args.what.dir.data.data_len = fh->len;
 	args.what.dir.data.data_val = fh->val;
@@ -464,6 +821,7 @@ nfs3_lookuppath_async(struct nfs_context *nfs, const char *path, int no_follow,
 {
 	struct nfs_cb_data *data;
 	struct GETATTR3args args;
+	struct nfs_attr *attr;
 	struct nfs_fh *fh;
 
 	if (path == NULL || path[0] == '\0') {
@@ -552,6 +910,13 @@ nfs3_lookuppath_async(struct nfs_context *nfs, const char *path, int no_follow,
 	/* We have a request for "", so just perform a GETATTR3 so we can
 	 * return the attributes to the caller.
 	 */
+	attr = nfs_attrcache_find(nfs, fh);
+	if (attr) {
+		struct nfs_attr cattr = *attr;
+
+		nfs3_lookup_path_async_internal(nfs, &cattr, data, fh);
+		return 0;
+	}
 	memset(&args, 0, sizeof(GETATTR3args));
 	args.object.data.data_len = fh->len;
 	args.object.data.data_val = fh->val;
@@ -688,6 +1053,7 @@ nfs3_mount_6_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	nfs->readmax = res->FSINFO3res_u.resok.rtmax;
 	nfs->writemax = res->FSINFO3res_u.resok.wtmax;
+	nfs->dtpref = res->FSINFO3res_u.resok.dtpref;
 
 	/* The server supports sizes up to rtmax and wtmax, so it is legal
 	 * to use smaller transfers sizes.
@@ -1130,6 +1496,8 @@ nfs3_link_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
+	nfs_dentry_drop(nfs, &link_data->newdir, link_data->newobject);
+
 	if (check_nfs3_error(nfs, status, data, command_data)) {
 		free_nfs_cb_data(data);
 		return;
@@ -1300,6 +1668,10 @@ nfs3_rename_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
+	/* whatever happened, the names may no longer be what we cached */
+	nfs_dentry_drop(nfs, &rename_data->olddir, rename_data->oldobject);
+	nfs_dentry_drop(nfs, &rename_data->newdir, rename_data->newobject);
+
 	if (check_nfs3_error(nfs, status, data, command_data)) {
 		free_nfs_cb_data(data);
 		return;
@@ -1487,6 +1859,8 @@ nfs3_symlink_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
+	nfs_dentry_drop(nfs, &data->fh, symlink_data->linkobject);
+
 	if (check_nfs3_error(nfs, status, data, command_data)) {
 		free_nfs_cb_data(data);
 		return;
@@ -1598,6 +1972,48 @@ nfs3_symlink_async(struct nfs_context *nfs, const char *target,
 }
 
 
+/*
+ * Remember the result of an ACCESS call for mask, along with the
+ * attributes it returned that the result is only valid with.
+ */
+static void
+nfs3_access_cache_reply(struct nfs_context *nfs, struct nfs_fh *fh,
+                        uint32_t mask, ACCESS3resok *resok)
+{
+	struct nfs_attr attr;
+
+	if (!resok->obj_attributes.attributes_follow) {
+		return;
+	}
+	fattr3_to_nfs_attr(&attr,
+                           &resok->obj_attributes.post_op_attr_u.attributes);
+	nfs_attrcache_update(nfs, fh, &attr);
+	nfs_access_cache_add(nfs, fh, mask, resok->access);
+}
+
+#define NFS3_ACCESS2_MASK (ACCESS3_READ | ACCESS3_LOOKUP | ACCESS3_MODIFY | \
+                           ACCESS3_EXTEND | ACCESS3_DELETE | ACCESS3_EXECUTE)
+
+static void
+nfs3_access2_done(struct nfs_context *nfs, struct nfs_cb_data *data,
+                  uint32_t access)
+{
+	unsigned int result = 0;
+
+	if (access & ACCESS3_READ) {
+		result |= R_OK;
+	}
+	if (access & (ACCESS3_MODIFY | ACCESS3_EXTEND | ACCESS3_DELETE)) {
+		result |= W_OK;
+	}
+	if (access & (ACCESS3_LOOKUP | ACCESS3_EXECUTE)) {
+		result |= X_OK;
+	}
+
+	data->cb(result, nfs, NULL, data->private_data);
+	free_nfs_cb_data(data);
+}
+
 static void
 nfs3_access2_cb(struct rpc_context *rpc, int status, void *command_data,
                 void *private_data)
@@ -1605,7 +2021,6 @@ nfs3_access2_cb(struct rpc_context *rpc, int status, void *command_data,
 	ACCESS3res *res;
 	struct nfs_cb_data *data = private_data;
 	struct nfs_context *nfs = data->nfs;
-	unsigned int result = 0;
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
@@ -1626,18 +2041,9 @@ nfs3_access2_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
-	if (res->ACCESS3res_u.resok.access & ACCESS3_READ) {
-		result |= R_OK;
-	}
-	if (res->ACCESS3res_u.resok.access & (ACCESS3_MODIFY | ACCESS3_EXTEND | ACCESS3_DELETE)) {
-		result |= W_OK;
-	}
-	if (res->ACCESS3res_u.resok.access & (ACCESS3_LOOKUP | ACCESS3_EXECUTE)) {
-		result |= X_OK;
-	}
-
-	data->cb(result, nfs, NULL, data->private_data);
-	free_nfs_cb_data(data);
+	nfs3_access_cache_reply(nfs, &data->fh, NFS3_ACCESS2_MASK,
+                                &res->ACCESS3res_u.resok);
+	nfs3_access2_done(nfs, data, res->ACCESS3res_u.resok.access);
 }
 
 static int
@@ -1646,11 +2052,18 @@ nfs3_access2_continue_internal(struct nfs_context *nfs,
                                struct nfs_cb_data *data)
 {
 	ACCESS3args args;
+	uint32_t access;
+
+	if (nfs_access_cache_find(nfs, &data->fh, NFS3_ACCESS2_MASK,
+                                  &access) == 0) {
+		nfs3_access2_done(nfs, data, access);
+		return 0;
+	}
 
 	memset(&args, 0, sizeof(ACCESS3args));
 	args.object.data.data_len = data->fh.len;
 	args.object.data.data_val = data->fh.val;
-	args.access = ACCESS3_READ | ACCESS3_LOOKUP | ACCESS3_MODIFY | ACCESS3_EXTEND | ACCESS3_DELETE | ACCESS3_EXECUTE;
+	args.access = NFS3_ACCESS2_MASK;
 
 	if (rpc_nfs3_access_async(nfs->rpc, nfs3_access2_cb,
                                   &args, data) != 0) {
@@ -1676,41 +2089,37 @@ nfs3_access2_async(struct nfs_context *nfs, const char *path, nfs_cb cb,
 }
 
 
-static void
-nfs3_access_cb(struct rpc_context *rpc, int status, void *command_data,
-               void *private_data)
+/* the ACCESS3_* bits to ask for to check the R_OK/W_OK/X_OK bits in mode */
+static uint32_t
+nfs3_access_mask(int mode)
 {
-	ACCESS3res *res;
-	struct nfs_cb_data *data = private_data;
-	struct nfs_context *nfs = data->nfs;
-	unsigned int mode = 0;
-
-	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+	uint32_t nfsmode = 0;
 
-	if (check_nfs3_error(nfs, status, data, command_data)) {
-		free_nfs_cb_data(data);
-		return;
+	if (mode & R_OK) {
+		nfsmode |= ACCESS3_READ;
+	}
+	if (mode & W_OK) {
+		nfsmode |= ACCESS3_MODIFY | ACCESS3_EXTEND | ACCESS3_DELETE;
+	}
+	if (mode & X_OK) {
+		nfsmode |= ACCESS3_LOOKUP | ACCESS3_EXECUTE;
 	}
+	return nfsmode;
+}
 
-	res = command_data;
-	if (res->status != NFS3_OK) {
-		nfs_set_error(nfs, "NFS: ACCESS of %s failed with "
-                              "%s(%d)", data->saved_path,
-                              nfsstat3_to_str(res->status),
-                              nfsstat3_to_errno(res->status));
-		data->cb(nfsstat3_to_errno(res->status), nfs,
-                         nfs_get_error(nfs), data->private_data);
-		free_nfs_cb_data(data);
-		return;
-	}
+static void
+nfs3_access_done(struct nfs_context *nfs, struct nfs_cb_data *data,
+                 uint32_t access)
+{
+	unsigned int mode = 0;
 
-	if ((data->continue_int & R_OK) && (res->ACCESS3res_u.resok.access & ACCESS3_READ)) {
+	if ((data->continue_int & R_OK) && (access & ACCESS3_READ)) {
 		mode |= R_OK;
 	}
-	if ((data->continue_int & W_OK) && (res->ACCESS3res_u.resok.access & (ACCESS3_MODIFY | ACCESS3_EXTEND | ACCESS3_DELETE))) {
+	if ((data->continue_int & W_OK) && (access & (ACCESS3_MODIFY | ACCESS3_EXTEND | ACCESS3_DELETE))) {
 		mode |= W_OK;
 	}
-	if ((data->continue_int & X_OK) && (res->ACCESS3res_u.resok.access & (ACCESS3_LOOKUP | ACCESS3_EXECUTE))) {
+	if ((data->continue_int & X_OK) && (access & (ACCESS3_LOOKUP | ACCESS3_EXECUTE))) {
 		mode |= X_OK;
 	}
 
@@ -1733,22 +2142,51 @@ nfs3_access_cb(struct rpc_context *rpc, int status, void *command_data,
 	free_nfs_cb_data(data);
 }
 
+static void
+nfs3_access_cb(struct rpc_context *rpc, int status, void *command_data,
+               void *private_data)
+{
+	ACCESS3res *res;
+	struct nfs_cb_data *data = private_data;
+	struct nfs_context *nfs = data->nfs;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	if (check_nfs3_error(nfs, status, data, command_data)) {
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	res = command_data;
+	if (res->status != NFS3_OK) {
+		nfs_set_error(nfs, "NFS: ACCESS of %s failed with "
+                              "%s(%d)", data->saved_path,
+                              nfsstat3_to_str(res->status),
+                              nfsstat3_to_errno(res->status));
+		data->cb(nfsstat3_to_errno(res->status), nfs,
+                         nfs_get_error(nfs), data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	nfs3_access_cache_reply(nfs, &data->fh,
+                                nfs3_access_mask(data->continue_int),
+                                &res->ACCESS3res_u.resok);
+	nfs3_access_done(nfs, data, res->ACCESS3res_u.resok.access);
+}
+
 static int
 nfs3_access_continue_internal(struct nfs_context *nfs,
                               struct nfs_attr *attr _U_,
                               struct nfs_cb_data *data)
 {
-	int nfsmode = 0;
+	uint32_t nfsmode = nfs3_access_mask(data->continue_int);
 	ACCESS3args args;
+	uint32_t access;
 
-	if (data->continue_int & R_OK) {
-		nfsmode |= ACCESS3_READ;
-	}
-	if (data->continue_int & W_OK) {
-		nfsmode |= ACCESS3_MODIFY | ACCESS3_EXTEND | ACCESS3_DELETE;
-	}
-	if (data->continue_int & X_OK) {
-		nfsmode |= ACCESS3_LOOKUP | ACCESS3_EXECUTE;
+	if (nfs_access_cache_find(nfs, &data->fh, nfsmode, &access) == 0) {
+		nfs3_access_done(nfs, data, access);
+		return 0;
 	}
 
 	memset(&args, 0, sizeof(ACCESS3args));
@@ -1806,6 +2244,7 @@ nfs3_utimes_cb(struct rpc_context *rpc, int status, void *command_data,
 	}
 
 	nfs_dircache_drop(nfs, &data->fh);
+	nfs3_update_inode_wcc(nfs, data, &res->SETATTR3res_u.resok.obj_wcc);
 	data->cb(0, nfs, NULL, data->private_data);
 	free_nfs_cb_data(data);
 }
@@ -1928,6 +2367,7 @@ nfs3_chown_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
+	nfs3_update_inode_wcc(nfs, data, &res->SETATTR3res_u.resok.obj_wcc);
 	data->cb(0, nfs, NULL, data->private_data);
 	free_nfs_cb_data(data);
 }
@@ -2067,6 +2507,7 @@ nfs3_chmod_cb(struct rpc_context *rpc, int status, void *command_data,
 	}
 
 	nfs_dircache_drop(nfs, &data->fh);
+	nfs3_update_inode_wcc(nfs, data, &res->SETATTR3res_u.resok.obj_wcc);
 	data->cb(0, nfs, NULL, data->private_data);
 	free_nfs_cb_data(data);
 }
@@ -2170,16 +2611,37 @@ nfs3_readlink_1_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
+	if (res->READLINK3res_u.resok.symlink_attributes.attributes_follow) {
+		struct nfs_attr attr;
+
+		fattr3_to_nfs_attr(&attr, &res->READLINK3res_u.resok.symlink_attributes.post_op_attr_u.attributes);
+		nfs_linkcache_add(nfs, &data->fh, &attr,
+                                  res->READLINK3res_u.resok.data);
+	}
 	data->cb(0, nfs, res->READLINK3res_u.resok.data, data->private_data);
 	free_nfs_cb_data(data);
 }
 
 static int
 nfs3_readlink_continue_internal(struct nfs_context *nfs,
-                                struct nfs_attr *attr _U_,
+                                struct nfs_attr *attr,
                                 struct nfs_cb_data *data)
 {
 	READLINK3args args;
+	const char *cached;
+
+	cached = nfs_linkcache_find(nfs, &data->fh, attr);
+	if (cached) {
+		/* the callback may well change the cache */
+		char *target = strdup(cached);
+
+		if (target) {
+			data->cb(0, nfs, target, data->private_data);
+			free(target);
+			free_nfs_cb_data(data);
+			return 0;
+		}
+	}
 
 	args.symlink.data.data_val = data->fh.val;
 	args.symlink.data.data_len = data->fh.len;
@@ -2389,6 +2851,8 @@ struct rdpe_cb_data {
 	int getattrcount;
 	int status;
 	struct nfs_cb_data *data;
+	/* next entry to send a LOOKUP for, if it needs one */
+	struct nfsdirent *next;
 };
 
 /* ReadDirPlus Emulation LOOKUP Callback data */
@@ -2397,8 +2861,130 @@ struct rdpe_lookup_cb_data {
 	struct nfsdirent *nfsdirent;
 };
 
+static void
+nfs3_attr_to_dirent(struct nfsdirent *nfsdirent, struct nfs_attr *attr)
+{
+	struct specdata3 sd3 = { attr->rdev.specdata1, attr->rdev.specdata2 };
+
+	nfsdirent->type = attr->type;
+	nfsdirent->mode = attr->mode;
+	switch (nfsdirent->type) {
+	case NF3REG:  nfsdirent->mode |= S_IFREG; break;
+	case NF3DIR:  nfsdirent->mode |= S_IFDIR; break;
+	case NF3BLK:  nfsdirent->mode |= S_IFBLK; break;
+	case NF3CHR:  nfsdirent->mode |= S_IFCHR; break;
+	case NF3LNK:  nfsdirent->mode |= S_IFLNK; break;
+	case NF3SOCK: nfsdirent->mode |= S_IFSOCK; break;
+	case NF3FIFO: nfsdirent->mode |= S_IFIFO; break;
+	};
+	nfsdirent->size = attr->size;
+
+	nfsdirent->atime.tv_sec  = attr->atime.seconds;
+	nfsdirent->atime.tv_usec = attr->atime.nseconds/1000;
+	nfsdirent->atime_nsec = attr->atime.nseconds;
+	nfsdirent->mtime.tv_sec  = attr->mtime.seconds;
+	nfsdirent->mtime.tv_usec = attr->mtime.nseconds/1000;
+	nfsdirent->mtime_nsec = attr->mtime.nseconds;
+	nfsdirent->ctime.tv_sec  = attr->ctime.seconds;
+	nfsdirent->ctime.tv_usec = attr->ctime.nseconds/1000;
+	nfsdirent->ctime_nsec = attr->ctime.nseconds;
+	nfsdirent->uid = attr->uid;
+	nfsdirent->gid = attr->gid;
+	nfsdirent->nlink = attr->nlink;
+	nfsdirent->dev = attr->fsid;
+	nfsdirent->rdev = specdata3_to_rdev(&sd3);
+	nfsdirent->blksize = NFS_BLKSIZE;
+	nfsdirent->blocks = (attr->used + 512 - 1) / 512;
+	nfsdirent->used = attr->used;
+}
+
+/*
+ * Size of the READDIR and READDIRPLUS replies we ask for. Unless set with
+ * nfs_set_readdir() this is the dtpref the server gave us in FSINFO, but
+ * never less than the 8k we always used to ask for.
+ */
+static uint32_t
+nfs3_readdir_maxcount(struct nfs_context *nfs)
+{
+	uint32_t maxcount = nfs->readdir_maxcount;
+
+	if (maxcount == 0) {
+		maxcount = MAX(nfs->dtpref, NFS_READDIR_MIN_SIZE);
+	}
+	if (nfs->readmax && maxcount > nfs->readmax) {
+		maxcount = nfs->readmax;
+	}
+	return maxcount;
+}
+
+static uint32_t
+nfs3_readdir_dircount(struct nfs_context *nfs)
+{
+	if (nfs->readdir_dircount) {
+		return nfs->readdir_dircount;
+	}
+	return nfs3_readdir_maxcount(nfs);
+}
+
+static void nfs3_opendir_3_cb(struct rpc_context *rpc, int status,
+                              void *command_data, void *private_data);
+
+/*
+ * Send LOOKUPs for the entries that still lack attributes until there are
+ * nfs->readdir_lookups of them in flight. Stops sending once something
+ * has failed, the LOOKUPs in flight still have to complete.
+ */
+static void
+nfs3_rdpe_send(struct nfs_context *nfs, struct rdpe_cb_data *rdpe_cb_data)
+{
+	struct nfs_cb_data *data = rdpe_cb_data->data;
+
+	while (rdpe_cb_data->next &&
+	       rdpe_cb_data->status == RPC_STATUS_SUCCESS &&
+	       rdpe_cb_data->getattrcount < nfs->readdir_lookups) {
+		struct nfsdirent *nfsdirent = rdpe_cb_data->next;
+		struct rdpe_lookup_cb_data *rdpe_lookup_cb_data;
+		LOOKUP3args args;
+
+		rdpe_cb_data->next = nfsdirent->next;
+
+		/* If type == 0 we assume it is a case of the server not
+		 * giving us the attributes for this entry during READIR[PLUS]
+		 * so we fallback to LOOKUP3
+		 */
+		if (nfsdirent->type != 0) {
+			continue;
+		}
+
+		rdpe_lookup_cb_data = malloc(sizeof(struct rdpe_lookup_cb_data));
+		if (rdpe_lookup_cb_data == NULL) {
+			nfs_set_error(nfs, "Failed to allocate READDIR LOOKUP "
+				      "data");
+			rdpe_cb_data->status = RPC_STATUS_ERROR;
+			break;
+		}
+		rdpe_lookup_cb_data->rdpe_cb_data = rdpe_cb_data;
+		rdpe_lookup_cb_data->nfsdirent = nfsdirent;
+
+		memset(&args, 0, sizeof(LOOKUP3args));
+		args.what.dir.data.data_len = data->fh.len;
+		args.what.dir.data.data_val = data->fh.val;
+		args.what.name = nfsdirent->name;
+
+		if (rpc_nfs3_lookup_async(nfs->rpc, nfs3_opendir_3_cb, &args,
+					  rdpe_lookup_cb_data) != 0) {
+			nfs_set_error(nfs, "RPC error: Failed to send "
+				      "READDIR LOOKUP call");
+			free(rdpe_lookup_cb_data);
+			rdpe_cb_data->status = RPC_STATUS_ERROR;
+			break;
+		}
+		rdpe_cb_data->getattrcount++;
+	}
+}
+
 /* Workaround for servers lacking READDIRPLUS.
- * Use READDIR instead and a GETATTR-loop */
+ * Use READDIR instead and a LOOKUP-loop */
 static void
 nfs3_opendir_3_cb(struct rpc_context *rpc, int status, void *command_data,
                   void *private_data)
@@ -2435,41 +3021,24 @@ nfs3_opendir_3_cb(struct rpc_context *rpc, int status, void *command_data,
 	}
 	if (status == RPC_STATUS_SUCCESS && res->status == NFS3_OK) {
 		if (res->LOOKUP3res_u.resok.obj_attributes.attributes_follow) {
-			fattr3 *attributes = &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes;
-
-			nfsdirent->type = attributes->type;
-			nfsdirent->mode = attributes->mode;
-			switch (nfsdirent->type) {
-			case NF3REG:  nfsdirent->mode |= S_IFREG; break;
-			case NF3DIR:  nfsdirent->mode |= S_IFDIR; break;
-			case NF3BLK:  nfsdirent->mode |= S_IFBLK; break;
-			case NF3CHR:  nfsdirent->mode |= S_IFCHR; break;
-			case NF3LNK:  nfsdirent->mode |= S_IFLNK; break;
-			case NF3SOCK: nfsdirent->mode |= S_IFSOCK; break;
-			case NF3FIFO: nfsdirent->mode |= S_IFIFO; break;
-			};
-			nfsdirent->size = attributes->size;
-
-			nfsdirent->atime.tv_sec  = attributes->atime.seconds;
-			nfsdirent->atime.tv_usec = attributes->atime.nseconds/1000;
-			nfsdirent->atime_nsec = attributes->atime.nseconds;
-			nfsdirent->mtime.tv_sec  = attributes->mtime.seconds;
-			nfsdirent->mtime.tv_usec = attributes->mtime.nseconds/1000;
-			nfsdirent->mtime_nsec = attributes->mtime.nseconds;
-			nfsdirent->ctime.tv_sec  = attributes->ctime.seconds;
-			nfsdirent->ctime.tv_usec = attributes->ctime.nseconds/1000;
-			nfsdirent->ctime_nsec = attributes->ctime.nseconds;
-			nfsdirent->uid = attributes->uid;
-			nfsdirent->gid = attributes->gid;
-			nfsdirent->nlink = attributes->nlink;
-			nfsdirent->dev = attributes->fsid;
-			nfsdirent->rdev = specdata3_to_rdev(&attributes->rdev);
-			nfsdirent->blksize = NFS_BLKSIZE;
-			nfsdirent->blocks = (attributes->used + 512 - 1) / 512;
-			nfsdirent->used = attributes->used;
+			struct nfs_attr attr;
+			struct nfs_fh fh;
+
+			fattr3_to_nfs_attr(&attr, &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes);
+			nfs3_attr_to_dirent(nfsdirent, &attr);
+
+			fh.len = res->LOOKUP3res_u.resok.object.data.data_len;
+			fh.val = res->LOOKUP3res_u.resok.object.data.data_val;
+			nfs_attrcache_update(nfs, &fh, &attr);
+			if (nfs->dentry_ttl || nfs->dentry_dir_ttl) {
+				nfs_dentry_add(nfs, &data->fh, nfsdirent->name,
+                                               &fh, &attr);
+			}
 		}
 	}
 
+	nfs3_rdpe_send(nfs, rdpe_cb_data);
+
 	if (rdpe_cb_data->getattrcount == 0) {
 		if (rdpe_cb_data->status != RPC_STATUS_SUCCESS) {
 			nfs_set_error(nfs, "READDIRPLUS emulation "
@@ -2486,60 +3055,46 @@ nfs3_opendir_3_cb(struct rpc_context *rpc, int status, void *command_data,
 	}
 }
 
+/*
+ * Start fetching the attributes of the entries READDIR[PLUS] did not give
+ * us any for. Returns 0 if there are none, 1 if LOOKUPs are in flight and
+ * nfs3_opendir_3_cb() will complete the opendir, and -1 on failure.
+ */
 static int
 lookup_missing_attributes(struct nfs_context *nfs,
                           struct nfsdir *nfsdir,
                           struct nfs_cb_data *data)
 {
-	struct rdpe_cb_data *rdpe_cb_data = NULL;
+	struct rdpe_cb_data *rdpe_cb_data;
 	struct nfsdirent *nfsdirent;
 
 	for (nfsdirent = nfsdir->entries;
 	     nfsdirent;
 	     nfsdirent = nfsdirent->next) {
-		struct rdpe_lookup_cb_data *rdpe_lookup_cb_data;
-		LOOKUP3args args;
-
-		/* If type == 0 we assume it is a case of the server not
-		 * giving us the attributes for this entry during READIR[PLUS]
-		 * so we fallback to LOOKUP3
-		 */
-		if (nfsdirent->type != 0) {
-			continue;
-		}
-
-		if (rdpe_cb_data == NULL) {
-			rdpe_cb_data = malloc(sizeof(struct rdpe_cb_data));
-			rdpe_cb_data->getattrcount = 0;
-			rdpe_cb_data->status = RPC_STATUS_SUCCESS;
-			rdpe_cb_data->data = data;
+		if (nfsdirent->type == 0) {
+			break;
 		}
-		rdpe_lookup_cb_data = malloc(sizeof(struct rdpe_lookup_cb_data));
-		rdpe_lookup_cb_data->rdpe_cb_data = rdpe_cb_data;
-		rdpe_lookup_cb_data->nfsdirent = nfsdirent;
-
-		memset(&args, 0, sizeof(LOOKUP3args));
-		args.what.dir.data.data_len = data->fh.len;
-		args.what.dir.data.data_val = data->fh.val;
-		args.what.name = nfsdirent->name;
-
-		if (rpc_nfs3_lookup_async(nfs->rpc, nfs3_opendir_3_cb, &args,
-					  rdpe_lookup_cb_data) != 0) {
-			nfs_set_error(nfs, "RPC error: Failed to send "
-				      "READDIR LOOKUP call");
+	}
+	if (nfsdirent == NULL) {
+		return 0;
+	}
 
-			/* if we have already commands in flight, we cant just
-			 * stop, we have to wait for the commands in flight to
-			 * complete
-			 */
-			continue;
-		}
-		rdpe_cb_data->getattrcount++;
+	rdpe_cb_data = malloc(sizeof(struct rdpe_cb_data));
+	if (rdpe_cb_data == NULL) {
+		nfs_set_error(nfs, "Failed to allocate READDIR LOOKUP data");
+		return -1;
 	}
-	if (rdpe_cb_data != NULL) {
-		return rdpe_cb_data->getattrcount;
+	rdpe_cb_data->getattrcount = 0;
+	rdpe_cb_data->status = RPC_STATUS_SUCCESS;
+	rdpe_cb_data->data = data;
+	rdpe_cb_data->next = nfsdirent;
+
+	nfs3_rdpe_send(nfs, rdpe_cb_data);
+	if (rdpe_cb_data->getattrcount == 0) {
+		free(rdpe_cb_data);
+		return -1;
 	}
-	return 0;
+	return 1;
 }
 
 static void
@@ -2550,9 +3105,9 @@ nfs3_opendir_2_cb(struct rpc_context *rpc, int status, void *command_data,
 	struct nfs_cb_data *data = private_data;
 	struct nfs_context *nfs = data->nfs;
 	struct nfsdir *nfsdir = data->continue_data;
-	struct nfsdirent *nfsdirent;
 	struct entry3 *entry;
 	uint64_t cookie = 0;
+	int ret;
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
@@ -2578,8 +3133,8 @@ nfs3_opendir_2_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	entry =res->READDIR3res_u.resok.reply.entries;
 	while (entry != NULL) {
-		nfsdirent = malloc(sizeof(struct nfsdirent));
-		if (nfsdirent == NULL) {
+		if (nfs_dirbuf_add(&nfsdir->buf, entry->name,
+                                   entry->fileid) == NULL) {
 			data->cb(-ENOMEM, nfs, "Failed to allocate dirent",
                                  data->private_data);
 			nfs_free_nfsdir(nfsdir);
@@ -2587,21 +3142,8 @@ nfs3_opendir_2_cb(struct rpc_context *rpc, int status, void *command_data,
 			free_nfs_cb_data(data);
 			return;
 		}
-		memset(nfsdirent, 0, sizeof(struct nfsdirent));
-		nfsdirent->name = strdup(entry->name);
-		if (nfsdirent->name == NULL) {
-			data->cb(-ENOMEM, nfs, "Failed to allocate "
-                                 "dirent->name", data->private_data);
-			free(nfsdirent);
-			nfs_free_nfsdir(nfsdir);
-			data->continue_data = NULL;
-			free_nfs_cb_data(data);
-			return;
-		}
-		nfsdirent->inode = entry->fileid;
-
-		nfsdirent->next  = nfsdir->entries;
-		nfsdir->entries  = nfsdirent;
+		nfs_dircache_add_name(nfs, nfsdir, nfsdir->buf.count - 1,
+                                      NULL);
 
 		cookie = entry->cookie;
 		entry  = entry->nextentry;
@@ -2615,7 +3157,7 @@ nfs3_opendir_2_cb(struct rpc_context *rpc, int status, void *command_data,
 		args.cookie = cookie;
 		memcpy(&args.cookieverf, res->READDIR3res_u.resok.cookieverf,
                        sizeof(cookieverf3));
-		args.count = 8192;
+		args.count = nfs3_readdir_maxcount(nfs);
 
 	     	if (rpc_nfs3_readdir_async(nfs->rpc, nfs3_opendir_2_cb,
                                            &args, data) != 0) {
@@ -2631,13 +3173,27 @@ nfs3_opendir_2_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
-	if (res->READDIR3res_u.resok.dir_attributes.attributes_follow)
+	if (res->READDIR3res_u.resok.dir_attributes.attributes_follow) {
 		fattr3_to_nfs_attr(&nfsdir->attr, &res->READDIR3res_u.resok.dir_attributes.post_op_attr_u.attributes);
+		nfs_attrcache_update(nfs, &nfsdir->fh, &nfsdir->attr);
+	}
 
 	/* steal the dirhandle */
+	nfs_dirbuf_finish(&nfsdir->buf);
+	nfsdir->entries = nfsdir->buf.dirents;
 	nfsdir->current = nfsdir->entries;
 
-	if (lookup_missing_attributes(nfs, nfsdir, data) == 0) {
+	ret = nfsdir->names_only ? 0 :
+		lookup_missing_attributes(nfs, nfsdir, data);
+	if (ret < 0) {
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		nfs_free_nfsdir(nfsdir);
+		data->continue_data = NULL;
+		free_nfs_cb_data(data);
+		return;
+	}
+	if (ret == 0) {
 		data->cb(0, nfs, nfsdir, data->private_data);
 		data->continue_data = NULL;
 		free_nfs_cb_data(data);
@@ -2655,6 +3211,7 @@ nfs3_opendir_cb(struct rpc_context *rpc, int status, void *command_data,
 	struct nfsdir *nfsdir = data->continue_data;
 	struct entryplus3 *entry;
 	uint64_t cookie = 0;
+	int ret;
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
@@ -2666,7 +3223,7 @@ nfs3_opendir_cb(struct rpc_context *rpc, int status, void *command_data,
 		args.dir.data.data_val = data->fh.val;
 		args.cookie = cookie;
 		memset(&args.cookieverf, 0, sizeof(cookieverf3));
-		args.count = 8192;
+		args.count = nfs3_readdir_maxcount(nfs);
 
 		if (rpc_nfs3_readdir_async(nfs->rpc, nfs3_opendir_2_cb,
                                            &args, data) != 0) {
@@ -2708,11 +3265,13 @@ nfs3_opendir_cb(struct rpc_context *rpc, int status, void *command_data,
 	while (entry != NULL) {
 		struct nfsdirent *nfsdirent;
 		struct nfs_attr attr;
-                int has_attr = 0;
+		struct nfs_fh fh;
+                int has_attr = 0, has_fh = 0;
 
                 memset(&attr, 0, sizeof(attr));
 
-		nfsdirent = malloc(sizeof(struct nfsdirent));
+		nfsdirent = nfs_dirbuf_add(&nfsdir->buf, entry->name,
+                                           entry->fileid);
 		if (nfsdirent == NULL) {
 			data->cb(-ENOMEM, nfs, "Failed to allocate dirent",
                                  data->private_data);
@@ -2721,23 +3280,23 @@ nfs3_opendir_cb(struct rpc_context *rpc, int status, void *command_data,
 			free_nfs_cb_data(data);
 			return;
 		}
-		memset(nfsdirent, 0, sizeof(struct nfsdirent));
-		nfsdirent->name = strdup(entry->name);
-		if (nfsdirent->name == NULL) {
-			data->cb(-ENOMEM, nfs, "Failed to allocate "
-                                 "dirent->name", data->private_data);
-			free(nfsdirent);
-			nfs_free_nfsdir(nfsdir);
-			data->continue_data = NULL;
-			free_nfs_cb_data(data);
-			return;
-		}
-		nfsdirent->inode = entry->fileid;
 
 		if (entry->name_attributes.attributes_follow) {
 			fattr3_to_nfs_attr(&attr, &entry->name_attributes.post_op_attr_u.attributes);
                         has_attr = 1;
                 }
+		if (entry->name_handle.handle_follows) {
+			fh.len = entry->name_handle.post_op_fh3_u.handle.data.data_len;
+			fh.val = entry->name_handle.post_op_fh3_u.handle.data.data_val;
+			has_fh = 1;
+		}
+		if (has_attr && has_fh) {
+			nfs_attrcache_update(nfs, &fh, &attr);
+			if (nfs->dentry_ttl || nfs->dentry_dir_ttl) {
+				nfs_dentry_add(nfs, &data->fh, entry->name,
+                                               &fh, &attr);
+			}
+		}
 
 		if (!has_attr) {
 			struct nested_mounts *mnt;
@@ -2762,43 +3321,11 @@ nfs3_opendir_cb(struct rpc_context *rpc, int status, void *command_data,
 			}
 		}
 		if (has_attr) {
-                        struct specdata3 sd3 = { attr.rdev.specdata1,
-                                                 attr.rdev.specdata2 };
-
-			nfsdirent->type = attr.type;
-			nfsdirent->mode = attr.mode;
-			switch (nfsdirent->type) {
-			case NF3REG:  nfsdirent->mode |= S_IFREG; break;
-			case NF3DIR:  nfsdirent->mode |= S_IFDIR; break;
-			case NF3BLK:  nfsdirent->mode |= S_IFBLK; break;
-			case NF3CHR:  nfsdirent->mode |= S_IFCHR; break;
-			case NF3LNK:  nfsdirent->mode |= S_IFLNK; break;
-			case NF3SOCK: nfsdirent->mode |= S_IFSOCK; break;
-			case NF3FIFO: nfsdirent->mode |= S_IFIFO; break;
-			};
-			nfsdirent->size = attr.size;
-
-			nfsdirent->atime.tv_sec  = attr.atime.seconds;
-			nfsdirent->atime.tv_usec = attr.atime.nseconds/1000;
-			nfsdirent->atime_nsec = attr.atime.nseconds;
-			nfsdirent->mtime.tv_sec  = attr.mtime.seconds;
-			nfsdirent->mtime.tv_usec = attr.mtime.nseconds/1000;
-			nfsdirent->mtime_nsec = attr.mtime.nseconds;
-			nfsdirent->ctime.tv_sec  = attr.ctime.seconds;
-			nfsdirent->ctime.tv_usec = attr.ctime.nseconds/1000;
-			nfsdirent->ctime_nsec = attr.ctime.nseconds;
-			nfsdirent->uid = attr.uid;
-			nfsdirent->gid = attr.gid;
-			nfsdirent->nlink = attr.nlink;
-			nfsdirent->dev = attr.fsid;
-			nfsdirent->rdev = specdata3_to_rdev(&sd3);
-			nfsdirent->blksize = NFS_BLKSIZE;
-			nfsdirent->blocks = (attr.used + 512 - 1) / 512;
-			nfsdirent->used = attr.used;
+			nfs3_attr_to_dirent(nfsdirent, &attr);
 		}
 
-		nfsdirent->next  = nfsdir->entries;
-		nfsdir->entries  = nfsdirent;
+		nfs_dircache_add_name(nfs, nfsdir, nfsdir->buf.count - 1,
+                                      has_fh ? &fh : NULL);
 
 		cookie = entry->cookie;
 		entry  = entry->nextentry;
@@ -2813,8 +3340,8 @@ nfs3_opendir_cb(struct rpc_context *rpc, int status, void *command_data,
 		memcpy(&args.cookieverf,
                        res->READDIRPLUS3res_u.resok.cookieverf,
                        sizeof(cookieverf3));
-		args.dircount = 8192;
-		args.maxcount = 8192;
+		args.dircount = nfs3_readdir_dircount(nfs);
+		args.maxcount = nfs3_readdir_maxcount(nfs);
 
 	     	if (rpc_nfs3_readdirplus_async(nfs->rpc, nfs3_opendir_cb,
                                                &args, data) != 0) {
@@ -2832,12 +3359,24 @@ nfs3_opendir_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	if (res->READDIRPLUS3res_u.resok.dir_attributes.attributes_follow) {
 		fattr3_to_nfs_attr(&nfsdir->attr, &res->READDIRPLUS3res_u.resok.dir_attributes.post_op_attr_u.attributes);
+		nfs_attrcache_update(nfs, &nfsdir->fh, &nfsdir->attr);
         }
 
 	/* steal the dirhandle */
+	nfs_dirbuf_finish(&nfsdir->buf);
+	nfsdir->entries = nfsdir->buf.dirents;
 	nfsdir->current = nfsdir->entries;
 
-	if (lookup_missing_attributes(nfs, nfsdir, data) == 0) {
+	ret = lookup_missing_attributes(nfs, nfsdir, data);
+	if (ret < 0) {
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		nfs_free_nfsdir(nfsdir);
+		data->continue_data = NULL;
+		free_nfs_cb_data(data);
+		return;
+	}
+	if (ret == 0) {
 		data->cb(0, nfs, nfsdir, data->private_data);
 		/* We can not free data->continue_data here */
 		data->continue_data = NULL;
@@ -2855,10 +3394,14 @@ nfs3_opendir_continue_internal(struct nfs_context *nfs,
 	struct nfsdir *nfsdir = data->continue_data;
 	struct nfsdir *cached;
 
+	nfsdir->names_only = nfs->readdir_names_only;
+	nfsdir->read_time = rpc_current_time();
+
 	cached = nfs_dircache_find(nfs, &data->fh);
 	if (cached) {
 		if (attr && attr->mtime.seconds == cached->attr.mtime.seconds
-		    && attr->mtime.nseconds == cached->attr.mtime.nseconds) {
+		    && attr->mtime.nseconds == cached->attr.mtime.nseconds
+		    && (!cached->names_only || nfsdir->names_only)) {
 			cached->current = cached->entries;
 			data->cb(0, nfs, cached, data->private_data);
 			free_nfs_cb_data(data);
@@ -2880,12 +3423,32 @@ nfs3_opendir_continue_internal(struct nfs_context *nfs,
 	}
 	memcpy(nfsdir->fh.val, data->fh.val, data->fh.len);
 
+	if (nfsdir->names_only) {
+		READDIR3args rd_args;
+
+		rd_args.dir.data.data_len = data->fh.len;
+		rd_args.dir.data.data_val = data->fh.val;
+		rd_args.cookie = 0;
+		memset(&rd_args.cookieverf, 0, sizeof(cookieverf3));
+		rd_args.count = nfs3_readdir_maxcount(nfs);
+		if (rpc_nfs3_readdir_async(nfs->rpc, nfs3_opendir_2_cb,
+                                           &rd_args, data) != 0) {
+			nfs_set_error(nfs, "RPC error: Failed to send "
+                                      "READDIR call for %s", data->path);
+			data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                                 data->private_data);
+			free_nfs_cb_data(data);
+			return -1;
+		}
+		return 0;
+	}
+
 	args.dir.data.data_len = data->fh.len;
 	args.dir.data.data_val = data->fh.val;
 	args.cookie = 0;
 	memset(&args.cookieverf, 0, sizeof(cookieverf3));
-	args.dircount = 8192;
-	args.maxcount = 8192;
+	args.dircount = nfs3_readdir_dircount(nfs);
+	args.maxcount = nfs3_readdir_maxcount(nfs);
 	if (rpc_nfs3_readdirplus_async(nfs->rpc, nfs3_opendir_cb,
                                        &args, data) != 0) {
 		nfs_set_error(nfs, "RPC error: Failed to send "
@@ -2920,63 +3483,533 @@ nfs3_opendir_async(struct nfs_context *nfs, const char *path, nfs_cb cb,
 	return 0;
 }
 
-struct mknod_cb_data {
-       char *path;
-       int mode;
-       int major;
-       int minor;
-};
+/*
+ * Streaming directory reads. Only the page the application is reading
+ * and the one after it are kept, and the one after it is asked for as
+ * soon as the previous page has been handed out.
+ */
+static void
+nfs3_dirstream_free(struct nfs_dirstream *stream)
+{
+	nfs_dirbuf_free(&stream->next_buf);
+	free(stream->next_cookies);
+	free(stream->cookies);
+	free(stream->fh.val);
+	free(stream);
+}
 
 static void
-free_mknod_cb_data(void *ptr)
+free_nfsdir_stream(void *ptr)
 {
-	struct mknod_cb_data *data = ptr;
+	struct nfsdir *nfsdir = ptr;
 
-	free(data->path);
-	free(data);
+	nfs3_dirstream_free(nfsdir->stream);
+	nfsdir->stream = NULL;
+	nfs_free_nfsdir(nfsdir);
 }
 
-static void
-nfs3_mknod_cb(struct rpc_context *rpc, int status, void *command_data,
-              void *private_data)
+void
+nfs3_dirstream_close(struct nfs_context *nfs _U_, struct nfsdir *nfsdir)
 {
-	MKNOD3res *res;
-	struct nfs_cb_data *data = private_data;
-	struct nfs_context *nfs = data->nfs;
-	char *str = data->continue_data;
+	struct nfs_dirstream *stream = nfsdir->stream;
 
-	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+	nfsdir->stream = NULL;
+	nfs_free_nfsdir(nfsdir);
 
-	str = &str[strlen(str) + 1];
+	/* the reply for the next page frees the stream when it arrives */
+	if (stream->in_flight) {
+		stream->closed = 1;
+		stream->dir = NULL;
+		stream->cb = NULL;
+		return;
+	}
+	nfs3_dirstream_free(stream);
+}
 
-	if (check_nfs3_error(nfs, status, data, command_data)) {
-		free_nfs_cb_data(data);
+static int nfs3_dirstream_send(struct nfs_dirstream *stream);
+
+/* hand the next page to the caller that is waiting for it */
+static void
+nfs3_dirstream_deliver(struct nfs_dirstream *stream)
+{
+	struct nfs_context *nfs = stream->nfs;
+	struct nfsdir *nfsdir = stream->dir;
+	nfs_cb cb = stream->cb;
+	void *private_data = stream->private_data;
+	int opening = stream->opening;
+	int status, count;
+
+	stream->cb = NULL;
+	stream->opening = 0;
+
+	/* the current page is done with */
+	nfs_dirbuf_free(&nfsdir->buf);
+	free(stream->cookies);
+	nfsdir->entries = NULL;
+	nfsdir->current = NULL;
+	stream->cookies = NULL;
+	stream->start_cookie = stream->cookie;
+
+	if (!stream->next_ready) {
+		/* end of the directory */
+		cb(0, nfs, NULL, private_data);
 		return;
 	}
 
-	res = command_data;
-	if (res->status != NFS3_OK) {
-		nfs_set_error(nfs, "NFS: MKNOD of %s/%s failed with "
-                              "%s(%d)", data->saved_path, str,
-                              nfsstat3_to_str(res->status),
-                              nfsstat3_to_errno(res->status));
-		data->cb(nfsstat3_to_errno(res->status), nfs,
-                         nfs_get_error(nfs), data->private_data);
-		free_nfs_cb_data(data);
+	status = stream->next_status;
+	count = stream->next_buf.count;
+	nfsdir->buf = stream->next_buf;
+	nfsdir->entries = nfsdir->buf.dirents;
+	nfsdir->current = nfsdir->entries;
+	stream->cookies = stream->next_cookies;
+	stream->start_cookie = stream->next_start;
+	memset(&stream->next_buf, 0, sizeof(struct nfs_dirbuf));
+	stream->next_cookies = NULL;
+	stream->next_status = 0;
+	stream->next_ready = 0;
+
+	if (status < 0) {
+		cb(status, nfs, nfs_get_error(nfs), private_data);
+		if (opening) {
+			nfs3_dirstream_close(nfs, nfsdir);
+		}
 		return;
 	}
 
-	nfs_dircache_drop(nfs, &data->fh);
-	data->cb(0, nfs, NULL, data->private_data);
-	free_nfs_cb_data(data);
+	if (!stream->eof && !stream->in_flight &&
+	    nfs3_dirstream_send(stream) != 0) {
+		/* report it instead of the next page */
+		stream->next_status = -ENOMEM;
+		stream->next_ready = 1;
+		stream->eof = 1;
+	}
+
+	if (opening) {
+		cb(0, nfs, nfsdir, private_data);
+	} else {
+		cb(count, nfs, NULL, private_data);
+	}
 }
 
-static int
-nfs3_mknod_continue_internal(struct nfs_context *nfs,
-                             struct nfs_attr *attr _U_,
-                             struct nfs_cb_data *data)
+/* buf is the page if status is 0 and is then taken over by the stream */
+static void
+nfs3_dirstream_page(struct nfs_dirstream *stream, int status,
+                    struct nfs_dirbuf *buf, uint64_t *cookies)
 {
-	struct mknod_cb_data *cb_data = data->continue_data;
+	if (status == 0 && buf->count == 0 && !stream->eof) {
+		/* we would ask for the same page again forever */
+		nfs_set_error(stream->nfs, "NFS: READDIR returned no entries "
+                              "before the end of the directory");
+		status = -EIO;
+	}
+	if (status < 0) {
+		if (buf) {
+			nfs_dirbuf_free(buf);
+		}
+		free(cookies);
+		cookies = NULL;
+		stream->eof = 1;
+	} else {
+		nfs_dirbuf_finish(buf);
+		stream->next_buf = *buf;
+	}
+	stream->next_cookies = cookies;
+	stream->next_status = status;
+	stream->next_ready = 1;
+
+	if (stream->cb) {
+		nfs3_dirstream_deliver(stream);
+	}
+}
+
+static int
+nfs3_dirstream_check(struct nfs_context *nfs, int status, void *command_data)
+{
+	if (status == RPC_STATUS_ERROR) {
+		nfs_set_error(nfs, "%s", (char *)command_data);
+		return -EFAULT;
+	}
+	if (status == RPC_STATUS_CANCEL) {
+		nfs_set_error(nfs, "Command was cancelled");
+		return -EINTR;
+	}
+	if (status == RPC_STATUS_TIMEOUT) {
+		nfs_set_error(nfs, "Command timed out");
+		return -EINTR;
+	}
+	return 0;
+}
+
+static void
+nfs3_dirstream_names_cb(struct rpc_context *rpc, int status,
+                        void *command_data, void *private_data)
+{
+	READDIR3res *res = command_data;
+	struct nfs_dirstream *stream = private_data;
+	struct nfs_context *nfs = stream->nfs;
+	struct nfs_dirbuf buf;
+	struct entry3 *entry;
+	uint64_t *cookies;
+	int count = 0, err;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	stream->in_flight = 0;
+	if (stream->closed) {
+		nfs3_dirstream_free(stream);
+		return;
+	}
+
+	err = nfs3_dirstream_check(nfs, status, command_data);
+	if (err == 0 && res->status != NFS3_OK) {
+		nfs_set_error(nfs, "NFS: READDIR failed with %s(%d)",
+                              nfsstat3_to_str(res->status),
+                              nfsstat3_to_errno(res->status));
+		err = nfsstat3_to_errno(res->status);
+	}
+	if (err) {
+		nfs3_dirstream_page(stream, err, NULL, NULL);
+		return;
+	}
+
+	for (entry = res->READDIR3res_u.resok.reply.entries; entry;
+	     entry = entry->nextentry) {
+		count++;
+	}
+	cookies = malloc((count + 1) * sizeof(uint64_t));
+	if (cookies == NULL) {
+		nfs_set_error(nfs, "Failed to allocate cookies");
+		nfs3_dirstream_page(stream, -ENOMEM, NULL, NULL);
+		return;
+	}
+
+	memset(&buf, 0, sizeof(struct nfs_dirbuf));
+	count = 0;
+	for (entry = res->READDIR3res_u.resok.reply.entries; entry;
+	     entry = entry->nextentry) {
+		if (nfs_dirbuf_add(&buf, entry->name, entry->fileid) == NULL) {
+			nfs_set_error(nfs, "Failed to allocate dirent");
+			nfs3_dirstream_page(stream, -ENOMEM, &buf, cookies);
+			return;
+		}
+		cookies[count++] = entry->cookie;
+		stream->cookie = entry->cookie;
+	}
+	memcpy(&stream->cookieverf, res->READDIR3res_u.resok.cookieverf,
+               sizeof(cookieverf3));
+	stream->eof = res->READDIR3res_u.resok.reply.eof;
+
+	if (res->READDIR3res_u.resok.dir_attributes.attributes_follow) {
+		struct nfs_attr attr;
+
+		fattr3_to_nfs_attr(&attr, &res->READDIR3res_u.resok.dir_attributes.post_op_attr_u.attributes);
+		nfs_attrcache_update(nfs, &stream->fh, &attr);
+	}
+
+	nfs3_dirstream_page(stream, 0, &buf, cookies);
+}
+
+static void
+nfs3_dirstream_plus_cb(struct rpc_context *rpc, int status,
+                       void *command_data, void *private_data)
+{
+	READDIRPLUS3res *res = command_data;
+	struct nfs_dirstream *stream = private_data;
+	struct nfs_context *nfs = stream->nfs;
+	struct nfs_dirbuf buf;
+	struct entryplus3 *entry;
+	uint64_t *cookies;
+	int count = 0, err;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	stream->in_flight = 0;
+	if (stream->closed) {
+		nfs3_dirstream_free(stream);
+		return;
+	}
+
+	err = nfs3_dirstream_check(nfs, status, command_data);
+	if (err == 0 && res->status == NFS3ERR_NOTSUPP) {
+		/* carry on with READDIR, without the attributes, and do
+		 * not let the listing pass for one that has them */
+		stream->names_only = 1;
+		stream->dir->names_only = 1;
+		if (nfs3_dirstream_send(stream) == 0) {
+			return;
+		}
+		err = -ENOMEM;
+	}
+	if (err == 0 && res->status != NFS3_OK) {
+		nfs_set_error(nfs, "NFS: READDIRPLUS failed with %s(%d)",
+                              nfsstat3_to_str(res->status),
+                              nfsstat3_to_errno(res->status));
+		err = nfsstat3_to_errno(res->status);
+	}
+	if (err) {
+		nfs3_dirstream_page(stream, err, NULL, NULL);
+		return;
+	}
+
+	for (entry = res->READDIRPLUS3res_u.resok.reply.entries; entry;
+	     entry = entry->nextentry) {
+		count++;
+	}
+	cookies = malloc((count + 1) * sizeof(uint64_t));
+	if (cookies == NULL) {
+		nfs_set_error(nfs, "Failed to allocate cookies");
+		nfs3_dirstream_page(stream, -ENOMEM, NULL, NULL);
+		return;
+	}
+
+	memset(&buf, 0, sizeof(struct nfs_dirbuf));
+	count = 0;
+	for (entry = res->READDIRPLUS3res_u.resok.reply.entries; entry;
+	     entry = entry->nextentry) {
+		struct nfsdirent *nfsdirent;
+		struct nfs_attr attr;
+		struct nfs_fh fh;
+
+		nfsdirent = nfs_dirbuf_add(&buf, entry->name, entry->fileid);
+		if (nfsdirent == NULL) {
+			nfs_set_error(nfs, "Failed to allocate dirent");
+			nfs3_dirstream_page(stream, -ENOMEM, &buf, cookies);
+			return;
+		}
+		if (entry->name_attributes.attributes_follow) {
+			fattr3_to_nfs_attr(&attr, &entry->name_attributes.post_op_attr_u.attributes);
+			nfs3_attr_to_dirent(nfsdirent, &attr);
+			if (entry->name_handle.handle_follows) {
+				fh.len = entry->name_handle.post_op_fh3_u.handle.data.data_len;
+				fh.val = entry->name_handle.post_op_fh3_u.handle.data.data_val;
+				nfs_attrcache_update(nfs, &fh, &attr);
+				if (nfs->dentry_ttl || nfs->dentry_dir_ttl) {
+					nfs_dentry_add(nfs, &stream->fh,
+                                                       entry->name, &fh,
+                                                       &attr);
+				}
+			}
+		}
+		cookies[count++] = entry->cookie;
+		stream->cookie = entry->cookie;
+	}
+	memcpy(&stream->cookieverf, res->READDIRPLUS3res_u.resok.cookieverf,
+               sizeof(cookieverf3));
+	stream->eof = res->READDIRPLUS3res_u.resok.reply.eof;
+
+	if (res->READDIRPLUS3res_u.resok.dir_attributes.attributes_follow) {
+		struct nfs_attr attr;
+
+		fattr3_to_nfs_attr(&attr, &res->READDIRPLUS3res_u.resok.dir_attributes.post_op_attr_u.attributes);
+		nfs_attrcache_update(nfs, &stream->fh, &attr);
+	}
+
+	nfs3_dirstream_page(stream, 0, &buf, cookies);
+}
+
+static int
+nfs3_dirstream_send(struct nfs_dirstream *stream)
+{
+	struct nfs_context *nfs = stream->nfs;
+
+	stream->next_start = stream->cookie;
+	if (stream->names_only) {
+		READDIR3args args;
+
+		args.dir.data.data_len = stream->fh.len;
+		args.dir.data.data_val = stream->fh.val;
+		args.cookie = stream->cookie;
+		memcpy(&args.cookieverf, &stream->cookieverf,
+                       sizeof(cookieverf3));
+		args.count = nfs3_readdir_maxcount(nfs);
+		if (rpc_nfs3_readdir_async(nfs->rpc, nfs3_dirstream_names_cb,
+                                           &args, stream) != 0) {
+			nfs_set_error(nfs, "RPC error: Failed to send "
+                                      "READDIR call");
+			return -1;
+		}
+	} else {
+		READDIRPLUS3args args;
+
+		args.dir.data.data_len = stream->fh.len;
+		args.dir.data.data_val = stream->fh.val;
+		args.cookie = stream->cookie;
+		memcpy(&args.cookieverf, &stream->cookieverf,
+                       sizeof(cookieverf3));
+		args.dircount = nfs3_readdir_dircount(nfs);
+		args.maxcount = nfs3_readdir_maxcount(nfs);
+		if (rpc_nfs3_readdirplus_async(nfs->rpc,
+                                               nfs3_dirstream_plus_cb,
+                                               &args, stream) != 0) {
+			nfs_set_error(nfs, "RPC error: Failed to send "
+                                      "READDIRPLUS call");
+			return -1;
+		}
+	}
+	stream->in_flight = 1;
+	return 0;
+}
+
+static int
+nfs3_opendir_stream_continue_internal(struct nfs_context *nfs,
+                                      struct nfs_attr *attr,
+                                      struct nfs_cb_data *data)
+{
+	struct nfsdir *nfsdir = data->continue_data;
+	struct nfs_dirstream *stream = nfsdir->stream;
+
+	if (attr && attr->type != NF3DIR) {
+		nfs_set_error(nfs, "NFS: %s is not a directory",
+                              data->saved_path);
+		data->cb(-ENOTDIR, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		free_nfs_cb_data(data);
+		return -1;
+	}
+
+	stream->fh.len = data->fh.len;
+	stream->fh.val = malloc(stream->fh.len);
+	if (stream->fh.val == NULL) {
+		nfs_set_error(nfs, "OOM when allocating fh for nfsdir");
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		free_nfs_cb_data(data);
+		return -1;
+	}
+	memcpy(stream->fh.val, data->fh.val, data->fh.len);
+
+	if (nfs3_dirstream_send(stream) != 0) {
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		free_nfs_cb_data(data);
+		return -1;
+	}
+
+	/* the stream calls back once the first page is here */
+	stream->opening = 1;
+	stream->cb = data->cb;
+	stream->private_data = data->private_data;
+	data->continue_data = NULL;
+	free_nfs_cb_data(data);
+	return 0;
+}
+
+int
+nfs3_opendir_stream_async(struct nfs_context *nfs, const char *path,
+                          uint64_t cookie, nfs_cb cb, void *private_data)
+{
+	struct nfsdir *nfsdir;
+	struct nfs_dirstream *stream;
+
+	nfsdir = malloc(sizeof(struct nfsdir));
+	if (nfsdir == NULL) {
+		nfs_set_error(nfs, "failed to allocate buffer for nfsdir");
+		return -1;
+	}
+	memset(nfsdir, 0, sizeof(struct nfsdir));
+
+	stream = malloc(sizeof(struct nfs_dirstream));
+	if (stream == NULL) {
+		nfs_set_error(nfs, "failed to allocate buffer for nfsdir");
+		free(nfsdir);
+		return -1;
+	}
+	memset(stream, 0, sizeof(struct nfs_dirstream));
+	stream->nfs = nfs;
+	stream->dir = nfsdir;
+	stream->cookie = cookie;
+	stream->start_cookie = cookie;
+	stream->names_only = nfs->readdir_names_only;
+	nfsdir->stream = stream;
+	nfsdir->names_only = stream->names_only;
+
+	if (nfs3_lookuppath_async(nfs, path, 0, cb, private_data,
+                                  nfs3_opendir_stream_continue_internal,
+                                  nfsdir, free_nfsdir_stream, 0) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+nfs3_readdir_next_page_async(struct nfs_context *nfs, struct nfsdir *nfsdir,
+                             nfs_cb cb, void *private_data)
+{
+	struct nfs_dirstream *stream = nfsdir->stream;
+
+	if (stream->cb) {
+		nfs_set_error(nfs, "The next page of the directory has "
+                              "already been asked for");
+		return -1;
+	}
+	stream->cb = cb;
+	stream->private_data = private_data;
+	if (stream->next_ready || !stream->in_flight) {
+		nfs3_dirstream_deliver(stream);
+	}
+	return 0;
+}
+
+struct mknod_cb_data {
+       char *path;
+       int mode;
+       int major;
+       int minor;
+};
+
+static void
+free_mknod_cb_data(void *ptr)
+{
+	struct mknod_cb_data *data = ptr;
+
+	free(data->path);
+	free(data);
+}
+
+static void
+nfs3_mknod_cb(struct rpc_context *rpc, int status, void *command_data,
+              void *private_data)
+{
+	MKNOD3res *res;
+	struct nfs_cb_data *data = private_data;
+	struct nfs_context *nfs = data->nfs;
+	char *str = data->continue_data;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	str = &str[strlen(str) + 1];
+
+	nfs_dentry_drop(nfs, &data->fh, str);
+
+	if (check_nfs3_error(nfs, status, data, command_data)) {
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	res = command_data;
+	if (res->status != NFS3_OK) {
+		nfs_set_error(nfs, "NFS: MKNOD of %s/%s failed with "
+                              "%s(%d)", data->saved_path, str,
+                              nfsstat3_to_str(res->status),
+                              nfsstat3_to_errno(res->status));
+		data->cb(nfsstat3_to_errno(res->status), nfs,
+                         nfs_get_error(nfs), data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	nfs_dircache_drop(nfs, &data->fh);
+	data->cb(0, nfs, NULL, data->private_data);
+	free_nfs_cb_data(data);
+}
+
+static int
+nfs3_mknod_continue_internal(struct nfs_context *nfs,
+                             struct nfs_attr *attr _U_,
+                             struct nfs_cb_data *data)
+{
+	struct mknod_cb_data *cb_data = data->continue_data;
 	char *str = cb_data->path;
 	MKNOD3args args;
 
@@ -3091,6 +4124,9 @@ nfs3_unlink_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	str = &str[strlen(str) + 1];
 
+	/* whatever happened, the name may no longer be what we cached */
+	nfs_dentry_drop(nfs, &data->fh, str);
+
 	if (check_nfs3_error(nfs, status, data, command_data)) {
 		free_nfs_cb_data(data);
 		return;
@@ -3203,7 +4239,7 @@ nfs3_create_trunc_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	if (check_nfs3_error(nfs, status, data, command_data)) {
 		free_nfs_cb_data(data);
-		nfs_free_nfsfh(nfsfh);
+		nfs_free_nfsfh(nfs, nfsfh);
 		return;
 	}
 
@@ -3215,10 +4251,11 @@ nfs3_create_trunc_cb(struct rpc_context *rpc, int status, void *command_data,
 		data->cb(nfsstat3_to_errno(res->status), nfs,
                          nfs_get_error(nfs), data->private_data);
 		free_nfs_cb_data(data);
-		nfs_free_nfsfh(nfsfh);
+		nfs_free_nfsfh(nfs, nfsfh);
 		return;
 	}
 
+	nfs3_update_inode_wcc(nfs, data, &res->SETATTR3res_u.resok.obj_wcc);
 	nfs_dircache_drop(nfs, &data->fh);
 	data->cb(0, nfs, nfsfh, data->private_data);
 	free_nfs_cb_data(data);
@@ -3271,6 +4308,8 @@ nfs3_create_2_cb(struct rpc_context *rpc, int status, void *command_data,
 	if (cb_data->flags & O_APPEND) {
 		nfsfh->is_append = 1;
 	}
+	nfsfh->writeback = nfs->writeback;
+	nfs3_set_eof(nfsfh, &res->LOOKUP3res_u.resok.obj_attributes);
 
 	/* copy the filehandle */
 	nfsfh->fh.len = res->LOOKUP3res_u.resok.object.data.data_len;
@@ -3306,7 +4345,7 @@ nfs3_create_2_cb(struct rpc_context *rpc, int status, void *command_data,
 			data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
 				data->private_data);
 			free_nfs_cb_data(data);
-			nfs_free_nfsfh(nfsfh);
+			nfs_free_nfsfh(nfs, nfsfh);
 			return;
 		}
 		return;
@@ -3348,6 +4387,10 @@ nfs3_create_1_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
+	nfs3_dentry_add_created(nfs, &data->fh, str,
+                                &res->CREATE3res_u.resok.obj,
+                                &res->CREATE3res_u.resok.obj_attributes);
+
 	memset(&args, 0, sizeof(LOOKUP3args));
 	args.what.dir.data.data_len = data->fh.len;
 	args.what.dir.data.data_val = data->fh.val;
@@ -3457,6 +4500,9 @@ nfs3_rmdir_cb(struct rpc_context *rpc, int status, void *command_data,
 
 	str = &str[strlen(str) + 1];
 
+	/* whatever happened, the name may no longer be what we cached */
+	nfs_dentry_drop(nfs, &data->fh, str);
+
 	if (check_nfs3_error(nfs, status, data, command_data)) {
 		free_nfs_cb_data(data);
 		return;
@@ -3572,6 +4618,9 @@ nfs3_mkdir_cb(struct rpc_context *rpc, int status, void *command_data,
 	}
 
 	nfs_dircache_drop(nfs, &data->fh);
+	nfs3_dentry_add_created(nfs, &data->fh, str,
+                                &res->MKDIR3res_u.resok.obj,
+                                &res->MKDIR3res_u.resok.obj_attributes);
 	data->cb(0, nfs, NULL, data->private_data);
 	free_nfs_cb_data(data);
 }
@@ -3643,28 +4692,20 @@ nfs3_mkdir2_async(struct nfs_context *nfs, const char *path, int mode,
 	return 0;
 }
 
+static int
+nfs3_ftruncate_continue_internal(struct nfs_context *nfs,
+                                 struct nfs_attr *attr _U_,
+                                 struct nfs_cb_data *data);
+
 static int
 nfs3_truncate_continue_internal(struct nfs_context *nfs,
                                 struct nfs_attr *attr _U_,
                                 struct nfs_cb_data *data)
 {
-	uint64_t offset = data->continue_int;
-	struct nfsfh nfsfh;
-
-        memset(&nfsfh, 0, sizeof(struct nfsfh));
-	nfsfh.fh = data->fh;
-
-	if (nfs_ftruncate_async(nfs, &nfsfh, offset, data->cb,
-                                data->private_data) != 0) {
-		nfs_set_error(nfs, "RPC error: Failed to send SETATTR "
-                              "call for %s", data->path);
-		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
-                         data->private_data);
-		free_nfs_cb_data(data);
-		return -1;
-	}
-	free_nfs_cb_data(data);
-	return 0;
+	/* data->fh is the file and data->continue_int the new size, we
+	 * have no handle of our own for the file */
+	data->nfsfh = NULL;
+	return nfs3_ftruncate_continue_internal(nfs, NULL, data);
 }
 
 int
@@ -3711,35 +4752,49 @@ nfs3_ftruncate_cb(struct rpc_context *rpc, int status, void *command_data,
 	}
 
 	nfs_dircache_drop(nfs, &data->fh);
+	nfs3_update_inode_wcc(nfs, data, &res->SETATTR3res_u.resok.obj_wcc);
 	data->cb(0, nfs, NULL, data->private_data);
 	free_nfs_cb_data(data);
 }
 
-int
-nfs3_ftruncate_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
-                     uint64_t length, nfs_cb cb, void *private_data)
+static int
+nfs3_ftruncate_continue_internal(struct nfs_context *nfs,
+                                 struct nfs_attr *attr _U_,
+                                 struct nfs_cb_data *data)
 {
-	struct nfs_cb_data *data;
+	struct nfsfh *nfsfh = data->nfsfh;
+	struct nfsfh *busy;
 	SETATTR3args args;
 
-	nfs_pagecache_invalidate(nfs, nfsfh);
-	data = malloc(sizeof(struct nfs_cb_data));
-	if (data == NULL) {
-		nfs_set_error(nfs, "out of memory: failed to allocate "
-                              "nfs_cb_data structure");
-		return -1;
+	/* buffered writes must reach the server before the truncate, also
+	 * those on the other handles of the file or they would extend it
+	 * again afterwards */
+	busy = nfs3_writeback_busy_fh(nfs, &data->fh);
+	if (busy) {
+		return nfs3_writeback_defer(nfs, busy,
+                                            nfs3_ftruncate_continue_internal,
+                                            data);
+	}
+	if (nfsfh) {
+		nfsfh->eof_valid = 0;
+		nfs_pagecache_invalidate(nfs, nfsfh);
+	} else {
+		struct nfsfh tmp;
+
+		memset(&tmp, 0, sizeof(struct nfsfh));
+		tmp.fh = data->fh;
+		nfs_pagecache_invalidate(nfs, &tmp);
 	}
-	memset(data, 0, sizeof(struct nfs_cb_data));
-	data->nfs          = nfs;
-	data->cb           = cb;
-	data->private_data = private_data;
 
 	memset(&args, 0, sizeof(SETATTR3args));
-	args.object.data.data_len = nfsfh->fh.len;
-	args.object.data.data_val = nfsfh->fh.val;
+	args.object.data.data_len = data->fh.len;
+	args.object.data.data_val = data->fh.val;
 	args.new_attributes.size.set_it = 1;
-	args.new_attributes.size.set_size3_u.size = length;
+	args.new_attributes.size.set_size3_u.size = data->continue_int;
 
+	/* the handle may be closed before the reply arrives, it finds the
+	 * inode through data->fh */
+	data->nfsfh = NULL;
 	if (rpc_nfs3_setattr_async(nfs->rpc, nfs3_ftruncate_cb,
                                    &args, data) != 0) {
 		nfs_set_error(nfs, "RPC error: Failed to send SETATTR "
@@ -3747,27 +4802,76 @@ nfs3_ftruncate_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
 		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
                          data->private_data);
 		free_nfs_cb_data(data);
-		return -1;
 	}
 	return 0;
 }
 
+int
+nfs3_ftruncate_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                     uint64_t length, nfs_cb cb, void *private_data)
+{
+	struct nfs_cb_data *data;
+
+	data = malloc(sizeof(struct nfs_cb_data));
+	if (data == NULL) {
+		nfs_set_error(nfs, "out of memory: failed to allocate "
+                              "nfs_cb_data structure");
+		return -1;
+	}
+	memset(data, 0, sizeof(struct nfs_cb_data));
+	data->nfs          = nfs;
+	data->cb           = cb;
+	data->private_data = private_data;
+	data->fh.len = nfsfh->fh.len;
+	data->fh.val = malloc(data->fh.len);
+	if (data->fh.val == NULL) {
+		nfs_set_error(nfs, "Out of memory: Failed to allocate fh");
+		free_nfs_cb_data(data);
+		return -1;
+	}
+	memcpy(data->fh.val, nfsfh->fh.val, data->fh.len);
+	data->nfsfh        = nfsfh;
+	data->continue_int = length;
+
+	return nfs3_ftruncate_continue_internal(nfs, NULL, data);
+}
+
+/* completion of a COMMIT we sent on our own to limit uncommitted data */
+static void
+nfs3_writeback_commit_cb(int err _U_, struct nfs_context *nfs _U_,
+                         void *data _U_, void *private_data _U_)
+{
+}
+
+static int
+nfs3_fsync_continue_internal(struct nfs_context *nfs,
+                             struct nfs_attr *attr _U_,
+                             struct nfs_cb_data *data);
+
 static void
 nfs3_fsync_cb(struct rpc_context *rpc, int status, void *command_data,
               void *private_data)
 {
 	struct nfs_cb_data *data = private_data;
 	struct nfs_context *nfs = data->nfs;
-	COMMIT3res *res;
+	struct nfs_writeback *wb = data->nfsfh->wb;
+	COMMIT3res *res = command_data;
+	int replay = 0;
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
+	if (wb) {
+		replay = nfs3_writeback_commit_done(nfs, wb,
+                        (status == RPC_STATUS_SUCCESS &&
+                         res->status == NFS3_OK) ?
+                        res->COMMIT3res_u.resok.verf : NULL);
+	}
+
 	if (check_nfs3_error(nfs, status, data, command_data)) {
 		free_nfs_cb_data(data);
 		return;
 	}
 
-	res = command_data;
 	if (res->status != NFS3_OK) {
 		nfs_set_error(nfs, "NFS: Commit failed with %s(%d)",
                               nfsstat3_to_str(res->status),
@@ -3778,16 +4882,99 @@ nfs3_fsync_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
+	nfs3_update_inode_wcc(nfs, data, &res->COMMIT3res_u.resok.file_wcc);
+
+	if (replay && data->cb != nfs3_writeback_commit_cb) {
+		/* the server rebooted and the data is being written again,
+		 * commit it once that is done */
+		if (++data->continue_int > NFS_WB_COMMIT_RETRIES) {
+			nfs_set_error(nfs, "NFS: Server lost uncommitted data "
+                                      "%d times", NFS_WB_COMMIT_RETRIES);
+			data->cb(-EIO, nfs, nfs_get_error(nfs),
+                                 data->private_data);
+			free_nfs_cb_data(data);
+			return;
+		}
+		nfs3_writeback_defer(nfs, data->nfsfh,
+                                     nfs3_fsync_continue_internal, data);
+		return;
+	}
 	data->cb(0, nfs, NULL, data->private_data);
 	free_nfs_cb_data(data);
 }
 
+/*
+ * Send a COMMIT for everything the handle has written UNSTABLE so far.
+ * WRITEs that complete after this are covered by the next COMMIT.
+ * If the COMMIT can not be sent the callback is invoked with an error,
+ * the callback is always called so this returns 0.
+ */
+static int
+nfs3_writeback_commit(struct nfs_context *nfs, struct nfs_cb_data *data)
+{
+	struct nfsfh *nfsfh = data->nfsfh;
+	struct nfs_writeback *wb = nfsfh->wb;
+	struct COMMIT3args args;
+
+	args.file.data.data_len = nfsfh->fh.len;
+	args.file.data.data_val = nfsfh->fh.val;
+	args.offset = 0;
+	args.count = 0;
+	if (rpc_nfs3_commit_async(nfs->rpc, nfs3_fsync_cb, &args, data) != 0) {
+		nfs_set_error(nfs, "RPC error: Failed to send COMMIT "
+                              "call for %s", data->path);
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		free_nfs_cb_data(data);
+		return 0;
+	}
+
+	wb->committing = wb->unstable;
+	wb->unstable = NULL;
+	wb->unstable_bytes = 0;
+	wb->commit_replay = wb->verf_changed;
+	wb->verf_changed = 0;
+	memcpy(wb->commit_verf, wb->verf, NFS3_WRITEVERFSIZE);
+	return 0;
+}
+
+static int
+nfs3_fsync_continue_internal(struct nfs_context *nfs,
+                             struct nfs_attr *attr _U_,
+                             struct nfs_cb_data *data)
+{
+	struct nfsfh *nfsfh = data->nfsfh;
+	int err;
+
+	if (nfs3_writeback_busy(nfsfh)) {
+		return nfs3_writeback_defer(nfs, nfsfh,
+                                            nfs3_fsync_continue_internal,
+                                            data);
+	}
+	if (nfsfh->wb && nfsfh->wb->error) {
+		err = nfsfh->wb->error;
+		nfsfh->wb->error = 0;
+		nfs_set_error(nfs, "NFS: Failed to write cached data to "
+                              "the server");
+		data->cb(err, nfs, nfs_get_error(nfs), data->private_data);
+		free_nfs_cb_data(data);
+		return 0;
+	}
+	if (nfsfh->wb == NULL || nfsfh->wb->unstable == NULL) {
+		/* nothing has been written UNSTABLE since the last COMMIT */
+		data->cb(0, nfs, NULL, data->private_data);
+		free_nfs_cb_data(data);
+		return 0;
+	}
+
+	return nfs3_writeback_commit(nfs, data);
+}
+
 int
 nfs3_fsync_async(struct nfs_context *nfs, struct nfsfh *nfsfh, nfs_cb cb,
                  void *private_data)
 {
 	struct nfs_cb_data *data;
-	struct COMMIT3args args;
 
 	data = malloc(sizeof(struct nfs_cb_data));
 	if (data == NULL) {
@@ -3799,20 +4986,66 @@ nfs3_fsync_async(struct nfs_context *nfs, struct nfsfh *nfsfh, nfs_cb cb,
 	data->nfs          = nfs;
 	data->cb           = cb;
 	data->private_data = private_data;
+	data->nfsfh        = nfsfh;
 
-	args.file.data.data_len = nfsfh->fh.len;
-	args.file.data.data_val = nfsfh->fh.val;
-	args.offset = 0;
-	args.count = 0;
-	if (rpc_nfs3_commit_async(nfs->rpc, nfs3_fsync_cb, &args, data) != 0) {
-		nfs_set_error(nfs, "RPC error: Failed to send COMMIT "
-                              "call for %s", data->path);
-		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
-                         data->private_data);
-		free_nfs_cb_data(data);
-		return -1;
+	return nfs3_fsync_continue_internal(nfs, NULL, data);
+}
+
+#ifdef WIN32
+static void
+nfs3_attr_to_stat(struct __stat64 *stp, struct nfs_attr *attr)
+#else
+static void
+nfs3_attr_to_stat(struct stat *stp, struct nfs_attr *attr)
+#endif
+{
+	struct specdata3 rdev;
+
+	rdev.specdata1 = attr->rdev.specdata1;
+	rdev.specdata2 = attr->rdev.specdata2;
+	stp->st_dev     = (dev_t)attr->fsid;
+        stp->st_ino     = (ino_t)attr->fileid;
+        stp->st_mode    = attr->mode;
+	switch (attr->type) {
+	case NF3REG:
+		stp->st_mode |= S_IFREG;
+		break;
+	case NF3DIR:
+		stp->st_mode |= S_IFDIR;
+		break;
+	case NF3BLK:
+		stp->st_mode |= S_IFBLK;
+		break;
+	case NF3CHR:
+		stp->st_mode |= S_IFCHR;
+		break;
+	case NF3LNK:
+		stp->st_mode |= S_IFLNK;
+		break;
+	case NF3SOCK:
+		stp->st_mode |= S_IFSOCK;
+		break;
+	case NF3FIFO:
+		stp->st_mode |= S_IFIFO;
+		break;
 	}
-	return 0;
+        stp->st_nlink   = attr->nlink;
+        stp->st_uid     = attr->uid;
+        stp->st_gid     = attr->gid;
+	stp->st_rdev    = specdata3_to_rdev(&rdev);
+        stp->st_size    = attr->size;
+#ifndef WIN32
+        stp->st_blksize = NFS_BLKSIZE;
+	stp->st_blocks  = (attr->used + 512 - 1) / 512;
+#endif//WIN32
+        stp->st_atime   = attr->atime.seconds;
+        stp->st_mtime   = attr->mtime.seconds;
+        stp->st_ctime   = attr->ctime.seconds;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	stp->st_atim.tv_nsec = attr->atime.nseconds;
+	stp->st_mtim.tv_nsec = attr->mtime.nseconds;
+	stp->st_ctim.tv_nsec = attr->ctime.nseconds;
+#endif
 }
 
 static void
@@ -3822,6 +5055,7 @@ nfs3_stat_1_cb(struct rpc_context *rpc, int status, void *command_data,
 	GETATTR3res *res;
 	struct nfs_cb_data *data = private_data;
 	struct nfs_context *nfs = data->nfs;
+	struct nfs_attr attr;
 #ifdef WIN32
   struct __stat64 st;
 #else
@@ -3847,52 +5081,66 @@ nfs3_stat_1_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
-	st.st_dev     = (dev_t)res->GETATTR3res_u.resok.obj_attributes.fsid;
-        st.st_ino     = (ino_t)res->GETATTR3res_u.resok.obj_attributes.fileid;
-        st.st_mode    = res->GETATTR3res_u.resok.obj_attributes.mode;
-	switch (res->GETATTR3res_u.resok.obj_attributes.type) {
-	case NF3REG:
-		st.st_mode |= S_IFREG;
-		break;
-	case NF3DIR:
-		st.st_mode |= S_IFDIR;
-		break;
-	case NF3BLK:
-		st.st_mode |= S_IFBLK;
-		break;
-	case NF3CHR:
-		st.st_mode |= S_IFCHR;
-		break;
-	case NF3LNK:
-		st.st_mode |= S_IFLNK;
-		break;
-	case NF3SOCK:
-		st.st_mode |= S_IFSOCK;
-		break;
-	case NF3FIFO:
-		st.st_mode |= S_IFIFO;
-		break;
-	}
-        st.st_nlink   = res->GETATTR3res_u.resok.obj_attributes.nlink;
-        st.st_uid     = res->GETATTR3res_u.resok.obj_attributes.uid;
-        st.st_gid     = res->GETATTR3res_u.resok.obj_attributes.gid;
-	st.st_rdev    = specdata3_to_rdev(&res->GETATTR3res_u.resok.obj_attributes.rdev);
-        st.st_size    = res->GETATTR3res_u.resok.obj_attributes.size;
-#ifndef WIN32
-        st.st_blksize = NFS_BLKSIZE;
-	st.st_blocks  = (res->GETATTR3res_u.resok.obj_attributes.used + 512 - 1) / 512;
-#endif//WIN32
-        st.st_atime   = res->GETATTR3res_u.resok.obj_attributes.atime.seconds;
-        st.st_mtime   = res->GETATTR3res_u.resok.obj_attributes.mtime.seconds;
-        st.st_ctime   = res->GETATTR3res_u.resok.obj_attributes.ctime.seconds;
-#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
-	st.st_atim.tv_nsec = res->GETATTR3res_u.resok.obj_attributes.atime.nseconds;
-	st.st_mtim.tv_nsec = res->GETATTR3res_u.resok.obj_attributes.mtime.nseconds;
-	st.st_ctim.tv_nsec = res->GETATTR3res_u.resok.obj_attributes.ctime.nseconds;
+	nfs3_revalidate_inode(nfs, data,
+                              &res->GETATTR3res_u.resok.obj_attributes);
+	fattr3_to_nfs_attr(&attr, &res->GETATTR3res_u.resok.obj_attributes);
+	nfs3_attr_to_stat(&st, &attr);
+
+	data->cb(0, nfs, &st, data->private_data);
+	free_nfs_cb_data(data);
+}
+
+/* answer a stat from the attribute cache if we can */
+static int
+nfs3_stat_cached(struct nfs_context *nfs, struct nfs_fh *fh,
+                 struct nfs_cb_data *data)
+{
+	struct nfs_attr *attr = nfs_attrcache_find(nfs, fh);
+#ifdef WIN32
+	struct __stat64 st;
+#else
+	struct stat st;
 #endif
 
+	if (attr == NULL) {
+		return 0;
+	}
+	nfs3_attr_to_stat(&st, attr);
 	data->cb(0, nfs, &st, data->private_data);
 	free_nfs_cb_data(data);
+	return 1;
+}
+
+static int
+nfs3_fstat_continue_internal(struct nfs_context *nfs,
+                             struct nfs_attr *attr _U_,
+                             struct nfs_cb_data *data)
+{
+	struct nfsfh *nfsfh = data->nfsfh;
+	struct GETATTR3args args;
+
+	/* make sure the size includes the data we have buffered */
+	if (nfs3_writeback_busy(nfsfh)) {
+		return nfs3_writeback_defer(nfs, nfsfh,
+                                            nfs3_fstat_continue_internal,
+                                            data);
+	}
+	if (nfs3_stat_cached(nfs, &nfsfh->fh, data)) {
+		return 0;
+	}
+
+	memset(&args, 0, sizeof(GETATTR3args));
+	args.object.data.data_len = nfsfh->fh.len;
+	args.object.data.data_val = nfsfh->fh.val;
+
+	if (rpc_nfs3_getattr_async(nfs->rpc, nfs3_stat_1_cb, &args,
+                                   data) != 0) {
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		free_nfs_cb_data(data);
+		return -1;
+	}
+	return 0;
 }
 
 int
@@ -3900,7 +5148,6 @@ nfs3_fstat_async(struct nfs_context *nfs, struct nfsfh *nfsfh, nfs_cb cb,
                  void *private_data)
 {
 	struct nfs_cb_data *data;
-	struct GETATTR3args args;
 
 	data = malloc(sizeof(struct nfs_cb_data));
 	if (data == NULL) {
@@ -3912,19 +5159,74 @@ nfs3_fstat_async(struct nfs_context *nfs, struct nfsfh *nfsfh, nfs_cb cb,
 	data->nfs          = nfs;
 	data->cb           = cb;
 	data->private_data = private_data;
+	data->nfsfh        = nfsfh;
 
-	memset(&args, 0, sizeof(GETATTR3args));
-	args.object.data.data_len = nfsfh->fh.len;
-	args.object.data.data_val = nfsfh->fh.val;
+	return nfs3_fstat_continue_internal(nfs, NULL, data);
+}
 
-	if (rpc_nfs3_getattr_async(nfs->rpc, nfs3_stat_1_cb, &args,
-                                   data) != 0) {
-		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
-                         data->private_data);
-		free_nfs_cb_data(data);
-		return -1;
+static void
+nfs3_attr_to_stat64(struct nfs_stat_64 *stp, struct nfs_attr *attr)
+{
+	struct specdata3 rdev;
+
+	rdev.specdata1 = attr->rdev.specdata1;
+	rdev.specdata2 = attr->rdev.specdata2;
+	stp->nfs_dev     = attr->fsid;
+        stp->nfs_ino     = attr->fileid;
+        stp->nfs_mode    = attr->mode;
+	switch (attr->type) {
+	case NF3REG:
+		stp->nfs_mode |= S_IFREG;
+		break;
+	case NF3DIR:
+		stp->nfs_mode |= S_IFDIR;
+		break;
+	case NF3BLK:
+		stp->nfs_mode |= S_IFBLK;
+		break;
+	case NF3CHR:
+		stp->nfs_mode |= S_IFCHR;
+		break;
+	case NF3LNK:
+		stp->nfs_mode |= S_IFLNK;
+		break;
+	case NF3SOCK:
+		stp->nfs_mode |= S_IFSOCK;
+		break;
+	case NF3FIFO:
+		stp->nfs_mode |= S_IFIFO;
+		break;
 	}
-	return 0;
+        stp->nfs_nlink   = attr->nlink;
+        stp->nfs_uid     = attr->uid;
+        stp->nfs_gid     = attr->gid;
+	stp->nfs_rdev    = specdata3_to_rdev(&rdev);
+        stp->nfs_size    = attr->size;
+	stp->nfs_blksize = NFS_BLKSIZE;
+	stp->nfs_blocks  = (attr->used + 512 - 1) / 512;
+        stp->nfs_atime   = attr->atime.seconds;
+        stp->nfs_mtime   = attr->mtime.seconds;
+        stp->nfs_ctime   = attr->ctime.seconds;
+	stp->nfs_atime_nsec = attr->atime.nseconds;
+	stp->nfs_mtime_nsec = attr->mtime.nseconds;
+	stp->nfs_ctime_nsec = attr->ctime.nseconds;
+	stp->nfs_used    = attr->used;
+}
+
+static int
+nfs3_stat64_cached(struct nfs_context *nfs, struct nfs_fh *fh,
+                   struct nfs_cb_data *data)
+{
+	struct nfs_attr *attr = nfs_attrcache_find(nfs, fh);
+	struct nfs_stat_64 st;
+
+	if (attr == NULL) {
+		return 0;
+	}
+	nfs3_attr_to_stat64(&st, attr);
+	data->cb(0, nfs, &st, data->private_data);
+	free_nfs_cb_data(data);
+	return 1;
 }
 
 static void
@@ -3935,6 +5237,7 @@ nfs3_stat64_1_cb(struct rpc_context *rpc, int status, void *command_data,
 	struct nfs_cb_data *data = private_data;
 	struct nfs_context *nfs = data->nfs;
 	struct nfs_stat_64 st;
+	struct nfs_attr attr;
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
@@ -3955,46 +5258,10 @@ nfs3_stat64_1_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
-	st.nfs_dev     = res->GETATTR3res_u.resok.obj_attributes.fsid;
-        st.nfs_ino     = res->GETATTR3res_u.resok.obj_attributes.fileid;
-        st.nfs_mode    = res->GETATTR3res_u.resok.obj_attributes.mode;
-	switch (res->GETATTR3res_u.resok.obj_attributes.type) {
-	case NF3REG:
-		st.nfs_mode |= S_IFREG;
-		break;
-	case NF3DIR:
-		st.nfs_mode |= S_IFDIR;
-		break;
-	case NF3BLK:
-		st.nfs_mode |= S_IFBLK;
-		break;
-	case NF3CHR:
-		st.nfs_mode |= S_IFCHR;
-		break;
-	case NF3LNK:
-		st.nfs_mode |= S_IFLNK;
-		break;
-	case NF3SOCK:
-		st.nfs_mode |= S_IFSOCK;
-		break;
-	case NF3FIFO:
-		st.nfs_mode |= S_IFIFO;
-		break;
-	}
-        st.nfs_nlink   = res->GETATTR3res_u.resok.obj_attributes.nlink;
-        st.nfs_uid     = res->GETATTR3res_u.resok.obj_attributes.uid;
-        st.nfs_gid     = res->GETATTR3res_u.resok.obj_attributes.gid;
-	st.nfs_rdev    = specdata3_to_rdev(&res->GETATTR3res_u.resok.obj_attributes.rdev);
-        st.nfs_size    = res->GETATTR3res_u.resok.obj_attributes.size;
-	st.nfs_blksize = NFS_BLKSIZE;
-	st.nfs_blocks  = (res->GETATTR3res_u.resok.obj_attributes.used + 512 - 1) / 512;
-        st.nfs_atime   = res->GETATTR3res_u.resok.obj_attributes.atime.seconds;
-        st.nfs_mtime   = res->GETATTR3res_u.resok.obj_attributes.mtime.seconds;
-        st.nfs_ctime   = res->GETATTR3res_u.resok.obj_attributes.ctime.seconds;
-	st.nfs_atime_nsec = res->GETATTR3res_u.resok.obj_attributes.atime.nseconds;
-	st.nfs_mtime_nsec = res->GETATTR3res_u.resok.obj_attributes.mtime.nseconds;
-	st.nfs_ctime_nsec = res->GETATTR3res_u.resok.obj_attributes.ctime.nseconds;
-	st.nfs_used    = res->GETATTR3res_u.resok.obj_attributes.used;
+	nfs3_revalidate_inode(nfs, data,
+                              &res->GETATTR3res_u.resok.obj_attributes);
+	fattr3_to_nfs_attr(&attr, &res->GETATTR3res_u.resok.obj_attributes);
+	nfs3_attr_to_stat64(&st, &attr);
 
 	data->cb(0, nfs, &st, data->private_data);
 	free_nfs_cb_data(data);
@@ -4007,6 +5274,10 @@ nfs3_stat64_continue_internal(struct nfs_context *nfs,
 {
 	struct GETATTR3args args;
 
+	if (nfs3_stat64_cached(nfs, &data->fh, data)) {
+		return 0;
+	}
+
 	memset(&args, 0, sizeof(GETATTR3args));
 	args.object.data.data_len = data->fh.len;
 	args.object.data.data_val = data->fh.val;
@@ -4034,23 +5305,23 @@ nfs3_stat64_async(struct nfs_context *nfs, const char *path,
 	return 0;
 }
 
-int
-nfs3_fstat64_async(struct nfs_context *nfs, struct nfsfh *nfsfh, nfs_cb cb,
-                   void *private_data)
-{
-	struct nfs_cb_data *data;
+static int
+nfs3_fstat64_continue_internal(struct nfs_context *nfs,
+                               struct nfs_attr *attr _U_,
+                               struct nfs_cb_data *data)
+{
+	struct nfsfh *nfsfh = data->nfsfh;
 	struct GETATTR3args args;
 
-	data = malloc(sizeof(struct nfs_cb_data));
-	if (data == NULL) {
-		nfs_set_error(nfs, "out of memory: failed to allocate "
-                              "nfs_cb_data structure");
-		return -1;
+	/* make sure the size includes the data we have buffered */
+	if (nfs3_writeback_busy(nfsfh)) {
+		return nfs3_writeback_defer(nfs, nfsfh,
+                                            nfs3_fstat64_continue_internal,
+                                            data);
+	}
+	if (nfs3_stat64_cached(nfs, &nfsfh->fh, data)) {
+		return 0;
 	}
-	memset(data, 0, sizeof(struct nfs_cb_data));
-	data->nfs          = nfs;
-	data->cb           = cb;
-	data->private_data = private_data;
 
 	memset(&args, 0, sizeof(GETATTR3args));
 	args.object.data.data_len = nfsfh->fh.len;
@@ -4066,6 +5337,27 @@ nfs3_fstat64_async(struct nfs_context *nfs, struct nfsfh *nfsfh, nfs_cb cb,
 	return 0;
 }
 
+int
+nfs3_fstat64_async(struct nfs_context *nfs, struct nfsfh *nfsfh, nfs_cb cb,
+                   void *private_data)
+{
+	struct nfs_cb_data *data;
+
+	data = malloc(sizeof(struct nfs_cb_data));
+	if (data == NULL) {
+		nfs_set_error(nfs, "out of memory: failed to allocate "
+                              "nfs_cb_data structure");
+		return -1;
+	}
+	memset(data, 0, sizeof(struct nfs_cb_data));
+	data->nfs          = nfs;
+	data->cb           = cb;
+	data->private_data = private_data;
+	data->nfsfh        = nfsfh;
+
+	return nfs3_fstat64_continue_internal(nfs, NULL, data);
+}
+
 static int
 nfs3_stat_continue_internal(struct nfs_context *nfs,
                             struct nfs_attr *attr _U_,
@@ -4073,6 +5365,10 @@ nfs3_stat_continue_internal(struct nfs_context *nfs,
 {
 	struct GETATTR3args args;
 
+	if (nfs3_stat_cached(nfs, &data->fh, data)) {
+		return 0;
+	}
+
 	memset(&args, 0, sizeof(GETATTR3args));
 	args.object.data.data_len = data->fh.len;
 	args.object.data.data_val = data->fh.val;
@@ -4104,7 +5400,7 @@ static void
 nfs3_close_cb(int err, struct nfs_context *nfs, void *ret_data,
               void *private_data) {
         struct nfs_cb_data *data = private_data;
-        nfs_free_nfsfh(data->nfsfh);
+        nfs_free_nfsfh(nfs, data->nfsfh);
         data->cb(err, nfs, ret_data, data->private_data);
         free_nfs_cb_data(data);
 }
@@ -4137,6 +5433,7 @@ nfs3_write_append_cb(struct rpc_context *rpc, int status, void *command_data,
 	struct nfs_cb_data *data = private_data;
 	struct nfs_context *nfs = data->nfs;
 	GETATTR3res *res;
+	uint64_t offset;
 
 	assert(rpc->magic == RPC_CONTEXT_MAGIC);
 
@@ -4156,7 +5453,15 @@ nfs3_write_append_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
-	if (nfs3_pwrite_async_internal(nfs, data->nfsfh, res->GETATTR3res_u.resok.obj_attributes.size, data->count, data->usrbuf, data->cb, data->private_data, 1) != 0) {
+	/* another append may have found the end of file while we were
+	 * waiting and already sent data past it */
+	if (!data->nfsfh->eof_valid) {
+		data->nfsfh->eof = res->GETATTR3res_u.resok.obj_attributes.size;
+		data->nfsfh->eof_valid = 1;
+	}
+	offset = data->nfsfh->eof;
+
+	if (nfs3_pwrite_async_internal(nfs, data->nfsfh, offset, data->count, data->usrbuf, data->cb, data->private_data, 1) != 0) {
 		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
                          data->private_data);
 		free_nfs_cb_data(data);
@@ -4213,6 +5518,21 @@ nfs3_pwrite_mcb(struct rpc_context *rpc, int status, void *command_data,
 		} else  {
 			size_t count = res->WRITE3res_u.resok.count;
 
+			nfs3_update_inode_wcc(nfs, data,
+                                              &res->WRITE3res_u.resok.file_wcc);
+			nfs3_update_eof(data->nfsfh, mdata->offset,
+                                        &res->WRITE3res_u.resok.file_wcc);
+			if (count > 0 &&
+			    res->WRITE3res_u.resok.committed == UNSTABLE &&
+			    nfs3_writeback_unstable(nfs, data->nfsfh,
+                                                    mdata->offset,
+                                                    &data->usrbuf[mdata->offset - data->offset],
+                                                    count,
+                                                    res->WRITE3res_u.resok.verf) != 0) {
+				nfs_set_error(nfs, "out of memory: failed to "
+                                              "keep uncommitted data");
+				data->oom = 1;
+			}
 			if (count < mdata->count) {
 				if (count == 0) {
 					nfs_set_error(nfs, "NFS: Write failed. No bytes written!");
@@ -4247,12 +5567,17 @@ nfs3_pwrite_mcb(struct rpc_context *rpc, int status, void *command_data,
 		}
 	}
 
+	nfs3_inode_write_done(data->nfsfh);
 	free(mdata);
 
 	if (data->num_calls > 0) {
 		/* still waiting for more replies */
 		return;
 	}
+	if (data->oom || data->error || data->cancel) {
+		/* we no longer know where the file ends */
+		data->nfsfh->eof_valid = 0;
+	}
 	if (data->oom != 0) {
 		data->cb(-ENOMEM, nfs, command_data, data->private_data);
 		free_nfs_cb_data(data);
@@ -4274,16 +5599,21 @@ nfs3_pwrite_mcb(struct rpc_context *rpc, int status, void *command_data,
 		data->nfsfh->offset = data->max_offset;
 	}
 
-	nfs_pagecache_put(&data->nfsfh->pagecache, data->offset, data->usrbuf, data->count);
+	/* READs that are still in flight may return the old data */
+	if (data->nfsfh->inode) {
+		data->nfsfh->inode->gen++;
+	}
+	nfs_pagecache_put(nfs, data->nfsfh->inode, data->offset, data->usrbuf,
+                          data->count);
 	data->cb((int)(data->max_offset - data->offset), nfs, NULL, data->private_data);
 
 	free_nfs_cb_data(data);
 }
 
-int
-nfs3_pwrite_async_internal(struct nfs_context *nfs, struct nfsfh *nfsfh,
-                           uint64_t offset, size_t count, const char *buf,
-                           nfs_cb cb, void *private_data, int update_pos)
+static int
+nfs3_pwrite_send(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                 uint64_t offset, size_t count, const char *buf,
+                 nfs_cb cb, void *private_data, int update_pos)
 {
 	struct nfs_cb_data *data;
 
@@ -4352,6 +5682,7 @@ nfs3_pwrite_async_internal(struct nfs_context *nfs, struct nfsfh *nfsfh,
 			break;
 		}
 
+		nfs3_inode_write_start(nfsfh);
 		count               -= writecount;
 		offset              += writecount;
 		data->num_calls++;
@@ -4364,6 +5695,11 @@ int
 nfs3_write_async(struct nfs_context *nfs, struct nfsfh *nfsfh, uint64_t count,
                 const void *buf, nfs_cb cb, void *private_data)
 {
+	if (nfsfh->is_append && nfsfh->eof_valid) {
+		return nfs3_pwrite_async_internal(nfs, nfsfh, nfsfh->eof,
+                                                  (size_t)count, buf,
+                                                  cb, private_data, 1);
+	}
 	if (nfsfh->is_append) {
 		struct GETATTR3args args;
 		struct nfs_cb_data *data;
@@ -4397,293 +5733,1648 @@ nfs3_write_async(struct nfs_context *nfs, struct nfsfh *nfsfh, uint64_t count,
                                           cb, private_data, 1);
 }
 
-static void
-nfs3_fill_READ3args(READ3args *args, struct nfsfh *fh, uint64_t offset,
-                    uint64_t count)
+static int
+nfs3_writeback_overlaps(struct nfs_wb_range *r, uint64_t offset, size_t len)
 {
-	memset(args, 0, sizeof(READ3args));
-	args->file.data.data_len = fh->fh.len;
-	args->file.data.data_val = fh->fh.val;
-	args->offset = offset;
-	args->count = (count3)count;
+	for (; r; r = r->next) {
+		if (r->offset < offset + len && offset < r->offset + r->len) {
+			return 1;
+		}
+	}
+	return 0;
 }
 
-static void
-nfs3_pread_mcb(struct rpc_context *rpc, int status, void *command_data,
-               void *private_data)
+int
+nfs3_writeback_busy(struct nfsfh *nfsfh)
 {
-	struct nfs_mcb_data *mdata = private_data;
-	struct nfs_cb_data *data = mdata->data;
-	struct nfs_context *nfs = data->nfs;
-	READ3res *res;
-	int cb_err;
-	void *cb_data;
-
-	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+	return nfsfh->wb && (nfsfh->wb->dirty || nfsfh->wb->inflight ||
+                             nfsfh->wb->committing);
+}
 
-	data->num_calls--;
+/* a handle of the file fh with writes that are not on the server yet */
+struct nfsfh *
+nfs3_writeback_busy_fh(struct nfs_context *nfs, struct nfs_fh *fh)
+{
+	struct nfs_writeback *wb;
 
-	/* Flag the failure but do not invoke callback until we have
-	 * received all responses.
-	 */
-	if (status == RPC_STATUS_ERROR) {
-		data->error = 1;
+	for (wb = nfs->writebacks; wb; wb = wb->next) {
+		if (wb->nfsfh->fh.len == fh->len &&
+		    !memcmp(wb->nfsfh->fh.val, fh->val, fh->len) &&
+		    nfs3_writeback_busy(wb->nfsfh)) {
+			return wb->nfsfh;
+		}
 	}
-	if (status == RPC_STATUS_CANCEL) {
-		data->cancel = 1;
+	return NULL;
+}
+
+static void
+nfs3_writeback_kick(struct nfs_context *nfs, struct nfs_writeback *wb);
+
+static void
+nfs3_writeback_write_cb(int err, struct nfs_context *nfs, void *data _U_,
+                        void *private_data)
+{
+	struct nfs_wb_range *r = private_data;
+	struct nfs_writeback *wb = r->wb;
+
+	if (err < 0 && wb->error == 0) {
+		wb->error = err;
 	}
-	if (status == RPC_STATUS_TIMEOUT) {
-		data->cancel = 1;
+	LIBNFS_LIST_REMOVE(&wb->inflight, r);
+	free(r->buf);
+	free(r);
+
+	nfs3_writeback_kick(nfs, wb);
+}
+
+static void
+nfs3_writeback_send(struct nfs_context *nfs, struct nfs_writeback *wb,
+                    struct nfs_wb_range *r)
+{
+	LIBNFS_LIST_ADD(&wb->inflight, r);
+	if (nfs3_pwrite_send(nfs, wb->nfsfh, r->offset, r->len, r->buf,
+                             nfs3_writeback_write_cb, r, 0) != 0) {
+		if (wb->error == 0) {
+			wb->error = -ENOMEM;
+		}
+		LIBNFS_LIST_REMOVE(&wb->inflight, r);
+		free(r->buf);
+		free(r);
 	}
+}
 
-	if (status == RPC_STATUS_SUCCESS) {
-		res = command_data;
-		if (res->status != NFS3_OK) {
-			nfs_set_error(nfs, "NFS: Read failed with %s(%d)",
-                                      nfsstat3_to_str(res->status),
-                                      nfsstat3_to_errno(res->status));
-			data->error = 1;
+/*
+ * Send dirty data to the server. With all == 0 we only send whole
+ * wsize sized chunks and keep the remainder of each range around so
+ * that it can still grow. Ranges that overlap data that is already
+ * being written are held back until that WRITE has completed so that
+ * the server sees the writes in the right order.
+ */
+static void
+nfs3_writeback_flush_ranges(struct nfs_context *nfs, struct nfs_writeback *wb,
+                            int all)
+{
+	struct nfs_wb_range **pp = &wb->dirty, *r, *chunk;
+	size_t writemax = (size_t)nfs_get_writemax(nfs);
+	size_t len;
+
+	while ((r = *pp) != NULL) {
+		len = r->len;
+		if (!all && writemax) {
+			len -= len % writemax;
+		}
+		if (len == 0 ||
+		    nfs3_writeback_overlaps(wb->inflight, r->offset, len)) {
+			pp = &r->next;
+			continue;
+		}
+		if (len == r->len) {
+			*pp = r->next;
+			chunk = r;
 		} else {
-			size_t count = res->READ3res_u.resok.count;
-			if (count < data->count && data->buffer == NULL) {
-				/* we need a reassembly buffer after all */
-				data->buffer = malloc(mdata->count);
-				if (data->buffer == NULL) {
-					data->oom = 1;
-					goto out;
-				}
-			}
-			if (count > 0) {
-				if (count == data->count && data->buffer == NULL) {
-					data->buffer = res->READ3res_u.resok.data.data_val;
-					data->not_my_buffer = 1;
-				} else if (count <= mdata->count) {
-					/* copy data into reassembly buffer */
-					memcpy(&data->buffer[mdata->offset - data->offset], res->READ3res_u.resok.data.data_val, count);
-				} else {
-					nfs_set_error(nfs, "NFS: Read overflow. Server has sent more data than requested!");
-					data->error = 1;
-					goto out;
-				}
-				if (data->max_offset < mdata->offset + count) {
-					data->max_offset = mdata->offset + count;
-				}
+			chunk = malloc(sizeof(struct nfs_wb_range));
+			if (chunk == NULL) {
+				return;
 			}
-			/* check if we have received a short read */
-			if (count < mdata->count && !res->READ3res_u.resok.eof) {
-				if (count == 0) {
-					nfs_set_error(nfs, "NFS: Read failed. No bytes read and not at EOF!");
-					data->error = 1;
-				} else {
-					/* reissue reminder of this read request */
-					READ3args args;
-					mdata->offset += count;
-					mdata->count -= count;
-					nfs3_fill_READ3args(&args, data->nfsfh,
-                                                            mdata->offset,
-                                                            mdata->count);
-					if (rpc_nfs3_read_async(nfs->rpc,
-                                                                nfs3_pread_mcb,
-                                                                &args, mdata)
-                                            == 0) {
-						data->num_calls++;
-						return;
-					} else {
-						nfs_set_error(nfs, "RPC error: Failed to send READ call for %s", data->path);
-						data->oom = 1;
-					}
-				}
+			memset(chunk, 0, sizeof(struct nfs_wb_range));
+			chunk->buf = malloc(len);
+			if (chunk->buf == NULL) {
+				free(chunk);
+				return;
 			}
+			memcpy(chunk->buf, r->buf, len);
+			chunk->wb     = wb;
+			chunk->offset = r->offset;
+			chunk->len    = len;
+			chunk->size   = len;
+			memmove(r->buf, r->buf + len, r->len - len);
+			r->offset += len;
+			r->len    -= len;
+			pp = &r->next;
 		}
+		wb->dirty_bytes -= len;
+		nfs3_writeback_send(nfs, wb, chunk);
 	}
+}
 
-out:
-	free(mdata);
+/*
+ * Called whenever something changed. Flushes what needs flushing and
+ * tells the waiters once everything has reached the server.
+ */
+static void
+nfs3_writeback_kick(struct nfs_context *nfs, struct nfs_writeback *wb)
+{
+	struct nfs_wb_waiter *waiters, *w;
+	int err;
 
-	if (data->num_calls > 0) {
-		/* still waiting for more replies */
-		return;
+	if (wb->dirty &&
+	    (wb->waiters || wb->nfsfh->writeback == 0 ||
+	     wb->dirty_bytes >= wb->nfsfh->writeback ||
+	     rpc_current_time() - wb->dirty_since >= NFS_WB_MAX_AGE)) {
+		nfs3_writeback_flush_ranges(nfs, wb, 1);
+	} else if (wb->dirty) {
+		nfs3_writeback_flush_ranges(nfs, wb, 0);
 	}
-	if (data->oom != 0) {
-		data->cb(-ENOMEM, nfs, command_data, data->private_data);
-		free_nfs_cb_data(data);
-		return;
+	if (wb->dirty == NULL) {
+		wb->dirty_bytes = 0;
 	}
-	if (data->error != 0) {
-		data->cb(-EFAULT, nfs, command_data, data->private_data);
-		free_nfs_cb_data(data);
+
+	if (wb->waiters == NULL || wb->dirty || wb->inflight ||
+	    wb->committing) {
 		return;
 	}
-	if (data->cancel != 0) {
+	/* a waiter may close the file and free wb so we must not touch
+	 * it once we start calling them */
+	waiters = wb->waiters;
+	wb->waiters = NULL;
+	err = wb->error;
+	while ((w = waiters) != NULL) {
+		waiters = w->next;
+		w->cb(err, nfs, NULL, w->private_data);
+		free(w);
+	}
+}
+
+/*
+ * Calls cb once all data that is dirty or being written now has reached
+ * the server.
+ */
+int
+nfs3_writeback_flush(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                     nfs_cb cb, void *private_data)
+{
+	struct nfs_writeback *wb = nfsfh->wb;
+	struct nfs_wb_waiter *w;
+
+	w = malloc(sizeof(struct nfs_wb_waiter));
+	if (w == NULL) {
+		nfs_set_error(nfs, "out of memory: failed to allocate "
+                              "nfs_wb_waiter structure");
+		return -1;
+	}
+	memset(w, 0, sizeof(struct nfs_wb_waiter));
+	w->cb           = cb;
+	w->private_data = private_data;
+	LIBNFS_LIST_ADD_END(&wb->waiters, w);
+
+	nfs3_writeback_kick(nfs, wb);
+	return 0;
+}
+
+static void
+nfs3_writeback_flushed_cb(int err, struct nfs_context *nfs,
+                          void *ret_data _U_, void *private_data)
+{
+	struct nfs_cb_data *data = private_data;
+
+	if (err == -EINTR) {
 		data->cb(-EINTR, nfs, "Command was cancelled",
                          data->private_data);
 		free_nfs_cb_data(data);
 		return;
 	}
+	data->continue_cb(nfs, NULL, data);
+}
 
-	data->nfsfh->ra.fh_offset = data->max_offset;
+/*
+ * Run fn(nfs, NULL, data) once the write-back cache of the handle has
+ * been flushed. fn is responsible for freeing data. If we can not
+ * queue the request the callback is invoked with an error. Either way
+ * the callback will have been called, so this always returns 0.
+ */
+int
+nfs3_writeback_defer(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                     continue_func fn, struct nfs_cb_data *data)
+{
+	data->continue_cb = fn;
+	if (nfs3_writeback_flush(nfs, nfsfh, nfs3_writeback_flushed_cb,
+                                 data) != 0) {
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		free_nfs_cb_data(data);
+	}
+	return 0;
+}
 
-	nfs_pagecache_put(&data->nfsfh->pagecache, data->offset, data->buffer,
-                          (size_t)(data->max_offset - data->offset));
+/* flush dirty data that has become too old or is no longer wanted */
+void
+nfs3_writeback_scan(struct nfs_context *nfs)
+{
+	struct nfs_writeback *wb, *next;
 
-	if (data->max_offset > data->org_offset + data->org_count) {
-		data->max_offset = data->org_offset + data->org_count;
-	}
-	if (data->update_pos) {
-		data->nfsfh->offset = data->max_offset;
+	for (wb = nfs->writebacks; wb; wb = next) {
+		next = wb->next;
+		if (wb->dirty && (wb->nfsfh->writeback == 0 ||
+		    rpc_current_time() - wb->dirty_since >= NFS_WB_MAX_AGE)) {
+			nfs3_writeback_kick(nfs, wb);
+		}
 	}
-
-	cb_err = (int)(data->max_offset - data->org_offset);
-	cb_data = data->buffer + (data->org_offset - data->offset);
-	data->cb(cb_err, nfs, cb_data, data->private_data);
-	free_nfs_cb_data(data);
-	return;
 }
 
-int
-nfs3_pread_async_internal(struct nfs_context *nfs, struct nfsfh *nfsfh,
-                          uint64_t offset, size_t count, nfs_cb cb,
-                          void *private_data, int update_pos)
+static int
+nfs3_writeback_reserve(struct nfs_wb_range *r, size_t size)
 {
-	struct nfs_cb_data *data;
+	char *buf;
 
-	data = malloc(sizeof(struct nfs_cb_data));
-	if (data == NULL) {
-		nfs_set_error(nfs, "out of memory: failed to allocate "
-                              "nfs_cb_data structure");
+	if (size <= r->size) {
+		return 0;
+	}
+	size = MAX(size, 2 * r->size);
+	buf = realloc(r->buf, size);
+	if (buf == NULL) {
 		return -1;
 	}
-	memset(data, 0, sizeof(struct nfs_cb_data));
-	data->nfs          = nfs;
-	data->cb           = cb;
-	data->private_data = private_data;
-	data->nfsfh        = nfsfh;
-	data->org_offset   = offset;
-	data->org_count    = (count3)count;
-	data->update_pos   = update_pos;
-
-	assert(data->num_calls == 0);
+	r->buf = buf;
+	r->size = size;
+	return 0;
+}
 
-	if (nfsfh->pagecache.num_entries) {
-		/* align start offset to blocksize */
-		count += offset & (NFS_BLKSIZE - 1);
+/*
+ * Add [offset, offset + count) to a sorted list of ranges, merging it
+ * with all ranges it overlaps or touches. The new data replaces what the
+ * list already had for that part of the file.
+ */
+static int
+nfs3_writeback_add_range(struct nfs_writeback *wb,
+                         struct nfs_wb_range **list, uint64_t *bytes,
+                         uint64_t offset, const char *buf, size_t count)
+{
+	struct nfs_wb_range **pp, *n, *r;
+	uint64_t end = offset + count;
+
+	for (pp = list; *pp && (*pp)->offset + (*pp)->len < offset;
+	     pp = &(*pp)->next) {
+	}
+	n = *pp;
+	if (n == NULL || n->offset > offset) {
+		n = malloc(sizeof(struct nfs_wb_range));
+		if (n == NULL) {
+			return -1;
+		}
+		memset(n, 0, sizeof(struct nfs_wb_range));
+		n->wb = wb;
+		n->offset = offset;
+		n->next = *pp;
+		*pp = n;
+	}
+
+	end = MAX(end, n->offset + n->len);
+	for (r = n->next; r && r->offset <= end; r = r->next) {
+		end = MAX(end, r->offset + r->len);
+	}
+	if (nfs3_writeback_reserve(n, (size_t)(end - n->offset)) != 0) {
+		if (n->len == 0) {
+			*pp = n->next;
+			free(n);
+		}
+		return -1;
+	}
+	while ((r = n->next) != NULL && r->offset <= end) {
+		memcpy(n->buf + (r->offset - n->offset), r->buf, r->len);
+		*bytes -= r->len;
+		n->next = r->next;
+		free(r->buf);
+		free(r);
+	}
+	memcpy(n->buf + (offset - n->offset), buf, count);
+	*bytes += (end - n->offset) - n->len;
+	n->len = (size_t)(end - n->offset);
+	return 0;
+}
+
+static int
+nfs3_writeback_add(struct nfs_writeback *wb, uint64_t offset,
+                   const char *buf, size_t count)
+{
+	if (wb->dirty == NULL) {
+		wb->dirty_since = rpc_current_time();
+	}
+	return nfs3_writeback_add_range(wb, &wb->dirty, &wb->dirty_bytes,
+                                        offset, buf, count);
+}
+
+struct nfs_writeback *
+nfs3_writeback_get(struct nfs_context *nfs, struct nfsfh *nfsfh)
+{
+	struct nfs_writeback *wb = nfsfh->wb;
+
+	if (wb) {
+		return wb;
+	}
+	wb = malloc(sizeof(struct nfs_writeback));
+	if (wb == NULL) {
+		return NULL;
+	}
+	memset(wb, 0, sizeof(struct nfs_writeback));
+	wb->nfsfh = nfsfh;
+	LIBNFS_LIST_ADD(&nfs->writebacks, wb);
+	nfsfh->wb = wb;
+	return wb;
+}
+
+/* add the ranges of src on top of what *list already has */
+static int
+nfs3_writeback_merge(struct nfs_writeback *wb, struct nfs_wb_range **list,
+                     uint64_t *bytes, struct nfs_wb_range *src)
+{
+	for (; src; src = src->next) {
+		if (nfs3_writeback_add_range(wb, list, bytes, src->offset,
+                                             src->buf, src->len) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void
+nfs3_writeback_commit_background(struct nfs_context *nfs,
+                                 struct nfs_writeback *wb)
+{
+	struct nfs_cb_data *data;
+
+	data = malloc(sizeof(struct nfs_cb_data));
+	if (data == NULL) {
+		return;
+	}
+	memset(data, 0, sizeof(struct nfs_cb_data));
+	data->nfs   = nfs;
+	data->cb    = nfs3_writeback_commit_cb;
+	data->nfsfh = wb->nfsfh;
+	nfs3_writeback_commit(nfs, data);
+}
+
+/*
+ * Keep a copy of data the server has only written UNSTABLE until a
+ * COMMIT with a matching verifier tells us it is on stable storage.
+ */
+int
+nfs3_writeback_unstable(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                        uint64_t offset, const char *buf, size_t count,
+                        const char *verf)
+{
+	struct nfs_writeback *wb;
+
+	wb = nfs3_writeback_get(nfs, nfsfh);
+	if (wb == NULL) {
+		return -1;
+	}
+	if (wb->verf_valid && memcmp(wb->verf, verf, NFS3_WRITEVERFSIZE)) {
+		/* the server rebooted, everything we have not committed
+		 * yet may be gone */
+		wb->verf_changed = 1;
+	}
+	memcpy(wb->verf, verf, NFS3_WRITEVERFSIZE);
+	wb->verf_valid = 1;
+
+	if (nfs3_writeback_add_range(wb, &wb->unstable, &wb->unstable_bytes,
+                                     offset, buf, count) != 0) {
+		return -1;
+	}
+	if (wb->unstable_bytes >= NFS_WB_MAX_UNSTABLE &&
+	    wb->committing == NULL) {
+		nfs3_writeback_commit_background(nfs, wb);
+	}
+	return 0;
+}
+
+/*
+ * Called when the COMMIT for wb->committing has completed. verf is the
+ * verifier returned by the server or NULL if the COMMIT failed, in which
+ * case the data is kept for the next one. If the verifier does not match
+ * the one from the WRITEs everything that is not known to be committed
+ * is made dirty again, and we return 1.
+ */
+int
+nfs3_writeback_commit_done(struct nfs_context *nfs, struct nfs_writeback *wb,
+                           const char *verf)
+{
+	struct nfs_wb_range *list = NULL;
+	uint64_t bytes = 0;
+	int replay = 0, ret = 0;
+
+	if (verf && !wb->commit_replay &&
+	    !memcmp(verf, wb->commit_verf, NFS3_WRITEVERFSIZE)) {
+		nfs_wb_free_ranges(&wb->committing);
+		if (memcmp(verf, wb->verf, NFS3_WRITEVERFSIZE) &&
+		    wb->unstable) {
+			wb->verf_changed = 1;
+		}
+		nfs3_writeback_kick(nfs, wb);
+		return 0;
+	}
+	if (verf) {
+		replay = 1;
+	}
+
+	/* newer data goes on top of older data */
+	ret |= nfs3_writeback_merge(wb, &list, &bytes, wb->committing);
+	ret |= nfs3_writeback_merge(wb, &list, &bytes, wb->unstable);
+	nfs_wb_free_ranges(&wb->committing);
+	nfs_wb_free_ranges(&wb->unstable);
+	if (replay) {
+		ret |= nfs3_writeback_merge(wb, &list, &bytes, wb->inflight);
+		ret |= nfs3_writeback_merge(wb, &list, &bytes, wb->dirty);
+		nfs_wb_free_ranges(&wb->dirty);
+		wb->dirty = list;
+		wb->dirty_bytes = bytes;
+		wb->dirty_since = rpc_current_time();
+		wb->unstable_bytes = 0;
+		memcpy(wb->verf, verf, NFS3_WRITEVERFSIZE);
+		wb->verf_changed = 0;
+	} else {
+		wb->unstable = list;
+		wb->unstable_bytes = bytes;
+	}
+	if (ret && wb->error == 0) {
+		wb->error = -ENOMEM;
+	}
+
+	nfs3_writeback_kick(nfs, wb);
+	return replay;
+}
+
+int
+nfs3_pwrite_async_internal(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                           uint64_t offset, size_t count, const char *buf,
+                           nfs_cb cb, void *private_data, int update_pos)
+{
+	struct nfs_writeback *wb = nfsfh->wb;
+
+	if (nfsfh->eof_valid) {
+		nfsfh->eof = MAX(nfsfh->eof, offset + count);
+	}
+	if (nfsfh->writeback == 0 || nfsfh->is_sync || count == 0) {
+		return nfs3_pwrite_send(nfs, nfsfh, offset, count, buf,
+                                        cb, private_data, update_pos);
+	}
+
+	/* large writes that do not overlap anything we have buffered
+	 * gain nothing from going through the cache */
+	if (count >= nfsfh->writeback &&
+	    (wb == NULL ||
+	     (!nfs3_writeback_overlaps(wb->dirty, offset, count) &&
+	      !nfs3_writeback_overlaps(wb->inflight, offset, count)))) {
+		return nfs3_pwrite_send(nfs, nfsfh, offset, count, buf,
+                                        cb, private_data, update_pos);
+	}
+
+	wb = nfs3_writeback_get(nfs, nfsfh);
+	if (wb == NULL || nfs3_writeback_add(wb, offset, buf, count) != 0) {
+		nfs_set_error(nfs, "out of memory: failed to add data to "
+                              "the write-back cache");
+		return -1;
+	}
+	if (update_pos) {
+		nfsfh->offset = offset + count;
+	}
+	nfs3_writeback_kick(nfs, wb);
+
+	cb((int)count, nfs, NULL, private_data);
+	return 0;
+}
+
+static void
+nfs3_fill_READ3args(READ3args *args, struct nfsfh *fh, uint64_t offset,
+                    uint64_t count)
+{
+	memset(args, 0, sizeof(READ3args));
+	args->file.data.data_len = fh->fh.len;
+	args->file.data.data_val = fh->fh.val;
+	args->offset = offset;
+	args->count = (count3)count;
+}
+
+static int
+nfs3_pread_async_common(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                        uint64_t offset, size_t count, nfs_cb cb,
+                        void *private_data, int update_pos, int restarted);
+
+/*
+ * A READ of [offset, offset + count) is done. Take it out of the list of
+ * READs in flight and restart the reads that were waiting for it, they
+ * will now find the data in the pagecache or send their own READs.
+ */
+static void
+nfs3_read_req_done(struct nfs_context *nfs, struct nfs_read_req *req,
+                   int status)
+{
+	struct nfs_inode *inode = req->inode;
+	struct nfs_read_waiter *w;
+
+	LIBNFS_LIST_REMOVE(&inode->reads, req);
+
+	while ((w = req->waiters) != NULL) {
+		req->waiters = w->next;
+		if (status == RPC_STATUS_CANCEL) {
+			w->cb(-EINTR, nfs, "Command was cancelled",
+                              w->private_data);
+		} else if (nfs3_pread_async_common(nfs, w->nfsfh, w->offset,
+                                                   w->count, w->cb,
+                                                   w->private_data,
+                                                   w->update_pos, 1) != 0) {
+			w->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                              w->private_data);
+		}
+		free(w);
+	}
+
+	nfs_inode_put(nfs, inode);
+	free(req);
+}
+
+static struct nfs_read_req *
+nfs3_read_req_alloc(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                    uint64_t offset, uint32_t count)
+{
+	struct nfs_read_req *req;
+
+	req = malloc(sizeof(struct nfs_read_req));
+	if (req == NULL) {
+		return NULL;
+	}
+	memset(req, 0, sizeof(struct nfs_read_req));
+	req->nfs    = nfs;
+	req->offset = offset;
+	req->count  = count;
+	req->gen    = nfsfh->inode->gen;
+	return req;
+}
+
+/* called once the READ for req has been sent */
+static void
+nfs3_read_req_add(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                  struct nfs_read_req *req)
+{
+	/* the reply may arrive after the file has been closed */
+	req->inode = nfs_inode_get(nfs, &nfsfh->inode->fh);
+	LIBNFS_LIST_ADD(&nfsfh->inode->reads, req);
+}
+
+/*
+ * Find a READ in flight that overlaps [offset, offset + count) and whose
+ * data will still be good for the pagecache.
+ */
+static struct nfs_read_req *
+nfs3_read_req_find(struct nfs_inode *inode, uint64_t offset, uint64_t count)
+{
+	struct nfs_read_req *req;
+
+	for (req = inode->reads; req; req = req->next) {
+		if (offset < req->offset + req->count &&
+		    req->offset < offset + count && req->gen == inode->gen) {
+			return req;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put the data from a READ reply into the pagecache. The last page of
+ * the file is padded with zeros so that it can be cached as well, reads
+ * that are served from the pagecache stop at the size of the file.
+ */
+static void
+nfs3_pagecache_put_read(struct nfs_context *nfs, struct nfs_inode *inode,
+                        uint64_t offset, READ3resok *res)
+{
+	uint64_t end = offset + res->count;
+	size_t tail = (size_t)(end % NFS_BLKSIZE);
+	char page[NFS_BLKSIZE];
+
+	nfs_pagecache_put(nfs, inode, offset, res->data.data_val, res->count);
+
+	if (!res->eof || tail == 0 || offset > end - tail ||
+	    !inode->has_attr || inode->attr.size != end) {
+		return;
+	}
+	memcpy(page, res->data.data_val + (end - tail - offset), tail);
+	memset(page + tail, 0, NFS_BLKSIZE - tail);
+	nfs_pagecache_put(nfs, inode, end - tail, page, NFS_BLKSIZE);
+}
+
+static void
+nfs3_readahead_cb(struct rpc_context *rpc, int status, void *command_data,
+                  void *private_data)
+{
+	struct nfs_read_req *req = private_data;
+	struct nfs_context *nfs = req->nfs;
+	struct nfs_inode *inode = req->inode;
+	READ3res *res = command_data;
+	struct nfs_attr attr;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	if (status == RPC_STATUS_SUCCESS && res->status == NFS3_OK) {
+		if (res->READ3res_u.resok.file_attributes.attributes_follow) {
+			fattr3_to_nfs_attr(&attr, &res->READ3res_u.resok.file_attributes.post_op_attr_u.attributes);
+			nfs_attrcache_update(nfs, &inode->fh, &attr);
+			nfs_inode_revalidate(nfs, inode, &attr);
+		}
+		if (inode->gen == req->gen &&
+		    res->READ3res_u.resok.count <= req->count) {
+			nfs3_pagecache_put_read(nfs, inode, req->offset,
+                                                &res->READ3res_u.resok);
+		}
+	}
+
+	nfs3_read_req_done(nfs, req, status);
+}
+
+static int
+nfs3_readahead_send(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                    uint64_t offset, uint32_t count)
+{
+	struct nfs_read_req *req;
+	READ3args args;
+
+	req = nfs3_read_req_alloc(nfs, nfsfh, offset, count);
+	if (req == NULL) {
+		return -1;
+	}
+
+	nfs3_fill_READ3args(&args, nfsfh, offset, count);
+	if (rpc_nfs3_read_async(nfs->rpc, nfs3_readahead_cb, &args, req) != 0) {
+		free(req);
+		return -1;
+	}
+	nfs3_read_req_add(nfs, nfsfh, req);
+	return 0;
+}
+
+static void
+nfs3_pread_mcb(struct rpc_context *rpc, int status, void *command_data,
+               void *private_data)
+{
+	struct nfs_mcb_data *mdata = private_data;
+	struct nfs_cb_data *data = mdata->data;
+	struct nfs_context *nfs = data->nfs;
+	struct nfs_inode *inode = data->nfsfh->inode;
+	READ3res *res;
+	int cb_err;
+	void *cb_data;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	data->num_calls--;
+
+	/* Flag the failure but do not invoke callback until we have
+	 * received all responses.
+	 */
+	if (status == RPC_STATUS_ERROR) {
+		data->error = 1;
+	}
+	if (status == RPC_STATUS_CANCEL) {
+		data->cancel = 1;
+	}
+	if (status == RPC_STATUS_TIMEOUT) {
+		data->cancel = 1;
+	}
+
+	if (status == RPC_STATUS_SUCCESS) {
+		res = command_data;
+		if (res->status != NFS3_OK) {
+			nfs_set_error(nfs, "NFS: Read failed with %s(%d)",
+                                      nfsstat3_to_str(res->status),
+                                      nfsstat3_to_errno(res->status));
+			data->error = 1;
+		} else {
+			size_t count = res->READ3res_u.resok.count;
+
+			nfs3_revalidate_inode_post_op(nfs, data,
+                                    &res->READ3res_u.resok.file_attributes);
+			if (count < data->count && data->buffer == NULL) {
+				/* we need a reassembly buffer after all */
+				data->buffer = malloc(mdata->count);
+				if (data->buffer == NULL) {
+					data->oom = 1;
+					goto out;
+				}
+			}
+			if (count > 0) {
+				if (count == data->count && data->buffer == NULL) {
+					data->buffer = res->READ3res_u.resok.data.data_val;
+					data->not_my_buffer = 1;
+				} else if (count <= mdata->count) {
+					/* copy data into reassembly buffer */
+					memcpy(&data->buffer[mdata->offset - data->offset], res->READ3res_u.resok.data.data_val, count);
+				} else {
+					nfs_set_error(nfs, "NFS: Read overflow. Server has sent more data than requested!");
+					data->error = 1;
+					goto out;
+				}
+				if (data->max_offset < mdata->offset + count) {
+					data->max_offset = mdata->offset + count;
+				}
+				/* do not cache data that was read while the
+				 * file was changing */
+				if (inode && inode->gen == data->inode_gen) {
+					nfs3_pagecache_put_read(nfs, inode,
+                                                                mdata->offset,
+                                                                &res->READ3res_u.resok);
+				}
+			}
+			/* check if we have received a short read */
+			if (count < mdata->count && !res->READ3res_u.resok.eof) {
+				if (count == 0) {
+					nfs_set_error(nfs, "NFS: Read failed. No bytes read and not at EOF!");
+					data->error = 1;
+				} else {
+					/* reissue reminder of this read request */
+					READ3args args;
+					mdata->offset += count;
+					mdata->count -= count;
+					nfs3_fill_READ3args(&args, data->nfsfh,
+                                                            mdata->offset,
+                                                            mdata->count);
+					if (rpc_nfs3_read_async(nfs->rpc,
+                                                                nfs3_pread_mcb,
+                                                                &args, mdata)
+                                            == 0) {
+						data->num_calls++;
+						return;
+					} else {
+						nfs_set_error(nfs, "RPC error: Failed to send READ call for %s", data->path);
+						data->oom = 1;
+					}
+				}
+			}
+		}
+	}
+
+out:
+	/* let the reads that were waiting for this one continue */
+	if (mdata->req) {
+		nfs3_read_req_done(nfs, mdata->req, status);
+	}
+	free(mdata);
+
+	if (data->num_calls > 0) {
+		/* still waiting for more replies */
+		return;
+	}
+	if (data->oom != 0) {
+		data->cb(-ENOMEM, nfs, command_data, data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+	if (data->error != 0) {
+		data->cb(-EFAULT, nfs, command_data, data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+	if (data->cancel != 0) {
+		data->cb(-EINTR, nfs, "Command was cancelled",
+                         data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	if (data->max_offset > data->org_offset + data->org_count) {
+		data->max_offset = data->org_offset + data->org_count;
+	}
+	/* the read was aligned down and started past the end of the file */
+	if (data->max_offset < data->org_offset) {
+		data->max_offset = data->org_offset;
+	}
+	if (data->update_pos) {
+		data->nfsfh->offset = data->max_offset;
+	}
+
+	cb_err = (int)(data->max_offset - data->org_offset);
+	cb_data = data->buffer + (data->org_offset - data->offset);
+	data->cb(cb_err, nfs, cb_data, data->private_data);
+	free_nfs_cb_data(data);
+	return;
+}
+
+/*
+ * Send readahead READs for the blocks in [start, end) that are neither
+ * cached nor already requested. Returns how far we got.
+ */
+static uint64_t
+nfs3_readahead_range(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                     uint64_t start, uint64_t end)
+{
+	struct nfs_inode *inode = nfsfh->inode;
+	uint32_t readmax = (uint32_t)nfs_get_readmax(nfs) & ~(NFS_BLKSIZE - 1);
+	uint64_t eof;
+
+	if (inode->has_attr) {
+		eof = (inode->attr.size + NFS_BLKSIZE - 1) &
+			~(uint64_t)(NFS_BLKSIZE - 1);
+		end = MIN(end, eof);
+	}
+
+	while (start < end) {
+		uint64_t len = 0;
+
+		/* skip what is already cached or on its way */
+		if (nfs_pagecache_cached(nfs, inode, start) ||
+		    nfs3_read_req_find(inode, start, NFS_BLKSIZE)) {
+			start += NFS_BLKSIZE;
+			continue;
+		}
+		while (start + len < end && len < readmax &&
+		       !nfs_pagecache_cached(nfs, inode, start + len) &&
+		       !nfs3_read_req_find(inode, start + len,
+                                           NFS_BLKSIZE)) {
+			len += NFS_BLKSIZE;
+		}
+		if (nfs3_readahead_send(nfs, nfsfh, start, (uint32_t)len)) {
+			break;
+		}
+		start += len;
+	}
+	return start;
+}
+
+/*
+ * Find the stream this read belongs to, starting a new one if it does
+ * not continue any of them. Streams that have not been used for a
+ * while are dropped. *hit is set if the read follows the pattern of
+ * the stream so that it is worth reading ahead.
+ */
+static struct nfs_ra_stream *
+nfs3_ra_stream(struct nfs_readahead *ra, uint64_t offset, uint32_t max_ra,
+               int *hit)
+{
+	struct nfs_ra_stream *st, *victim = NULL;
+	int i;
+
+	*hit = 1;
+	ra->clock++;
+	for (i = 0; i < NFS_RA_STREAMS; i++) {
+		st = &ra->streams[i];
+		if (st->in_use && ra->clock - st->last_use > NFS_RA_STREAM_AGE) {
+			st->in_use = 0;
+		}
+	}
+
+	/* the next read of a strided stream */
+	for (i = 0; i < NFS_RA_STREAMS; i++) {
+		st = &ra->streams[i];
+		if (st->in_use && st->stride &&
+		    offset == st->last_offset + st->stride) {
+			return st;
+		}
+	}
+	/* continues a sequential stream */
+	for (i = 0; i < NFS_RA_STREAMS; i++) {
+		st = &ra->streams[i];
+		if (st->in_use && offset >= st->fh_offset &&
+		    offset <= st->fh_offset + st->cur_ra + NFS_BLKSIZE) {
+			if (st->stride) {
+				st->stride = 0;
+				st->ra_end = 0;
+			}
+			return st;
+		}
+	}
+
+	*hit = 0;
+	/* a short skip forward from a stream that has not turned out to
+	 * be sequential may be the start of a strided one */
+	for (i = 0; i < NFS_RA_STREAMS; i++) {
+		st = &ra->streams[i];
+		if (st->in_use && st->cur_ra == 0 && offset > st->fh_offset &&
+		    offset - st->last_offset <= max_ra) {
+			st->stride = offset - st->last_offset;
+			st->ra_end = 0;
+			return st;
+		}
+	}
+
+	for (i = 0; i < NFS_RA_STREAMS; i++) {
+		st = &ra->streams[i];
+		if (!st->in_use) {
+			victim = st;
+			break;
+		}
+		if (victim == NULL || st->last_use < victim->last_use) {
+			victim = st;
+		}
+	}
+	memset(victim, 0, sizeof(struct nfs_ra_stream));
+	victim->in_use = 1;
+	/* reads from the start of a file are almost always sequential */
+	*hit = offset == 0;
+	return victim;
+}
+
+/*
+ * Called for every application read of [offset, offset + count).
+ * When the access pattern of the stream the read belongs to is
+ * sequential or has a fixed stride we grow the readahead window of
+ * that stream and send READs for the part of it we have not already
+ * requested. These READs are independent of the application reads and
+ * only fill the pagecache.
+ */
+static void
+nfs3_readahead(struct nfs_context *nfs, struct nfsfh *nfsfh,
+               uint64_t offset, uint64_t count)
+{
+	struct nfs_ra_stream *st;
+	uint32_t max_ra = nfs->rpc->readahead;
+	uint64_t i, next;
+	int hit;
+
+	if (!max_ra || nfsfh->inode == NULL ||
+	    nfs_get_readmax(nfs) < NFS_BLKSIZE) {
+		return;
+	}
+
+	st = nfs3_ra_stream(&nfsfh->ra, offset, max_ra, &hit);
+	st->last_use = nfsfh->ra.clock;
+	st->last_offset = offset;
+	st->fh_offset = offset + count;
+	if (!hit) {
+		return;
+	}
+
+	st->cur_ra = MAX(NFS_BLKSIZE, st->cur_ra);
+	if (max_ra > st->cur_ra) {
+		st->cur_ra <<= 1;
+	}
+	st->cur_ra = MIN(st->cur_ra, max_ra);
+
+	if (st->stride == 0) {
+		st->ra_end = nfs3_readahead_range(nfs, nfsfh,
+                                MAX(st->ra_end, st->fh_offset),
+                                (st->fh_offset + st->cur_ra) &
+                                ~(uint64_t)(NFS_BLKSIZE - 1));
+		return;
+	}
+
+	/* fetch the next reads of the strided stream that fit in the
+	 * window */
+	for (i = 1; i * count <= MAX(st->cur_ra, count); i++) {
+		next = offset + i * st->stride;
+		if (next < st->ra_end) {
+			continue;
+		}
+		if (nfs3_readahead_range(nfs, nfsfh, next,
+                                         next + count) != next + count) {
+			break;
+		}
+		st->ra_end = next + count;
+	}
+}
+
+/*
+ * Some of the data is being fetched by a READ that is already in
+ * flight. Queue the read to be restarted once that completes instead of
+ * reading the same data twice.
+ */
+static int
+nfs3_pread_wait(struct nfs_read_req *req, struct nfs_cb_data *data)
+{
+	struct nfs_read_waiter *w;
+
+	w = malloc(sizeof(struct nfs_read_waiter));
+	if (w == NULL) {
+		return -1;
+	}
+	memset(w, 0, sizeof(struct nfs_read_waiter));
+	w->nfsfh        = data->nfsfh;
+	w->offset       = data->org_offset;
+	w->count        = data->org_count;
+	w->cb           = data->cb;
+	w->private_data = data->private_data;
+	w->update_pos   = data->update_pos;
+	LIBNFS_LIST_ADD_END(&req->waiters, w);
+	free_nfs_cb_data(data);
+	return 0;
+}
+
+static int
+nfs3_pread_continue_internal(struct nfs_context *nfs,
+                             struct nfs_attr *attr _U_,
+                             struct nfs_cb_data *data)
+{
+	if (nfs3_pread_async_internal(nfs, data->nfsfh, data->org_offset,
+                                      (size_t)data->org_count, data->cb,
+                                      data->private_data,
+                                      data->update_pos) != 0) {
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+	}
+	free_nfs_cb_data(data);
+	return 0;
+}
+
+/*
+ * restarted is set when the read has already waited for a READ in
+ * flight. It may wait again but does not send READs of its own for the
+ * pagecache, data we fetched for it may already have been evicted and
+ * we must not do that again and again.
+ */
+static int
+nfs3_pread_async_common(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                        uint64_t offset, size_t count, nfs_cb cb,
+                        void *private_data, int update_pos, int restarted)
+{
+	struct nfs_cb_data *data;
+	struct nfs_read_req *req;
+
+	data = malloc(sizeof(struct nfs_cb_data));
+	if (data == NULL) {
+		nfs_set_error(nfs, "out of memory: failed to allocate "
+                              "nfs_cb_data structure");
+		return -1;
+	}
+	memset(data, 0, sizeof(struct nfs_cb_data));
+	data->nfs          = nfs;
+	data->cb           = cb;
+	data->private_data = private_data;
+	data->nfsfh        = nfsfh;
+	data->org_offset   = offset;
+	data->org_count    = (count3)count;
+	data->update_pos   = update_pos;
+
+	assert(data->num_calls == 0);
+
+	/* make sure we read our own buffered writes */
+	if (nfsfh->wb &&
+	    (nfs3_writeback_overlaps(nfsfh->wb->dirty, offset, count) ||
+	     nfs3_writeback_overlaps(nfsfh->wb->inflight, offset, count))) {
+		return nfs3_writeback_defer(nfs, nfsfh,
+                                            nfs3_pread_continue_internal,
+                                            data);
+	}
+
+	if (nfsfh->inode) {
+		data->inode_gen = nfsfh->inode->gen;
+
+		/* align start offset to blocksize */
+		count += offset & (NFS_BLKSIZE - 1);
 		offset &= ~(NFS_BLKSIZE - 1);
 
-		/* align end offset to blocksize */
-		count += NFS_BLKSIZE - 1 ;
-		count &= ~(NFS_BLKSIZE - 1);
+		/* align end offset to blocksize */
+		count += NFS_BLKSIZE - 1 ;
+		count &= ~(NFS_BLKSIZE - 1);
+	}
+
+	data->offset = offset;
+	data->count = (count3)count;
+
+	if (nfsfh->inode) {
+		struct nfs_inode *inode = nfsfh->inode;
+
+		while (count > 0) {
+			char *cdata;
+
+			/* we have everything up to the end of the file */
+			if (offset > data->offset && inode->has_attr &&
+			    offset >= inode->attr.size) {
+				count = 0;
+				break;
+			}
+			cdata = nfs_pagecache_get(nfs, inode, offset);
+			if (!cdata) {
+				break;
+			}
+			/* we copy data from the pagecache so we need a
+                         * reassembly buffer */
+			if (data->buffer == NULL) {
+				data->buffer = malloc(data->count);
+				if (data->buffer == NULL) {
+					free_nfs_cb_data(data);
+					return -ENOMEM;
+				}
+			}
+			memcpy(data->buffer + offset - data->offset, cdata,
+                               NFS_BLKSIZE);
+			offset += NFS_BLKSIZE;
+			count -= NFS_BLKSIZE;
+		}
+		if (!count) {
+			uint64_t end = data->org_offset + data->org_count;
+
+			if (inode->has_attr && end > inode->attr.size) {
+				end = MAX(inode->attr.size, data->org_offset);
+			}
+			nfs3_readahead(nfs, nfsfh, data->offset, data->count);
+			if (update_pos) {
+				data->nfsfh->offset = end;
+			}
+			data->cb((int)(end - data->org_offset), nfs, data->buffer + (data->org_offset - data->offset), data->private_data);
+			free_nfs_cb_data(data);
+			return 0;
+		}
+
+		/*
+		 * Some of the data is already on its way. Send READs for
+		 * the parts nobody has asked for yet so that they fill the
+		 * pagecache as well and wait for the READ in flight.
+		 */
+		req = nfs3_read_req_find(inode, offset, count);
+		if (req &&
+		    count <= (uint64_t)nfs->rpc->pagecache * NFS_BLKSIZE / 2) {
+			if (!restarted &&
+			    nfs_get_readmax(nfs) >= NFS_BLKSIZE) {
+				nfs3_readahead_range(nfs, nfsfh, offset,
+                                                     offset + count);
+			}
+			if (nfs3_pread_wait(req, data)) {
+				nfs_set_error(nfs, "out of memory: failed to "
+                                              "allocate nfs_read_waiter");
+				free_nfs_cb_data(data);
+				return -ENOMEM;
+			}
+			return 0;
+		}
+	}
+
+	if ((data->count > nfs_get_readmax(nfs) || data->count > data->org_count) &&
+	    data->buffer == NULL) {
+		/* we do a big read or aligned out the request so we
+		 * need a reassembly buffer */
+		data->buffer = malloc(data->count);
+		if (data->buffer == NULL) {
+			free_nfs_cb_data(data);
+			return -ENOMEM;
+		}
+	}
+
+	/* everything before offset came from the pagecache */
+	data->max_offset = offset;
+
+	/* chop requests into chunks of at most READMAX bytes if necessary.
+	 * we send all reads in parallel so that performance is still good.
+	 */
+	do {
+		size_t readcount = count;
+		struct nfs_mcb_data *mdata;
+		READ3args args;
+
+		if (readcount > nfs_get_readmax(nfs)) {
+		  readcount = (size_t)nfs_get_readmax(nfs);
+		}
+
+		mdata = malloc(sizeof(struct nfs_mcb_data));
+		if (mdata == NULL) {
+			nfs_set_error(nfs, "out of memory: failed to allocate nfs_mcb_data structure");
+			if (data->num_calls == 0) {
+				free_nfs_cb_data(data);
+				return -1;
+			}
+			data->oom = 1;
+			break;
+		}
+		memset(mdata, 0, sizeof(struct nfs_mcb_data));
+		mdata->data   = data;
+		mdata->offset = offset;
+		mdata->count  = readcount;
+		if (nfsfh->inode) {
+			/* not fatal, others just can not share this READ */
+			mdata->req = nfs3_read_req_alloc(nfs, nfsfh, offset,
+                                                         (uint32_t)readcount);
+		}
+
+		nfs3_fill_READ3args(&args, nfsfh, offset, readcount);
+
+		if (rpc_nfs3_read_async(nfs->rpc, nfs3_pread_mcb,
+                                        &args, mdata) != 0) {
+			nfs_set_error(nfs, "RPC error: Failed to send READ "
+                                      "call for %s", data->path);
+			free(mdata->req);
+			free(mdata);
+			if (data->num_calls == 0) {
+				free_nfs_cb_data(data);
+				return -1;
+			}
+			data->oom = 1;
+			break;
+		}
+
+		if (mdata->req) {
+			nfs3_read_req_add(nfs, nfsfh, mdata->req);
+		}
+
+		count               -= readcount;
+		offset              += readcount;
+		data->num_calls++;
+	 } while (count > 0);
+
+	 nfs3_readahead(nfs, nfsfh, data->offset, data->count);
+	 return 0;
+}
+
+int
+nfs3_pread_async_internal(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                          uint64_t offset, size_t count, nfs_cb cb,
+                          void *private_data, int update_pos)
+{
+	return nfs3_pread_async_common(nfs, nfsfh, offset, count, cb,
+                                       private_data, update_pos, 0);
+}
+
+/* copy len bytes from buf to byte pos of the data described by iov */
+static void
+nfs3_iov_scatter(const struct iovec *iov, int iovcnt, uint64_t pos,
+                 const char *buf, size_t len)
+{
+	int i;
+
+	for (i = 0; i < iovcnt && len > 0; i++) {
+		size_t n;
+
+		if (pos >= iov[i].iov_len) {
+			pos -= iov[i].iov_len;
+			continue;
+		}
+		n = MIN(iov[i].iov_len - (size_t)pos, len);
+		memcpy((char *)iov[i].iov_base + pos, buf, n);
+		buf += n;
+		len -= n;
+		pos = 0;
 	}
+}
 
-	data->offset = offset;
-	data->count = (count3)count;
+static void
+nfs3_preadv_mcb(struct rpc_context *rpc, int status, void *command_data,
+                void *private_data)
+{
+	struct nfs_mcb_data *mdata = private_data;
+	struct nfs_cb_data *data = mdata->data;
+	struct nfs_context *nfs = data->nfs;
+	struct nfs_inode *inode = data->nfsfh->inode;
+	READ3res *res;
 
-	if (nfsfh->pagecache.num_entries) {
-		while (count > 0) {
-			char *cdata = nfs_pagecache_get(&nfsfh->pagecache,
-                                                        offset);
-			if (!cdata) {
-				break;
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	data->num_calls--;
+
+	if (status == RPC_STATUS_ERROR) {
+		data->error = 1;
+	}
+	if (status == RPC_STATUS_CANCEL) {
+		data->cancel = 1;
+	}
+	if (status == RPC_STATUS_TIMEOUT) {
+		data->cancel = 1;
+	}
+
+	if (status == RPC_STATUS_SUCCESS) {
+		res = command_data;
+		if (res->status != NFS3_OK) {
+			nfs_set_error(nfs, "NFS: Read failed with %s(%d)",
+                                      nfsstat3_to_str(res->status),
+                                      nfsstat3_to_errno(res->status));
+			data->error = 1;
+			goto out;
+		}
+
+		nfs3_revalidate_inode_post_op(nfs, data,
+                                   &res->READ3res_u.resok.file_attributes);
+		if (res->READ3res_u.resok.count > mdata->count) {
+			nfs_set_error(nfs, "NFS: Read overflow. Server has sent "
+                                      "more data than requested!");
+			data->error = 1;
+			goto out;
+		}
+		if (res->READ3res_u.resok.count > 0) {
+			size_t count = res->READ3res_u.resok.count;
+			uint64_t lo, hi;
+
+			/* the READ may have been aligned out to full pages */
+			lo = MAX(mdata->offset, data->offset);
+			hi = MIN(mdata->offset + count,
+                                 data->offset + data->count);
+			if (lo < hi) {
+				nfs3_iov_scatter(data->continue_data,
+                                                 (int)data->continue_int,
+                                                 lo - data->offset,
+                                                 res->READ3res_u.resok.data.data_val + (lo - mdata->offset),
+                                                 (size_t)(hi - lo));
 			}
-			/* we copy data from the pagecache so we need a
-                         * reassembly buffer */
-			if (data->buffer == NULL) {
-				data->buffer = malloc(data->count);
-				if (data->buffer == NULL) {
-					free_nfs_cb_data(data);
-					return -ENOMEM;
-				}
+			if (inode && inode->gen == data->inode_gen) {
+				nfs_pagecache_put(nfs, inode, mdata->offset,
+                                                  res->READ3res_u.resok.data.data_val,
+                                                  count);
+			}
+			if (data->max_offset < mdata->offset + count) {
+				data->max_offset = mdata->offset + count;
 			}
-			memcpy(data->buffer + offset - data->offset, cdata,
-                               NFS_BLKSIZE);
-			offset += NFS_BLKSIZE;
-			count -= NFS_BLKSIZE;
 		}
-		if (!count) {
-			data->nfsfh->ra.fh_offset = data->offset + data->count;
-			if (update_pos) {
-				data->nfsfh->offset = data->org_offset + data->org_count;
+		/* check if we have received a short read */
+		if (res->READ3res_u.resok.count < mdata->count &&
+		    !res->READ3res_u.resok.eof) {
+			READ3args args;
+
+			if (res->READ3res_u.resok.count == 0) {
+				nfs_set_error(nfs, "NFS: Read failed. No bytes "
+                                              "read and not at EOF!");
+				data->error = 1;
+				goto out;
 			}
-			data->cb(data->org_count, nfs, data->buffer + (data->org_offset - data->offset), data->private_data);
+			/* reissue reminder of this read request */
+			mdata->offset += res->READ3res_u.resok.count;
+			mdata->count -= res->READ3res_u.resok.count;
+			nfs3_fill_READ3args(&args, data->nfsfh, mdata->offset,
+                                            mdata->count);
+			if (rpc_nfs3_read_async(nfs->rpc, nfs3_preadv_mcb,
+                                                &args, mdata) == 0) {
+				data->num_calls++;
+				return;
+			}
+			nfs_set_error(nfs, "RPC error: Failed to send READ "
+                                      "call for %s", data->path);
+			data->oom = 1;
+		}
+	}
+
+out:
+	free(mdata);
+
+	if (data->num_calls > 0) {
+		/* still waiting for more replies */
+		return;
+	}
+	if (data->oom != 0) {
+		data->cb(-ENOMEM, nfs, command_data, data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+	if (data->error != 0) {
+		data->cb(-EFAULT, nfs, command_data, data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+	if (data->cancel != 0) {
+		data->cb(-EINTR, nfs, "Command was cancelled",
+                         data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	if (data->max_offset > data->offset + data->count) {
+		data->max_offset = data->offset + data->count;
+	}
+	data->cb((int)(data->max_offset - data->offset), nfs, NULL,
+                 data->private_data);
+	free_nfs_cb_data(data);
+}
+
+/*
+ * Serve the read from the pagecache if all of it is there. Returns 1
+ * if it was and sets *count to the number of bytes read, which is less
+ * than asked for if the read goes past the end of the file.
+ */
+static int
+nfs3_preadv_cached(struct nfs_context *nfs, struct nfs_cb_data *data,
+                   uint64_t *count)
+{
+	struct nfs_inode *inode = data->nfsfh->inode;
+	uint64_t offset = data->offset & ~(uint64_t)(NFS_BLKSIZE - 1);
+	uint64_t end = data->offset + data->count;
+
+	/* the last page is cached padded with zeros */
+	if (inode->has_attr && end > inode->attr.size) {
+		end = MAX(inode->attr.size, data->offset);
+	}
+	do {
+		uint64_t start = MAX(offset, data->offset);
+		char *cdata;
+
+		cdata = nfs_pagecache_get(nfs, inode, offset);
+		if (cdata == NULL) {
+			return 0;
+		}
+		if (start < end) {
+			nfs3_iov_scatter(data->continue_data,
+                                         (int)data->continue_int,
+                                         start - data->offset,
+                                         cdata + (start - offset),
+                                         (size_t)(MIN(end, offset + NFS_BLKSIZE) -
+                                                  start));
+		}
+		offset += NFS_BLKSIZE;
+	} while (offset < end);
+
+	*count = end - data->offset;
+	return 1;
+}
+
+/* returns -1 without invoking the callback if nothing could be sent */
+static int
+nfs3_preadv_send(struct nfs_context *nfs, struct nfs_cb_data *data)
+{
+	struct nfsfh *nfsfh = data->nfsfh;
+	uint64_t offset = data->offset;
+	size_t count = data->count;
+
+	if (nfsfh->inode) {
+		uint64_t cached;
+
+		data->inode_gen = nfsfh->inode->gen;
+		if (nfs3_preadv_cached(nfs, data, &cached)) {
+			nfs3_readahead(nfs, nfsfh, data->offset, data->count);
+			data->cb((int)cached, nfs, NULL, data->private_data);
 			free_nfs_cb_data(data);
 			return 0;
 		}
+
+		/* read full pages so that all of it can be cached */
+		count += offset & (NFS_BLKSIZE - 1);
+		offset &= ~(uint64_t)(NFS_BLKSIZE - 1);
+		count = (count + NFS_BLKSIZE - 1) & ~(size_t)(NFS_BLKSIZE - 1);
 	}
 
-	if (nfs->rpc->readahead) {
-		nfsfh->ra.cur_ra = MAX(NFS_BLKSIZE, nfsfh->ra.cur_ra);
-		if (offset >= nfsfh->ra.fh_offset &&
-			offset - NFS_BLKSIZE <= nfsfh->ra.fh_offset + nfsfh->ra.cur_ra) {
-			if (nfs->rpc->readahead > nfsfh->ra.cur_ra) {
-				nfsfh->ra.cur_ra <<= 1;
+	data->max_offset = data->offset;
+	do {
+		size_t readcount = count;
+		struct nfs_mcb_data *mdata;
+		READ3args args;
+
+		if (readcount > nfs_get_readmax(nfs)) {
+			readcount = (size_t)nfs_get_readmax(nfs);
+		}
+
+		mdata = malloc(sizeof(struct nfs_mcb_data));
+		if (mdata == NULL) {
+			nfs_set_error(nfs, "out of memory: failed to allocate "
+                                      "nfs_mcb_data structure");
+			if (data->num_calls == 0) {
+				return -1;
+			}
+			data->oom = 1;
+			break;
+		}
+		memset(mdata, 0, sizeof(struct nfs_mcb_data));
+		mdata->data   = data;
+		mdata->offset = offset;
+		mdata->count  = readcount;
+
+		nfs3_fill_READ3args(&args, nfsfh, offset, readcount);
+		if (rpc_nfs3_read_async(nfs->rpc, nfs3_preadv_mcb,
+                                        &args, mdata) != 0) {
+			nfs_set_error(nfs, "RPC error: Failed to send READ "
+                                      "call for %s", data->path);
+			free(mdata);
+			if (data->num_calls == 0) {
+				return -1;
 			}
-		} else {
-			nfsfh->ra.cur_ra = 0;
+			data->oom = 1;
+			break;
 		}
-		count += nfsfh->ra.cur_ra;
-		data->count += nfsfh->ra.cur_ra;
+
+		count  -= readcount;
+		offset += readcount;
+		data->num_calls++;
+	} while (count > 0);
+
+	nfs3_readahead(nfs, nfsfh, data->offset, data->count);
+	return 0;
+}
+
+static int
+nfs3_preadv_continue_internal(struct nfs_context *nfs,
+                              struct nfs_attr *attr _U_,
+                              struct nfs_cb_data *data)
+{
+	if (nfs3_preadv_send(nfs, data) != 0) {
+		data->cb(-ENOMEM, nfs, nfs_get_error(nfs),
+                         data->private_data);
+		free_nfs_cb_data(data);
+	}
+	return 0;
+}
+
+int
+nfs3_preadv_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                  const struct iovec *iov, int iovcnt, uint64_t offset,
+                  nfs_cb cb, void *private_data)
+{
+	struct nfs_cb_data *data;
+	struct iovec *iov_copy;
+	size_t count = 0;
+	int i;
+
+	if (iovcnt < 0) {
+		nfs_set_error(nfs, "Invalid iovcnt %d", iovcnt);
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		count += iov[i].iov_len;
+	}
+	if (count == 0) {
+		cb(0, nfs, NULL, private_data);
+		return 0;
+	}
+
+	data = malloc(sizeof(struct nfs_cb_data));
+	if (data == NULL) {
+		nfs_set_error(nfs, "out of memory: failed to allocate "
+                              "nfs_cb_data structure");
+		return -1;
+	}
+	memset(data, 0, sizeof(struct nfs_cb_data));
+	data->nfs          = nfs;
+	data->cb           = cb;
+	data->private_data = private_data;
+	data->nfsfh        = nfsfh;
+	data->offset       = offset;
+	data->count        = count;
+
+	/* the caller only has to keep the buffers around, not the array */
+	iov_copy = malloc(iovcnt * sizeof(struct iovec));
+	if (iov_copy == NULL) {
+		nfs_set_error(nfs, "out of memory: failed to copy iovec");
+		free_nfs_cb_data(data);
+		return -1;
 	}
-
-	if ((data->count > nfs_get_readmax(nfs) || data->count > data->org_count) &&
-	    (data->buffer == NULL || nfsfh->ra.cur_ra > 0)) {
-		/* we do readahead, a big read or aligned out the request so we
-		 * need a (bigger) reassembly buffer */
-		data->buffer = realloc(data->buffer, data->count + nfsfh->ra.cur_ra);
-		if (data->buffer == NULL) {
+	memcpy(iov_copy, iov, iovcnt * sizeof(struct iovec));
+	data->continue_data      = iov_copy;
+	data->free_continue_data = free;
+	data->continue_int       = iovcnt;
+
+	/* make sure we read our own buffered writes */
+	if (nfsfh->wb &&
+	    (nfs3_writeback_overlaps(nfsfh->wb->dirty, offset, count) ||
+	     nfs3_writeback_overlaps(nfsfh->wb->inflight, offset, count))) {
+		data->continue_cb = nfs3_preadv_continue_internal;
+		if (nfs3_writeback_flush(nfs, nfsfh, nfs3_writeback_flushed_cb,
+                                         data) != 0) {
 			free_nfs_cb_data(data);
-			return -ENOMEM;
+			return -1;
 		}
+		return 0;
 	}
 
-	data->max_offset = data->offset;
-
-	/* chop requests into chunks of at most READMAX bytes if necessary.
-	 * we send all reads in parallel so that performance is still good.
-	 */
-	do {
-		size_t readcount = count;
-		struct nfs_mcb_data *mdata;
-		READ3args args;
+	if (nfs3_preadv_send(nfs, data) != 0) {
+		free_nfs_cb_data(data);
+		return -1;
+	}
+	return 0;
+}
 
-		if (readcount > nfs_get_readmax(nfs)) {
-		  readcount = (size_t)nfs_get_readmax(nfs);
-		}
+static void
+nfs3_pwritev_cb(int err, struct nfs_context *nfs, void *ret_data,
+                void *private_data)
+{
+	struct nfs_cb_data *data = private_data;
 
-		mdata = malloc(sizeof(struct nfs_mcb_data));
-		if (mdata == NULL) {
-			nfs_set_error(nfs, "out of memory: failed to allocate nfs_mcb_data structure");
-			if (data->num_calls == 0) {
-				free_nfs_cb_data(data);
-				return -1;
-			}
-			data->oom = 1;
-			break;
-		}
-		memset(mdata, 0, sizeof(struct nfs_mcb_data));
-		mdata->data   = data;
-		mdata->offset = offset;
-		mdata->count  = readcount;
+	data->cb(err, nfs, ret_data, data->private_data);
+	free_nfs_cb_data(data);
+}
 
-		nfs3_fill_READ3args(&args, nfsfh, offset, readcount);
+/*
+ * WRITE3args can only carry a single buffer so we gather the vector
+ * into one and use the normal write path from there.
+ */
+int
+nfs3_pwritev_async(struct nfs_context *nfs, struct nfsfh *nfsfh,
+                   const struct iovec *iov, int iovcnt, uint64_t offset,
+                   nfs_cb cb, void *private_data)
+{
+	struct nfs_cb_data *data;
+	size_t count = 0, pos = 0;
+	int i;
 
-		if (rpc_nfs3_read_async(nfs->rpc, nfs3_pread_mcb,
-                                        &args, mdata) != 0) {
-			nfs_set_error(nfs, "RPC error: Failed to send READ "
-                                      "call for %s", data->path);
-			free(mdata);
-			if (data->num_calls == 0) {
-				free_nfs_cb_data(data);
-				return -1;
-			}
-			data->oom = 1;
-			break;
-		}
+	if (iovcnt < 0) {
+		nfs_set_error(nfs, "Invalid iovcnt %d", iovcnt);
+		return -1;
+	}
+	if (iovcnt == 1) {
+		return nfs3_pwrite_async_internal(nfs, nfsfh, offset,
+                                                  iov[0].iov_len,
+                                                  iov[0].iov_base,
+                                                  cb, private_data, 0);
+	}
+	for (i = 0; i < iovcnt; i++) {
+		count += iov[i].iov_len;
+	}
 
-		count               -= readcount;
-		offset              += readcount;
-		data->num_calls++;
-	 } while (count > 0);
+	data = malloc(sizeof(struct nfs_cb_data));
+	if (data == NULL) {
+		nfs_set_error(nfs, "out of memory: failed to allocate "
+                              "nfs_cb_data structure");
+		return -1;
+	}
+	memset(data, 0, sizeof(struct nfs_cb_data));
+	data->nfs          = nfs;
+	data->cb           = cb;
+	data->private_data = private_data;
+	data->buffer       = malloc(count ? count : 1);
+	if (data->buffer == NULL) {
+		nfs_set_error(nfs, "out of memory: failed to allocate "
+                              "buffer for pwritev");
+		free_nfs_cb_data(data);
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(data->buffer + pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
 
-	 return 0;
+	if (nfs3_pwrite_async_internal(nfs, nfsfh, offset, count,
+                                       data->buffer, nfs3_pwritev_cb,
+                                       data, 0) != 0) {
+		free_nfs_cb_data(data);
+		return -1;
+	}
+	return 0;
 }
 
 static int
@@ -4742,6 +7433,8 @@ nfs3_open_trunc_cb(struct rpc_context *rpc, int status, void *command_data,
 		return;
 	}
 
+	nfs3_update_inode_wcc(nfs, data, &res->SETATTR3res_u.resok.obj_wcc);
+
 	nfsfh = malloc(sizeof(struct nfsfh));
 	if (nfsfh == NULL) {
 		nfs_set_error(nfs, "NFS: Failed to allocate nfsfh "
@@ -4759,6 +7452,8 @@ nfs3_open_trunc_cb(struct rpc_context *rpc, int status, void *command_data,
 	if (data->continue_int & O_APPEND) {
 		nfsfh->is_append = 1;
 	}
+	nfsfh->writeback = nfs->writeback;
+	nfs3_set_eof(nfsfh, &res->SETATTR3res_u.resok.obj_wcc.after);
 
 	/* steal the filehandle */
 	nfsfh->fh = data->fh;
@@ -4768,54 +7463,44 @@ nfs3_open_trunc_cb(struct rpc_context *rpc, int status, void *command_data,
 	free_nfs_cb_data(data);
 }
 
-static void
-nfs3_open_cb(struct rpc_context *rpc, int status, void *command_data,
-             void *private_data)
+/* the ACCESS3_* bits an open with flags needs */
+static uint32_t
+nfs3_open_access_mask(int flags)
 {
-	ACCESS3res *res;
-	struct nfs_cb_data *data = private_data;
-	struct nfs_context *nfs = data->nfs;
-	struct nfsfh *nfsfh;
-	unsigned int nfsmode = 0;
-
-	assert(rpc->magic == RPC_CONTEXT_MAGIC);
-
-	if (check_nfs3_error(nfs, status, data, command_data)) {
-		free_nfs_cb_data(data);
-		return;
-	}
-
-	res = command_data;
-	if (res->status != NFS3_OK) {
-		nfs_set_error(nfs, "NFS: ACCESS of %s failed with %s(%d)",
-                              data->saved_path, nfsstat3_to_str(res->status),
-                              nfsstat3_to_errno(res->status));
-		data->cb(nfsstat3_to_errno(res->status), nfs,
-                         nfs_get_error(nfs), data->private_data);
-		free_nfs_cb_data(data);
-		return;
-	}
+	uint32_t nfsmode = 0;
 
-	if (data->continue_int & O_WRONLY) {
+	if (flags & O_WRONLY) {
 		nfsmode |= ACCESS3_MODIFY;
 	}
-	if (data->continue_int & O_RDWR) {
+	if (flags & O_RDWR) {
 		nfsmode |= ACCESS3_READ|ACCESS3_MODIFY;
 	}
-	if (!(data->continue_int & (O_WRONLY|O_RDWR))) {
+	if (!(flags & (O_WRONLY|O_RDWR))) {
 		nfsmode |= ACCESS3_READ;
 	}
+	return nfsmode;
+}
 
+/*
+ * Finish an open once we know what access we have to the file. attr are
+ * the current attributes of the file, if we have them.
+ */
+static void
+nfs3_open_done(struct nfs_context *nfs, struct nfs_cb_data *data,
+               uint32_t access, struct nfs_attr *attr)
+{
+	struct nfsfh *nfsfh;
+	uint32_t nfsmode = nfs3_open_access_mask(data->continue_int);
 
-	if (res->ACCESS3res_u.resok.access != nfsmode) {
+	if ((access & nfsmode) != nfsmode) {
 		nfs_set_error(nfs, "NFS: ACCESS denied. Required "
                               "access %c%c%c. Allowed access %c%c%c",
                               nfsmode&ACCESS3_READ?'r':'-',
                               nfsmode&ACCESS3_MODIFY?'w':'-',
                               nfsmode&ACCESS3_EXECUTE?'x':'-',
-                              res->ACCESS3res_u.resok.access&ACCESS3_READ ? 'r':'-',
-                              res->ACCESS3res_u.resok.access&ACCESS3_MODIFY ?'w':'-',
-                              res->ACCESS3res_u.resok.access&ACCESS3_EXECUTE ?'x':'-');
+                              access&ACCESS3_READ ? 'r':'-',
+                              access&ACCESS3_MODIFY ?'w':'-',
+                              access&ACCESS3_EXECUTE ?'x':'-');
 		data->cb(-EACCES, nfs, nfs_get_error(nfs), data->private_data);
 		free_nfs_cb_data(data);
 		return;
@@ -4858,42 +7543,309 @@ nfs3_open_cb(struct rpc_context *rpc, int status, void *command_data,
 	}
 	if (data->continue_int & O_APPEND) {
 		nfsfh->is_append = 1;
+		if (attr) {
+			nfsfh->eof = attr->size;
+			nfsfh->eof_valid = 1;
+		}
 	}
+	nfsfh->writeback = nfs->writeback;
 
 	/* steal the filehandle */
 	nfsfh->fh = data->fh;
 	data->fh.val = NULL;
 
-	/* init page cache */
-	if (rpc->pagecache) {
-		nfsfh->pagecache.num_entries = rpc->pagecache;
-		nfsfh->pagecache.ttl = rpc->pagecache_ttl;
-		nfsfh->pagecache.entries = malloc(sizeof(struct nfs_pagecache_entry) * nfsfh->pagecache.num_entries);
-		nfs_pagecache_invalidate(nfs, nfsfh);
-		RPC_LOG(nfs->rpc, 2, "init pagecache entries %d pagesize %d\n",
-                        nfsfh->pagecache.num_entries, NFS_BLKSIZE);
+	/* cached data for this file may survive from an earlier open, so
+	 * check it against the current attributes from the server */
+	nfs_pagecache_init(nfs, nfsfh);
+	if (nfsfh->inode) {
+		nfs_inode_revalidate(nfs, nfsfh->inode, attr);
 	}
 
 	data->cb(0, nfs, nfsfh, data->private_data);
 	free_nfs_cb_data(data);
 }
 
+static void
+nfs3_open_cb(struct rpc_context *rpc, int status, void *command_data,
+             void *private_data)
+{
+	ACCESS3res *res;
+	struct nfs_cb_data *data = private_data;
+	struct nfs_context *nfs = data->nfs;
+	struct nfs_attr attr;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	if (check_nfs3_error(nfs, status, data, command_data)) {
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	res = command_data;
+	if (res->status != NFS3_OK) {
+		nfs_set_error(nfs, "NFS: ACCESS of %s failed with %s(%d)",
+                              data->saved_path, nfsstat3_to_str(res->status),
+                              nfsstat3_to_errno(res->status));
+		data->cb(nfsstat3_to_errno(res->status), nfs,
+                         nfs_get_error(nfs), data->private_data);
+		free_nfs_cb_data(data);
+		return;
+	}
+
+	nfs3_access_cache_reply(nfs, &data->fh,
+                                nfs3_open_access_mask(data->continue_int),
+                                &res->ACCESS3res_u.resok);
+	if (res->ACCESS3res_u.resok.obj_attributes.attributes_follow) {
+		fattr3_to_nfs_attr(&attr, &res->ACCESS3res_u.resok.obj_attributes.post_op_attr_u.attributes);
+		nfs3_open_done(nfs, data, res->ACCESS3res_u.resok.access,
+                               &attr);
+	} else {
+		nfs3_open_done(nfs, data, res->ACCESS3res_u.resok.access,
+                               NULL);
+	}
+}
+
+/*
+ * Read all of a small file into the pagecache while the ACCESS for the
+ * open is in flight. Reads that arrive before the data will wait for
+ * these READs instead of sending their own.
+ */
+static void
+nfs3_open_prefetch(struct nfs_context *nfs, struct nfs_attr *attr,
+                   struct nfs_cb_data *data)
+{
+	struct nfsfh nfsfh;
+
+	if (nfs->prefetch_small == 0 || attr == NULL ||
+	    attr->type != NF3REG || attr->size == 0 ||
+	    attr->size > nfs->prefetch_small ||
+	    nfs_get_readmax(nfs) < NFS_BLKSIZE ||
+	    (data->continue_int & (O_WRONLY|O_TRUNC))) {
+		return;
+	}
+
+	memset(&nfsfh, 0, sizeof(struct nfsfh));
+	nfsfh.fh = data->fh;
+	nfs_pagecache_init(nfs, &nfsfh);
+	if (nfsfh.inode == NULL) {
+		return;
+	}
+	/* the attributes may come from the name lookup cache, leave it to
+	 * the ACCESS reply to check the data we already have */
+	if (!nfsfh.inode->has_attr) {
+		nfs_inode_revalidate(nfs, nfsfh.inode, attr);
+	}
+	nfs3_readahead_range(nfs, &nfsfh, 0, attr->size);
+	nfs_pagecache_release(nfs, &nfsfh);
+}
+
+struct nfs3_dirscan_data {
+       struct nfs_context *nfs;
+       uint32_t count;
+};
+
+static void
+nfs3_dirscan_prefetch(struct nfs_context *nfs, struct nfs_fh *fh,
+                      struct nfs_attr *attr, uint32_t count)
+{
+	struct nfsfh nfsfh;
+
+	if (attr->type != NF3REG) {
+		return;
+	}
+	memset(&nfsfh, 0, sizeof(struct nfsfh));
+	nfsfh.fh = *fh;
+	nfs_pagecache_init(nfs, &nfsfh);
+	if (nfsfh.inode == NULL) {
+		return;
+	}
+	if (!nfsfh.inode->has_attr) {
+		nfs_inode_revalidate(nfs, nfsfh.inode, attr);
+	}
+	nfs3_readahead_range(nfs, &nfsfh, 0, count);
+	nfs_pagecache_release(nfs, &nfsfh);
+}
+
+static void
+nfs3_dirscan_lookup_cb(struct rpc_context *rpc, int status,
+                       void *command_data, void *private_data)
+{
+	struct nfs3_dirscan_data *dsd = private_data;
+	struct nfs_context *nfs = dsd->nfs;
+	LOOKUP3res *res = command_data;
+	struct nfs_attr attr;
+	struct nfs_fh fh;
+
+	assert(rpc->magic == RPC_CONTEXT_MAGIC);
+
+	if (status == RPC_STATUS_SUCCESS && res->status == NFS3_OK &&
+	    res->LOOKUP3res_u.resok.obj_attributes.attributes_follow) {
+		fattr3_to_nfs_attr(&attr, &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes);
+		fh.len = res->LOOKUP3res_u.resok.object.data.data_len;
+		fh.val = res->LOOKUP3res_u.resok.object.data.data_val;
+		nfs3_dirscan_prefetch(nfs, &fh, &attr, dsd->count);
+	}
+	free(dsd);
+}
+
 static int
-nfs3_open_continue_internal(struct nfs_context *nfs,
-                            struct nfs_attr *attr _U_,
-                            struct nfs_cb_data *data)
+nfs3_dirscan_send(struct nfs_context *nfs, struct nfsdir *nfsdir,
+                  struct nfsdirent *dirent, uint32_t count)
 {
-	int nfsmode = 0;
-	ACCESS3args args;
+	struct nfs3_dirscan_data *dsd;
+	struct nfs_dentry *dentry;
+	LOOKUP3args args;
 
-	if (data->continue_int & O_WRONLY) {
-		nfsmode |= ACCESS3_MODIFY;
+	dentry = nfs_dentry_find(nfs, &nfsdir->fh, dirent->name);
+	if (dentry && dentry->negative) {
+		return 0;
 	}
-	if (data->continue_int & O_RDWR) {
-		nfsmode |= ACCESS3_READ|ACCESS3_MODIFY;
+	if (dentry) {
+		struct nfs_attr attr = dentry->attr;
+
+		nfs3_dirscan_prefetch(nfs, &dentry->fh, &attr, count);
+		return 0;
 	}
-	if (!(data->continue_int & (O_WRONLY|O_RDWR))) {
-		nfsmode |= ACCESS3_READ;
+
+	dsd = malloc(sizeof(struct nfs3_dirscan_data));
+	if (dsd == NULL) {
+		return -1;
+	}
+	dsd->nfs = nfs;
+	dsd->count = count;
+
+	memset(&args, 0, sizeof(LOOKUP3args));
+	args.what.dir.data.data_len = nfsdir->fh.len;
+	args.what.dir.data.data_val = nfsdir->fh.val;
+	args.what.name = dirent->name;
+	if (rpc_nfs3_lookup_async(nfs->rpc, nfs3_dirscan_lookup_cb, &args,
+                                  dsd) != 0) {
+		free(dsd);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Find the entry for the file with this fileid in the directory being
+ * scanned. Looks just past the last file that was opened first.
+ */
+static struct nfsdirent *
+nfs3_dirscan_find(struct nfs_dirscan *ds, uint64_t fileid, int *index,
+                  int *in_order)
+{
+	struct nfsdirent *e;
+	int i;
+
+	*in_order = 0;
+	if (ds->pos) {
+		for (i = 0, e = ds->pos->next; e && i < NFS_DIRSCAN_WINDOW;
+		     i++, e = e->next) {
+			if (e->inode == fileid) {
+				*index = ds->pos_index + 1 + i;
+				*in_order = 1;
+				return e;
+			}
+		}
+	}
+	for (i = 0, e = ds->dir->entries; e; i++, e = e->next) {
+		if (e->inode == fileid) {
+			*index = i;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * A file is being opened for reading. If the application opens the files
+ * of the directory it is reading in the order nfs_readdir() returned
+ * them, start reading the beginning of the next files so they are in the
+ * pagecache by the time they are opened.
+ */
+static void
+nfs3_dirscan_open(struct nfs_context *nfs, struct nfs_attr *attr,
+                  int flags)
+{
+	struct nfs_dirscan *ds = &nfs->dirscan;
+	uint32_t readmax = (uint32_t)nfs_get_readmax(nfs);
+	struct nfsdirent *e;
+	uint64_t bytes = 0;
+	int i, index, in_order, files = 0;
+
+	if (nfs->dirscan_prefetch == 0 || ds->dir == NULL || attr == NULL ||
+	    attr->type != NF3REG || (flags & O_WRONLY) ||
+	    readmax < NFS_BLKSIZE) {
+		return;
+	}
+
+	e = nfs3_dirscan_find(ds, attr->fileid, &index, &in_order);
+	if (e == NULL) {
+		ds->pos = NULL;
+		ds->hits = 0;
+		return;
+	}
+	ds->pos = e;
+	ds->pos_index = index;
+	if (in_order) {
+		ds->hits++;
+	} else {
+		ds->hits = 1;
+		ds->ahead_index = index;
+	}
+	if (ds->hits < 2) {
+		return;
+	}
+
+	for (i = index + 1, e = e->next;
+	     e && files < NFS_DIRSCAN_MAX_FILES && bytes < nfs->dirscan_prefetch;
+	     i++, e = e->next) {
+		uint32_t count;
+
+		if (e->type != NF3REG || e->size == 0) {
+			continue;
+		}
+		count = (uint32_t)MIN(e->size, readmax);
+		if (bytes + count > nfs->dirscan_prefetch) {
+			/* rather than reading part of the file now, wait
+			 * until there is room for all of it */
+			count = nfs->dirscan_prefetch & ~(NFS_BLKSIZE - 1);
+			if (files > 0 || count == 0) {
+				break;
+			}
+		}
+		if (i > ds->ahead_index) {
+			if (nfs3_dirscan_send(nfs, ds->dir, e, count)) {
+				break;
+			}
+			ds->ahead_index = i;
+		}
+		bytes += count;
+		files++;
+	}
+}
+
+static int
+nfs3_open_continue_internal(struct nfs_context *nfs,
+                            struct nfs_attr *attr,
+                            struct nfs_cb_data *data)
+{
+	uint32_t nfsmode = nfs3_open_access_mask(data->continue_int);
+	struct nfs_attr *acattr;
+	ACCESS3args args;
+	uint32_t access;
+
+	/* close-to-open: unless told otherwise every open revalidates the
+	 * file with the server, O_APPEND also needs its current size */
+	acattr = nfs->nocto ? nfs_attrcache_find(nfs, &data->fh) : NULL;
+	if (acattr && !(data->continue_int & O_APPEND) &&
+	    nfs_access_cache_find(nfs, &data->fh, nfsmode, &access) == 0) {
+		struct nfs_attr cattr = *acattr;
+
+		nfs3_open_prefetch(nfs, &cattr, data);
+		nfs3_dirscan_open(nfs, &cattr, data->continue_int);
+		nfs3_open_done(nfs, data, access, &cattr);
+		return 0;
 	}
 
 	memset(&args, 0, sizeof(ACCESS3args));
@@ -4907,6 +7859,8 @@ nfs3_open_continue_internal(struct nfs_context *nfs,
 		free_nfs_cb_data(data);
 		return -1;
 	}
+	nfs3_open_prefetch(nfs, attr, data);
+	nfs3_dirscan_open(nfs, attr, data->continue_int);
 	return 0;
 }
 
@@ -0,0 +1,211 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_append <url> <cwd> <path> <count> "
+                "<alternate|pipeline>\n");
+	exit(1);
+}
+
+static struct nfs_context *mount_share(const char *urlstr, const char *cwd)
+{
+	struct nfs_context *nfs;
+	struct nfs_url *url;
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 10000);
+
+	url = nfs_parse_url_full(nfs, urlstr);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		exit(1);
+	}
+	nfs_destroy_url(url);
+
+	if (nfs_chdir(nfs, cwd) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			cwd, nfs_get_error(nfs));
+		exit(1);
+	}
+
+	return nfs;
+}
+
+static struct nfsfh *open_append(struct nfs_context *nfs, const char *path)
+{
+	struct nfsfh *fh;
+
+	if (nfs_open(nfs, path, O_WRONLY|O_APPEND, &fh)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		exit(1);
+	}
+	return fh;
+}
+
+static int append_line(struct nfs_context *nfs, struct nfsfh *fh,
+                       const char *prefix, int i, const char *suffix)
+{
+	char line[64];
+	int len;
+
+	len = snprintf(line, sizeof(line), "%s%d%s\n", prefix, i, suffix);
+	if (nfs_write(nfs, fh, len, line) != len) {
+		fprintf(stderr, "Failed to write \"%s%d%s\": %s\n", prefix,
+			i, suffix, nfs_get_error(nfs));
+		return -1;
+	}
+	return 0;
+}
+
+static void write_cb(int status, struct nfs_context *nfs, void *data,
+                     void *private_data)
+{
+	int *pending = private_data;
+
+	(*pending)--;
+	if (status < 0) {
+		fprintf(stderr, "Failed to write: %s\n", (char *)data);
+		exit(1);
+	}
+}
+
+/* send count appends of "<prefix><i>\n" without waiting in between */
+static int append_pipelined(struct nfs_context *nfs, struct nfsfh *fh,
+                            const char *prefix, int count)
+{
+	struct pollfd pfd;
+	char line[64];
+	int i, len, pending = 0;
+
+	for (i = 0; i < count; i++) {
+		len = snprintf(line, sizeof(line), "%s%d\n", prefix, i);
+		if (nfs_write_async(nfs, fh, len, line, write_cb,
+				    &pending) != 0) {
+			fprintf(stderr, "Failed to start write: %s\n",
+				nfs_get_error(nfs));
+			exit(1);
+		}
+		pending++;
+	}
+	while (pending) {
+		pfd.fd = nfs_get_fd(nfs);
+		pfd.events = nfs_which_events(nfs);
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, 100) < 0) {
+			fprintf(stderr, "Poll failed\n");
+			exit(1);
+		}
+		if (nfs_service(nfs, pfd.revents) < 0) {
+			fprintf(stderr, "nfs_service failed\n");
+			exit(1);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Append lines to <path> through two contexts that take turns, each one
+ * opens the file, appends and closes it again. With alternate the first
+ * one appends "a<i>.0" and "a<i>.1" and the second one "b<i>". With
+ * pipeline the first context sends "a0" to "a<count-1>" at once, the
+ * second one appends "b0" and the first one then sends "c0" to
+ * "c<count-1>" at once.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs, *nfs2;
+	struct nfsfh *fh;
+	int i, count, ret = 0;
+
+	if (argc != 6) {
+		usage();
+	}
+	count = atoi(argv[4]);
+
+	nfs = mount_share(argv[1], argv[2]);
+	nfs2 = mount_share(argv[1], argv[2]);
+
+	if (!strcmp(argv[5], "alternate")) {
+		for (i = 0; i < count && ret == 0; i++) {
+			fh = open_append(nfs, argv[3]);
+			if (append_line(nfs, fh, "a", i, ".0") ||
+			    append_line(nfs, fh, "a", i, ".1")) {
+				ret = 1;
+			}
+			nfs_close(nfs, fh);
+			if (ret) {
+				break;
+			}
+			fh = open_append(nfs2, argv[3]);
+			if (append_line(nfs2, fh, "b", i, "")) {
+				ret = 1;
+			}
+			nfs_close(nfs2, fh);
+		}
+	} else if (!strcmp(argv[5], "pipeline")) {
+		fh = open_append(nfs, argv[3]);
+		append_pipelined(nfs, fh, "a", count);
+		nfs_close(nfs, fh);
+		fh = open_append(nfs2, argv[3]);
+		if (append_line(nfs2, fh, "b", 0, "")) {
+			ret = 1;
+		}
+		nfs_close(nfs2, fh);
+		if (ret == 0) {
+			fh = open_append(nfs, argv[3]);
+			append_pipelined(nfs, fh, "c", count);
+			nfs_close(nfs, fh);
+		}
+	} else {
+		usage();
+	}
+
+	nfs_destroy_context(nfs);
+	nfs_destroy_context(nfs2);
+
+	return ret;
+}
@@ -0,0 +1,142 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_dircache_lookup <url> <cwd> <dir> <file>"
+                "\n");
+	exit(1);
+}
+
+static struct nfs_context *mount_share(const char *urlstr, const char *cwd)
+{
+	struct nfs_context *nfs;
+	struct nfs_url *url;
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, urlstr);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		exit(1);
+	}
+	nfs_destroy_url(url);
+
+	if (nfs_chdir(nfs, cwd) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			cwd, nfs_get_error(nfs));
+		exit(1);
+	}
+
+	return nfs;
+}
+
+/*
+ * Read the listing of <dir> into the directory cache of one context,
+ * create <dir>/<file> through a second context and check that the first
+ * one can still stat and open it.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL, *nfs2 = NULL;
+	struct nfsdir *dir;
+	struct nfsfh *fh;
+	struct nfs_stat_64 st;
+	char path[1024];
+	int ret = 0;
+
+	if (argc != 5) {
+		usage();
+	}
+	snprintf(path, sizeof(path), "%s/%s", argv[3], argv[4]);
+
+	nfs = mount_share(argv[1], argv[2]);
+	nfs2 = mount_share(argv[1], argv[2]);
+
+	if (nfs_opendir(nfs, argv[3], &dir)) {
+ 		fprintf(stderr, "Failed to opendir(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	while (nfs_readdir(nfs, dir) != NULL) {
+		;
+	}
+	nfs_closedir(nfs, dir);
+
+	if (nfs_stat64(nfs, path, &st) == 0) {
+ 		fprintf(stderr, "\"%s\" already exists\n", path);
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_creat(nfs2, path, 0644, &fh)) {
+ 		fprintf(stderr, "Failed to creat(): %s\n",
+			nfs_get_error(nfs2));
+		ret = 1;
+		goto finished;
+	}
+	nfs_close(nfs2, fh);
+
+	if (nfs_stat64(nfs, path, &st)) {
+ 		fprintf(stderr, "Failed to stat file : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_open(nfs, path, O_RDONLY, &fh)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	nfs_close(nfs, fh);
+
+finished:
+	nfs_destroy_context(nfs2);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
@@ -0,0 +1,171 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_dirscan <url> <cwd> <dir> <outdir> "
+                "<open|closed>\n");
+	exit(1);
+}
+
+/* copy <dir>/<name> to <outdir>/<name> */
+static int copy_file(struct nfs_context *nfs, const char *dir,
+                     const char *outdir, const char *name)
+{
+	struct nfsfh *fh;
+	char path[1024];
+	char buf[8192];
+	FILE *out;
+	int count, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (nfs_open(nfs, path, O_RDONLY, &fh)) {
+ 		fprintf(stderr, "Failed to open(%s): %s\n", path,
+			nfs_get_error(nfs));
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", outdir, name);
+	out = fopen(path, "w");
+	if (out == NULL) {
+		fprintf(stderr, "Failed to create %s\n", path);
+		nfs_close(nfs, fh);
+		return -1;
+	}
+	while ((count = nfs_read(nfs, fh, sizeof(buf), buf)) > 0) {
+		if (fwrite(buf, 1, count, out) != (size_t)count) {
+			fprintf(stderr, "Failed to write to %s\n", path);
+			ret = -1;
+			break;
+		}
+	}
+	if (count < 0) {
+		fprintf(stderr, "Failed to read %s: %s\n", name,
+			nfs_get_error(nfs));
+		ret = -1;
+	}
+	fclose(out);
+	nfs_close(nfs, fh);
+	return ret;
+}
+
+/*
+ * Copy the regular files in <dir> to the local directory <outdir> in the
+ * order nfs_readdir() returns them. With open every file is copied while
+ * the directory is still open, with closed the directory is closed
+ * first.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfsdir *dir;
+	struct nfsdirent *ent;
+	char **names = NULL;
+	int i, num = 0, ret = 0;
+
+	if (argc != 6) {
+		usage();
+	}
+	if (strcmp(argv[5], "open") && strcmp(argv[5], "closed")) {
+		usage();
+	}
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 10000);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_opendir(nfs, argv[3], &dir)) {
+ 		fprintf(stderr, "Failed to opendir(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	while ((ent = nfs_readdir(nfs, dir)) != NULL) {
+		if ((ent->mode & S_IFMT) != S_IFREG) {
+			continue;
+		}
+		if (!strcmp(argv[5], "open")) {
+			if (copy_file(nfs, argv[3], argv[4], ent->name)) {
+				ret = 1;
+				break;
+			}
+			continue;
+		}
+		names = realloc(names, (num + 1) * sizeof(char *));
+		if (names == NULL) {
+			fprintf(stderr, "Failed to allocate names\n");
+			exit(1);
+		}
+		names[num++] = strdup(ent->name);
+	}
+	nfs_closedir(nfs, dir);
+
+	for (i = 0; i < num; i++) {
+		if (ret == 0 && copy_file(nfs, argv[3], argv[4], names[i])) {
+			ret = 1;
+		}
+		free(names[i]);
+	}
+	free(names);
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
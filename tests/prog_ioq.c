@@ -0,0 +1,206 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "libnfs.h"
+
+#define BLOCK_SIZE 8192
+#define QUEUE_DEPTH 16
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_ioq <url> <cwd> <path> <blocks>\n");
+	exit(1);
+}
+
+static char pattern(uint64_t offset)
+{
+	return 'a' + offset % 23;
+}
+
+/*
+ * Run op on blocks 0 to nblocks - 1 through the queue, with up to
+ * QUEUE_DEPTH of them in flight. The tag of an operation is its block
+ * number + 1.
+ * Returns the number of operations that failed.
+ */
+static int run_queue(struct nfs_ioq *q, struct nfsfh *fh, int op, char *buf,
+                     int nblocks)
+{
+	struct nfs_io ios[QUEUE_DEPTH];
+	struct nfs_io_completion comps[QUEUE_DEPTH];
+	int next = 0, done = 0, nr, i, failed = 0;
+
+	while (done < nblocks) {
+		for (nr = 0; nr < QUEUE_DEPTH && next + nr < nblocks; nr++) {
+			ios[nr].nfsfh = fh;
+			ios[nr].op = op;
+			ios[nr].offset = (uint64_t)(next + nr) * BLOCK_SIZE;
+			ios[nr].count = BLOCK_SIZE;
+			ios[nr].buf = &buf[(next + nr) * BLOCK_SIZE];
+			ios[nr].tag = (void *)(intptr_t)(next + nr + 1);
+		}
+		next += nfs_ioq_submit(q, ios, nr);
+
+		nr = nfs_ioq_wait(q, comps, 1, QUEUE_DEPTH);
+		if (nr < 0) {
+			fprintf(stderr, "Failed to wait for the queue\n");
+			return nblocks;
+		}
+		for (i = 0; i < nr; i++) {
+			if (comps[i].status != BLOCK_SIZE) {
+				fprintf(stderr, "Block %d failed with %d\n",
+					(int)(intptr_t)comps[i].tag - 1,
+					comps[i].status);
+				failed++;
+			}
+		}
+		done += nr;
+	}
+
+	return failed;
+}
+
+/*
+ * Write <blocks> blocks to a new file through a queue of operations,
+ * fsync it through the queue and read it back the same way.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfsfh *fh;
+	struct nfs_ioq *q;
+	struct nfs_io io;
+	struct nfs_io_completion comp;
+	char *buf;
+	int nblocks, i, ret = 0;
+
+	if (argc != 5) {
+		usage();
+	}
+	nblocks = atoi(argv[4]);
+
+	buf = malloc((size_t)nblocks * BLOCK_SIZE);
+	if (buf == NULL) {
+		fprintf(stderr, "Failed to allocate buffer\n");
+		exit(1);
+	}
+	for (i = 0; i < nblocks * BLOCK_SIZE; i++) {
+		buf[i] = pattern(i);
+	}
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_create(nfs, argv[3], O_RDWR | O_TRUNC, 0644, &fh)) {
+ 		fprintf(stderr, "Failed to create(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	q = nfs_ioq_init(nfs, QUEUE_DEPTH);
+	if (q == NULL) {
+ 		fprintf(stderr, "Failed to create the queue\n");
+		ret = 1;
+		goto close;
+	}
+
+	if (run_queue(q, fh, NFS_IO_WRITE, buf, nblocks)) {
+		ret = 1;
+		goto destroy;
+	}
+
+	memset(&io, 0, sizeof(io));
+	io.nfsfh = fh;
+	io.op = NFS_IO_FSYNC;
+	if (nfs_ioq_submit(q, &io, 1) != 1 ||
+	    nfs_ioq_wait(q, &comp, 1, 1) != 1 || comp.status != 0) {
+ 		fprintf(stderr, "Failed to fsync through the queue\n");
+		ret = 1;
+		goto destroy;
+	}
+	/* exactly one completion for the fsync */
+	if (nfs_ioq_inflight(q) != 0 || nfs_ioq_reap(q, &comp, 1) != 0) {
+ 		fprintf(stderr, "Unexpected completions after fsync\n");
+		ret = 1;
+		goto destroy;
+	}
+
+	memset(buf, 0, (size_t)nblocks * BLOCK_SIZE);
+	if (run_queue(q, fh, NFS_IO_READ, buf, nblocks)) {
+		ret = 1;
+		goto destroy;
+	}
+	for (i = 0; i < nblocks * BLOCK_SIZE; i++) {
+		if (buf[i] != pattern(i)) {
+			fprintf(stderr, "Data mismatch at offset %d\n", i);
+			ret = 1;
+			break;
+		}
+	}
+
+destroy:
+	nfs_ioq_destroy(q);
+close:
+	nfs_close(nfs, fh);
+
+finished:
+	free(buf);
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
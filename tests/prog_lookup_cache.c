@@ -0,0 +1,171 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_lookup_cache <url> <cwd> <path>\n");
+	exit(1);
+}
+
+static int check_size(struct nfs_context *nfs, const char *path,
+                      int64_t size)
+{
+	struct nfs_stat_64 st;
+	int rc;
+
+	rc = nfs_stat64(nfs, path, &st);
+	if (size < 0) {
+		if (rc != -ENOENT) {
+			fprintf(stderr, "stat of missing \"%s\" returned %d\n",
+				path, rc);
+			return -1;
+		}
+		return 0;
+	}
+	if (rc) {
+		fprintf(stderr, "Failed to stat \"%s\": %s\n", path,
+			nfs_get_error(nfs));
+		return -1;
+	}
+	if (st.nfs_size != (uint64_t)size) {
+		fprintf(stderr, "\"%s\" has size %" PRIu64 " instead of "
+			"%" PRId64 "\n", path, st.nfs_size, size);
+		return -1;
+	}
+	return 0;
+}
+
+/* creates path if flags has O_EXCL */
+static int write_file(struct nfs_context *nfs, const char *path, int flags,
+                      const char *data)
+{
+	struct nfsfh *fh;
+	int rc;
+
+	if (flags & O_EXCL) {
+		rc = nfs_create(nfs, path, flags, 0644, &fh);
+	} else {
+		rc = nfs_open(nfs, path, O_WRONLY | flags, &fh);
+	}
+	if (rc) {
+		fprintf(stderr, "Failed to open \"%s\": %s\n", path,
+			nfs_get_error(nfs));
+		return -1;
+	}
+	if (nfs_write(nfs, fh, strlen(data), data) != (int)strlen(data)) {
+		fprintf(stderr, "Failed to write \"%s\": %s\n", path,
+			nfs_get_error(nfs));
+		nfs_close(nfs, fh);
+		return -1;
+	}
+	if (nfs_close(nfs, fh)) {
+		fprintf(stderr, "Failed to close \"%s\": %s\n", path,
+			nfs_get_error(nfs));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * <path> must not exist. Check that the changes we make to it ourselves
+ * are seen right away by the lookup and attribute caches enabled in the
+ * url, a missing name that is then created, a size that grows and a file
+ * that is removed again.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	int ret = 0;
+
+	if (argc != 4) {
+		usage();
+	}
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (check_size(nfs, argv[3], -1) ||
+	    check_size(nfs, argv[3], -1) ||
+	    write_file(nfs, argv[3], O_EXCL, "0123456789") ||
+	    check_size(nfs, argv[3], 10) ||
+	    write_file(nfs, argv[3], O_APPEND, "abcde") ||
+	    check_size(nfs, argv[3], 15) ||
+	    write_file(nfs, argv[3], O_TRUNC, "xyz") ||
+	    check_size(nfs, argv[3], 3)) {
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_unlink(nfs, argv[3])) {
+ 		fprintf(stderr, "Failed to unlink(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	if (check_size(nfs, argv[3], -1)) {
+		ret = 1;
+		goto finished;
+	}
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
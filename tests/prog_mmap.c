@@ -0,0 +1,192 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_mmap <url> <cwd> <path>\n");
+	exit(1);
+}
+
+struct copy_data {
+	const char *addr;
+	char *buf;
+	size_t size;
+	volatile int finished;
+};
+
+/* touches the mapping, the faults are served by main() */
+static void *copy_mapping(void *arg)
+{
+	struct copy_data *cd = arg;
+
+	memcpy(cd->buf, cd->addr, cd->size);
+	cd->finished = 1;
+	return NULL;
+}
+
+/*
+ * Map the whole file and copy it to stdout from a second thread while
+ * the main thread serves the faults.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfsfh *fh;
+	struct nfs_stat_64 st;
+	struct nfs_mmap *map;
+	struct copy_data cd;
+	struct pollfd pfd[2];
+	pthread_t thread;
+	int rc, ret = 0;
+
+	if (argc != 4) {
+		usage();
+	}
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_open(nfs, argv[3], O_RDONLY, &fh)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_fstat64(nfs, fh, &st)) {
+ 		fprintf(stderr, "Failed to fstat(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+	if (st.nfs_size == 0) {
+		goto close;
+	}
+
+	map = nfs_mmap(nfs, fh, st.nfs_size);
+	if (map == NULL) {
+ 		fprintf(stderr, "Failed to mmap(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+
+	cd.addr = nfs_mmap_get_addr(map);
+	cd.size = st.nfs_size;
+	cd.finished = 0;
+	cd.buf = malloc(cd.size);
+	if (cd.buf == NULL) {
+		fprintf(stderr, "Failed to allocate buffer\n");
+		ret = 1;
+		goto unmap;
+	}
+
+	if (pthread_create(&thread, NULL, copy_mapping, &cd)) {
+		fprintf(stderr, "Failed to create thread\n");
+		ret = 1;
+		goto free;
+	}
+	while (!cd.finished) {
+		pfd[0].fd = nfs_get_fd(nfs);
+		pfd[0].events = nfs_which_events(nfs);
+		pfd[0].revents = 0;
+		pfd[1].fd = nfs_mmap_get_fd(map);
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+
+		if (poll(pfd, 2, 100) < 0) {
+			fprintf(stderr, "Poll failed\n");
+			exit(1);
+		}
+		if (pfd[1].revents & POLLIN) {
+			rc = nfs_mmap_service(map);
+			if (rc < 0) {
+				/* the copy thread may be stuck on the fault */
+				fprintf(stderr, "Failed to read the mapping: "
+					"%s\n", strerror(-rc));
+				exit(1);
+			}
+		}
+		if (nfs_service(nfs, pfd[0].revents) < 0) {
+			fprintf(stderr, "nfs_service failed\n");
+			exit(1);
+		}
+	}
+	pthread_join(thread, NULL);
+
+	if (write(1, cd.buf, cd.size) != (ssize_t)cd.size) {
+		fprintf(stderr, "Failed to write to stdout\n");
+		ret = 1;
+	}
+
+free:
+	free(cd.buf);
+unmap:
+	nfs_munmap(map);
+close:
+	nfs_close(nfs, fh);
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
@@ -0,0 +1,162 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_opendir_stream <url> <cwd> <path> "
+                "<resume-after>\n");
+	exit(1);
+}
+
+static struct nfs_context *mount_share(const char *urlstr, const char *cwd)
+{
+	struct nfs_context *nfs;
+	struct nfs_url *url;
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, urlstr);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		exit(1);
+	}
+	nfs_destroy_url(url);
+
+	if (nfs_chdir(nfs, cwd) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			cwd, nfs_get_error(nfs));
+		exit(1);
+	}
+
+	return nfs;
+}
+
+/*
+ * Print the names in <path> a page at a time, one per line.
+ * With <resume-after> > 0 the directory is closed after that many
+ * entries, while the next page is still being read, and the rest is
+ * read from the cookie of the last entry through a new context.
+ * With <resume-after> == -1 the directory is closed right after the
+ * first page arrived.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfsdir *dir;
+	struct nfsdirent *ent;
+	uint64_t cookie = 0;
+	int resume_after, count = 0, ret = 0, rc;
+
+	if (argc != 5) {
+		usage();
+	}
+	resume_after = atoi(argv[4]);
+
+	nfs = mount_share(argv[1], argv[2]);
+
+	rc = nfs_opendir_stream(nfs, argv[3], 0, &dir);
+	if (rc) {
+ 		fprintf(stderr, "Failed to opendir_stream(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	if (resume_after == -1) {
+		nfs_closedir(nfs, dir);
+		goto finished;
+	}
+
+	for (;;) {
+		while ((ent = nfs_readdir(nfs, dir)) != NULL) {
+			count++;
+			if (strcmp(ent->name, ".") && strcmp(ent->name, "..")) {
+				printf("%s\n", ent->name);
+			}
+			if (count == resume_after) {
+				break;
+			}
+		}
+		if (ent != NULL) {
+			/* close with the next page in flight and resume */
+			cookie = nfs_readdir_cookie(nfs, dir);
+			nfs_closedir(nfs, dir);
+			nfs_destroy_context(nfs);
+			nfs = mount_share(argv[1], argv[2]);
+			rc = nfs_opendir_stream(nfs, argv[3], cookie, &dir);
+			if (rc) {
+				fprintf(stderr, "Failed to resume "
+					"opendir_stream(): %s\n",
+					nfs_get_error(nfs));
+				ret = 1;
+				goto finished;
+			}
+			resume_after = 0;
+			continue;
+		}
+		rc = nfs_readdir_next_page(nfs, dir);
+		if (rc < 0) {
+			fprintf(stderr, "Failed to readdir_next_page(): %s\n",
+				nfs_get_error(nfs));
+			nfs_closedir(nfs, dir);
+			ret = 1;
+			goto finished;
+		}
+		if (rc == 0) {
+			break;
+		}
+	}
+
+	/* stays at the end */
+	if (nfs_readdir_next_page(nfs, dir) != 0) {
+ 		fprintf(stderr, "readdir_next_page() past the end did not "
+			"return 0\n");
+		ret = 1;
+	}
+	nfs_closedir(nfs, dir);
+
+finished:
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
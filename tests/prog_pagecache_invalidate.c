@@ -0,0 +1,181 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_pagecache_invalidate <url> <cwd> <path> "
+                "<write|stat>\n");
+	exit(1);
+}
+
+static struct nfs_context *mount_share(const char *urlstr, const char *cwd)
+{
+	struct nfs_context *nfs;
+	struct nfs_url *url;
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, urlstr);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		exit(1);
+	}
+	nfs_destroy_url(url);
+
+	if (nfs_chdir(nfs, cwd) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			cwd, nfs_get_error(nfs));
+		exit(1);
+	}
+
+	return nfs;
+}
+
+static int read_file(struct nfs_context *nfs, struct nfsfh *fh, char *buf,
+                     uint64_t size)
+{
+	int rc;
+
+	rc = nfs_pread(nfs, fh, 0, size, buf);
+	if (rc != (int)size) {
+		fprintf(stderr, "Failed to pread() %" PRIu64 " bytes: %d %s\n",
+			size, rc, rc < 0 ? nfs_get_error(nfs) : "");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read all of <path> into the pagecache of one context, then write
+ * "0123456789" at offset 5000 through a second context. With "write"
+ * the first context then writes "abc" at offset 100, with "stat" it
+ * stats the file. Either tells it that the file was changed by someone
+ * else, through the wcc data of the WRITE or the attributes of the
+ * GETATTR, so it must read the file again from the server and see both
+ * writes. The file as the first context reads it is written to stdout.
+ * <path> must be larger than 5010 bytes.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL, *nfs2 = NULL;
+	struct nfs_stat_64 st;
+	struct nfsfh *fh = NULL, *fh2 = NULL;
+	char *buf = NULL;
+	int ret = 0;
+
+	if (argc != 5) {
+		usage();
+	}
+
+	nfs = mount_share(argv[1], argv[2]);
+	nfs2 = mount_share(argv[1], argv[2]);
+
+	if (nfs_open(nfs, argv[3], O_RDWR, &fh)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	if (nfs_fstat64(nfs, fh, &st)) {
+ 		fprintf(stderr, "Failed to fstat(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	buf = malloc(st.nfs_size + 1);
+	if (buf == NULL) {
+		fprintf(stderr, "Failed to allocate buffer\n");
+		ret = 1;
+		goto finished;
+	}
+	if (read_file(nfs, fh, buf, st.nfs_size)) {
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_open(nfs2, argv[3], O_WRONLY, &fh2) ||
+	    nfs_pwrite(nfs2, fh2, 5000, 10, "0123456789") != 10 ||
+	    nfs_close(nfs2, fh2)) {
+ 		fprintf(stderr, "Failed to write through the second "
+			"context: %s\n", nfs_get_error(nfs2));
+		ret = 1;
+		goto finished;
+	}
+
+	if (!strcmp(argv[4], "write")) {
+		if (nfs_pwrite(nfs, fh, 100, 3, "abc") != 3) {
+ 			fprintf(stderr, "Failed to pwrite(): %s\n",
+				nfs_get_error(nfs));
+			ret = 1;
+			goto finished;
+		}
+	} else {
+		if (nfs_stat64(nfs, argv[3], &st)) {
+ 			fprintf(stderr, "Failed to stat(): %s\n",
+				nfs_get_error(nfs));
+			ret = 1;
+			goto finished;
+		}
+	}
+
+	if (read_file(nfs, fh, buf, st.nfs_size)) {
+		ret = 1;
+		goto finished;
+	}
+	if (write(1, buf, st.nfs_size) != (ssize_t)st.nfs_size) {
+		fprintf(stderr, "Failed to write to stdout\n");
+		ret = 1;
+	}
+
+finished:
+	free(buf);
+	if (fh) {
+		nfs_close(nfs, fh);
+	}
+	nfs_destroy_context(nfs2);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
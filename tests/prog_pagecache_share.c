@@ -0,0 +1,194 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_pagecache_share <url> <cwd> <path> "
+                "<offset> <string>\n");
+	exit(1);
+}
+
+static int read_file(struct nfs_context *nfs, struct nfsfh *fh, char *buf,
+                     uint64_t size)
+{
+	int rc;
+
+	rc = nfs_pread(nfs, fh, 0, size, buf);
+	if (rc != (int)size) {
+		fprintf(stderr, "Failed to pread() %" PRIu64 " bytes: %d %s\n",
+			size, rc, rc < 0 ? nfs_get_error(nfs) : "");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Open <path> twice in the same context. Read all of it through the
+ * first handle, write <string> at <offset> through the second one and
+ * read it again through the first handle, and through a third handle
+ * opened afterwards. Both must see the write. The file as read through
+ * the first handle is written to stdout.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfs_stat_64 st;
+	struct nfsfh *fh = NULL, *fh2 = NULL, *fh3 = NULL;
+	char *buf = NULL, *buf2 = NULL;
+	uint64_t offset, size, len;
+	int ret = 0;
+
+	if (argc != 6) {
+		usage();
+	}
+	offset = strtoull(argv[4], NULL, 10);
+	len = strlen(argv[5]);
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_open(nfs, argv[3], O_RDONLY, &fh) ||
+	    nfs_open(nfs, argv[3], O_WRONLY, &fh2)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+
+	if (nfs_fstat64(nfs, fh, &st)) {
+ 		fprintf(stderr, "Failed to fstat(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+	size = st.nfs_size;
+	if (offset + len > size) {
+		size = offset + len;
+	}
+
+	buf = malloc(size + 1);
+	buf2 = malloc(size + 1);
+	if (buf == NULL || buf2 == NULL) {
+		fprintf(stderr, "Failed to allocate buffers\n");
+		ret = 1;
+		goto close;
+	}
+
+	if (read_file(nfs, fh, buf, st.nfs_size)) {
+		ret = 1;
+		goto close;
+	}
+
+	if (nfs_pwrite(nfs, fh2, offset, len, argv[5]) != (int)len) {
+ 		fprintf(stderr, "Failed to pwrite(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+
+	if (read_file(nfs, fh, buf, size)) {
+		ret = 1;
+		goto close;
+	}
+	if (memcmp(buf + offset, argv[5], len)) {
+		fprintf(stderr, "The first handle does not see the write\n");
+		ret = 1;
+		goto close;
+	}
+
+	if (nfs_open(nfs, argv[3], O_RDONLY, &fh3)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+	if (read_file(nfs, fh3, buf2, size)) {
+		ret = 1;
+		goto close;
+	}
+	if (memcmp(buf, buf2, size)) {
+		fprintf(stderr, "A new handle reads different data\n");
+		ret = 1;
+		goto close;
+	}
+
+	if (write(1, buf, size) != (ssize_t)size) {
+		fprintf(stderr, "Failed to write to stdout\n");
+		ret = 1;
+	}
+
+close:
+	free(buf);
+	free(buf2);
+	if (fh3) {
+		nfs_close(nfs, fh3);
+	}
+	if (fh2) {
+		nfs_close(nfs, fh2);
+	}
+	if (fh) {
+		nfs_close(nfs, fh);
+	}
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
@@ -0,0 +1,191 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_pread <url> <cwd> <path> <chunk> "
+                "<seq|reverse|stride|interleave>\n");
+	exit(1);
+}
+
+/* the index of the chunk to read as the i:th of n */
+static uint64_t chunk_index(const char *order, uint64_t i, uint64_t n)
+{
+	if (!strcmp(order, "reverse")) {
+		return n - 1 - i;
+	}
+	if (!strcmp(order, "stride")) {
+		/* every other chunk, then the ones in between */
+		return i < (n + 1) / 2 ? 2 * i : 2 * (i - (n + 1) / 2) + 1;
+	}
+	if (!strcmp(order, "interleave")) {
+		/* two sequential readers, one in each half of the file */
+		return i % 2 ? (n + 1) / 2 + i / 2 : i / 2;
+	}
+	return i;
+}
+
+static int read_file(struct nfs_context *nfs, struct nfsfh *fh, char *buf,
+                     uint64_t size, uint64_t chunk, const char *order)
+{
+	uint64_t i, n, idx, count;
+	int rc;
+
+	n = (size + chunk - 1) / chunk;
+	for (i = 0; i < n; i++) {
+		idx = chunk_index(order, i, n);
+		count = chunk;
+		if (idx * chunk + count > size) {
+			count = size - idx * chunk;
+		}
+		rc = nfs_pread(nfs, fh, idx * chunk, count, buf + idx * chunk);
+		if (rc != (int)count) {
+			fprintf(stderr, "Failed to pread() %" PRIu64 " bytes at "
+				"%" PRIu64 ": %d %s\n", count, idx * chunk, rc,
+				rc < 0 ? nfs_get_error(nfs) : "");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read the whole file with nfs_pread() calls of <chunk> bytes, going
+ * through the chunks in the given order, and write it to stdout. The
+ * file is read twice, the second time mostly from whatever caches the
+ * url enables, and both reads must return the same data.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfs_stat_64 st;
+	struct nfsfh *fh;
+	char *buf = NULL, *buf2 = NULL;
+	uint64_t chunk;
+	int ret = 0;
+
+	if (argc != 6) {
+		usage();
+	}
+	chunk = strtoull(argv[4], NULL, 10);
+	if (chunk == 0) {
+		usage();
+	}
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_open(nfs, argv[3], O_RDONLY, &fh)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_fstat64(nfs, fh, &st)) {
+ 		fprintf(stderr, "Failed to fstat(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+
+	buf = malloc(st.nfs_size + 1);
+	buf2 = malloc(st.nfs_size + 1);
+	if (buf == NULL || buf2 == NULL) {
+		fprintf(stderr, "Failed to allocate buffers\n");
+		ret = 1;
+		goto close;
+	}
+
+	if (read_file(nfs, fh, buf, st.nfs_size, chunk, argv[5]) ||
+	    read_file(nfs, fh, buf2, st.nfs_size, chunk, argv[5])) {
+		ret = 1;
+		goto close;
+	}
+	if (memcmp(buf, buf2, st.nfs_size)) {
+		fprintf(stderr, "Reading the file again returned different "
+			"data\n");
+		ret = 1;
+		goto close;
+	}
+
+	/* there is nothing more to read */
+	if (nfs_pread(nfs, fh, st.nfs_size, chunk, buf2) != 0) {
+		fprintf(stderr, "Read past the end of the file returned "
+			"data\n");
+		ret = 1;
+		goto close;
+	}
+
+	if (write(1, buf, st.nfs_size) != (ssize_t)st.nfs_size) {
+		fprintf(stderr, "Failed to write to stdout\n");
+		ret = 1;
+	}
+
+close:
+	free(buf);
+	free(buf2);
+	nfs_close(nfs, fh);
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
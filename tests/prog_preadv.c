@@ -0,0 +1,127 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_preadv <url> <cwd> <path>\n");
+	exit(1);
+}
+
+/*
+ * Copy the whole file to stdout, reading it with nfs_preadv() into
+ * three buffers of different sizes at a time.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfsfh *fh;
+	char buf0[1000], buf1[4096], buf2[7];
+	struct iovec iov[3];
+	uint64_t offset = 0;
+	int i, count, len, ret = 0;
+
+	if (argc != 4) {
+		usage();
+	}
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_open(nfs, argv[3], O_RDONLY, &fh)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	iov[0].iov_base = buf0;
+	iov[0].iov_len = sizeof(buf0);
+	iov[1].iov_base = buf1;
+	iov[1].iov_len = sizeof(buf1);
+	iov[2].iov_base = buf2;
+	iov[2].iov_len = sizeof(buf2);
+
+	while ((count = nfs_preadv(nfs, fh, iov, 3, offset)) > 0) {
+		offset += count;
+		for (i = 0; i < 3 && count > 0; i++) {
+			len = count < (int)iov[i].iov_len ?
+				count : (int)iov[i].iov_len;
+			if (write(1, iov[i].iov_base, len) != len) {
+				fprintf(stderr, "Failed to write to stdout\n");
+				ret = 1;
+				break;
+			}
+			count -= len;
+		}
+	}
+	if (count < 0) {
+ 		fprintf(stderr, "Failed to preadv(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+	}
+
+	nfs_close(nfs, fh);
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
@@ -0,0 +1,163 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_pwritev <url> <cwd> <path> <size>\n");
+	exit(1);
+}
+
+static char pattern(uint64_t offset)
+{
+	return 'a' + offset % 23;
+}
+
+/*
+ * Create a file of <size> bytes with nfs_pwritev(), three buffers of
+ * different sizes at a time, and check what nfs_preadv() reads back
+ * with the buffers split differently.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfsfh *fh;
+	static char buf[3 * 65536];
+	static const size_t wlens[3] = { 3000, 1, 65536 };
+	static const size_t rlens[3] = { 65536, 17, 4000 };
+	struct iovec iov[3];
+	uint64_t size, offset, todo;
+	size_t i, j, pos;
+	int count, ret = 0;
+
+	if (argc != 5) {
+		usage();
+	}
+	size = strtoull(argv[4], NULL, 10);
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 300);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_create(nfs, argv[3], O_RDWR | O_TRUNC, 0644, &fh)) {
+ 		fprintf(stderr, "Failed to create(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	for (offset = 0; offset < size; offset += count) {
+		todo = size - offset;
+		for (i = 0, pos = 0; i < 3; i++) {
+			iov[i].iov_base = &buf[pos];
+			iov[i].iov_len = wlens[i] < todo ? wlens[i] : todo;
+			for (j = 0; j < iov[i].iov_len; j++) {
+				buf[pos + j] = pattern(offset + pos + j);
+			}
+			pos += iov[i].iov_len;
+			todo -= iov[i].iov_len;
+		}
+		count = nfs_pwritev(nfs, fh, iov, 3, offset);
+		if (count <= 0) {
+			fprintf(stderr, "Failed to pwritev(): %s\n",
+				nfs_get_error(nfs));
+			ret = 1;
+			goto close;
+		}
+	}
+
+	if (nfs_fsync(nfs, fh)) {
+ 		fprintf(stderr, "Failed to fsync(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+
+	for (offset = 0; offset < size; offset += count) {
+		for (i = 0, pos = 0; i < 3; i++) {
+			iov[i].iov_base = &buf[pos];
+			iov[i].iov_len = rlens[i];
+			pos += rlens[i];
+		}
+		count = nfs_preadv(nfs, fh, iov, 3, offset);
+		if (count <= 0) {
+			fprintf(stderr, "Failed to preadv(): %s\n",
+				nfs_get_error(nfs));
+			ret = 1;
+			goto close;
+		}
+		/* the buffers are contiguous in buf */
+		for (pos = 0; pos < (size_t)count; pos++) {
+			if (buf[pos] != pattern(offset + pos)) {
+				fprintf(stderr, "Data mismatch at offset "
+					"%" PRIu64 "\n", offset + pos);
+				ret = 1;
+				goto close;
+			}
+		}
+	}
+
+close:
+	nfs_close(nfs, fh);
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
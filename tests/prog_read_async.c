@@ -0,0 +1,253 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_read_async <url> <cwd> <path> <chunk>\n");
+	exit(1);
+}
+
+struct read_state {
+	char *buf;
+	/* 1 for every byte of buf that has been read */
+	char *done;
+	uint64_t size;
+	int pending;
+	int failed;
+};
+
+struct read_data {
+	struct read_state *state;
+	uint64_t offset;
+	uint64_t count;
+};
+
+static void pread_cb(int status, struct nfs_context *nfs, void *data,
+                     void *private_data)
+{
+	struct read_data *rd = private_data;
+	struct read_state *state = rd->state;
+	char *buf = data;
+	uint64_t i;
+
+	state->pending--;
+	if (status < 0) {
+		fprintf(stderr, "pread of %" PRIu64 " bytes at %" PRIu64
+			" failed: %s\n", rd->count, rd->offset, (char *)data);
+		state->failed = 1;
+		goto free;
+	}
+	if ((uint64_t)status != rd->count) {
+		fprintf(stderr, "pread of %" PRIu64 " bytes at %" PRIu64
+			" returned %d bytes\n", rd->count, rd->offset, status);
+		state->failed = 1;
+		goto free;
+	}
+	/* every read of the same bytes must see the same data */
+	for (i = 0; i < rd->count; i++) {
+		if (state->done[rd->offset + i] &&
+		    state->buf[rd->offset + i] != buf[i]) {
+			fprintf(stderr, "pread of %" PRIu64 " bytes at %"
+				PRIu64 " returned different data at %"
+				PRIu64 "\n", rd->count, rd->offset,
+				rd->offset + i);
+			state->failed = 1;
+			goto free;
+		}
+	}
+	memcpy(state->buf + rd->offset, buf, rd->count);
+	memset(state->done + rd->offset, 1, rd->count);
+
+free:
+	free(rd);
+}
+
+static int pread_start(struct nfs_context *nfs, struct nfsfh *fh,
+                       struct read_state *state, uint64_t offset,
+                       uint64_t count)
+{
+	struct read_data *rd;
+
+	if (offset >= state->size) {
+		return 0;
+	}
+	if (offset + count > state->size) {
+		count = state->size - offset;
+	}
+	rd = malloc(sizeof(struct read_data));
+	if (rd == NULL) {
+		fprintf(stderr, "Failed to allocate read_data\n");
+		return -1;
+	}
+	rd->state  = state;
+	rd->offset = offset;
+	rd->count  = count;
+	if (nfs_pread_async(nfs, fh, offset, count, pread_cb, rd) != 0) {
+		fprintf(stderr, "Failed to start pread: %s\n",
+			nfs_get_error(nfs));
+		free(rd);
+		return -1;
+	}
+	state->pending++;
+	return 0;
+}
+
+/*
+ * Start reads of the whole file all at once: each chunk twice, a read
+ * that also covers half of the next chunk and a small unaligned read
+ * inside it. Wait for all of them, check that overlapping reads saw
+ * the same data and write the file to stdout.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfs_stat_64 st;
+	struct nfsfh *fh;
+	struct read_state state;
+	struct pollfd pfd;
+	uint64_t chunk, offset;
+	int ret = 0;
+
+	if (argc != 5) {
+		usage();
+	}
+	chunk = strtoull(argv[4], NULL, 10);
+	if (chunk < 2) {
+		usage();
+	}
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 10000);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_open(nfs, argv[3], O_RDONLY, &fh)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_fstat64(nfs, fh, &st)) {
+ 		fprintf(stderr, "Failed to fstat(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto close;
+	}
+
+	memset(&state, 0, sizeof(state));
+	state.size = st.nfs_size;
+	state.buf = malloc(st.nfs_size + 1);
+	state.done = calloc(st.nfs_size + 1, 1);
+	if (state.buf == NULL || state.done == NULL) {
+		fprintf(stderr, "Failed to allocate buffers\n");
+		ret = 1;
+		goto free;
+	}
+
+	for (offset = 0; offset < state.size; offset += chunk) {
+		if (pread_start(nfs, fh, &state, offset, chunk) ||
+		    pread_start(nfs, fh, &state, offset, chunk) ||
+		    pread_start(nfs, fh, &state, offset + chunk / 2, chunk) ||
+		    pread_start(nfs, fh, &state, offset + 123, chunk / 2)) {
+			ret = 1;
+			break;
+		}
+	}
+
+	while (state.pending) {
+		pfd.fd = nfs_get_fd(nfs);
+		pfd.events = nfs_which_events(nfs);
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, 100) < 0) {
+			fprintf(stderr, "Poll failed\n");
+			exit(1);
+		}
+		if (nfs_service(nfs, pfd.revents) < 0) {
+			fprintf(stderr, "nfs_service failed\n");
+			exit(1);
+		}
+	}
+	if (ret || state.failed) {
+		ret = 1;
+		goto free;
+	}
+	if (memchr(state.done, 0, state.size) != NULL) {
+		fprintf(stderr, "Part of the file was not read\n");
+		ret = 1;
+		goto free;
+	}
+
+	if (write(1, state.buf, state.size) != (ssize_t)state.size) {
+		fprintf(stderr, "Failed to write to stdout\n");
+		ret = 1;
+	}
+
+free:
+	free(state.buf);
+	free(state.done);
+close:
+	nfs_close(nfs, fh);
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
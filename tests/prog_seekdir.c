@@ -0,0 +1,154 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_seekdir <url> <cwd> <dir>\n");
+	exit(1);
+}
+
+/*
+ * Read <dir> and remember nfs_telldir() for every entry. Then seek to
+ * every entry from the last one to the first, check that nfs_readdir()
+ * returns the same entry again, and do the same after a rewind. The
+ * names, without "." and "..", are printed in readdir order.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL;
+	struct nfs_url *url = NULL;
+	struct nfsdir *dir;
+	struct nfsdirent *ent;
+	char **names = NULL;
+	long *pos = NULL;
+	int i, num = 0, ret = 0;
+
+	if (argc != 4) {
+		usage();
+	}
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 10000);
+
+	url = nfs_parse_url_full(nfs, argv[1]);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_chdir(nfs, argv[2]) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			argv[2], nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_opendir(nfs, argv[3], &dir)) {
+ 		fprintf(stderr, "Failed to opendir(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	while (1) {
+		names = realloc(names, (num + 1) * sizeof(char *));
+		pos = realloc(pos, (num + 1) * sizeof(long));
+		if (names == NULL || pos == NULL) {
+			fprintf(stderr, "Failed to allocate names\n");
+			exit(1);
+		}
+		pos[num] = nfs_telldir(nfs, dir);
+		ent = nfs_readdir(nfs, dir);
+		if (ent == NULL) {
+			break;
+		}
+		names[num++] = strdup(ent->name);
+	}
+	if (nfs_readdir(nfs, dir) != NULL) {
+		fprintf(stderr, "Read past the end of the directory\n");
+		ret = 1;
+		goto close;
+	}
+
+	for (i = num - 1; i >= 0; i--) {
+		nfs_seekdir(nfs, dir, pos[i]);
+		ent = nfs_readdir(nfs, dir);
+		if (ent == NULL || strcmp(ent->name, names[i])) {
+			fprintf(stderr, "Entry %d is \"%s\" after seekdir(), "
+				"not \"%s\"\n", i, ent ? ent->name : "(null)",
+				names[i]);
+			ret = 1;
+			goto close;
+		}
+	}
+	nfs_rewinddir(nfs, dir);
+	for (i = 0; i < num; i++) {
+		ent = nfs_readdir(nfs, dir);
+		if (ent == NULL || strcmp(ent->name, names[i])) {
+			fprintf(stderr, "Entry %d is \"%s\" after "
+				"rewinddir(), not \"%s\"\n", i,
+				ent ? ent->name : "(null)", names[i]);
+			ret = 1;
+			goto close;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		if (strcmp(names[i], ".") && strcmp(names[i], "..")) {
+			printf("%s\n", names[i]);
+		}
+	}
+
+close:
+	nfs_closedir(nfs, dir);
+	for (i = 0; i < num; i++) {
+		free(names[i]);
+	}
+	free(names);
+	free(pos);
+
+finished:
+	nfs_destroy_url(url);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
@@ -0,0 +1,155 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "libnfs.h"
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_symlink_cache <url> <cwd> <link> "
+                "<newtarget> <file>\n");
+	exit(1);
+}
+
+static struct nfs_context *mount_share(const char *urlstr, const char *cwd)
+{
+	struct nfs_context *nfs;
+	struct nfs_url *url;
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 10000);
+
+	url = nfs_parse_url_full(nfs, urlstr);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		exit(1);
+	}
+	nfs_destroy_url(url);
+
+	if (nfs_chdir(nfs, cwd) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			cwd, nfs_get_error(nfs));
+		exit(1);
+	}
+
+	return nfs;
+}
+
+/* print where <link> points to and what is in <link>/<file> */
+static int print_link(struct nfs_context *nfs, const char *link,
+                      const char *file)
+{
+	struct nfsfh *fh;
+	char path[1024];
+	char buf[1024];
+	int count;
+
+	if (nfs_readlink(nfs, link, buf, sizeof(buf))) {
+ 		fprintf(stderr, "Failed to readlink(): %s\n",
+			nfs_get_error(nfs));
+		return -1;
+	}
+	printf("%s -> %s\n", link, buf);
+
+	snprintf(path, sizeof(path), "%s/%s", link, file);
+	if (nfs_open(nfs, path, O_RDONLY, &fh)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs));
+		return -1;
+	}
+	count = nfs_read(nfs, fh, sizeof(buf) - 1, buf);
+	nfs_close(nfs, fh);
+	if (count < 0) {
+ 		fprintf(stderr, "Failed to read(): %s\n",
+			nfs_get_error(nfs));
+		return -1;
+	}
+	buf[count] = 0;
+	printf("%s", buf);
+	return 0;
+}
+
+/*
+ * Print the target of <link> and the contents of <link>/<file> twice,
+ * point <link> to <newtarget> through a second context and print them
+ * twice again.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs, *nfs2;
+	char tmp[1024];
+	int ret = 0;
+
+	if (argc != 6) {
+		usage();
+	}
+	snprintf(tmp, sizeof(tmp), "%s.new", argv[3]);
+
+	nfs = mount_share(argv[1], argv[2]);
+	nfs2 = mount_share(argv[1], argv[2]);
+
+	if (print_link(nfs, argv[3], argv[5]) || print_link(nfs, argv[3], argv[5])) {
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_symlink(nfs2, argv[4], tmp)) {
+ 		fprintf(stderr, "Failed to symlink(): %s\n",
+			nfs_get_error(nfs2));
+		ret = 1;
+		goto finished;
+	}
+	if (nfs_rename(nfs2, tmp, argv[3])) {
+ 		fprintf(stderr, "Failed to rename(): %s\n",
+			nfs_get_error(nfs2));
+		ret = 1;
+		goto finished;
+	}
+
+	if (print_link(nfs, argv[3], argv[5]) || print_link(nfs, argv[3], argv[5])) {
+		ret = 1;
+	}
+
+finished:
+	nfs_destroy_context(nfs);
+	nfs_destroy_context(nfs2);
+
+	return ret;
+}
@@ -0,0 +1,260 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/* 
+   Copyright (C) by Ronnie Sahlberg <ronniesahlberg@gmail.com> 2017
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libnfs.h"
+
+#define NUM_RECORDS 2000
+#define MAX_RECORD 200
+#define FILE_AREA 100000
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: prog_writeback <url> <cwd> <path> "
+                "<check|fsync-error|close-error>\n");
+	exit(1);
+}
+
+static struct nfs_context *mount_share(const char *urlstr, const char *cwd)
+{
+	struct nfs_context *nfs;
+	struct nfs_url *url;
+
+	nfs = nfs_init_context();
+	if (nfs == NULL) {
+		printf("failed to init context\n");
+		exit(1);
+	}
+
+	nfs_set_timeout(nfs, 10000);
+
+	url = nfs_parse_url_full(nfs, urlstr);
+	if (url == NULL) {
+		fprintf(stderr, "%s\n", nfs_get_error(nfs));
+		exit(1);
+	}
+
+	if (nfs_mount(nfs, url->server, url->path) != 0) {
+ 		fprintf(stderr, "Failed to mount nfs share : %s\n",
+			nfs_get_error(nfs));
+		exit(1);
+	}
+	nfs_destroy_url(url);
+
+	if (nfs_chdir(nfs, cwd) != 0) {
+ 		fprintf(stderr, "Failed to chdir to \"%s\" : %s\n",
+			cwd, nfs_get_error(nfs));
+		exit(1);
+	}
+
+	return nfs;
+}
+
+static uint32_t next_random(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 8) & 0xffffff;
+}
+
+/*
+ * Write num small records at random, unaligned and overlapping offsets
+ * and keep a copy of what the file should look like in buf.
+ */
+static int write_records(struct nfs_context *nfs, struct nfsfh *fh,
+                         char *buf, uint64_t *size, int num)
+{
+	char record[MAX_RECORD];
+	uint32_t seed = 1;
+	uint64_t offset, len, j;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		offset = next_random(&seed) % (FILE_AREA - MAX_RECORD);
+		len = 1 + next_random(&seed) % MAX_RECORD;
+		for (j = 0; j < len; j++) {
+			record[j] = 'a' + (i + j) % 26;
+		}
+		if (nfs_pwrite(nfs, fh, offset, len, record) != (int)len) {
+ 			fprintf(stderr, "Failed to pwrite(): %s\n",
+				nfs_get_error(nfs));
+			return -1;
+		}
+		memcpy(buf + offset, record, len);
+		if (offset + len > *size) {
+			*size = offset + len;
+		}
+	}
+	return 0;
+}
+
+static int check_file(struct nfs_context *nfs, struct nfsfh *fh,
+                      const char *buf, uint64_t size, const char *how)
+{
+	char *data;
+	int rc;
+
+	data = malloc(FILE_AREA);
+	if (data == NULL) {
+		fprintf(stderr, "Failed to allocate buffer\n");
+		return -1;
+	}
+	rc = nfs_pread(nfs, fh, 0, FILE_AREA, data);
+	if (rc != (int)size) {
+		fprintf(stderr, "Reading %s returned %d bytes instead of "
+			"%" PRIu64 ": %s\n", how, rc, size,
+			rc < 0 ? nfs_get_error(nfs) : "");
+		free(data);
+		return -1;
+	}
+	if (memcmp(data, buf, size)) {
+		fprintf(stderr, "Reading %s returned different data\n", how);
+		free(data);
+		return -1;
+	}
+	free(data);
+	return 0;
+}
+
+/*
+ * Write many small overlapping records to <path> through the write-back
+ * cache enabled in the url.
+ * check: read the file back through the same handle before and after
+ * nfs_fsync(), and through a second context, and write it to stdout.
+ * fsync-error, close-error: remove the file through a second context
+ * while the records are still buffered and check that nfs_fsync(), or
+ * nfs_close() without an nfs_fsync() before it, fails.
+ */
+int main(int argc, char *argv[])
+{
+	struct nfs_context *nfs = NULL, *nfs2 = NULL;
+	struct nfsfh *fh = NULL, *fh2 = NULL;
+	char *buf = NULL;
+	uint64_t size = 0;
+	int ret = 0;
+
+	if (argc != 5) {
+		usage();
+	}
+
+	nfs = mount_share(argv[1], argv[2]);
+	nfs2 = mount_share(argv[1], argv[2]);
+
+	buf = calloc(1, FILE_AREA);
+	if (buf == NULL) {
+		fprintf(stderr, "Failed to allocate buffer\n");
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_create(nfs, argv[3], O_RDWR|O_TRUNC, 0644, &fh)) {
+ 		fprintf(stderr, "Failed to create(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+
+	if (strcmp(argv[4], "check")) {
+		if (write_records(nfs, fh, buf, &size, NUM_RECORDS / 10)) {
+			ret = 1;
+			goto finished;
+		}
+		if (nfs_unlink(nfs2, argv[3])) {
+ 			fprintf(stderr, "Failed to unlink(): %s\n",
+				nfs_get_error(nfs2));
+			ret = 1;
+			goto finished;
+		}
+		if (!strcmp(argv[4], "fsync-error")) {
+			if (nfs_fsync(nfs, fh) == 0) {
+				fprintf(stderr, "fsync() did not fail\n");
+				ret = 1;
+			}
+		} else {
+			if (nfs_close(nfs, fh) == 0) {
+				fprintf(stderr, "close() did not fail\n");
+				ret = 1;
+			}
+			fh = NULL;
+		}
+		goto finished;
+	}
+
+	if (write_records(nfs, fh, buf, &size, NUM_RECORDS) ||
+	    check_file(nfs, fh, buf, size, "before fsync()")) {
+		ret = 1;
+		goto finished;
+	}
+	if (nfs_fsync(nfs, fh)) {
+ 		fprintf(stderr, "Failed to fsync(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+		goto finished;
+	}
+	if (check_file(nfs, fh, buf, size, "after fsync()")) {
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_open(nfs2, argv[3], O_RDONLY, &fh2)) {
+ 		fprintf(stderr, "Failed to open(): %s\n",
+			nfs_get_error(nfs2));
+		ret = 1;
+		goto finished;
+	}
+	if (check_file(nfs2, fh2, buf, size, "through a second context")) {
+		ret = 1;
+		goto finished;
+	}
+
+	if (nfs_close(nfs, fh)) {
+ 		fprintf(stderr, "Failed to close(): %s\n",
+			nfs_get_error(nfs));
+		ret = 1;
+	}
+	fh = NULL;
+
+	if (ret == 0 && write(1, buf, size) != (ssize_t)size) {
+		fprintf(stderr, "Failed to write to stdout\n");
+		ret = 1;
+	}
+
+finished:
+	if (fh2) {
+		nfs_close(nfs2, fh2);
+	}
+	if (fh) {
+		nfs_close(nfs, fh);
+	}
+	free(buf);
+	nfs_destroy_context(nfs2);
+	nfs_destroy_context(nfs);
+
+	return ret;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "dircache lookup test"
+
+start_share
+
+mkdir "${TESTDIR}/subdir"
+echo "kangabanga" > "${TESTDIR}/subdir/testfile"
+
+echo -n "Find a file created by another client in the root ... "
+./prog_dircache_lookup "${TESTURL}/" "." / newfile1 || failure
+success
+
+echo -n "Find a file created by another client in a subdir ... "
+./prog_dircache_lookup "${TESTURL}/" "." subdir newfile2 || failure
+success
+
+echo -n "Find a file created by another client from a subdir cwd ... "
+./prog_dircache_lookup "${TESTURL}/" "subdir" . newfile3 || failure
+success
+
+echo -n "Find a file created by another client with the attribute cache ... "
+./prog_dircache_lookup "${TESTURL}/?acregmin=60&acdirmin=60" "." subdir newfile4 || failure
+success
+
+echo -n "Leak check ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_dircache_lookup "${TESTURL}/" "." subdir newfile5 >/dev/null 2>&1 || failure
+success
+
+stop_share
+
+exit 0
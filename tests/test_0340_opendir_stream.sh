@@ -0,0 +1,66 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic opendir_stream test"
+
+start_share
+
+mkdir "${TESTDIR}/empty"
+mkdir "${TESTDIR}/big"
+i=0
+while [ $i -lt 2000 ]; do
+    touch "${TESTDIR}/big/a_file_with_a_rather_long_name_number_$i"
+    i=`expr $i + 1`
+done
+ls -A "${TESTDIR}/big" | sort > "${TESTDIR}/expected"
+
+# small pages so that the directory is read in many of them
+STREAMURL="${TESTURL}/?readdir_dircount=1024&readdir_maxcount=4096"
+
+echo -n "List an empty directory ... "
+./prog_opendir_stream "${TESTURL}/" "." /empty 0 > "${TESTDIR}/out" || failure
+[ -s "${TESTDIR}/out" ] && failure
+success
+
+echo -n "List a directory with the default page size ... "
+./prog_opendir_stream "${TESTURL}/" "." /big 0 > "${TESTDIR}/out" || failure
+sort "${TESTDIR}/out" | cmp -s - "${TESTDIR}/expected" || failure
+success
+
+echo -n "List a directory page by page ... "
+./prog_opendir_stream "${STREAMURL}" "." /big 0 > "${TESTDIR}/out" || failure
+sort "${TESTDIR}/out" | cmp -s - "${TESTDIR}/expected" || failure
+success
+
+echo -n "List a directory page by page from a subdir cwd ... "
+./prog_opendir_stream "${STREAMURL}" "big" . 0 > "${TESTDIR}/out" || failure
+sort "${TESTDIR}/out" | cmp -s - "${TESTDIR}/expected" || failure
+success
+
+echo -n "List a directory page by page without attributes ... "
+./prog_opendir_stream "${STREAMURL}&readdir_names_only=1" "." /big 0 > "${TESTDIR}/out" || failure
+sort "${TESTDIR}/out" | cmp -s - "${TESTDIR}/expected" || failure
+success
+
+echo -n "Resume from a cookie within the first page ... "
+./prog_opendir_stream "${STREAMURL}" "." /big 5 > "${TESTDIR}/out" || failure
+sort "${TESTDIR}/out" | cmp -s - "${TESTDIR}/expected" || failure
+success
+
+echo -n "Resume from a cookie in a later page ... "
+./prog_opendir_stream "${STREAMURL}" "." /big 1234 > "${TESTDIR}/out" || failure
+sort "${TESTDIR}/out" | cmp -s - "${TESTDIR}/expected" || failure
+success
+
+echo -n "Close with the next page in flight ... "
+./prog_opendir_stream "${STREAMURL}" "." /big -1 || failure
+success
+
+echo -n "Open a missing directory ... "
+./prog_opendir_stream "${STREAMURL}" "." /missing 0 2>/dev/null && failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,37 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic valgrind leak check for nfs_opendir_stream()"
+
+start_share
+
+mkdir "${TESTDIR}/big"
+i=0
+while [ $i -lt 1000 ]; do
+    touch "${TESTDIR}/big/a_file_with_a_rather_long_name_number_$i"
+    i=`expr $i + 1`
+done
+
+STREAMURL="${TESTURL}/?readdir_dircount=1024&readdir_maxcount=4096"
+
+echo -n "test nfs_opendir_stream() paging (1) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_opendir_stream "${STREAMURL}" "." /big 0 >/dev/null 2>&1 || failure
+success
+
+echo -n "test nfs_opendir_stream() resume from a cookie (2) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_opendir_stream "${STREAMURL}" "." /big 321 >/dev/null 2>&1 || failure
+success
+
+echo -n "test nfs_opendir_stream() close with a page in flight (3) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_opendir_stream "${STREAMURL}" "." /big -1 >/dev/null 2>&1 || failure
+success
+
+echo -n "test nfs_opendir_stream() missing directory (4) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_opendir_stream "${STREAMURL}" "." /missing 0 >/dev/null 2>&1
+[ $? -ne 1 ] && failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic preadv/pwritev test"
+
+start_share
+
+echo -n "Create a 1M file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1M count=1 2>/dev/null || failure
+success
+
+echo -n "Read a file with preadv ... "
+./prog_preadv "${TESTURL}/" "." /orig > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file with preadv through the pagecache ... "
+./prog_preadv "${TESTURL}/?pagecache=256" "." orig > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read an empty file with preadv ... "
+touch "${TESTDIR}/empty"
+./prog_preadv "${TESTURL}/" "." /empty > "${TESTDIR}/copy" || failure
+[ -s "${TESTDIR}/copy" ] && failure
+success
+
+echo -n "Write a file with pwritev ... "
+./prog_pwritev "${TESTURL}/" "." /written 1000000 || failure
+[ `stat -c %s "${TESTDIR}/written"` != 1000000 ] && failure
+./prog_preadv "${TESTURL}/" "." /written | cmp -s - "${TESTDIR}/written" || failure
+success
+
+echo -n "Write a file with pwritev through the write-back cache ... "
+./prog_pwritev "${TESTURL}/?writeback=65536" "." /written2 123457 || failure
+[ `stat -c %s "${TESTDIR}/written2"` != 123457 ] && failure
+success
+
+echo -n "Write a missing path with pwritev ... "
+./prog_pwritev "${TESTURL}/" "." /missing/written 10 2>/dev/null && failure
+success
+
+stop_share
+
+exit 0
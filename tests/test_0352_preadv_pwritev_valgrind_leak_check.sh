@@ -0,0 +1,25 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic valgrind leak check for nfs_preadv()/nfs_pwritev()"
+
+start_share
+
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1K count=200 2>/dev/null
+
+echo -n "test nfs_preadv() (1) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_preadv "${TESTURL}/" "." /orig >/dev/null 2>&1 || failure
+success
+
+echo -n "test nfs_preadv() through the pagecache (2) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_preadv "${TESTURL}/?pagecache=64" "." /orig >/dev/null 2>&1 || failure
+success
+
+echo -n "test nfs_pwritev() (3) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_pwritev "${TESTURL}/" "." /written 200000 >/dev/null 2>&1 || failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,27 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic ioq test"
+
+start_share
+
+echo -n "Write, fsync and read a file through a queue ... "
+./prog_ioq "${TESTURL}/" "." /queued 200 || failure
+[ `stat -c %s "${TESTDIR}/queued"` != 1638400 ] && failure
+success
+
+echo -n "Write, fsync and read a file through a queue from a subdir cwd ... "
+mkdir "${TESTDIR}/subdir"
+./prog_ioq "${TESTURL}/" "subdir" queued 33 || failure
+[ `stat -c %s "${TESTDIR}/subdir/queued"` != 270336 ] && failure
+success
+
+echo -n "Use a queue with the pagecache and write-back cache ... "
+./prog_ioq "${TESTURL}/?pagecache=256&writeback=65536" "." /queued2 100 || failure
+[ `stat -c %s "${TESTDIR}/queued2"` != 819200 ] && failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,19 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic valgrind leak check for nfs_ioq"
+
+start_share
+
+echo -n "test nfs_ioq (1) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_ioq "${TESTURL}/" "." /queued 50 >/dev/null 2>&1 || failure
+success
+
+echo -n "test nfs_ioq with the write-back cache (2) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_ioq "${TESTURL}/?writeback=65536" "." /queued 50 >/dev/null 2>&1 || failure
+success
+
+stop_share
+
+exit 0
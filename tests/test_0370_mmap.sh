@@ -0,0 +1,26 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic mmap test"
+
+start_share
+
+echo -n "Create a 5M file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1K count=5000 2>/dev/null || failure
+success
+
+echo -n "Read a file through a mapping ... "
+./prog_mmap "${TESTURL}/" "." /orig > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file that does not end on a page boundary ... "
+echo -n "kangabanga" > "${TESTDIR}/short"
+./prog_mmap "${TESTURL}/" "." short > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/short" "${TESTDIR}/copy" || failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,51 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic diskcache test"
+
+start_share
+
+CACHEDIR=`pwd`/diskcache
+rm -rf "${CACHEDIR}"
+CACHEURL="${TESTURL}/?pagecache=1024&diskcache=${CACHEDIR}&diskcache_size=64"
+
+echo -n "Create a 2M file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1K count=2000 2>/dev/null || failure
+success
+
+echo -n "Read a file into the disk cache ... "
+./prog_preadv "${CACHEURL}" "." /orig > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+[ -z "`ls -A "${CACHEDIR}"`" ] && failure
+success
+
+echo -n "Read a file from the disk cache ... "
+./prog_preadv "${CACHEURL}" "." /orig > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file that changed on the server ... "
+sleep 1
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1K count=2000 conv=notrunc 2>/dev/null || failure
+./prog_preadv "${CACHEURL}" "." /orig > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file that was truncated on the server ... "
+sleep 1
+echo -n "kangabanga" > "${TESTDIR}/orig"
+./prog_preadv "${CACHEURL}" "." /orig > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Give the disk cache size first ... "
+./prog_preadv "${TESTURL}/?diskcache_size=64&pagecache=1024&diskcache=${CACHEDIR}" "." /orig > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+rm -rf "${CACHEDIR}"
+
+stop_share
+
+exit 0
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic dentry cache test"
+
+start_share
+
+mkdir "${TESTDIR}/subdir"
+
+echo -n "Without caches ... "
+./prog_lookup_cache "${TESTURL}/" "." /file1 || failure
+success
+
+echo -n "With the dentry cache ... "
+./prog_lookup_cache "${TESTURL}/?dentry_ttl=60&dentry_dir_ttl=60" "." subdir/file2 || failure
+success
+
+echo -n "With the dentry cache and a relative path ... "
+./prog_lookup_cache "${TESTURL}/?dentry_ttl=60&dentry_dir_ttl=60" "subdir" file3 || failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic negative lookup cache test"
+
+start_share
+
+mkdir "${TESTDIR}/subdir"
+
+echo -n "With the negative lookup cache ... "
+./prog_lookup_cache "${TESTURL}/?negative_ttl=60" "." /file1 || failure
+success
+
+echo -n "With the negative lookup cache in a subdirectory ... "
+./prog_lookup_cache "${TESTURL}/?negative_ttl=60" "." /subdir/file2 || failure
+success
+
+echo -n "With the negative lookup and dentry caches ... "
+./prog_lookup_cache "${TESTURL}/?negative_ttl=60&dentry_ttl=60&dentry_dir_ttl=60" "subdir" file3 || failure
+success
+
+stop_share
+
+exit 0
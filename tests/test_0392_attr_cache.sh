@@ -0,0 +1,21 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic attribute cache test"
+
+start_share
+
+mkdir "${TESTDIR}/subdir"
+
+echo -n "With the attribute cache ... "
+./prog_lookup_cache "${TESTURL}/?actimeo=60" "." /subdir/file1 || failure
+success
+
+echo -n "With all of the lookup caches ... "
+./prog_lookup_cache "${TESTURL}/?negative_ttl=60&actimeo=60&dentry_ttl=60&dentry_dir_ttl=60" "subdir" file2 || failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,17 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic valgrind leak check for the lookup caches"
+
+start_share
+
+mkdir "${TESTDIR}/subdir"
+
+echo -n "test lookup caches (1) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_lookup_cache "${TESTURL}/?negative_ttl=60&actimeo=60&dentry_ttl=60&dentry_dir_ttl=60" "." /subdir/file1 >/dev/null 2>&1 || failure
+success
+
+stop_share
+
+exit 0
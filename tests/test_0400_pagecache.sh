@@ -0,0 +1,44 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic pagecache test"
+
+start_share
+
+echo -n "Create a 1M file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1M count=1 2>/dev/null || failure
+success
+
+echo -n "Create a file that does not end on a page boundary ... "
+dd if=/dev/urandom of="${TESTDIR}/odd" bs=1000 count=77 2>/dev/null || failure
+success
+
+echo -n "Read a file without the pagecache ... "
+./prog_pread "${TESTURL}/" "." /orig 4096 seq > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file through the pagecache ... "
+./prog_pread "${TESTURL}/?pagecache=1024" "." /orig 4096 seq > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file backwards through the pagecache ... "
+./prog_pread "${TESTURL}/?pagecache=1024" "." /orig 10000 reverse > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file in unaligned chunks through the pagecache ... "
+./prog_pread "${TESTURL}/?pagecache=1024" "." /odd 333 stride > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/odd" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file larger than the pagecache ... "
+./prog_pread "${TESTURL}/?pagecache=64" "." /orig 5000 interleave > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+stop_share
+
+exit 0
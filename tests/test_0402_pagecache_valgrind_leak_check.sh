@@ -0,0 +1,17 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic valgrind leak check for the pagecache"
+
+start_share
+
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1000 count=300 2>/dev/null || failure
+
+echo -n "test pagecache (1) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_pread "${TESTURL}/?pagecache=16" "." /orig 3000 reverse >/dev/null 2>&1 || failure
+success
+
+stop_share
+
+exit 0
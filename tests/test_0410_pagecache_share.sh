@@ -0,0 +1,46 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "pagecache sharing test"
+
+start_share
+
+echo -n "Create a 100k file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1000 count=100 2>/dev/null || failure
+success
+
+echo -n "Write through one handle and read through another ... "
+cp "${TESTDIR}/orig" "${TESTDIR}/file1"
+cp "${TESTDIR}/orig" "${TESTDIR}/expected"
+printf "kangabanga" | dd of="${TESTDIR}/expected" bs=1 seek=5000 conv=notrunc 2>/dev/null
+./prog_pagecache_share "${TESTURL}/" "." /file1 5000 kangabanga > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Write through one handle and read through another with the pagecache ... "
+cp "${TESTDIR}/orig" "${TESTDIR}/file2"
+./prog_pagecache_share "${TESTURL}/?pagecache=256" "." /file2 5000 kangabanga > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/file2" || failure
+success
+
+echo -n "Write across a page boundary with the pagecache ... "
+cp "${TESTDIR}/orig" "${TESTDIR}/file3"
+cp "${TESTDIR}/orig" "${TESTDIR}/expected"
+printf "kangabanga" | dd of="${TESTDIR}/expected" bs=1 seek=4090 conv=notrunc 2>/dev/null
+./prog_pagecache_share "${TESTURL}/?pagecache=256" "." /file3 4090 kangabanga > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Write past the end of the file with the pagecache ... "
+cp "${TESTDIR}/orig" "${TESTDIR}/file4"
+cp "${TESTDIR}/orig" "${TESTDIR}/expected"
+printf "kangabanga" | dd of="${TESTDIR}/expected" bs=1 seek=100005 conv=notrunc 2>/dev/null
+./prog_pagecache_share "${TESTURL}/?pagecache=256" "." /file4 100005 kangabanga > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/copy" || failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,43 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "pagecache invalidation test"
+
+start_share
+
+echo -n "Create a 100k file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1000 count=100 2>/dev/null || failure
+cp "${TESTDIR}/orig" "${TESTDIR}/expected"
+printf "0123456789" | dd of="${TESTDIR}/expected" bs=1 seek=5000 conv=notrunc 2>/dev/null
+success
+
+echo -n "Notice a change by another client from the wcc data of a WRITE ... "
+cp "${TESTDIR}/orig" "${TESTDIR}/file1"
+cp "${TESTDIR}/expected" "${TESTDIR}/expected1"
+printf "abc" | dd of="${TESTDIR}/expected1" bs=1 seek=100 conv=notrunc 2>/dev/null
+./prog_pagecache_invalidate "${TESTURL}/?pagecache=256" "." /file1 write > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected1" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Notice a change by another client from the attributes of a GETATTR ... "
+cp "${TESTDIR}/orig" "${TESTDIR}/file2"
+./prog_pagecache_invalidate "${TESTURL}/?pagecache=256" "." /file2 stat > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Notice a change by another client with readahead ... "
+cp "${TESTDIR}/orig" "${TESTDIR}/file3"
+./prog_pagecache_invalidate "${TESTURL}/?pagecache=256&readahead=65536" "." /file3 stat > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Notice a change by another client with a long pagecache_ttl ... "
+cp "${TESTDIR}/orig" "${TESTDIR}/file4"
+./prog_pagecache_invalidate "${TESTURL}/?pagecache=256&pagecache_ttl=3600" "." /file4 stat > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/copy" || failure
+success
+
+stop_share
+
+exit 0
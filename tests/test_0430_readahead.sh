@@ -0,0 +1,40 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic readahead test"
+
+start_share
+
+echo -n "Create a 3M file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1000 count=3000 2>/dev/null || failure
+success
+
+echo -n "Read a file sequentially with readahead ... "
+./prog_pread "${TESTURL}/?readahead=262144" "." /orig 4096 seq > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file sequentially in small chunks with readahead ... "
+./prog_pread "${TESTURL}/?readahead=65536" "." /orig 1000 seq > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file sequentially with readahead and the pagecache ... "
+./prog_pread "${TESTURL}/?readahead=262144&pagecache=2048" "." /orig 10000 seq > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file backwards with readahead ... "
+./prog_pread "${TESTURL}/?readahead=262144" "." /orig 65536 reverse > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file with more readahead than the pagecache holds ... "
+./prog_pread "${TESTURL}/?readahead=1048576&pagecache=64" "." /orig 4096 seq > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+stop_share
+
+exit 0
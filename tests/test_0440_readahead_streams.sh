@@ -0,0 +1,35 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "readahead stream and stride detection test"
+
+start_share
+
+echo -n "Create a 3M file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1000 count=3000 2>/dev/null || failure
+success
+
+echo -n "Read a file with two interleaved sequential readers ... "
+./prog_pread "${TESTURL}/?readahead=262144" "." /orig 8192 interleave > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file with two interleaved readers through the pagecache ... "
+./prog_pread "${TESTURL}/?readahead=262144&pagecache=1024" "." /orig 5000 interleave > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read every other chunk of a file, then the ones in between ... "
+./prog_pread "${TESTURL}/?readahead=262144" "." /orig 4096 stride > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read a file with a stride through the pagecache ... "
+./prog_pread "${TESTURL}/?readahead=262144&pagecache=1024" "." /orig 3000 stride > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,40 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "write-back cache test"
+
+start_share
+
+echo -n "Write overlapping records without the write-back cache ... "
+./prog_writeback "${TESTURL}/" "." /file1 check > "${TESTDIR}/expected" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/file1" || failure
+success
+
+echo -n "Write overlapping records through the write-back cache ... "
+./prog_writeback "${TESTURL}/?writeback=65536" "." /file2 check > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/file2" || failure
+success
+
+echo -n "Write overlapping records through a small write-back cache ... "
+./prog_writeback "${TESTURL}/?writeback=1000" "." /file3 check > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/file3" || failure
+success
+
+echo -n "Write overlapping records through the write-back cache and the pagecache ... "
+./prog_writeback "${TESTURL}/?writeback=65536&pagecache=256" "." /file4 check > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/file4" || failure
+success
+
+echo -n "Report a failed write-back from fsync ... "
+./prog_writeback "${TESTURL}/?writeback=1048576" "." /file5 fsync-error 2>/dev/null || failure
+success
+
+echo -n "Report a failed write-back from close ... "
+./prog_writeback "${TESTURL}/?writeback=1048576" "." /file6 close-error 2>/dev/null || failure
+success
+
+stop_share
+
+exit 0
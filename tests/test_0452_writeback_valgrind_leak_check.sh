@@ -0,0 +1,19 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "basic valgrind leak check for the write-back cache"
+
+start_share
+
+echo -n "test write-back cache (1) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_writeback "${TESTURL}/?writeback=65536" "." /file1 check >/dev/null 2>&1 || failure
+success
+
+echo -n "test write-back cache (2) ... "
+libtool --mode=execute valgrind --leak-check=full --error-exitcode=99 ./prog_writeback "${TESTURL}/?writeback=1048576" "." /file2 close-error >/dev/null 2>&1 || failure
+success
+
+stop_share
+
+exit 0
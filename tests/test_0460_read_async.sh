@@ -0,0 +1,44 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "overlapping async read test"
+
+start_share
+
+echo -n "Create a 1M file ... "
+dd if=/dev/urandom of="${TESTDIR}/orig" bs=1M count=1 2>/dev/null || failure
+success
+
+echo -n "Create a file that does not end on a page boundary ... "
+dd if=/dev/urandom of="${TESTDIR}/odd" bs=1000 count=333 2>/dev/null || failure
+success
+
+echo -n "Read overlapping ranges at once without the pagecache ... "
+./prog_read_async "${TESTURL}/" "." /orig 10000 > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read overlapping ranges at once through the pagecache ... "
+./prog_read_async "${TESTURL}/?pagecache=1024" "." /orig 10000 > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read large overlapping ranges at once through the pagecache ... "
+./prog_read_async "${TESTURL}/?pagecache=1024" "." /orig 200000 > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read up to the end of a file through the pagecache ... "
+./prog_read_async "${TESTURL}/?pagecache=1024" "." /odd 7777 > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/odd" "${TESTDIR}/copy" || failure
+success
+
+echo -n "Read overlapping ranges at once through a small pagecache ... "
+./prog_read_async "${TESTURL}/?pagecache=16" "." /orig 10000 > "${TESTDIR}/copy" || failure
+cmp -s "${TESTDIR}/orig" "${TESTDIR}/copy" || failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,29 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "O_APPEND test"
+
+start_share
+
+echo -n "Append from two clients in turn ... "
+echo "start" > "${TESTDIR}/file1"
+./prog_append "${TESTURL}/" "." /file1 100 alternate || failure
+(echo "start"
+ for i in `seq 0 99`; do echo "a$i.0"; echo "a$i.1"; echo "b$i"; done) > "${TESTDIR}/expected"
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/file1" || failure
+success
+
+echo -n "Send many appends at once ... "
+echo "start" > "${TESTDIR}/file2"
+./prog_append "${TESTURL}/" "." /file2 500 pipeline || failure
+(echo "start"
+ for i in `seq 0 499`; do echo "a$i"; done
+ echo "b0"
+ for i in `seq 0 499`; do echo "c$i"; done) > "${TESTDIR}/expected"
+cmp -s "${TESTDIR}/expected" "${TESTDIR}/file2" || failure
+success
+
+stop_share
+
+exit 0
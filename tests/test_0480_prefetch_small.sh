@@ -0,0 +1,31 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "small file prefetch test"
+
+start_share
+
+echo -n "Create files of different sizes ... "
+for s in 0 10 4097 65536 65537 1048576; do
+    head -c $s /dev/urandom > "${TESTDIR}/file$s" || failure
+done
+success
+
+for s in 0 10 4097 65536 65537 1048576; do
+    echo -n "Read a $s byte file with prefetch ... "
+    ./prog_pread "${TESTURL}/?prefetch_small=65536" "." /file$s 1000 seq > "${TESTDIR}/copy" || failure
+    cmp -s "${TESTDIR}/file$s" "${TESTDIR}/copy" || failure
+    success
+done
+
+for s in 10 4097 65536 65537; do
+    echo -n "Read a $s byte file backwards with prefetch and the pagecache ... "
+    ./prog_pread "${TESTURL}/?prefetch_small=65536&pagecache=256" "." /file$s 333 reverse > "${TESTDIR}/copy" || failure
+    cmp -s "${TESTDIR}/file$s" "${TESTDIR}/copy" || failure
+    success
+done
+
+stop_share
+
+exit 0
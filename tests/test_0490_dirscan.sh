@@ -0,0 +1,43 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "directory scan prefetch test"
+
+start_share
+
+echo -n "Create a directory with files of different sizes ... "
+mkdir "${TESTDIR}/dir" || failure
+for i in `seq 1 50`; do
+    head -c `expr $i \* 3001` /dev/urandom > "${TESTDIR}/dir/file$i" || failure
+done
+mkdir "${TESTDIR}/dir/subdir" || failure
+success
+
+echo -n "Copy the files without prefetch ... "
+mkdir "${TESTDIR}/copy0" || failure
+./prog_dirscan "${TESTURL}/" "." /dir "${TESTDIR}/copy0" open || failure
+diff -r -x subdir "${TESTDIR}/dir" "${TESTDIR}/copy0" >/dev/null || failure
+success
+
+echo -n "Copy the files in readdir order with prefetch ... "
+mkdir "${TESTDIR}/copy1" || failure
+./prog_dirscan "${TESTURL}/?dirscan_prefetch=200000" "." /dir "${TESTDIR}/copy1" open || failure
+diff -r -x subdir "${TESTDIR}/dir" "${TESTDIR}/copy1" >/dev/null || failure
+success
+
+echo -n "Copy the files of a closed directory with prefetch ... "
+mkdir "${TESTDIR}/copy2" || failure
+./prog_dirscan "${TESTURL}/?dirscan_prefetch=200000" "." /dir "${TESTDIR}/copy2" closed || failure
+diff -r -x subdir "${TESTDIR}/dir" "${TESTDIR}/copy2" >/dev/null || failure
+success
+
+echo -n "Copy the files with prefetch and a small pagecache ... "
+mkdir "${TESTDIR}/copy3" || failure
+./prog_dirscan "${TESTURL}/?dirscan_prefetch=200000&pagecache=8" "." /dir "${TESTDIR}/copy3" open || failure
+diff -r -x subdir "${TESTDIR}/dir" "${TESTDIR}/copy3" >/dev/null || failure
+success
+
+stop_share
+
+exit 0
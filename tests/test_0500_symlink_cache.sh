@@ -0,0 +1,36 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "symlink cache test"
+
+start_share
+
+echo -n "Create two releases and a symlink to the first one ... "
+mkdir "${TESTDIR}/release-1" "${TESTDIR}/release-2" || failure
+echo "first release" > "${TESTDIR}/release-1/version" || failure
+echo "second release" > "${TESTDIR}/release-2/version" || failure
+cat > "${TESTDIR}/expected" <<EOT
+current -> release-1
+first release
+current -> release-1
+first release
+current -> release-2
+second release
+current -> release-2
+second release
+EOT
+success
+
+for args in "linkcache=0" "linkcache=1" "actimeo=60"; do
+    echo -n "Follow a symlink that is replaced with $args ... "
+    rm -f "${TESTDIR}/current" || failure
+    ln -s release-1 "${TESTDIR}/current" || failure
+    ./prog_symlink_cache "${TESTURL}/?$args" "." current release-2 version > "${TESTDIR}/output" || failure
+    cmp -s "${TESTDIR}/expected" "${TESTDIR}/output" || failure
+    success
+done
+
+stop_share
+
+exit 0
@@ -0,0 +1,52 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "readdir sizes test"
+
+start_share
+
+echo -n "Create a directory with many entries ... "
+mkdir "${TESTDIR}/dir" || failure
+for i in `seq 1 300`; do
+    head -c $i /dev/zero > "${TESTDIR}/dir/a-file-with-a-rather-long-name-$i" || failure
+    echo "a-file-with-a-rather-long-name-$i $i" >> "${TESTDIR}/attrs.unsorted"
+done
+for i in `seq 1 5`; do
+    mkdir "${TESTDIR}/dir/subdir-$i" || failure
+    echo "subdir-$i dir" >> "${TESTDIR}/attrs.unsorted"
+    ln -s "subdir-$i" "${TESTDIR}/dir/link-$i" || failure
+    echo "link-$i link" >> "${TESTDIR}/attrs.unsorted"
+done
+sort "${TESTDIR}/attrs.unsorted" > "${TESTDIR}/attrs"
+cut -d' ' -f1 "${TESTDIR}/attrs" > "${TESTDIR}/names"
+success
+
+echo -n "List the directory ... "
+./prog_readdir "${TESTURL}/" "." /dir attrs > "${TESTDIR}/output" || failure
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/attrs" - || failure
+success
+
+echo -n "List the directory with small READDIRPLUS replies ... "
+./prog_readdir "${TESTURL}/?readdir_dircount=512&readdir_maxcount=1024" "." /dir attrs > "${TESTDIR}/output" || failure
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/attrs" - || failure
+success
+
+echo -n "List the directory with large READDIRPLUS replies ... "
+./prog_readdir "${TESTURL}/?readdir_dircount=65536&readdir_maxcount=1048576" "." /dir attrs > "${TESTDIR}/output" || failure
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/attrs" - || failure
+success
+
+echo -n "List the names in the directory ... "
+./prog_readdir "${TESTURL}/?readdir_names_only=1" "." /dir names > "${TESTDIR}/output" || failure
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/names" - || failure
+success
+
+echo -n "List the names in the directory with small READDIR replies ... "
+./prog_readdir "${TESTURL}/?readdir_names_only=1&readdir_dircount=512" "." /dir names > "${TESTDIR}/output" || failure
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/names" - || failure
+success
+
+stop_share
+
+exit 0
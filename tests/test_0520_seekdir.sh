@@ -0,0 +1,41 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "seekdir test"
+
+start_share
+
+echo -n "Create a directory with many entries ... "
+mkdir "${TESTDIR}/dir" || failure
+for i in `seq 1 1000`; do
+    touch "${TESTDIR}/dir/file-$i" || failure
+done
+mkdir "${TESTDIR}/empty" || failure
+success
+
+echo -n "Seek in a directory ... "
+./prog_seekdir "${TESTURL}/" "." /dir > "${TESTDIR}/output" || failure
+ls "${TESTDIR}/dir" | sort > "${TESTDIR}/expected"
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/expected" - || failure
+success
+
+echo -n "Seek in a directory without the dircache ... "
+./prog_seekdir "${TESTURL}/?dircache=0" "." /dir > "${TESTDIR}/output" || failure
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/expected" - || failure
+success
+
+echo -n "Seek in a directory read in small parts ... "
+./prog_seekdir "${TESTURL}/?readdir_dircount=512&readdir_maxcount=1024" "." /dir > "${TESTDIR}/output" || failure
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/expected" - || failure
+success
+
+echo -n "Seek in an empty directory ... "
+./prog_seekdir "${TESTURL}/" "." /empty > "${TESTDIR}/output" || failure
+ls "${TESTDIR}/empty" | sort > "${TESTDIR}/expected"
+sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/expected" - || failure
+success
+
+stop_share
+
+exit 0
@@ -0,0 +1,32 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "readdir lookups test"
+
+start_share
+
+echo -n "Create a directory with many entries ... "
+mkdir "${TESTDIR}/dir" || failure
+for i in `seq 1 500`; do
+    head -c $i /dev/zero > "${TESTDIR}/dir/file-$i" || failure
+    echo "file-$i $i" >> "${TESTDIR}/attrs.unsorted"
+done
+for i in `seq 1 5`; do
+    mkdir "${TESTDIR}/dir/subdir-$i" || failure
+    echo "subdir-$i dir" >> "${TESTDIR}/attrs.unsorted"
+done
+sort "${TESTDIR}/attrs.unsorted" > "${TESTDIR}/attrs"
+success
+
+# the LOOKUPs are only needed on servers without READDIRPLUS
+for lookups in 1 4 64 1000; do
+    echo -n "List the directory with up to $lookups LOOKUPs in flight ... "
+    ./prog_readdir "${TESTURL}/?readdir_lookups=$lookups" "." /dir attrs > "${TESTDIR}/output" || failure
+    sort "${TESTDIR}/output" | cmp -s "${TESTDIR}/attrs" - || failure
+    success
+done
+
+stop_share
+
+exit 0